@@ -74,6 +74,17 @@ object BenchmarkService {
         val deviceInfo: String
     )
 
+    /**
+     * Delivered tokens/s for each way text crosses from native into Kotlin
+     */
+    data class TransportComparison(
+        val callbackTps: Float,
+        val ringTps: Float,
+        val callbackTokens: Int,
+        val ringTokens: Int,
+        val ringBatches: Int
+    )
+
     /**
      * Predefined benchmark prompts designed to exercise different model capabilities
      */
@@ -207,6 +218,22 @@ object BenchmarkService {
             
             results.addAll(benchmarkResults)
 
+            runCatching {
+                progressCallback(
+                    BenchmarkProgress(
+                        stage = "Transport Comparison",
+                        progress = 0.9f,
+                        message = "Comparing callback and ring-buffer token streaming...",
+                        completedResults = results
+                    )
+                )
+            }
+            val transport = runCatching { compareStreamTransports(config) }
+            transport.exceptionOrNull()?.let { e ->
+                if (e is CancellationException) throw e
+                Logger.w("BenchmarkService: transport comparison failed", mapOf("modelId" to manifest.id, "error" to e.message), e)
+            }
+
             runCatching {
                 progressCallback(
                     BenchmarkProgress(
@@ -492,8 +519,8 @@ object BenchmarkService {
                                     streamError = event.message
                                     finalMetrics = EngineMetrics.empty().copy(stopReason = "error")
                                 }
-                                is EngineStreamEvent.Checkpoint -> {
-                                    // Ignore checkpoints during benchmarking
+                                is EngineStreamEvent.Checkpoint, is EngineStreamEvent.Prefill -> {
+                                    // Ignore checkpoints and prefill progress during benchmarking
                                 }
                             }
                             
@@ -662,6 +689,86 @@ object BenchmarkService {
         }
     }
 
+    /**
+     * Stream the same prompt through the per-token JNI callback and through the native
+     * token ring, alternating [rounds] times, and report delivered tokens/s for each.
+     * The rate is measured from the first delivered chunk to the terminal event so
+     * prefill (and any KV prefix reuse between rounds) does not skew the comparison.
+     */
+    suspend fun compareStreamTransports(
+        config: BenchmarkConfig = BenchmarkConfig(),
+        prompt: String = benchmarkPrompts.first(),
+        rounds: Int = 2
+    ): TransportComparison = withContext(Dispatchers.IO) {
+        check(EngineRuntime.status.value is EngineRuntime.EngineStatus.Loaded) {
+            "Model must be loaded before benchmarking"
+        }
+        val template = TemplateCatalog.resolve(null) ?: TemplateCatalog.default()
+        val tokens = IntArray(2)
+        val batches = IntArray(2)
+        val decodeNs = LongArray(2)
+
+        repeat(rounds.coerceAtLeast(1)) {
+            StreamTransport.entries.forEachIndexed { index, transport ->
+                var firstChunkNs = 0L
+                var endNs = 0L
+                StreamingEngine.stream(
+                    prompt = prompt,
+                    systemPrompt = null,
+                    template = template.id,
+                    temperature = config.temperature,
+                    topP = config.topP,
+                    topK = config.topK,
+                    maxTokens = config.maxTokens,
+                    stop = emptyArray(),
+                    transport = transport
+                ).collect { event ->
+                    when (event) {
+                        is EngineStreamEvent.Token -> {
+                            if (firstChunkNs == 0L) firstChunkNs = System.nanoTime()
+                            batches[index]++
+                        }
+                        is EngineStreamEvent.Terminal -> {
+                            endNs = System.nanoTime()
+                            // The first token is delivered before the clock starts.
+                            tokens[index] += (event.metrics.generationTokens - 1).coerceAtLeast(0)
+                        }
+                        else -> Unit
+                    }
+                }
+                if (firstChunkNs > 0L && endNs > firstChunkNs) {
+                    decodeNs[index] += endNs - firstChunkNs
+                }
+                delay(250)
+            }
+        }
+
+        fun rate(index: Int): Float =
+            if (decodeNs[index] > 0) (tokens[index] * 1e9 / decodeNs[index]).toFloat() else 0f
+
+        val callbackIndex = StreamTransport.Callback.ordinal
+        val ringIndex = StreamTransport.Ring.ordinal
+        TransportComparison(
+            callbackTps = rate(callbackIndex),
+            ringTps = rate(ringIndex),
+            callbackTokens = tokens[callbackIndex],
+            ringTokens = tokens[ringIndex],
+            ringBatches = batches[ringIndex]
+        ).also { comparison ->
+            Logger.perf(
+                "BenchmarkService: transport comparison",
+                mapOf(
+                    "callbackTps" to comparison.callbackTps,
+                    "ringTps" to comparison.ringTps,
+                    "callbackTokens" to comparison.callbackTokens,
+                    "ringTokens" to comparison.ringTokens,
+                    "ringBatches" to comparison.ringBatches,
+                    "rounds" to rounds
+                )
+            )
+        }
+    }
+
     /**
      * Get device information for benchmark results
      */
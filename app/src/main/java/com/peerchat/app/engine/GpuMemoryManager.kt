@@ -5,8 +5,10 @@ import android.content.Context
 import android.os.Build
 import com.peerchat.app.util.Logger
 import com.peerchat.data.db.ModelManifest
+import com.peerchat.engine.EngineRuntime
 import kotlin.math.max
 import kotlin.math.min
+import org.json.JSONObject
 
 /**
  * Intelligent GPU memory manager that dynamically allocates GPU layers
@@ -248,7 +250,8 @@ class GpuMemoryManager(private val context: Context) {
     fun calculateOptimalLayers(
         manifest: ModelManifest,
         contextLength: Int,
-        targetMemoryUsage: Double = 0.7 // Use 70% of available VRAM
+        targetMemoryUsage: Double = 0.7, // Use 70% of available VRAM
+        kvPrecision: String = "q8_0"
     ): MemoryProfile {
         val capabilities = detectCapabilities()
 
@@ -263,6 +266,8 @@ class GpuMemoryManager(private val context: Context) {
             )
         }
 
+        plannedProfile(manifest, contextLength, kvPrecision, capabilities, targetMemoryUsage)?.let { return it }
+
         // Get model family-specific memory profile
         val familyProfile = getModelFamilyProfile(manifest)
         
@@ -329,10 +334,92 @@ class GpuMemoryManager(private val context: Context) {
         )
     }
 
+    /**
+     * Layer placement from the native dry-run planner: the most layers whose weights,
+     * KV cache and compute buffers fit the VRAM share, computed from the GGUF tensor
+     * directory. Compute buffers are the planner's estimate, flagged in the reasoning. Null when the model cannot be read, so the family estimates apply.
+     */
+    private fun plannedProfile(
+        manifest: ModelManifest,
+        contextLength: Int,
+        kvPrecision: String,
+        capabilities: GpuCapabilities,
+        targetMemoryUsage: Double
+    ): MemoryProfile? {
+        val availableVramBytes = (capabilities.maxVramBytes * targetMemoryUsage).toLong()
+        // Mirrors the engine's GPU batch sizing for this context length.
+        val batch = (contextLength / 4).coerceIn(64, 2048)
+        val plan = EngineRuntime.planMemory(
+            path = manifest.filePath,
+            contextLength = contextLength,
+            gpuLayers = Int.MAX_VALUE,
+            kvPrecision = kvPrecision,
+            batch = batch,
+            ubatch = (batch / 4).coerceIn(256, 1024),
+            gpuBudgetBytes = availableVramBytes
+        ) ?: return null
+
+        val reasoning = buildString {
+            append("Device: ${capabilities.deviceName}, ")
+            append("VRAM budget: ${availableVramBytes / (1024 * 1024)}MB, ")
+            append("Model: ${manifest.name}, ")
+            append("Layers: ${plan.nGpuLayers}/${plan.nLayer + 1} planned, ")
+            append("GPU weights ${plan.gpu.weights / (1024 * 1024)}MB + KV ${plan.gpu.kv / (1024 * 1024)}MB")
+            append(" + compute ")
+            if (plan.computeEstimated) append("~")
+            append("${plan.gpu.compute / (1024 * 1024)}MB")
+            if (plan.computeEstimated) append(" (estimate)")
+        }
+        Logger.d("GpuMemoryManager: planned memory profile", mapOf(
+            "model" to manifest.name,
+            "recommendedLayers" to plan.nGpuLayers,
+            "estimatedVramMB" to (plan.gpu.total / (1024 * 1024)),
+            "cpuMB" to (plan.cpu.total / (1024 * 1024))
+        ))
+
+        return MemoryProfile(
+            modelSizeBytes = manifest.sizeBytes,
+            contextLength = contextLength,
+            recommendedGpuLayers = plan.nGpuLayers,
+            estimatedVramUsageBytes = plan.gpu.total,
+            canUseGpu = plan.nGpuLayers > 0,
+            reasoning = reasoning
+        )
+    }
+
     /**
      * Get memory profile for a specific model family
      */
     fun getModelFamilyProfile(manifest: ModelManifest): ModelFamilyProfile {
+        val familyProfile = familyProfileFor(manifest)
+        return measuredProfile(manifest, familyProfile) ?: familyProfile
+    }
+
+    /**
+     * Replace the family estimates with the sizes read from the GGUF header
+     * (layerBytes, sharedBytes, kvBytesPerTokenF16) when the manifest has them.
+     */
+    private fun measuredProfile(manifest: ModelManifest, familyProfile: ModelFamilyProfile): ModelFamilyProfile? {
+        val meta = runCatching { JSONObject(manifest.metadataJson) }.getOrNull() ?: return null
+        val layerBytes = meta.optJSONArray("layerBytes") ?: return null
+        if (layerBytes.length() == 0) return null
+        val nLayer = layerBytes.length()
+        val meanLayerBytes = (0 until nLayer).sumOf { layerBytes.optLong(it) } / nLayer
+        val mb = 1024f * 1024f
+        val kvPerLayerPer1k = meta.optLong("kvBytesPerTokenF16") * 1000f / nLayer / mb
+        // Offloading every block also moves the output head, hence the extra layer.
+        val layerCap = nLayer + 1
+        return ModelFamilyProfile(
+            vramPerLayerMB = (meanLayerBytes / (1024 * 1024)).coerceAtLeast(1L),
+            baseMemoryMB = meta.optLong("sharedBytes") / (1024 * 1024),
+            kvCachePerLayerPer1kTokensMB = if (kvPerLayerPer1k > 0f) kvPerLayerPer1k else familyProfile.kvCachePerLayerPer1kTokensMB,
+            maxLayersSmallContext = min(familyProfile.maxLayersSmallContext, layerCap),
+            maxLayersMediumContext = min(familyProfile.maxLayersMediumContext, layerCap),
+            maxLayersLargeContext = min(familyProfile.maxLayersLargeContext, layerCap)
+        )
+    }
+
+    private fun familyProfileFor(manifest: ModelManifest): ModelFamilyProfile {
         val familyLower = manifest.family.lowercase()
         return modelFamilyProfiles.entries.firstOrNull { (key, _) ->
             familyLower.contains(key, ignoreCase = true)
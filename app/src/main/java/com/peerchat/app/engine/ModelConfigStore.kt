@@ -14,10 +14,30 @@ data class StoredEngineConfig(
     val threads: Int,
     val contextLength: Int,
     val gpuLayers: Int,
-    val useVulkan: Boolean
+    val useVulkan: Boolean,
+    // Small same-vocabulary model used for speculative decoding, if any.
+    val draftModelPath: String? = null,
+    // "f16", "q8_0" or "q4_0"; q8_0 halves the KV cache at negligible quality cost.
+    val kvPrecision: String = "q8_0",
+    // Dedicated embedding model for RAG; null embeds with the chat model.
+    val embeddingModelPath: String? = null
 ) {
-    fun toEngineConfig(): EngineRuntime.EngineConfig =
-        EngineRuntime.EngineConfig(modelPath, threads, contextLength, gpuLayers, useVulkan)
+    fun toEngineConfig(
+        memoryBudgetBytes: Long = 0,
+        threadProfile: ThreadProfile? = null
+    ): EngineRuntime.EngineConfig =
+        EngineRuntime.EngineConfig(
+            modelPath = modelPath,
+            threads = threads,
+            contextLength = contextLength,
+            gpuLayers = gpuLayers,
+            useVulkan = useVulkan,
+            draftModelPath = draftModelPath?.takeIf { File(it).exists() },
+            kvPrecision = kvPrecision,
+            memoryBudgetBytes = memoryBudgetBytes,
+            decodeThreads = threadProfile?.decodeThreads ?: 0,
+            batchThreads = threadProfile?.batchThreads ?: 0
+        )
 }
 
 object ModelConfigStore {
@@ -27,6 +47,9 @@ object ModelConfigStore {
     private const val KEY_CONTEXT_LENGTH = "contextLength"
     private const val KEY_GPU_LAYERS = "gpuLayers"
     private const val KEY_USE_VULKAN = "useVulkan"
+    private const val KEY_DRAFT_MODEL_PATH = "draftModelPath"
+    private const val KEY_KV_PRECISION = "kvPrecision"
+    private const val KEY_EMBEDDING_MODEL_PATH = "embeddingModelPath"
 
     private fun getEncryptedPrefs(context: Context): EncryptedSharedPreferences {
         val masterKey = MasterKey.Builder(context)
@@ -49,7 +72,12 @@ object ModelConfigStore {
             val contextLength = prefs.getInt(KEY_CONTEXT_LENGTH, 4096)
             val gpuLayers = prefs.getInt(KEY_GPU_LAYERS, 20)
             val useVulkan = prefs.getBoolean(KEY_USE_VULKAN, true)
-            StoredEngineConfig(path, threads, contextLength, gpuLayers, useVulkan)
+            val draftModelPath = prefs.getString(KEY_DRAFT_MODEL_PATH, null)
+            val kvPrecision = prefs.getString(KEY_KV_PRECISION, null) ?: "q8_0"
+            val embeddingModelPath = prefs.getString(KEY_EMBEDDING_MODEL_PATH, null)
+            StoredEngineConfig(
+                path, threads, contextLength, gpuLayers, useVulkan, draftModelPath, kvPrecision, embeddingModelPath
+            )
         } catch (e: Exception) {
             null
         }
@@ -64,6 +92,9 @@ object ModelConfigStore {
                 .putInt(KEY_CONTEXT_LENGTH, config.contextLength)
                 .putInt(KEY_GPU_LAYERS, config.gpuLayers)
                 .putBoolean(KEY_USE_VULKAN, config.useVulkan)
+                .putString(KEY_DRAFT_MODEL_PATH, config.draftModelPath)
+                .putString(KEY_KV_PRECISION, config.kvPrecision)
+                .putString(KEY_EMBEDDING_MODEL_PATH, config.embeddingModelPath)
                 .apply()
         } catch (e: Exception) {
         }
@@ -137,7 +137,8 @@ class ModelHealthChecker {
                     topP = 0.9f,
                     topK = 10,
                     maxTokens = 5, // Very short generation
-                    stop = emptyArray()
+                    stop = emptyArray(),
+                    keepPrefix = 0
                 )
 
                 if (result.isNotBlank() && result.length > 3) {
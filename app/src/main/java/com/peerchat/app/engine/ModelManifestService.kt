@@ -2,6 +2,7 @@ package com.peerchat.app.engine
 
 import android.content.Context
 import com.peerchat.data.db.ModelManifest
+import com.peerchat.engine.EngineRuntime
 import com.peerchat.templates.TemplateCatalog
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.flow.Flow
@@ -45,7 +46,7 @@ class ModelManifestService(
                 !modelMetaJson.isNullOrBlank() -> modelMetaJson
                 cached != null -> cached.toString()
                 existing != null -> existing.metadataJson
-                else -> null
+                else -> EngineRuntime.inspectModel(path)
             }
 
             val metadata = baseMetadataJson
@@ -165,7 +166,7 @@ class ModelManifestService(
 
     private fun extractContextLength(meta: JSONObject?): Int? {
         if (meta == null) return null
-        val keys = listOf("n_ctx_train", "context_length", "general.context_length")
+        val keys = listOf("nCtxTrain", "n_ctx_train", "context_length", "general.context_length")
         for (key in keys) {
             val value = meta.optInt(key, -1)
             if (value > 0) return value
@@ -13,7 +13,9 @@ import com.peerchat.app.data.OperationResult
 import com.peerchat.app.util.Logger
 import com.peerchat.data.db.ModelManifest
 import com.peerchat.engine.EngineRuntime
+import kotlinx.coroutines.CoroutineScope
 import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.SupervisorJob
 import kotlinx.coroutines.flow.Flow
 import kotlinx.coroutines.flow.MutableStateFlow
 import kotlinx.coroutines.flow.StateFlow
@@ -22,15 +24,12 @@ import kotlinx.coroutines.flow.flow
 import kotlinx.coroutines.flow.flowOn
 import kotlinx.coroutines.flow.onCompletion
 import kotlinx.coroutines.flow.onEach
+import kotlinx.coroutines.launch
 import kotlinx.coroutines.withContext
-import java.io.ByteArrayInputStream
-import java.io.ByteArrayOutputStream
 import java.io.File
 import java.util.LinkedHashMap
 import java.util.concurrent.atomic.AtomicLong
 import java.util.concurrent.locks.ReentrantLock
-import java.util.zip.GZIPInputStream
-import java.util.zip.GZIPOutputStream
 import kotlin.concurrent.withLock
 
 class ModelRepository(
@@ -43,11 +42,13 @@ class ModelRepository(
 
     // Performance optimizations
     private val gpuMemoryManager = GpuMemoryManager(appContext)
-    private val kvCacheOptimizer = KvCacheOptimizer(maxCacheSizeBytes = maxCacheBytes, maxCacheEntries = maxCacheFiles)
+    // Thread calibration outlives the load call that starts it.
+    private val calibrationScope = CoroutineScope(SupervisorJob() + Dispatchers.IO)
 
     // Legacy KV cache (keeping for compatibility, but optimized version preferred)
     private val cacheDir: File by lazy { File(appContext.filesDir, "kv_cache").apply { if (!exists()) mkdirs() } }
     private fun stateFile(chatId: Long): File = File(cacheDir, "chat_${chatId}.kvc")
+    private val sessionSpillDir: File by lazy { File(appContext.filesDir, "kv_sessions").apply { if (!exists()) mkdirs() } }
     private val cacheLock = ReentrantLock()
     private val cacheIndex = object : LinkedHashMap<Long, CacheEntry>(16, 0.75f, true) {}
     private var cacheBytes: Long = 0
@@ -188,6 +189,17 @@ class ModelRepository(
         return availableMemoryMB >= requiredMemoryMB
     }
 
+    /**
+     * Memory the engine may plan weights and KV caches into: three quarters of what is
+     * available above the low-memory threshold. 0 (no budget) when it cannot be read.
+     */
+    private fun engineMemoryBudgetBytes(): Long = runCatching {
+        val activityManager = appContext.getSystemService(Context.ACTIVITY_SERVICE) as ActivityManager
+        val memoryInfo = ActivityManager.MemoryInfo()
+        activityManager.getMemoryInfo(memoryInfo)
+        ((memoryInfo.availMem - memoryInfo.threshold) * 3 / 4).coerceAtLeast(0L)
+    }.getOrDefault(0L)
+
     /**
      * Check battery status for power-intensive operations
      */
@@ -254,6 +266,9 @@ class ModelRepository(
                 )
             )
 
+            // Before the chat model, so its memory budget and contexts leave embeddings out.
+            syncEmbedder(config)
+
             for ((index, attempt) in attempts.withIndex()) {
                 var retries = 0
                 var lastError: String? = null
@@ -271,10 +286,13 @@ class ModelRepository(
                     )
                 )
 
+                val threadProfile = ThreadProfileStore.load(appContext, attempt.config)
                 while (retries < MAX_LOAD_RETRIES) {
                     unloadInternal()
                     val loadStartTime = System.currentTimeMillis()
-                    val loadResult = runCatching { EngineRuntime.load(attempt.config.toEngineConfig()) }
+                    val loadResult = runCatching {
+                        EngineRuntime.load(attempt.config.toEngineConfig(engineMemoryBudgetBytes(), threadProfile))
+                    }
                     val loaded = loadResult.getOrDefault(false)
 
                     if (loaded) {
@@ -293,6 +311,10 @@ class ModelRepository(
                         )
 
                         ModelConfigStore.save(appContext, attempt.config)
+                        runCatching { EngineRuntime.setSessionSpillDir(sessionSpillDir.absolutePath) }
+                        if (threadProfile == null) {
+                            calibrateThreadsInBackground(attempt.config)
+                        }
                         val modelMeta = EngineRuntime.currentModelMeta()
                         withContext(Dispatchers.IO) {
                             manifestService.ensureManifestFor(
@@ -391,6 +413,45 @@ class ModelRepository(
         }
     }
 
+    /**
+     * Measures the fastest decode and prompt-batch thread counts for a model loaded
+     * without a stored profile and keeps them for its next load. The engine runs the
+     * trials between chat requests, so the load result does not wait for them.
+     */
+    private fun calibrateThreadsInBackground(config: StoredEngineConfig) {
+        calibrationScope.launch {
+            val calibration = runCatching { EngineRuntime.calibrateThreads() }.getOrNull() ?: return@launch
+            ThreadProfileStore.save(appContext, config, calibration)
+            Logger.i(
+                "loadModel:threadsCalibrated",
+                mapOf(
+                    "file" to File(config.modelPath).name,
+                    "decodeThreads" to calibration.decodeThreads,
+                    "batchThreads" to calibration.batchThreads,
+                    "decodeTps" to calibration.decodeTps,
+                    "prefillTps" to calibration.prefillTps
+                )
+            )
+        }
+    }
+
+    /**
+     * Keeps the dedicated embedding model in step with [config]. It outlives chat model
+     * reloads; a missing or unloadable file falls back to embedding with the chat model.
+     */
+    private suspend fun syncEmbedder(config: StoredEngineConfig) {
+        val path = config.embeddingModelPath?.takeIf { File(it).exists() }
+        if (path == EngineRuntime.embedderPath.value) return
+        if (path == null) {
+            runCatching { EngineRuntime.unloadEmbedder() }
+            return
+        }
+        val loaded = runCatching { EngineRuntime.loadEmbedder(path) }.getOrDefault(false)
+        if (!loaded) {
+            Logger.w("loadModel:embedderFailed", mapOf("file" to File(path).name))
+        }
+    }
+
     private suspend fun unloadInternal() {
         EngineRuntime.unload()
         EngineRuntime.clearState(true)
@@ -434,6 +495,9 @@ class ModelRepository(
             contextLength = manifest.contextLength.takeIf { it > 0 } ?: (stored?.contextLength ?: 4096),
             gpuLayers = stored?.gpuLayers ?: 20,
             useVulkan = stored?.useVulkan ?: true,
+            draftModelPath = stored?.draftModelPath,
+            kvPrecision = stored?.kvPrecision ?: "q8_0",
+            embeddingModelPath = stored?.embeddingModelPath,
         )
         return loadModel(config)
     }
@@ -454,47 +518,9 @@ class ModelRepository(
             recordMiss()
             return@withContext false
         }
-        
-        // Validate file size (minimum expected size for a valid snapshot)
-        val fileSize = file.length()
-        if (fileSize < 16L) {
-            // Too small to be a valid snapshot, likely corrupted
-            removeEntry(chatId, deleteFile = true)
-            recordMiss()
-            return@withContext false
-        }
-        
-        val payload = runCatching { file.readBytes() }.getOrNull()
-        if (payload == null || payload.isEmpty()) {
-            removeEntry(chatId, deleteFile = true)
-            recordMiss()
-            return@withContext false
-        }
-        
-        // Validate payload size matches file size
-        if (payload.size != fileSize.toInt()) {
-            removeEntry(chatId, deleteFile = true)
-            recordMiss()
-            return@withContext false
-        }
-        
-        val snapshot = runCatching { decompress(payload) }.getOrNull()
-        if (snapshot == null || snapshot.isEmpty()) {
-            // Decompression failed or empty snapshot
-            removeEntry(chatId, deleteFile = true)
-            recordMiss()
-            return@withContext false
-        }
-        
-        // Validate snapshot size (should be reasonable)
-        if (snapshot.size > maxCacheBytes) {
-            // Snapshot too large, likely corrupted
-            removeEntry(chatId, deleteFile = true)
-            recordMiss()
-            return@withContext false
-        }
-        
-        val restored = runCatching { EngineRuntime.restoreState(snapshot) }.getOrDefault(false)
+
+        // Native side validates and decompresses the chunked snapshot straight into the chat's sequence
+        val restored = runCatching { EngineRuntime.loadSessionState(chatId, file.absolutePath) }.getOrDefault(false)
         if (restored) {
             recordHit(chatId, file)
         } else {
@@ -506,41 +532,24 @@ class ModelRepository(
     }
 
     suspend fun captureKv(chatId: Long) = withContext(Dispatchers.IO) {
-        val snapshot: ByteArray = EngineRuntime.captureState() ?: return@withContext
-        
-        // Use optimized compression from KvCacheOptimizer (non-blocking, already on IO dispatcher)
-        // For large snapshots, use async compression to avoid blocking
-        val packed = if (snapshot.size > 512 * 1024) { // > 512KB
-            // Large snapshot - compress asynchronously to avoid blocking
-            withContext(Dispatchers.Default) {
-                compressOptimized(snapshot)
-            }
-        } else {
-            // Small snapshot - compress synchronously (fast enough)
-            compressOptimized(snapshot)
-        }
-        
-        if (packed.size.toLong() > maxCacheBytes) {
+        val file = stateFile(chatId)
+        file.parentFile?.mkdirs()
+        // Streamed and compressed natively; the snapshot never enters the Java heap
+        val stored = runCatching { EngineRuntime.saveSessionState(chatId, file.absolutePath) }.getOrDefault(0L)
+        if (stored <= 0L) {
             recordMiss()
-            return@withContext // snapshot too large, skip caching
+            return@withContext
         }
-        val file = stateFile(chatId)
-        runCatching {
-            file.parentFile?.mkdirs()
-            val tmp = File(cacheDir, "${file.name}.tmp")
-            tmp.outputStream().use { it.write(packed) }
-            if (!tmp.renameTo(file)) {
-                tmp.copyTo(file, overwrite = true)
-                tmp.delete()
-            }
-            recordHit(chatId, file)
-        }.onFailure {
+        if (stored > maxCacheBytes) {
             removeEntry(chatId, deleteFile = true)
             recordMiss()
+            return@withContext // snapshot too large, skip caching
         }
+        recordHit(chatId, file)
     }
 
     suspend fun clearKv(chatId: Long) = withContext(Dispatchers.IO) {
+        runCatching { EngineRuntime.releaseSession(chatId) }
         removeEntry(chatId, deleteFile = true)
     }
 
@@ -556,56 +565,6 @@ class ModelRepository(
         cacheDir.listFiles()?.forEach { runCatching { it.delete() } }
     }
 
-    /**
-     * Optimized compression using KvCacheOptimizer for better performance
-     */
-    private fun compressOptimized(input: ByteArray): ByteArray {
-        if (input.isEmpty()) return input
-        
-        val startTime = System.nanoTime()
-        // Use KvCacheOptimizer for better compression (LZ4 for small, optimal for large)
-        val (compressed, stats) = kvCacheOptimizer.compressOptimal(input)
-        val compressionTimeMs = (System.nanoTime() - startTime) / 1_000_000
-        
-        val result = if (compressed.size >= input.size) input else compressed
-        
-        // Log compression effectiveness periodically (only for significant compressions)
-        if (stats.compressionRatio < 0.9f) { // At least 10% compression
-            val savedBytes = input.size - compressed.size
-            Logger.d("KV Cache compression", mapOf(
-                "originalSize" to input.size,
-                "compressedSize" to compressed.size,
-                "ratio" to "%.2f".format(stats.compressionRatio),
-                "algorithm" to stats.algorithm,
-                "savedBytes" to savedBytes,
-                "compressionTimeMs" to compressionTimeMs
-            ))
-        }
-        
-        return result
-    }
-    
-    /**
-     * Legacy compression method (kept for compatibility)
-     */
-    private fun compress(input: ByteArray): ByteArray {
-        return compressOptimized(input)
-    }
-
-    /**
-     * Optimized decompression using KvCacheOptimizer
-     */
-    private fun decompress(input: ByteArray): ByteArray {
-        if (input.isEmpty()) return input
-        return runCatching {
-            // Try optimized decompression first
-            kvCacheOptimizer.decompressOptimal(input) ?: run {
-                // Fallback to legacy GZIP if optimized fails
-                GZIPInputStream(ByteArrayInputStream(input)).use { it.readBytes() }
-            }
-        }.getOrElse { input }
-    }
-
     private fun recordHit(chatId: Long, file: File) {
         val size = file.length().coerceAtLeast(0L)
         cacheLock.withLock {
@@ -728,7 +687,11 @@ class ModelRepository(
         val attempts = LinkedHashMap<StoredEngineConfig, String>()
 
         // Get GPU memory profile for intelligent layer allocation
-        val gpuProfile = gpuMemoryManager.calculateOptimalLayers(manifest, initial.contextLength)
+        val gpuProfile = gpuMemoryManager.calculateOptimalLayers(
+            manifest,
+            initial.contextLength,
+            kvPrecision = initial.kvPrecision
+        )
 
         // Primary attempt with intelligent GPU allocation
         val optimizedConfig = if (gpuProfile.canUseGpu) {
@@ -794,14 +757,16 @@ class ModelRepository(
         topP: Float,
         topK: Int,
         maxTokens: Int,
-        stop: Array<String>
+        stop: Array<String>,
+        keepPrefix: Int = 0
     ): Flow<EngineStreamEvent> {
         return flow {
             var emittedTerminal = false
-            val restored = runCatching { restoreKv(chatId) }.getOrDefault(false)
-            if (!restored) {
-                runCatching { EngineRuntime.clearState(false) }
-            }
+            // Each chat owns a KV sequence in the native session pool; recently used
+            // chats stay resident and evicted ones are spilled/reloaded natively.
+            val resident = runCatching { EngineRuntime.selectSession(chatId) }.getOrDefault(false)
+            // Cold chats fall back to their persisted per-sequence snapshot.
+            val restored = resident || runCatching { restoreKv(chatId) }.getOrDefault(false)
 
             Logger.i(
                 "streamWithCache: start",
@@ -821,7 +786,8 @@ class ModelRepository(
                 topP = topP,
                 topK = topK,
                 maxTokens = maxTokens,
-                stop = stop
+                stop = stop,
+                keepPrefix = keepPrefix
             ).onEach { event ->
                 if (event is EngineStreamEvent.Terminal) {
                     emittedTerminal = true
@@ -855,7 +821,6 @@ class ModelRepository(
                         cause
                     )
                     withContext(Dispatchers.IO) {
-                        runCatching { EngineRuntime.clearState(false) }
                         runCatching { clearKv(chatId) }
                     }
                 }
@@ -7,10 +7,19 @@ import com.peerchat.engine.EngineMetrics
 import com.peerchat.engine.EngineNative
 import com.peerchat.engine.EngineRuntime
 import com.peerchat.engine.TokenCallback
+import com.peerchat.engine.TokenRing
+import kotlinx.coroutines.CancellationException
+import kotlinx.coroutines.NonCancellable
 import kotlinx.coroutines.channels.awaitClose
+import kotlinx.coroutines.coroutineScope
+import kotlinx.coroutines.delay
+import kotlinx.coroutines.ensureActive
 import kotlinx.coroutines.flow.Flow
 import kotlinx.coroutines.flow.callbackFlow
 import kotlinx.coroutines.flow.flowOn
+import kotlinx.coroutines.isActive
+import kotlinx.coroutines.launch
+import kotlinx.coroutines.withContext
 import kotlinx.coroutines.Dispatchers
 import java.util.concurrent.atomic.AtomicBoolean
 import java.util.concurrent.atomic.AtomicLong
@@ -20,6 +29,17 @@ sealed interface EngineStreamEvent {
     data class Terminal(val metrics: EngineMetrics) : EngineStreamEvent
     data class Error(val message: String, val recoverable: Boolean = false) : EngineStreamEvent
     data class Checkpoint(val state: ByteArray) : EngineStreamEvent
+    /** Prompt prefill progress, emitted before the first token while a long prompt is decoded. */
+    data class Prefill(val done: Int, val total: Int, val etaMs: Long) : EngineStreamEvent
+}
+
+/** How generated text crosses from the native decode loop into Kotlin. */
+enum class StreamTransport {
+    /** One JNI upcall and String allocation per token on the decode thread. */
+    Callback,
+
+    /** Native SPSC ring drained in batches; the decode loop never calls into the VM. */
+    Ring
 }
 
 object StreamingEngine {
@@ -28,6 +48,12 @@ object StreamingEngine {
     private const val MEMORY_CHECK_INTERVAL_MS = 10000L // Check every 10 seconds (reduced frequency)
     private var lastMemoryCheckResult: Boolean? = null
     private var lastMemoryCheckTime: Long = 0
+
+    // Upper bound on how long the ring consumer blocks before re-checking cancellation.
+    private const val RING_POLL_MS = 50
+
+    // Prefill progress is polled natively (lock-free) rather than pushed per slice.
+    private const val PREFILL_POLL_MS = 100L
     
     /**
      * Check if device is under memory pressure
@@ -56,7 +82,9 @@ object StreamingEngine {
         topK: Int,
         maxTokens: Int,
         stop: Array<String>,
-        context: Context? = null
+        keepPrefix: Int = 0,
+        context: Context? = null,
+        transport: StreamTransport = StreamTransport.Ring
     ): Flow<EngineStreamEvent> = callbackFlow {
         EngineRuntime.ensureInitialized()
         val completed = AtomicBoolean(false)
@@ -76,7 +104,8 @@ object StreamingEngine {
                 "topP" to topP,
                 "topK" to topK,
                 "maxTokens" to maxTokens,
-                "stopCount" to stop.size
+                "stopCount" to stop.size,
+                "transport" to transport.name
             )
         )
         
@@ -170,19 +199,48 @@ object StreamingEngine {
             }
         }
         
+        // Runs beside the blocking generate call; stops once text starts flowing.
+        val prefillWatcher = launch(Dispatchers.IO) {
+            val progress = LongArray(3)
+            var lastDone = -1L
+            while (isActive && !completed.get() && !firstChunkLogged.get()) {
+                if (EngineNative.prefillProgress(progress) && progress[0] != lastDone) {
+                    lastDone = progress[0]
+                    trySend(EngineStreamEvent.Prefill(progress[0].toInt(), progress[1].toInt(), progress[2]))
+                }
+                delay(PREFILL_POLL_MS)
+            }
+        }
+
         val start = runCatching {
-            EngineNative.generateStream(
-                prompt,
-                systemPrompt,
-                template,
-                temperature,
-                topP,
-                topK,
-                maxTokens,
-                stop,
-                callback
-            )
+            when (transport) {
+                StreamTransport.Callback -> EngineNative.generateStream(
+                    prompt,
+                    systemPrompt,
+                    template,
+                    temperature,
+                    topP,
+                    topK,
+                    maxTokens,
+                    stop,
+                    keepPrefix,
+                    callback
+                )
+                StreamTransport.Ring -> streamThroughRing(
+                    prompt,
+                    systemPrompt,
+                    template,
+                    temperature,
+                    topP,
+                    topK,
+                    maxTokens,
+                    stop,
+                    keepPrefix,
+                    callback
+                )
+            }
         }
+        start.exceptionOrNull()?.let { if (it is CancellationException) throw it }
         
         if (start.isFailure) {
             completed.set(true)
@@ -202,6 +260,7 @@ object StreamingEngine {
         }
         
         awaitClose {
+            prefillWatcher.cancel()
             // Ensure cleanup: abort any ongoing generation
             if (!completed.get()) {
                 Logger.i("StreamingEngine: awaitClose - aborting generation")
@@ -210,4 +269,57 @@ object StreamingEngine {
             Logger.d("StreamingEngine: cleanup complete")
         }
     }.flowOn(Dispatchers.IO)
+
+    /**
+     * Runs generation on its own IO thread while this coroutine drains the native ring
+     * and feeds [callback] one batch per wakeup, with done delivered after the producer
+     * has released the engine.
+     */
+    private suspend fun streamThroughRing(
+        prompt: String,
+        systemPrompt: String?,
+        template: String?,
+        temperature: Float,
+        topP: Float,
+        topK: Int,
+        maxTokens: Int,
+        stop: Array<String>,
+        keepPrefix: Int,
+        callback: TokenCallback
+    ) = coroutineScope {
+        val ring = TokenRing()
+        var drained = false
+        val producer = launch(Dispatchers.IO) {
+            EngineNative.generateStreamRing(
+                prompt,
+                systemPrompt,
+                template,
+                temperature,
+                topP,
+                topK,
+                maxTokens,
+                stop,
+                keepPrefix,
+                ring.handle
+            )
+        }
+        try {
+            while (true) {
+                ensureActive()
+                val chunk = ring.poll(RING_POLL_MS) ?: break
+                if (chunk.isNotEmpty()) {
+                    callback.onToken(chunk, false)
+                }
+            }
+            drained = true
+        } finally {
+            // The producer writes into the ring until it returns; never free it early.
+            if (!drained) {
+                EngineNative.abort()
+            }
+            withContext(NonCancellable) { producer.join() }
+            ring.close()
+        }
+        callback.onToken("", true)
+    }
 }
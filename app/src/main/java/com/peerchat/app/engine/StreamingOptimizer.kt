@@ -75,8 +75,8 @@ class StreamingOptimizer(
                             batchChannel.send(TokenBatch(emptyList(), errorMetrics))
                         }
                     }
-                    is EngineStreamEvent.Checkpoint -> {
-                        // Ignore checkpoints in optimizer
+                    is EngineStreamEvent.Checkpoint, is EngineStreamEvent.Prefill -> {
+                        // Ignore checkpoints and prefill progress in optimizer
                     }
                 }
             }
@@ -0,0 +1,50 @@
+package com.peerchat.app.engine
+
+import android.content.Context
+import com.peerchat.engine.ThreadCalibration
+
+/**
+ * Calibrated decode and prompt-batch thread counts, per model file, thread budget and
+ * placement (GPU offload changes what the CPU threads have to do). Not sensitive, so
+ * kept in plain preferences.
+ */
+data class ThreadProfile(
+    val decodeThreads: Int,
+    val batchThreads: Int,
+)
+
+object ThreadProfileStore {
+    private const val PREFS = "thread_profiles"
+
+    private fun key(config: StoredEngineConfig): String {
+        val placement = if (config.useVulkan && config.gpuLayers > 0) "gpu" else "cpu"
+        return "${config.modelPath}|${config.threads}|$placement"
+    }
+
+    fun load(context: Context, config: StoredEngineConfig): ThreadProfile? {
+        return try {
+            val prefs = context.getSharedPreferences(PREFS, Context.MODE_PRIVATE)
+            val value = prefs.getString(key(config), null) ?: return null
+            val (decode, batch) = value.split(",").map { it.toInt() }
+            ThreadProfile(decode, batch).takeIf { decode > 0 && batch > 0 }
+        } catch (e: Exception) {
+            null
+        }
+    }
+
+    fun save(context: Context, config: StoredEngineConfig, calibration: ThreadCalibration) {
+        try {
+            context.getSharedPreferences(PREFS, Context.MODE_PRIVATE).edit()
+                .putString(key(config), "${calibration.decodeThreads},${calibration.batchThreads}")
+                .apply()
+        } catch (e: Exception) {
+        }
+    }
+
+    fun clear(context: Context) {
+        try {
+            context.getSharedPreferences(PREFS, Context.MODE_PRIVATE).edit().clear().apply()
+        } catch (e: Exception) {
+        }
+    }
+}
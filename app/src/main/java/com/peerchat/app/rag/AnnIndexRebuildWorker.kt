@@ -20,7 +20,11 @@ class AnnIndexRebuildWorker(
         try {
             val db = PeerDatabaseProvider.get(applicationContext, BuildConfig.DEBUG)
             val snapshot = RagService.rebuildAnnIndex(db)
-            AnnIndexStorage.save(applicationContext, snapshot)
+            if (snapshot != null) {
+                AnnIndexStorage.save(applicationContext, snapshot)
+            } else {
+                AnnIndexStorage.clear(applicationContext)
+            }
             Logger.i("AnnIndexRebuildWorker: rebuild completed")
             Result.success()
         } catch (t: Throwable) {
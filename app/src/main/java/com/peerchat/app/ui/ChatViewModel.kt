@@ -524,7 +524,8 @@ class ChatViewModel @Inject constructor(
                 topP = stateSnapshot.topP,
                 topK = stateSnapshot.topK,
                 maxTokens = stateSnapshot.maxTokens,
-                stop = composition.prompt.stopSequences.toTypedArray()
+                stop = composition.prompt.stopSequences.toTypedArray(),
+                keepPrefix = composition.prompt.keepLength
             ).collect { event ->
                 when (event) {
                     is EngineStreamEvent.Token -> {
@@ -547,7 +548,21 @@ class ChatViewModel @Inject constructor(
                                 reasoningText = snapshot.reasoning,
                                 reasoningChars = snapshot.reasoningChars,
                                 reasoningDurationMs = null,
-                                metrics = null
+                                metrics = null,
+                                prefillDone = 0,
+                                prefillTotal = 0,
+                                prefillEtaMs = 0
+                            )
+                        }
+                    }
+
+                    is EngineStreamEvent.Prefill -> {
+                        updateStreamingState {
+                            it.copy(
+                                isStreaming = true,
+                                prefillDone = event.done,
+                                prefillTotal = event.total,
+                                prefillEtaMs = event.etaMs
                             )
                         }
                     }
@@ -599,7 +614,8 @@ class ChatViewModel @Inject constructor(
                                 reasoningText = "",
                                 reasoningChars = 0,
                                 reasoningDurationMs = parseResult.reasoningDurationMs,
-                                metrics = event.metrics
+                                metrics = event.metrics,
+                                prefillTotal = 0
                             )
                         }
                     }
@@ -616,7 +632,8 @@ class ChatViewModel @Inject constructor(
                                 reasoningText = "",
                                 reasoningChars = 0,
                                 reasoningDurationMs = null,
-                                metrics = EngineMetrics.empty().copy(stopReason = "error")
+                                metrics = EngineMetrics.empty().copy(stopReason = "error"),
+                                prefillTotal = 0
                             )
                         }
                     }
@@ -143,7 +143,11 @@ data class StreamingUiState(
     val reasoningText: String = "",
     val reasoningChars: Int = 0,
     val reasoningDurationMs: Long? = null,
-    val metrics: EngineMetrics? = null
+    val metrics: EngineMetrics? = null,
+    // Prompt tokens decoded so far while a long prompt is prefilled; total is 0 otherwise.
+    val prefillDone: Int = 0,
+    val prefillTotal: Int = 0,
+    val prefillEtaMs: Long = 0
 )
 
 // Supporting data classes
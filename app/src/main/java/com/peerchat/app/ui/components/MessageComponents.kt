@@ -15,6 +15,7 @@ import androidx.compose.foundation.layout.height
 import androidx.compose.foundation.layout.padding
 import androidx.compose.foundation.layout.width
 import androidx.compose.material3.AssistChip
+import androidx.compose.material3.LinearProgressIndicator
 import androidx.compose.material3.MaterialTheme
 import androidx.compose.material3.Surface
 import androidx.compose.material3.Text
@@ -217,7 +218,10 @@ fun StreamingMessageBubble(
     showCopyButton: Boolean = true,
     showReasoning: Boolean = false,
     reasoningText: String = "",
-    onShowReasoningChange: ((Boolean) -> Unit)? = null
+    onShowReasoningChange: ((Boolean) -> Unit)? = null,
+    prefillDone: Int = 0,
+    prefillTotal: Int = 0,
+    prefillEtaMs: Long = 0
 ) {
     val clipboard = LocalClipboardManager.current
 
@@ -238,6 +242,23 @@ fun StreamingMessageBubble(
                 .padding(horizontal = spacing.medium, vertical = spacing.small),
             verticalArrangement = Arrangement.spacedBy(spacing.small)
         ) {
+            if (prefillTotal > 0 && currentText.isEmpty()) {
+                val fraction = (prefillDone.toFloat() / prefillTotal).coerceIn(0f, 1f)
+                LinearProgressIndicator(
+                    progress = { fraction },
+                    modifier = Modifier.fillMaxWidth()
+                )
+                Text(
+                    text = if (prefillEtaMs > 0) {
+                        "Reading prompt ${(fraction * 100).toInt()}% · ~${(prefillEtaMs + 999) / 1000}s left"
+                    } else {
+                        "Reading prompt ${(fraction * 100).toInt()}%"
+                    },
+                    style = MaterialTheme.typography.labelSmall,
+                    color = MaterialTheme.colorScheme.onSurfaceVariant
+                )
+            }
+
             if (reasoningText.isNotEmpty()) {
                 Column(
                     modifier = Modifier.fillMaxWidth(),
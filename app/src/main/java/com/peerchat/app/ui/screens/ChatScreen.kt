@@ -91,6 +91,9 @@ fun ChatScreen(
                         currentText = streaming.visibleText,
                         showReasoning = selectedReasoningMessage != null,
                         reasoningText = streaming.reasoningText,
+                        prefillDone = streaming.prefillDone,
+                        prefillTotal = streaming.prefillTotal,
+                        prefillEtaMs = streaming.prefillEtaMs,
                         onShowReasoningChange = { if (it) selectedReasoningMessage = messages.lastOrNull { msg -> msg.role == "assistant" } else selectedReasoningMessage = null }
                     )
                 }
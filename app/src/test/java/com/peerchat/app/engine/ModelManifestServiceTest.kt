@@ -2,10 +2,14 @@ package com.peerchat.app.engine
 
 import android.content.Context
 import com.peerchat.data.db.ModelManifest
+import com.peerchat.engine.EngineRuntime
 import io.mockk.coEvery
 import io.mockk.coVerify
+import io.mockk.every
 import io.mockk.mockk
+import io.mockk.mockkObject
 import io.mockk.slot
+import io.mockk.unmockkObject
 import java.io.File
 import java.security.MessageDigest
 import kotlinx.coroutines.test.runTest
@@ -45,6 +49,37 @@ class ModelManifestServiceTest {
         org.junit.Assert.assertTrue(metaJson.optBoolean("fileExists"))
     }
 
+    @Test
+    fun `ensureManifestFor probes the GGUF header for new files`() = runTest {
+        val mockContext = mockk<Context>(relaxed = true)
+        val repository = mockk<ModelManifestRepository>(relaxed = true)
+        val service = ModelManifestService(mockContext, repository)
+
+        val file = temp.newFile("probed.gguf").apply { writeText("peerchat-model") }
+        val header = JSONObject()
+            .put("arch", "qwen2")
+            .put("nCtxTrain", 32768)
+            .put("layerBytes", org.json.JSONArray(listOf(1024L, 1024L)))
+            .toString()
+
+        mockkObject(EngineRuntime)
+        try {
+            every { EngineRuntime.inspectModel(file.absolutePath) } returns header
+            val captured = slot<ModelManifest>()
+            coEvery { repository.getByName(any()) } returns null
+            coEvery { repository.upsert(capture(captured)) } returns 1L
+
+            service.ensureManifestFor(path = file.absolutePath)
+
+            val manifest = captured.captured
+            val metaJson = JSONObject(manifest.metadataJson)
+            org.junit.Assert.assertEquals(32768, manifest.contextLength)
+            org.junit.Assert.assertEquals(2, metaJson.getJSONArray("layerBytes").length())
+        } finally {
+            unmockkObject(EngineRuntime)
+        }
+    }
+
     private fun sha(file: File): String {
         val digest = MessageDigest.getInstance("SHA-256")
         digest.update(file.readBytes())
@@ -43,6 +43,7 @@ class ModelRepositoryLoadFallbackTest {
         every { EngineRuntime.status } returns statusFlow
         coEvery { EngineRuntime.unload() } returns Unit
         coEvery { EngineRuntime.clearState(any()) } returns Unit
+        coEvery { EngineRuntime.setSessionSpillDir(any()) } returns Unit
         every { EngineRuntime.updateMetricsFromNative() } returns EngineMetrics.empty()
         every { EngineRuntime.currentModelMeta() } returns "{}"
 
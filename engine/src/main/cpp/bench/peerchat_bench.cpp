@@ -0,0 +1,515 @@
+// peerchat-bench: replays scripted multi-turn chats through peerchat_core on a
+// host CPU and prints per-turn prefill, time-to-first-token, decode rate and
+// resident memory as JSON.
+//
+//   peerchat-bench -m model.gguf -s chats.json [-t threads] [-c ctx] [-d draft.gguf] [--kv q8_0] [-o out.json]
+//   peerchat-bench -m model.gguf -s chats.json -t 8 --calibrate
+//
+// Chats are replayed round-robin by turn, each bound to its own session, so the
+// run exercises prompt-prefix reuse and session switching the way the app does.
+// Prompts use the ChatML layout of the app's template catalogue.
+
+#include "engine_core.h"
+#include "engine_log.h"
+#include "memory_plan.h"
+#include "llama.h"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using json = nlohmann::ordered_json;
+
+namespace {
+
+struct Options {
+    std::string model;
+    std::string script;
+    std::string out;
+    std::string draft;
+    std::string embed_model;
+    int draft_max = 8;
+    int lookup_max = 0;
+    std::string kv = "f16";
+    long mem_budget_mb = 0;
+    int threads = 4;
+    int decode_threads = 0;
+    int batch_threads = 0;
+    bool calibrate = false;
+    int ctx = 4096;
+    int slots = 0;
+    int max_tokens = -1;
+    int aux = 0;
+    float temperature = -1.0f;
+    bool embed = false;
+    bool verbose = false;
+};
+
+struct Chat {
+    int64_t id = 0;
+    std::string system;
+    std::vector<std::string> turns;
+    // Rendered history: every completed turn, ready to be extended.
+    std::string transcript;
+};
+
+constexpr const char * kStop = "<|im_end|>";
+
+void usage(const char * argv0) {
+    std::fprintf(stderr,
+                 "usage: %s -m MODEL -s SCRIPT [options]\n"
+                 "  -m, --model PATH       GGUF model\n"
+                 "  -s, --script PATH      chat script (JSON)\n"
+                 "  -t, --threads N        CPU threads (default 4)\n"
+                 "      --decode-threads N single-token decode threads (default: the fast cores, at most -t)\n"
+                 "      --batch-threads N  prompt batch threads (default -t)\n"
+                 "      --calibrate        time the candidate thread counts after loading and run on the best\n"
+                 "  -c, --ctx N            context length (default 4096)\n"
+                 "      --slots N          session slots (default: one per chat, max 64)\n"
+                 "  -n, --max-tokens N     override the script's maxTokens\n"
+                 "      --temp T           override the script's temperature\n"
+                 "  -d, --draft PATH       draft model for speculative decoding\n"
+                 "      --draft-max N      tokens drafted per step (default 8)\n"
+                 "      --lookup N         without a draft model, draft up to N tokens from prompt n-grams\n"
+                 "      --kv TYPE          KV cache precision: f16, q8_0 or q4_0 (default f16)\n"
+                 "      --mem-budget MB    shrink the context so weights and KV caches fit in MB\n"
+                 "      --embed            also time embedding every user turn\n"
+                 "      --embed-model PATH dedicated embedding model, loaded before the chat model\n"
+                 "      --aux N            run N auxiliary title requests alongside every reply\n"
+                 "  -o, --out PATH         write the report here instead of stdout\n"
+                 "  -v, --verbose          engine and llama logs on stderr\n",
+                 argv0);
+}
+
+bool parse_args(int argc, char ** argv, Options & opts) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        auto value = [&]() -> const char * {
+            if (i + 1 >= argc) {
+                std::fprintf(stderr, "missing value for %s\n", arg.c_str());
+                return nullptr;
+            }
+            return argv[++i];
+        };
+        const char * v = nullptr;
+        if (arg == "-m" || arg == "--model") {
+            if (!(v = value())) return false;
+            opts.model = v;
+        } else if (arg == "-s" || arg == "--script") {
+            if (!(v = value())) return false;
+            opts.script = v;
+        } else if (arg == "-d" || arg == "--draft") {
+            if (!(v = value())) return false;
+            opts.draft = v;
+        } else if (arg == "--draft-max") {
+            if (!(v = value())) return false;
+            opts.draft_max = std::atoi(v);
+        } else if (arg == "--lookup") {
+            if (!(v = value())) return false;
+            opts.lookup_max = std::atoi(v);
+        } else if (arg == "--kv") {
+            if (!(v = value())) return false;
+            opts.kv = v;
+        } else if (arg == "--mem-budget") {
+            if (!(v = value())) return false;
+            opts.mem_budget_mb = std::atol(v);
+        } else if (arg == "-o" || arg == "--out") {
+            if (!(v = value())) return false;
+            opts.out = v;
+        } else if (arg == "-t" || arg == "--threads") {
+            if (!(v = value())) return false;
+            opts.threads = std::atoi(v);
+        } else if (arg == "--decode-threads") {
+            if (!(v = value())) return false;
+            opts.decode_threads = std::max(0, std::atoi(v));
+        } else if (arg == "--batch-threads") {
+            if (!(v = value())) return false;
+            opts.batch_threads = std::max(0, std::atoi(v));
+        } else if (arg == "--calibrate") {
+            opts.calibrate = true;
+        } else if (arg == "-c" || arg == "--ctx") {
+            if (!(v = value())) return false;
+            opts.ctx = std::atoi(v);
+        } else if (arg == "--slots") {
+            if (!(v = value())) return false;
+            opts.slots = std::atoi(v);
+        } else if (arg == "-n" || arg == "--max-tokens") {
+            if (!(v = value())) return false;
+            opts.max_tokens = std::atoi(v);
+        } else if (arg == "--temp") {
+            if (!(v = value())) return false;
+            opts.temperature = static_cast<float>(std::atof(v));
+        } else if (arg == "--embed") {
+            opts.embed = true;
+        } else if (arg == "--embed-model") {
+            if (!(v = value())) return false;
+            opts.embed_model = v;
+        } else if (arg == "--aux") {
+            if (!(v = value())) return false;
+            opts.aux = std::clamp(std::atoi(v), 0, 16);
+        } else if (arg == "-v" || arg == "--verbose") {
+            opts.verbose = true;
+        } else {
+            std::fprintf(stderr, "unknown argument: %s\n", arg.c_str());
+            return false;
+        }
+    }
+    return !opts.model.empty() && !opts.script.empty();
+}
+
+// VmRSS and VmHWM from /proc/self/status, in KiB.
+void read_rss_kb(long & rss, long & peak) {
+    rss = 0;
+    peak = 0;
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind("VmRSS:", 0) == 0) {
+            rss = std::atol(line.c_str() + 6);
+        } else if (line.rfind("VmHWM:", 0) == 0) {
+            peak = std::atol(line.c_str() + 6);
+        }
+    }
+}
+
+std::string chatml_block(const std::string & role, const std::string & content) {
+    return "<|im_start|>" + role + "\n" + content + kStop + "\n";
+}
+
+json describe(std::vector<double> values) {
+    if (values.empty()) {
+        return json{{"mean", 0.0}, {"p50", 0.0}, {"p95", 0.0}, {"max", 0.0}};
+    }
+    std::sort(values.begin(), values.end());
+    double sum = 0.0;
+    for (double v : values) {
+        sum += v;
+    }
+    auto pct = [&](double p) {
+        return values[std::min(values.size() - 1, static_cast<size_t>(p * static_cast<double>(values.size() - 1) + 0.5))];
+    };
+    return json{{"mean", sum / static_cast<double>(values.size())},
+                {"p50", pct(0.50)},
+                {"p95", pct(0.95)},
+                {"max", values.back()}};
+}
+
+bool load_script(const std::string & path, json & script, std::vector<Chat> & chats) {
+    std::ifstream in(path);
+    if (!in) {
+        std::fprintf(stderr, "cannot open script %s\n", path.c_str());
+        return false;
+    }
+    script = json::parse(in, nullptr, false);
+    if (script.is_discarded() || !script.contains("chats") || !script["chats"].is_array()) {
+        std::fprintf(stderr, "script %s: expected an object with a \"chats\" array\n", path.c_str());
+        return false;
+    }
+    const std::string default_system = script.value("system", std::string());
+    int64_t next_id = 1;
+    for (const auto & entry : script["chats"]) {
+        Chat chat;
+        chat.id = entry.value("id", next_id);
+        next_id = chat.id + 1;
+        chat.system = entry.value("system", default_system);
+        for (const auto & turn : entry.value("turns", json::array())) {
+            if (turn.is_string()) {
+                chat.turns.push_back(turn.get<std::string>());
+            }
+        }
+        if (!chat.system.empty()) {
+            chat.transcript = chatml_block("system", chat.system);
+        }
+        chats.push_back(std::move(chat));
+    }
+    return !chats.empty();
+}
+
+void quiet_llama_log(ggml_log_level level, const char * text, void * data) {
+    (void) data;
+    if (level == GGML_LOG_LEVEL_ERROR) {
+        std::fputs(text, stderr);
+    }
+}
+
+} // namespace
+
+int main(int argc, char ** argv) {
+    Options opts;
+    if (!parse_args(argc, argv, opts)) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (!opts.verbose) {
+        peerchat::set_log_level(peerchat::LogLevel::Error);
+        llama_log_set(quiet_llama_log, nullptr);
+    }
+
+    json script;
+    std::vector<Chat> chats;
+    if (!load_script(opts.script, script, chats)) {
+        return 1;
+    }
+    const int max_tokens = opts.max_tokens > 0 ? opts.max_tokens : script.value("maxTokens", 128);
+    const float temperature = opts.temperature >= 0.0f ? opts.temperature : script.value("temperature", 0.0f);
+
+    peerchat::engine::init();
+    peerchat::EngineConfig config;
+    config.model_path = opts.model;
+    config.n_threads = std::max(1, opts.threads);
+    config.decode_threads = opts.decode_threads;
+    config.batch_threads = opts.batch_threads;
+    config.n_ctx = opts.ctx;
+    config.n_gpu_layers = 0;
+    config.use_vulkan = false;
+    config.session_slots = opts.slots > 0 ? opts.slots : std::min<int>(64, static_cast<int>(chats.size()));
+    config.draft_model_path = opts.draft;
+    config.draft_max = opts.draft_max;
+    config.lookup_max = opts.lookup_max;
+    config.kv_precision = peerchat::parse_kv_precision(opts.kv);
+    config.memory_budget_bytes = static_cast<int64_t>(opts.mem_budget_mb) * 1024 * 1024;
+
+    const auto probe_start = std::chrono::steady_clock::now();
+    const json model_meta = json::parse(peerchat::engine::detect_model(opts.model), nullptr, false);
+    const double probe_ms =
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - probe_start).count();
+
+    if (!opts.embed_model.empty()) {
+        peerchat::EmbedderConfig embedder;
+        embedder.model_path = opts.embed_model;
+        embedder.n_threads = std::max(1, opts.threads / 2);
+        if (!peerchat::engine::load_embedder(embedder)) {
+            std::fprintf(stderr, "failed to load embedder %s\n", opts.embed_model.c_str());
+            return 1;
+        }
+    }
+
+    const auto load_start = std::chrono::steady_clock::now();
+    if (!peerchat::engine::load(config)) {
+        std::fprintf(stderr, "failed to load %s\n", opts.model.c_str());
+        return 1;
+    }
+    const double load_ms =
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load_start).count();
+    long rss_loaded = 0;
+    long peak = 0;
+    read_rss_kb(rss_loaded, peak);
+    json calibration = nullptr;
+    if (opts.calibrate) {
+        peerchat::ThreadCalibration result;
+        if (peerchat::engine::calibrate_threads(result)) {
+            calibration = json::parse(peerchat::thread_calibration_json(result), nullptr, false);
+        } else {
+            std::fprintf(stderr, "thread calibration failed, keeping the default threads\n");
+        }
+    }
+    // The effective context and cache layout after precision fallback and budgeting.
+    const json loaded = json::parse(peerchat::engine::metrics_json(), nullptr, false);
+
+    // Dry-run prediction for the context just created, with the engine's CPU
+    // batch sizing, so the report can be checked against resident memory.
+    peerchat::MemoryPlanRequest plan_req;
+    plan_req.model_path = opts.model;
+    plan_req.n_ctx = loaded.value("nCtx", config.n_ctx);
+    plan_req.n_batch = std::min(512, plan_req.n_ctx / 8);
+    plan_req.n_ubatch = std::min(128, plan_req.n_batch / 4);
+    plan_req.n_seq = config.session_slots;
+    plan_req.type_k = peerchat::parse_kv_precision(loaded.value("kvType", std::string("f16")));
+    plan_req.type_v = plan_req.type_k;
+    peerchat::MemoryPlan plan;
+    const json plan_json = peerchat::plan_memory(plan_req, plan)
+        ? json::parse(peerchat::memory_plan_json(plan), nullptr, false)
+        : json::object();
+
+    json turns = json::array();
+    std::vector<double> prefill_ms;
+    std::vector<double> ttfs_ms;
+    std::vector<double> decode_tps;
+    long generated = 0;
+    long drafted = 0;
+    long accepted = 0;
+    long shifts = 0;
+    long evicted = 0;
+    long aux_tokens = 0;
+    double aux_ms = 0.0;
+    int failures = 0;
+
+    size_t max_turns = 0;
+    for (const auto & chat : chats) {
+        max_turns = std::max(max_turns, chat.turns.size());
+    }
+    for (size_t turn = 0; turn < max_turns; ++turn) {
+        for (auto & chat : chats) {
+            if (turn >= chat.turns.size()) {
+                continue;
+            }
+            const bool resident = peerchat::engine::session_select(chat.id);
+            const std::string & user = chat.turns[turn];
+
+            peerchat::GenerationRequest req;
+            req.prompt = chat.transcript + chatml_block("user", user) + "<|im_start|>assistant\n";
+            req.keep_bytes = chat.system.empty() ? 0 : chatml_block("system", chat.system).size();
+            req.temperature = temperature;
+            req.max_tokens = max_tokens;
+            req.stops = {kStop};
+
+            // Side requests the app would issue next to the reply; they share its decodes.
+            std::vector<peerchat::GenerationSummary> aux(static_cast<size_t>(opts.aux));
+            std::vector<std::thread> aux_threads;
+            const auto aux_start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < aux.size(); ++i) {
+                aux_threads.emplace_back([&, i] {
+                    peerchat::GenerationRequest title;
+                    title.prompt = chatml_block("user", "Suggest title " + std::to_string(i + 1) +
+                                                        " for a chat that starts: " + user) +
+                                   "<|im_start|>assistant\n";
+                    title.temperature = temperature;
+                    title.max_tokens = max_tokens;
+                    title.stops = {kStop};
+                    title.auxiliary = true;
+                    peerchat::engine::generate(title, nullptr, nullptr, aux[i]);
+                });
+            }
+
+            std::string reply;
+            peerchat::GenerationSummary summary;
+            const bool ok = peerchat::engine::generate(req, nullptr, &reply, summary);
+            long turn_aux_tokens = 0;
+            for (auto & thread : aux_threads) {
+                thread.join();
+            }
+            const double turn_aux_ms = aux.empty() ? 0.0 :
+                std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - aux_start).count();
+            for (const auto & a : aux) {
+                turn_aux_tokens += a.metrics.generation_tokens;
+            }
+            aux_tokens += turn_aux_tokens;
+            aux_ms += turn_aux_ms;
+            long rss = 0;
+            read_rss_kb(rss, peak);
+
+            const peerchat::EngineMetrics & m = summary.metrics;
+            turns.push_back(json{
+                {"chat", chat.id},
+                {"turn", turn},
+                {"resident", resident},
+                {"promptTokens", m.prompt_tokens},
+                {"reusedTokens", m.reused_tokens},
+                {"prefilledTokens", m.prefilled_tokens},
+                {"prefillMs", m.prefill_ms},
+                {"ttfsMs", m.ttfs_ms},
+                {"generationTokens", m.generation_tokens},
+                {"decodeMs", m.decode_ms},
+                {"decodeTps", m.tps},
+                {"tokensPerDecode", m.tokens_per_decode},
+                {"acceptanceRate", m.acceptance_rate},
+                {"contextShifts", m.context_shifts},
+                {"evictedTokens", m.evicted_tokens},
+                {"stopReason", peerchat::stop_reason_name(summary.reason)},
+                {"auxTokens", turn_aux_tokens},
+                {"auxMs", turn_aux_ms},
+                {"rssKb", rss},
+            });
+            if (!ok) {
+                ++failures;
+                continue;
+            }
+            prefill_ms.push_back(m.prefill_ms);
+            ttfs_ms.push_back(m.ttfs_ms);
+            if (m.generation_tokens > 0) {
+                decode_tps.push_back(m.tps);
+            }
+            generated += m.generation_tokens;
+            drafted += m.drafted_tokens;
+            accepted += m.accepted_tokens;
+            shifts += m.context_shifts;
+            evicted += m.evicted_tokens;
+            chat.transcript = req.prompt + reply + kStop + "\n";
+        }
+    }
+
+    json report{
+        {"model", opts.model},
+        {"threads", config.n_threads},
+        {"decodeThreads", loaded.value("nThreadsDecode", config.n_threads)},
+        {"batchThreads", loaded.value("nThreads", config.n_threads)},
+        {"calibration", calibration},
+        {"nCtx", loaded.value("nCtx", config.n_ctx)},
+        {"kvType", loaded.value("kvType", std::string(opts.kv))},
+        {"kvBytesPerToken", loaded.value("kvBytesPerToken", 0L)},
+        {"kvCacheBytes", loaded.value("kvCacheBytes", 0L)},
+        {"memoryBudgetBytes", config.memory_budget_bytes},
+        {"sessionSlots", config.session_slots},
+        {"draft", opts.draft},
+        {"embedModel", opts.embed_model},
+        {"lookup", opts.lookup_max},
+        {"aux", opts.aux},
+        {"maxTokens", max_tokens},
+        {"temperature", temperature},
+        {"probeMs", probe_ms},
+        {"plan", plan_json},
+        {"weightBytes", model_meta.is_object() ? model_meta.value("weightBytes", 0L) : 0L},
+        {"loadMs", load_ms},
+        {"rssAfterLoadKb", rss_loaded},
+        {"turns", turns},
+    };
+
+    if (opts.embed) {
+        std::vector<std::string> texts;
+        for (const auto & chat : chats) {
+            texts.insert(texts.end(), chat.turns.begin(), chat.turns.end());
+        }
+        std::vector<std::vector<float>> vectors;
+        const auto embed_start = std::chrono::steady_clock::now();
+        const bool ok = peerchat::engine::embed(texts, vectors);
+        const double embed_ms =
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - embed_start).count();
+        report["embedding"] = json{{"texts", texts.size()},
+                                   {"ok", ok},
+                                   {"dim", ok && !vectors.empty() ? vectors.front().size() : 0},
+                                   {"ms", embed_ms}};
+    }
+
+    long rss_end = 0;
+    read_rss_kb(rss_end, peak);
+    report["summary"] = json{
+        {"turns", turns.size()},
+        {"failures", failures},
+        {"generatedTokens", generated},
+        {"prefillMs", describe(prefill_ms)},
+        {"ttfsMs", describe(ttfs_ms)},
+        {"decodeTps", describe(decode_tps)},
+        {"draftedTokens", drafted},
+        {"acceptanceRate", drafted > 0 ? static_cast<double>(accepted) / static_cast<double>(drafted) : 0.0},
+        {"contextShifts", shifts},
+        {"evictedTokens", evicted},
+        {"auxTokens", aux_tokens},
+        // Reply and auxiliary tokens together per second of wall time the turns took.
+        {"auxAggregateTps", aux_ms > 0.0 ? (generated + aux_tokens) * 1000.0 / aux_ms : 0.0},
+        {"rssKb", rss_end},
+        {"peakRssKb", peak},
+    };
+
+    peerchat::engine::unload();
+
+    const std::string text = report.dump(2);
+    if (opts.out.empty()) {
+        std::cout << text << std::endl;
+    } else {
+        std::ofstream out(opts.out);
+        out << text << std::endl;
+        if (!out) {
+            std::fprintf(stderr, "cannot write %s\n", opts.out.c_str());
+            return 1;
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
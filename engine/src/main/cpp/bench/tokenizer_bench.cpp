@@ -0,0 +1,336 @@
+// peerchat-tokenizer-bench: checks and times the pre-tokenizer splitters of
+// llama/src/unicode.cpp on a host CPU.
+//
+//   peerchat-tokenizer-bench --fuzz N [--seed S]
+//   peerchat-tokenizer-bench [-f text.txt] [-m vocab.gguf] [-r repeats]
+//
+// --fuzz splits N random texts with the expressions of every BPE pre-tokenizer,
+// once with the hand-written splitters and once through std::regex, and fails
+// on the first text where the words differ. Otherwise it reports the split
+// rate of both paths in MB/s on the text (a generated multilingual document by
+// default), and with -m the rate of full llama_tokenize calls for that vocabulary.
+
+#include "llama.h"
+#include "llama-vocab.h"
+#include "unicode.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+struct Options {
+    int fuzz = 0;
+    uint32_t seed = 1;
+    std::string text_path;
+    std::string model;
+    int repeats = 3;
+};
+
+struct PreTokenizer {
+    std::string name;
+    std::vector<std::string> regex_exprs;
+};
+
+// The expressions llm_tokenizer_bpe uses, taken from llama-vocab.cpp, one entry
+// per distinct set, named after the first pre-tokenizer type using it. Kimi-K2
+// has no std::regex equivalent and is left out.
+const std::vector<PreTokenizer> & pre_tokenizers() {
+    static const std::vector<PreTokenizer> table = [] {
+        std::vector<PreTokenizer> sets;
+        for (int type = LLAMA_VOCAB_PRE_TYPE_DEFAULT; type <= LLAMA_VOCAB_PRE_TYPE_GRANITE_DOCLING; ++type) {
+            if (type == LLAMA_VOCAB_PRE_TYPE_KIMI_K2) {
+                continue;
+            }
+            auto regex_exprs = llama_vocab_pre_regex_exprs(static_cast<llama_vocab_pre_type>(type));
+            const bool seen = std::any_of(sets.begin(), sets.end(),
+                                          [&](const PreTokenizer & pre) { return pre.regex_exprs == regex_exprs; });
+            if (!seen) {
+                sets.push_back({ "pre-type " + std::to_string(type), std::move(regex_exprs) });
+            }
+        }
+        return sets;
+    }();
+    return table;
+}
+
+// Runs of codepoints the fuzzer strings together: every class the expressions
+// tell apart, plus the literal sequences some of them look for.
+const std::vector<std::vector<uint32_t>> & fuzz_alphabets() {
+    static const std::vector<std::vector<uint32_t>> alphabets = {
+        { 'a', 'b', 'e', 'z', 's', 't', 'm', 'd', 'l', 'v', 'r' },
+        { 'A', 'B', 'E', 'Z', 'S', 'T', 'M', 'D', 'L', 'V', 'R' },
+        { '0', '1', '5', '9' },
+        { ' ', ' ', ' ', '\t', '\n', '\r', '\v', '\f' },
+        { '!', '"', '#', '$', '%', '&', '\'', '(', ')', '*', '+', ',', '-', '.', '/', ':', ';', '<', '=', '>', '?', '@',
+          '[', '\\', ']', '^', '_', '`', '{', '|', '}', '~' },
+        { '\'' },
+        { 0x01, 0x1C, 0x1F, 0x7F },
+        { 0x00B5, 0x00C0, 0x00D7, 0x00E9, 0x00F8, 0x0131, 0x01BB, 0x01C5, 0x02B0, 0x0300, 0x0301, 0x0345 },
+        { 0x0391, 0x03B1, 0x03C9, 0x0410, 0x0436, 0x0531, 0x10A0, 0x13A0, 0x1E00, 0x1F08, 0x2126, 0x212A, 0x1E900 },
+        { 0x00A0, 0x0085, 0x1680, 0x2000, 0x2028, 0x2029, 0x202F, 0x3000 },
+        { 0x00A7, 0x00B2, 0x00BD, 0x0660, 0x0966, 0x2160, 0xFF10 },
+        { 0x2018, 0x201C, 0x201F, 0x2026, 0x3001, 0x3002, 0xFF01, 0xFF0C, 0xFF1A, 0xFF5E, 0x0964, 0x06D4, 0x060C },
+        { 0x00A2, 0x00A9, 0x00B0, 0x2190, 0x20AC, 0x1F600, 0x1F44D, 0x2764 },
+        { 0x4E00, 0x4E2D, 0x6587, 0x9FA5, 0x9FCC, 0x3042, 0x30A2, 0x30FC, 0x0800, 0xAC00, 0xD55C, 0xD7FF },
+        { 0x0627, 0x0644, 0x0915, 0x093E, 0x0E01, 0x0E31, 0x05D0 },
+        { 0x0378, 0xE000, 0xFFFF, 0x10FFFF },
+    };
+    return alphabets;
+}
+
+const std::vector<std::string> & fuzz_literals() {
+    static const std::vector<std::string> literals = {
+        "'s", "'T", "'re", "'VE", "'ll", "'D", "IMGIMG", "IMGIMGABZ", "IMGIMGABCDEZ", "<sentinel:", "<sentinel:12>",
+        "    ", "  ", "\r\n", " \n ", "1234567", "123",
+    };
+    return literals;
+}
+
+std::string random_text(std::mt19937 & rng) {
+    const auto & alphabets = fuzz_alphabets();
+    const auto & literals = fuzz_literals();
+    std::string text;
+    const int runs = std::uniform_int_distribution<int>(0, 24)(rng);
+    for (int r = 0; r < runs; ++r) {
+        if (rng() % 8 == 0) {
+            text += literals[rng() % literals.size()];
+            continue;
+        }
+        const auto & alphabet = alphabets[rng() % alphabets.size()];
+        const int length = std::uniform_int_distribution<int>(1, 5)(rng);
+        for (int i = 0; i < length; ++i) {
+            text += unicode_cpt_to_utf8(alphabet[rng() % alphabet.size()]);
+        }
+    }
+    return text;
+}
+
+std::string escaped(const std::string & text) {
+    std::string out;
+    for (const unsigned char c : text) {
+        if (c < 0x20 || c == 0x7F || c == '\\') {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\x%02X", c);
+            out += buf;
+        } else {
+            out += static_cast<char>(c);
+        }
+    }
+    return out;
+}
+
+// Checks the set and every expression of it alone; reports the first difference.
+bool compare(const PreTokenizer & pre, const std::string & text) {
+    std::vector<std::vector<std::string>> sets = { pre.regex_exprs };
+    if (pre.regex_exprs.size() > 1) {
+        for (const auto & regex_expr : pre.regex_exprs) {
+            sets.push_back({ regex_expr });
+        }
+    }
+    for (const auto & regex_exprs : sets) {
+        const auto custom = unicode_regex_split(text, regex_exprs, true);
+        const auto reference = unicode_regex_split(text, regex_exprs, false);
+        if (custom == reference) {
+            continue;
+        }
+        std::fprintf(stderr, "mismatch: %s, %s\n  text: \"%s\"\n", pre.name.c_str(),
+                     regex_exprs.size() > 1 ? "all expressions" : regex_exprs[0].c_str(), escaped(text).c_str());
+        auto print = [](const char * label, const std::vector<std::string> & words) {
+            std::fprintf(stderr, "  %s:", label);
+            for (const auto & word : words) {
+                std::fprintf(stderr, " [%s]", escaped(word).c_str());
+            }
+            std::fprintf(stderr, "\n");
+        };
+        print("custom", custom);
+        print("regex ", reference);
+        return false;
+    }
+    return true;
+}
+
+int run_fuzz(const Options & opts) {
+    std::mt19937 rng(opts.seed);
+    for (int i = 0; i < opts.fuzz; ++i) {
+        const std::string text = random_text(rng);
+        for (const auto & pre : pre_tokenizers()) {
+            if (!compare(pre, text)) {
+                return 1;
+            }
+        }
+    }
+    std::printf("fuzz: %d texts x %zu pre-tokenizers, no differences\n", opts.fuzz, pre_tokenizers().size());
+    return 0;
+}
+
+// About a megabyte of prose, code and CJK in the proportions of a mixed chat history.
+std::string generated_document() {
+    static const char * const paragraphs[] = {
+        "The quick brown fox doesn't jump over the lazy dog; it's 2024 and they've 3,141 reasons (at least) to rest.\n\n",
+        "    for (int i = 0; i < n; ++i) {\n        total += values[i] * 0.5f; // accumulate\n    }\n",
+        "Résumé: naïve café owners in Zürich paid €12.50 — “too much”, they said…\n",
+        "機械学習モデルは大量のデータから学習します。这是一个测试句子，包含中文标点。한국어 문장도 있습니다.\n",
+        "Γειά σου κόσμε! Привет, мир: 1234567 строк; مرحبا بالعالم। नमस्ते दुनिया।\n",
+        "JSON: {\"id\": 42, \"tags\": [\"a\", \"b\"], \"ok\": true}\t\r\n",
+    };
+    std::string doc;
+    for (size_t i = 0; doc.size() < (1u << 20); ++i) {
+        doc += paragraphs[(i * 7) % (sizeof(paragraphs) / sizeof(paragraphs[0]))];
+    }
+    return doc;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Best of `repeats` rates of fn over text, in MB/s.
+template <typename Fn>
+double best_rate(const std::string & text, int repeats, Fn && fn) {
+    double best = 0.0;
+    for (int r = 0; r < repeats; ++r) {
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        best = std::max(best, static_cast<double>(text.size()) / 1e6 / seconds_since(start));
+    }
+    return best;
+}
+
+// Splits line by line, as the tokenizer sees text between special tokens.
+std::vector<std::string> lines_of(const std::string & text) {
+    std::vector<std::string> lines;
+    std::istringstream in(text);
+    std::string line;
+    while (std::getline(in, line)) {
+        lines.push_back(line + "\n");
+    }
+    return lines;
+}
+
+int run_bench(const Options & opts) {
+    std::string text;
+    if (opts.text_path.empty()) {
+        text = generated_document();
+    } else {
+        std::ifstream in(opts.text_path, std::ios::binary);
+        if (!in) {
+            std::fprintf(stderr, "cannot read %s\n", opts.text_path.c_str());
+            return 1;
+        }
+        text.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    const auto lines = lines_of(text);
+    std::printf("text: %.2f MB in %zu lines\n", static_cast<double>(text.size()) / 1e6, lines.size());
+    std::printf("%-16s %12s %12s %8s\n", "pre-tokenizer", "custom MB/s", "regex MB/s", "speedup");
+    for (const auto & pre : pre_tokenizers()) {
+        auto split_all = [&](bool use_custom) {
+            return [&, use_custom]() {
+                for (const auto & line : lines) {
+                    unicode_regex_split(line, pre.regex_exprs, use_custom);
+                }
+            };
+        };
+        const double custom = best_rate(text, opts.repeats, split_all(true));
+        const double reference = best_rate(text, 1, split_all(false));
+        std::printf("%-16s %12.2f %12.2f %7.1fx\n", pre.name.c_str(), custom, reference, custom / reference);
+    }
+
+    if (opts.model.empty()) {
+        return 0;
+    }
+    llama_model_params params = llama_model_default_params();
+    params.vocab_only = true;
+    llama_model * model = llama_model_load_from_file(opts.model.c_str(), params);
+    if (!model) {
+        std::fprintf(stderr, "cannot load %s\n", opts.model.c_str());
+        return 1;
+    }
+    const llama_vocab * vocab = llama_model_get_vocab(model);
+    std::vector<llama_token> tokens;
+    size_t n_tokens = 0;
+    const double rate = best_rate(text, opts.repeats, [&]() {
+        n_tokens = 0;
+        for (const auto & line : lines) {
+            tokens.resize(line.size() + 8);
+            const int32_t n = llama_tokenize(vocab, line.data(), static_cast<int32_t>(line.size()), tokens.data(),
+                                             static_cast<int32_t>(tokens.size()), false, false);
+            n_tokens += static_cast<size_t>(std::max(n, 0));
+        }
+    });
+    std::printf("llama_tokenize: %.2f MB/s, %zu tokens\n", rate, n_tokens);
+    llama_model_free(model);
+    return 0;
+}
+
+void usage(const char * argv0) {
+    std::fprintf(stderr,
+                 "usage: %s [options]\n"
+                 "      --fuzz N           compare the splitters with std::regex on N random texts\n"
+                 "      --seed S           fuzz seed (default 1)\n"
+                 "  -f, --file PATH        text to time instead of the generated document\n"
+                 "  -m, --model PATH       also time llama_tokenize with this model's vocabulary\n"
+                 "  -r, --repeats N        timed passes, best kept (default 3)\n",
+                 argv0);
+}
+
+bool parse_args(int argc, char ** argv, Options & opts) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        auto value = [&]() -> const char * {
+            if (i + 1 >= argc) {
+                std::fprintf(stderr, "missing value for %s\n", arg.c_str());
+                return nullptr;
+            }
+            return argv[++i];
+        };
+        const char * v = nullptr;
+        if (arg == "--fuzz") {
+            if (!(v = value())) return false;
+            opts.fuzz = std::atoi(v);
+        } else if (arg == "--seed") {
+            if (!(v = value())) return false;
+            opts.seed = static_cast<uint32_t>(std::strtoul(v, nullptr, 10));
+        } else if (arg == "-f" || arg == "--file") {
+            if (!(v = value())) return false;
+            opts.text_path = v;
+        } else if (arg == "-m" || arg == "--model") {
+            if (!(v = value())) return false;
+            opts.model = v;
+        } else if (arg == "-r" || arg == "--repeats") {
+            if (!(v = value())) return false;
+            opts.repeats = std::max(1, std::atoi(v));
+        } else {
+            std::fprintf(stderr, "unknown argument: %s\n", arg.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+void quiet_llama_log(ggml_log_level level, const char * text, void *) {
+    if (level == GGML_LOG_LEVEL_ERROR) {
+        std::fputs(text, stderr);
+    }
+}
+
+} // namespace
+
+int main(int argc, char ** argv) {
+    Options opts;
+    if (!parse_args(argc, argv, opts)) {
+        usage(argv[0]);
+        return 2;
+    }
+    llama_log_set(quiet_llama_log, nullptr);
+    return opts.fuzz > 0 ? run_fuzz(opts) : run_bench(opts);
+}
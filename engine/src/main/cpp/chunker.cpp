@@ -0,0 +1,247 @@
+#include "chunker.h"
+
+#include <algorithm>
+#include <string>
+
+namespace peerchat {
+
+namespace {
+
+// How far past the cursor a piece that does not match in place is looked for.
+constexpr size_t kAlignWindow = 16;
+// Whitespace runs longer than this around a boundary are not measured further.
+constexpr size_t kMaxRunScan = 64;
+
+bool is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+
+char fold(char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+struct Mark {
+    std::string_view text;
+    uint8_t score;
+    // Full-width CJK marks end a sentence or clause without a following space.
+    bool unspaced;
+};
+
+// Punctuation scored as in break_score: Latin, CJK, Devanagari and Arabic.
+constexpr Mark kMarks[] = {
+    {".", 4, false}, {"!", 4, false}, {"?", 4, false}, {"\u0964", 4, false}, {"\u061F", 4, false},
+    {"\u3002", 4, true}, {"\uFF01", 4, true}, {"\uFF1F", 4, true}, {"\uFF0E", 4, true},
+    {";", 3, false}, {":", 3, false}, {"\uFF1B", 3, true}, {"\uFF1A", 3, true},
+    {",", 2, false}, {"-", 2, false}, {"\u060C", 2, false}, {"\uFF0C", 2, true}, {"\u3001", 2, true},
+};
+
+// Closing quotes and brackets after the punctuation belong to the sentence.
+constexpr std::string_view kClosers[] = {
+    "\"", "'", ")", "]", "\u201D", "\u2019", "\u300D", "\u300F", "\uFF09", "\u300B",
+};
+
+bool ends_with(std::string_view text, size_t at, std::string_view suffix) {
+    return at >= suffix.size() && text.compare(at - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Score of the punctuation ending at byte `at`, past any closers; 0 for none.
+// Without a following space only the full-width marks count, so "3.14" or
+// "e.g" never break.
+uint8_t mark_score(std::string_view text, size_t at, bool spaced) {
+    for (bool skipped = true; skipped;) {
+        skipped = false;
+        for (const std::string_view closer : kClosers) {
+            if (ends_with(text, at, closer)) {
+                at -= closer.size();
+                skipped = true;
+                break;
+            }
+        }
+    }
+    for (const Mark & mark : kMarks) {
+        if ((spaced || mark.unspaced) && ends_with(text, at, mark.text)) {
+            return mark.score;
+        }
+    }
+    return 0;
+}
+
+bool equals_folded(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (fold(a[i]) != fold(b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// How good a chunk end the byte offset `at` is:
+// 6 end of text, 5 paragraph, 4 sentence or line end, 3 clause, 2 comma or
+// dash, 1 word, 0 inside a word. Scripts written without spaces (CJK) only
+// break after their full-width punctuation.
+uint8_t break_score(std::string_view text, size_t at) {
+    const size_t n = text.size();
+    if (at >= n) {
+        return 6;
+    }
+    size_t run_start = at;
+    while (run_start > 0 && at - run_start < kMaxRunScan && is_space(text[run_start - 1])) {
+        --run_start;
+    }
+    size_t run_end = at;
+    while (run_end < n && run_end - at < kMaxRunScan && is_space(text[run_end])) {
+        ++run_end;
+    }
+    if (run_start == run_end) {
+        return mark_score(text, at, false);
+    }
+    int newlines = 0;
+    for (size_t i = run_start; i < run_end; ++i) {
+        newlines += text[i] == '\n';
+    }
+    if (newlines >= 2) {
+        return 5;
+    }
+    if (newlines == 1) {
+        return 4;
+    }
+    return std::max<uint8_t>(1, mark_score(text, run_start, true));
+}
+
+} // namespace
+
+std::vector<uint32_t> align_token_starts(std::string_view text, std::string_view pieces,
+                                         const std::vector<uint32_t> & piece_lengths) {
+    std::vector<uint32_t> starts;
+    starts.reserve(piece_lengths.size());
+    const size_t n = text.size();
+    size_t cursor = 0;
+    size_t offset = 0;
+    for (const uint32_t length : piece_lengths) {
+        std::string_view piece = pieces.substr(std::min(offset, pieces.size()), length);
+        offset += length;
+        starts.push_back(static_cast<uint32_t>(cursor));
+        if (piece.empty()) {
+            continue;
+        }
+        if (text.compare(cursor, piece.size(), piece) == 0) {
+            cursor += piece.size();
+            continue;
+        }
+        // A space the tokenizer put in front of a word that has none here
+        // (first word, word after a newline) or case the tokenizer folded.
+        if (piece.front() == ' ' && piece.size() > 1) {
+            piece.remove_prefix(1);
+        }
+        size_t found = std::string_view::npos;
+        const size_t last = std::min(n, cursor + kAlignWindow);
+        for (size_t at = cursor; at <= last && at + piece.size() <= n; ++at) {
+            if (equals_folded(text.substr(at, piece.size()), piece)) {
+                found = at;
+                break;
+            }
+        }
+        cursor = found != std::string_view::npos ? found + piece.size() : std::min(n, cursor + piece.size());
+    }
+    return starts;
+}
+
+std::vector<ChunkSpan> chunk_tokens(std::string_view text, const std::vector<uint32_t> & token_starts,
+                                    const ChunkOptions & options) {
+    std::vector<ChunkSpan> chunks;
+    const size_t n_tokens = token_starts.size();
+    if (n_tokens == 0) {
+        return chunks;
+    }
+    const size_t max_tokens = static_cast<size_t>(std::max(1, options.max_tokens));
+    const size_t overlap = static_cast<size_t>(std::clamp(options.overlap_tokens, 0, options.max_tokens - 1));
+
+    // Boundary i is the start of token i; boundary n_tokens is the end of the text.
+    auto byte_at = [&](size_t boundary) {
+        return boundary == 0 ? size_t{0} : (boundary >= n_tokens ? text.size() : token_starts[boundary]);
+    };
+    std::vector<uint8_t> scores(n_tokens + 1);
+    for (size_t i = 0; i <= n_tokens; ++i) {
+        scores[i] = break_score(text, byte_at(i));
+    }
+
+    size_t first = 0;
+    while (first < n_tokens) {
+        size_t end = n_tokens;
+        if (n_tokens - first > max_tokens) {
+            // The best break in the back half of the budget, the latest among equals.
+            const size_t hi = first + max_tokens;
+            const size_t lo = first + std::max<size_t>(1, max_tokens / 2);
+            end = hi;
+            for (size_t i = hi; i > lo; --i) {
+                if (scores[i - 1] > scores[end]) {
+                    end = i - 1;
+                }
+            }
+        }
+        chunks.push_back(ChunkSpan{byte_at(first), byte_at(end), static_cast<int32_t>(end - first)});
+        if (end >= n_tokens) {
+            break;
+        }
+        size_t next = end - std::min(overlap, end - first - 1);
+        // Start the overlap on a word rather than inside one, giving up at
+        // most half of it; text without breaks keeps the token boundary.
+        const size_t limit = next + (end - next) / 2;
+        size_t word = next;
+        while (word < limit && scores[word] == 0) {
+            ++word;
+        }
+        if (word < limit) {
+            next = word;
+        }
+        first = std::max(next, first + 1);
+    }
+    return chunks;
+}
+
+bool chunk_document(const llama_vocab * vocab, std::string_view text, const ChunkOptions & options,
+                    std::vector<ChunkSpan> & out) {
+    out.clear();
+    // The document's own tokens: no BOS, and markup in it is text, not control tokens.
+    std::vector<llama_token> tokens(text.size() + 8);
+    int32_t n = llama_tokenize(vocab, text.data(), static_cast<int32_t>(text.size()), tokens.data(),
+                               static_cast<int32_t>(tokens.size()), /*add_special=*/false, /*parse_special=*/false);
+    if (n < 0) {
+        tokens.resize(static_cast<size_t>(-n));
+        n = llama_tokenize(vocab, text.data(), static_cast<int32_t>(text.size()), tokens.data(),
+                           static_cast<int32_t>(tokens.size()), false, false);
+    }
+    if (n < 0) {
+        return false;
+    }
+    tokens.resize(static_cast<size_t>(n));
+
+    std::string pieces;
+    pieces.reserve(text.size() + tokens.size());
+    std::vector<uint32_t> lengths;
+    lengths.reserve(tokens.size());
+    char buffer[256];
+    for (const llama_token token : tokens) {
+        int32_t written = llama_token_to_piece(vocab, token, buffer, static_cast<int32_t>(sizeof(buffer)), 0, false);
+        if (written < 0) {
+            const size_t at = pieces.size();
+            pieces.resize(at + static_cast<size_t>(-written));
+            written = llama_token_to_piece(vocab, token, pieces.data() + at, -written, 0, false);
+            pieces.resize(at + static_cast<size_t>(std::max(written, 0)));
+        } else {
+            pieces.append(buffer, static_cast<size_t>(written));
+        }
+        lengths.push_back(static_cast<uint32_t>(std::max(written, 0)));
+    }
+    // Tokenized on its own, a chunk can take one token more at its edges (a
+    // leading-space prefix) than its share of the document did.
+    ChunkOptions budget = options;
+    budget.max_tokens = std::max(1, options.max_tokens - 1);
+    out = chunk_tokens(text, align_token_starts(text, pieces, lengths), budget);
+    return true;
+}
+
+} // namespace peerchat
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "llama.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace peerchat {
+
+// Token-budgeted document chunking over a single tokenization: the document is
+// tokenized once, every token is mapped back to the byte where it starts, and
+// chunk boundaries are picked among token starts by how natural a break they
+// are (paragraph, sentence, clause, word). Linear in the document size.
+
+struct ChunkOptions {
+    int32_t max_tokens = 512;
+    // Tokens the next chunk repeats from the end of the previous one, moved
+    // forward to the next word boundary.
+    int32_t overlap_tokens = 64;
+};
+
+// Byte range [start, end) of the text and the tokens starting inside it.
+struct ChunkSpan {
+    size_t start = 0;
+    size_t end = 0;
+    int32_t tokens = 0;
+};
+
+// Start byte of each token, given the tokens' rendered text laid end to end
+// in `pieces` with their lengths in `piece_lengths`. Tokenizers may add a
+// leading space or fold case, so a piece that does not match at the cursor is
+// searched for a little further on before the cursor just advances by its
+// length. The result is non-decreasing and never past the end of `text`.
+std::vector<uint32_t> align_token_starts(std::string_view text, std::string_view pieces,
+                                         const std::vector<uint32_t> & piece_lengths);
+
+// Splits the text into chunks of at most max_tokens tokens, each ending at the
+// best break in the back half of its budget. `token_starts` comes from
+// align_token_starts.
+std::vector<ChunkSpan> chunk_tokens(std::string_view text, const std::vector<uint32_t> & token_starts,
+                                    const ChunkOptions & options);
+
+// Tokenizes the document once with `vocab` (no BOS, markup as plain text),
+// aligns the tokens and chunks it. One token of max_tokens is kept back, as a
+// chunk tokenized on its own can gain one at its edges. False if the text
+// does not tokenize.
+bool chunk_document(const llama_vocab * vocab, std::string_view text, const ChunkOptions & options,
+                    std::vector<ChunkSpan> & out);
+
+} // namespace peerchat
@@ -0,0 +1,209 @@
+#include "cpu_topology.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace peerchat {
+
+namespace {
+
+bool read_line(const std::string & path, std::string & line) {
+    std::ifstream in(path);
+    return static_cast<bool>(std::getline(in, line));
+}
+
+bool read_int(const std::string & path, int64_t & value) {
+    std::ifstream in(path);
+    return static_cast<bool>(in >> value);
+}
+
+// "0-3,5,7-8" -> {0, 1, 2, 3, 5, 7, 8}
+std::vector<int> parse_cpu_list(const std::string & list) {
+    std::vector<int> ids;
+    std::istringstream in(list);
+    std::string range;
+    while (std::getline(in, range, ',')) {
+        const size_t dash = range.find('-');
+        try {
+            const int first = std::stoi(range.substr(0, dash));
+            const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int id = first; id <= last; ++id) {
+                ids.push_back(id);
+            }
+        } catch (const std::exception &) {
+            return {};
+        }
+    }
+    return ids;
+}
+
+// Capacities from one source for every core, so they compare; false if any core lacks it.
+bool read_capacities(const std::string & cpu_dir, const char * file, std::vector<CpuCore> & cores) {
+    for (CpuCore & core : cores) {
+        if (!read_int(cpu_dir + "/cpu" + std::to_string(core.id) + "/" + file, core.capacity) || core.capacity <= 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int clamp_threads(const CpuTopology & topology, int n_threads) {
+    const int n_cores = topology.cores.empty() ? GGML_MAX_N_THREADS : static_cast<int>(topology.cores.size());
+    return std::clamp(n_threads, 1, n_cores);
+}
+
+} // namespace
+
+CpuTopology detect_cpu_topology(const std::string & cpu_dir) {
+    CpuTopology topology;
+    std::string online;
+    std::vector<int> ids;
+    if (read_line(cpu_dir + "/online", online)) {
+        ids = parse_cpu_list(online);
+    }
+    if (ids.empty()) {
+        for (unsigned id = 0; id < std::max(1u, std::thread::hardware_concurrency()); ++id) {
+            ids.push_back(static_cast<int>(id));
+        }
+    }
+    for (const int id : ids) {
+        // The core mask ggml takes is indexed by core id.
+        if (id >= 0 && id < GGML_MAX_N_THREADS) {
+            topology.cores.push_back(CpuCore{id, 1});
+        }
+    }
+    if (!read_capacities(cpu_dir, "cpu_capacity", topology.cores) &&
+        !read_capacities(cpu_dir, "cpufreq/cpuinfo_max_freq", topology.cores)) {
+        for (CpuCore & core : topology.cores) {
+            core.capacity = 1;
+        }
+    }
+    std::stable_sort(topology.cores.begin(), topology.cores.end(), [](const CpuCore & a, const CpuCore & b) {
+        return a.capacity > b.capacity;
+    });
+    const int64_t slowest = topology.cores.empty() ? 0 : topology.cores.back().capacity;
+    topology.n_performance = static_cast<int>(std::count_if(topology.cores.begin(), topology.cores.end(),
+                                                             [&](const CpuCore & core) { return core.capacity > slowest; }));
+    if (topology.n_performance == 0) {
+        topology.n_performance = static_cast<int>(topology.cores.size());
+    }
+    return topology;
+}
+
+int default_decode_threads(const CpuTopology & topology, int max_threads) {
+    return clamp_threads(topology, std::min(std::max(1, topology.n_performance), max_threads));
+}
+
+int default_batch_threads(const CpuTopology & topology, int max_threads) {
+    return clamp_threads(topology, max_threads);
+}
+
+ThreadPoolPlan decode_pool_plan(const CpuTopology & topology, int n_threads) {
+    ThreadPoolPlan plan;
+    plan.n_threads = clamp_threads(topology, n_threads);
+    plan.strict_cpu = !topology.cores.empty();
+    plan.poll = 50;
+    return plan;
+}
+
+ThreadPoolPlan batch_pool_plan(const CpuTopology & topology, int n_threads) {
+    ThreadPoolPlan plan;
+    plan.n_threads = clamp_threads(topology, n_threads);
+    plan.strict_cpu = false;
+    plan.poll = 0;
+    return plan;
+}
+
+ggml_threadpool_params threadpool_params(const CpuTopology & topology, const ThreadPoolPlan & plan) {
+    ggml_threadpool_params params = ggml_threadpool_params_default(plan.n_threads);
+    params.strict_cpu = plan.strict_cpu;
+    params.poll = plan.poll;
+    const size_t n_masked = std::min(topology.cores.size(), static_cast<size_t>(plan.n_threads));
+    for (size_t i = 0; i < n_masked; ++i) {
+        params.cpumask[topology.cores[i].id] = true;
+    }
+    return params;
+}
+
+int pool_leader_core(const CpuTopology & topology, const ThreadPoolPlan & plan) {
+    if (!plan.strict_cpu || topology.cores.empty()) {
+        return -1;
+    }
+    const size_t n_masked = std::min(topology.cores.size(), static_cast<size_t>(plan.n_threads));
+    int leader = topology.cores[0].id;
+    for (size_t i = 1; i < n_masked; ++i) {
+        leader = std::min(leader, topology.cores[i].id);
+    }
+    return leader;
+}
+
+#if defined(__linux__)
+
+ThreadAffinityGuard::ThreadAffinityGuard() {
+    CPU_ZERO(&saved_);
+    valid_ = sched_getaffinity(0, sizeof(saved_), &saved_) == 0;
+}
+
+ThreadAffinityGuard::~ThreadAffinityGuard() {
+    if (valid_) {
+        sched_setaffinity(0, sizeof(saved_), &saved_);
+    }
+}
+
+void ThreadAffinityGuard::pin(int core) {
+    if (!valid_ || core < 0 || core >= CPU_SETSIZE) {
+        return;
+    }
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(core, &mask);
+    sched_setaffinity(0, sizeof(mask), &mask);
+}
+
+#else
+
+ThreadAffinityGuard::ThreadAffinityGuard() = default;
+ThreadAffinityGuard::~ThreadAffinityGuard() = default;
+void ThreadAffinityGuard::pin(int) {}
+
+#endif
+
+std::vector<int> thread_count_candidates(const CpuTopology & topology, int max_threads) {
+    const int n_cores = static_cast<int>(topology.cores.size());
+    const int limit = std::clamp(max_threads, 1, std::max(1, n_cores));
+    std::vector<int> counts;
+    for (int i = 1; i < n_cores; ++i) {
+        if (topology.cores[static_cast<size_t>(i)].capacity != topology.cores[static_cast<size_t>(i) - 1].capacity) {
+            counts.push_back(i);
+        }
+    }
+    counts.push_back(n_cores);
+    counts.push_back(topology.n_performance - 1);
+    counts.push_back(limit);
+    // A single thread only when there is a single core.
+    const int lowest = limit > 1 ? 2 : 1;
+    counts.erase(std::remove_if(counts.begin(), counts.end(), [&](int n) { return n < lowest || n > limit; }),
+                 counts.end());
+    // The default stays comparable even on a lone prime core.
+    counts.push_back(default_decode_threads(topology, limit));
+    std::sort(counts.begin(), counts.end());
+    counts.erase(std::unique(counts.begin(), counts.end()), counts.end());
+    return counts;
+}
+
+std::string cpu_topology_json(const CpuTopology & topology) {
+    std::ostringstream oss;
+    oss << "{\"cores\":[";
+    for (size_t i = 0; i < topology.cores.size(); ++i) {
+        if (i > 0) {
+            oss << ",";
+        }
+        oss << "{\"id\":" << topology.cores[i].id << ",\"capacity\":" << topology.cores[i].capacity << "}";
+    }
+    oss << "],\"performance\":" << topology.n_performance << "}";
+    return oss.str();
+}
+
+} // namespace peerchat
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "ggml.h"
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace peerchat {
+
+// Core layout for placing ggml's worker threads. Phone SoCs pair a few fast
+// cores with slower efficiency ones (big.LITTLE). A decode step is a short
+// graph that waits on its slowest thread, so it runs pinned to the fast cores
+// and polls between tokens. Prefill graphs are long and their matmuls hand out
+// work in chunks, so slower cores still add throughput; the prefill pool spans
+// the fastest n cores unpinned and sleeps between graphs. With OpenMP builds
+// of ggml the pools only carry the core mask; OpenMP owns the threads.
+
+struct CpuCore {
+    int id = 0;
+    // cpu_capacity (1024 for the fastest class) or, without it, the maximum
+    // frequency in kHz; only the order matters.
+    int64_t capacity = 0;
+};
+
+struct CpuTopology {
+    // Online cores, fastest first, ties in id order.
+    std::vector<CpuCore> cores;
+    // Cores faster than the slowest class; all of them when every core is alike.
+    int n_performance = 0;
+};
+
+// Reads <cpu_dir>/online and each core's cpu_capacity, falling back to
+// cpufreq/cpuinfo_max_freq. Without either, the cores count as alike; without
+// the online list, hardware_concurrency() cores from id 0.
+CpuTopology detect_cpu_topology(const std::string & cpu_dir = "/sys/devices/system/cpu");
+
+struct ThreadPoolPlan {
+    int n_threads = 1;
+    // Thread i on the i-th core of the mask instead of any core in it.
+    bool strict_cpu = false;
+    // ggml's spin before a worker sleeps between graphs, 0-100.
+    uint32_t poll = 0;
+};
+
+// The fast cores, or max_threads if fewer.
+int default_decode_threads(const CpuTopology & topology, int max_threads);
+// Every core, or max_threads if fewer.
+int default_batch_threads(const CpuTopology & topology, int max_threads);
+
+ThreadPoolPlan decode_pool_plan(const CpuTopology & topology, int n_threads);
+ThreadPoolPlan batch_pool_plan(const CpuTopology & topology, int n_threads);
+
+// Parameters for ggml_threadpool_new, masked to the plan's n_threads fastest
+// cores; an empty topology leaves the default affinity.
+ggml_threadpool_params threadpool_params(const CpuTopology & topology, const ThreadPoolPlan & plan);
+
+// Core the caller should run on while a graph computes on a pool of this plan:
+// ggml makes the calling thread worker 0, which a strict plan puts on the
+// lowest-numbered core of the mask. -1 when the plan is not strict.
+int pool_leader_core(const CpuTopology & topology, const ThreadPoolPlan & plan);
+
+// Saves the calling thread's core mask and restores it when destroyed. ggml
+// pins the thread that creates a pool or runs worker 0 and never unpins it,
+// which would leave the app's request threads stuck on one core.
+class ThreadAffinityGuard {
+public:
+    ThreadAffinityGuard();
+    ~ThreadAffinityGuard();
+
+    ThreadAffinityGuard(const ThreadAffinityGuard &) = delete;
+    ThreadAffinityGuard & operator=(const ThreadAffinityGuard &) = delete;
+
+    // Runs the calling thread on `core` alone until destruction; core < 0 is a no-op.
+    void pin(int core);
+
+private:
+#if defined(__linux__)
+    cpu_set_t saved_;
+#endif
+    bool valid_ = false;
+};
+
+// Thread counts worth timing, ascending: each core-class boundary, one fewer
+// than the fast cores, max_threads itself and the default decode count, none
+// above max_threads.
+std::vector<int> thread_count_candidates(const CpuTopology & topology, int max_threads);
+
+// {"cores":[{"id":..,"capacity":..}],"performance":N}
+std::string cpu_topology_json(const CpuTopology & topology);
+
+} // namespace peerchat
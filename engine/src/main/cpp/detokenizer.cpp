@@ -0,0 +1,167 @@
+#include "detokenizer.h"
+
+#include <algorithm>
+
+namespace peerchat {
+
+namespace {
+
+bool is_continuation(uint8_t c) {
+    return (c & 0xC0) == 0x80;
+}
+
+// Rendered pieces rarely exceed this; longer ones are measured and rendered again.
+constexpr int32_t kPieceGuess = 32;
+
+} // namespace
+
+size_t utf8_sequence_length(uint8_t lead) {
+    if (lead < 0x80) return 1;
+    if ((lead >> 5) == 0x06) return 2;
+    if ((lead >> 4) == 0x0E) return 3;
+    if ((lead >> 3) == 0x1E) return 4;
+    return 1;
+}
+
+size_t utf8_complete_prefix(const char * s, size_t n) {
+    for (size_t back = 1; back <= std::min<size_t>(n, 4); ++back) {
+        const uint8_t c = static_cast<uint8_t>(s[n - back]);
+        if (!is_continuation(c)) {
+            return back >= utf8_sequence_length(c) ? n : n - back;
+        }
+    }
+    return n;
+}
+
+void PieceCache::reset(const llama_vocab * vocab) {
+    vocab_ = vocab;
+    spans_.clear();
+    arena_.clear();
+    if (vocab_) {
+        spans_.resize(static_cast<size_t>(std::max(0, llama_vocab_n_tokens(vocab_))));
+    }
+}
+
+std::string_view PieceCache::piece(llama_token token) {
+    if (!vocab_ || token < 0 || static_cast<size_t>(token) >= spans_.size()) {
+        return {};
+    }
+    Span & span = spans_[static_cast<size_t>(token)];
+    if (span.length == kMissing) {
+        const size_t at = arena_.size();
+        arena_.resize(at + kPieceGuess);
+        int32_t n = llama_token_to_piece(vocab_, token, arena_.data() + at, kPieceGuess, 0, false);
+        if (n < 0) {
+            arena_.resize(at + static_cast<size_t>(-n));
+            n = llama_token_to_piece(vocab_, token, arena_.data() + at, -n, 0, false);
+        }
+        arena_.resize(at + static_cast<size_t>(std::max(n, 0)));
+        span.offset = static_cast<uint32_t>(at);
+        span.length = static_cast<uint32_t>(std::max(n, 0));
+    }
+    return std::string_view(arena_.data() + span.offset, span.length);
+}
+
+StopMatcher::StopMatcher(const std::vector<std::string> & stops) {
+    for (const auto & stop : stops) {
+        if (!stop.empty() && std::find(stops_.begin(), stops_.end(), stop) == stops_.end()) {
+            stops_.push_back(stop);
+            max_length_ = std::max(max_length_, stop.size());
+        }
+    }
+
+    // Trie first, with -1 for missing edges.
+    next_.assign(256, -1);
+    match_.assign(1, -1);
+    depth_.assign(1, 0);
+    for (size_t i = 0; i < stops_.size(); ++i) {
+        int32_t state = 0;
+        for (const char ch : stops_[i]) {
+            const size_t edge = static_cast<size_t>(state) * 256 + static_cast<uint8_t>(ch);
+            if (next_[edge] < 0) {
+                next_[edge] = static_cast<int32_t>(match_.size());
+                next_.resize(next_.size() + 256, -1);
+                match_.push_back(-1);
+                depth_.push_back(depth_[static_cast<size_t>(state)] + 1);
+            }
+            state = next_[edge];
+        }
+        match_[static_cast<size_t>(state)] = static_cast<int32_t>(i);
+    }
+
+    // Breadth-first, fill missing edges from the failure state's row, so the
+    // table becomes a DFA; a state without a stop of its own inherits the
+    // longest stop ending at its failure state.
+    std::vector<int32_t> fail(match_.size(), 0);
+    std::vector<int32_t> queue;
+    queue.reserve(match_.size());
+    for (size_t byte = 0; byte < 256; ++byte) {
+        int32_t & child = next_[byte];
+        if (child < 0) {
+            child = 0;
+        } else {
+            queue.push_back(child);
+        }
+    }
+    for (size_t head = 0; head < queue.size(); ++head) {
+        const int32_t state = queue[head];
+        const size_t row = static_cast<size_t>(state) * 256;
+        const size_t fail_row = static_cast<size_t>(fail[static_cast<size_t>(state)]) * 256;
+        if (match_[static_cast<size_t>(state)] < 0) {
+            match_[static_cast<size_t>(state)] = match_[static_cast<size_t>(fail[static_cast<size_t>(state)])];
+        }
+        for (size_t byte = 0; byte < 256; ++byte) {
+            int32_t & child = next_[row + byte];
+            if (child < 0) {
+                child = next_[fail_row + byte];
+            } else {
+                fail[static_cast<size_t>(child)] = next_[fail_row + byte];
+                queue.push_back(child);
+            }
+        }
+    }
+}
+
+StreamingDetokenizer::StreamingDetokenizer(PieceCache & pieces, const std::vector<std::string> & stops)
+    : pieces_(pieces), matcher_(stops) {
+    // Held back: a partial stop plus a partial character, next to one piece.
+    pending_.reserve(matcher_.max_length() + 256);
+}
+
+void StreamingDetokenizer::compact() {
+    if (released_ > 0) {
+        pending_.erase(0, released_);
+        released_ = 0;
+    }
+}
+
+std::string_view StreamingDetokenizer::push_bytes(std::string_view bytes, std::string_view & matched) {
+    matched = {};
+    compact();
+    const size_t start = pending_.size();
+    pending_.append(bytes);
+    for (size_t i = start; i < pending_.size(); ++i) {
+        const int stop = matcher_.step(static_cast<uint8_t>(pending_[i]));
+        if (stop >= 0) {
+            const std::string & text = matcher_.stop(stop);
+            matched = text;
+            pending_.resize(i + 1 - text.size());
+            matcher_.reset();
+            released_ = pending_.size();
+            return std::string_view(pending_.data(), released_);
+        }
+    }
+    // A held stop prefix starts on a character boundary, so trimming the
+    // remaining prefix to whole characters is enough.
+    released_ = utf8_complete_prefix(pending_.data(), pending_.size() - matcher_.depth());
+    return std::string_view(pending_.data(), released_);
+}
+
+std::string_view StreamingDetokenizer::flush() {
+    compact();
+    matcher_.reset();
+    released_ = pending_.size();
+    return std::string_view(pending_.data(), released_);
+}
+
+} // namespace peerchat
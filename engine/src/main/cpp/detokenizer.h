@@ -0,0 +1,100 @@
+#pragma once
+
+#include "llama.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace peerchat {
+
+// Streaming detokenization for the decode loop: token text rendered once per
+// model, stop strings matched in a single pass over the bytes, and output
+// released only on UTF-8 character boundaries, so every chunk a sink receives
+// converts to Java text on its own. Steady-state pushes do not allocate.
+
+// Bytes in the UTF-8 sequence `lead` starts; 1 for ASCII and stray bytes.
+size_t utf8_sequence_length(uint8_t lead);
+// Length of the prefix of s that does not end inside a multi-byte sequence.
+size_t utf8_complete_prefix(const char * s, size_t n);
+
+// Text of each token of one vocabulary, rendered on first use into a shared
+// arena. Control tokens render empty, as the decode loop never shows them.
+class PieceCache {
+public:
+    // Forgets every piece; the next lookups render against `vocab`.
+    void reset(const llama_vocab * vocab);
+    // Valid until the next piece() or reset().
+    std::string_view piece(llama_token token);
+
+private:
+    struct Span {
+        uint32_t offset = 0;
+        uint32_t length = kMissing;
+    };
+    static constexpr uint32_t kMissing = UINT32_MAX;
+
+    const llama_vocab * vocab_ = nullptr;
+    std::vector<Span> spans_;
+    std::string arena_;
+};
+
+// Aho-Corasick automaton over the bytes of a set of stop strings, expanded to
+// a full transition table so each byte costs one lookup however many stops
+// there are.
+class StopMatcher {
+public:
+    explicit StopMatcher(const std::vector<std::string> & stops);
+
+    // Advances over one byte; returns the stop string ending here, or -1.
+    // When several end here the longest wins.
+    int step(uint8_t byte) {
+        state_ = next_[static_cast<size_t>(state_) * 256 + byte];
+        return match_[static_cast<size_t>(state_)];
+    }
+    // Length of the longest suffix of the input so far that begins a stop
+    // string; those bytes cannot be released yet.
+    size_t depth() const { return depth_[static_cast<size_t>(state_)]; }
+    void reset() { state_ = 0; }
+    const std::string & stop(int index) const { return stops_[static_cast<size_t>(index)]; }
+    size_t max_length() const { return max_length_; }
+
+private:
+    std::vector<std::string> stops_;
+    // next_[state * 256 + byte]; every entry is a valid state.
+    std::vector<int32_t> next_;
+    std::vector<int32_t> match_;
+    std::vector<uint32_t> depth_;
+    size_t max_length_ = 0;
+    int32_t state_ = 0;
+};
+
+// Turns sampled tokens into releasable text for one generation.
+class StreamingDetokenizer {
+public:
+    StreamingDetokenizer(PieceCache & pieces, const std::vector<std::string> & stops);
+
+    // Appends the token's text and returns the bytes now safe to release: they
+    // end on a character boundary and cannot be the start of a stop string.
+    // On a stop match, returns the text before it, sets `matched` to the stop
+    // and drops the rest. Views stay valid until the next push or flush.
+    std::string_view push(llama_token token, std::string_view & matched) {
+        return push_bytes(pieces_.piece(token), matched);
+    }
+    std::string_view push_bytes(std::string_view bytes, std::string_view & matched);
+    // Everything still held back, whole or not, once generation ends.
+    std::string_view flush();
+
+private:
+    // Drops what the previous call released.
+    void compact();
+
+    PieceCache & pieces_;
+    StopMatcher matcher_;
+    std::string pending_;
+    size_t released_ = 0;
+};
+
+} // namespace peerchat
@@ -0,0 +1,3209 @@
+#include "engine_core.h"
+
+#include "cpu_topology.h"
+#include "detokenizer.h"
+#include "engine_log.h"
+#include "gguf_probe.h"
+#include "llama.h"
+#include "log.h"
+#include "ngram-cache.h"
+#include "scheduler.h"
+#include "speculative.h"
+#include "state_stream.h"
+#include "token_batch.h"
+#include "token_ring.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <dirent.h>
+#include <functional>
+#include <fcntl.h>
+#include <iomanip>
+#include <ios>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace peerchat {
+
+namespace {
+
+constexpr int64_t kNoChat = -1;
+// Chats whose reply n-grams are kept for prompt-lookup drafting.
+constexpr size_t kMaxLookupChats = 16;
+// Leading tokens a context shift always keeps: attention sinks that the model
+// leans on regardless of content, even when there is no system prompt.
+constexpr size_t kSinkTokens = 4;
+// Sequences reserved after the chat sessions for auxiliary requests.
+constexpr int kAuxSequences = 4;
+// Prompt tokens auxiliary requests may add to a step that a chat reply
+// drives, so prefilling a summary barely slows the stream the user watches.
+constexpr int32_t kAuxPrefillPerStep = 32;
+// Thread calibration: prompt tokens timed as one prefill batch, then tokens
+// decoded one at a time after it, per candidate thread count.
+constexpr int32_t kCalibrationPrompt = 32;
+constexpr int32_t kCalibrationDecode = 8;
+
+struct AuxSlot;
+
+// One chat bound to one llama_seq_id inside the shared generation context.
+struct SessionSlot {
+    int64_t chat_id = kNoChat;
+    // Tokens currently resident in the KV cache for this sequence, in position order.
+    std::vector<llama_token> tokens;
+    // Context shifts evict the tokens right after the first n_keep and record
+    // them here, in order, so the chat's history tokens[0, n_keep) + shifted +
+    // tokens[n_keep, end) can still be matched against the next turn's prompt.
+    std::vector<llama_token> shifted;
+    size_t n_keep = 0;
+    uint64_t last_used = 0;
+
+    void clear_history() {
+        tokens.clear();
+        shifted.clear();
+        n_keep = 0;
+    }
+};
+
+// N-grams of a chat's earlier replies. Outlives the chat's KV sequence, so a
+// chat keeps drafting from its own phrasing after an eviction.
+struct ChatNgrams {
+    common_ngram_cache cache;
+    uint64_t last_used = 0;
+};
+
+struct EngineState {
+    // Serialises requests on the contexts below; see EngineLock.
+    RequestScheduler scheduler;
+    // Held exclusively while the model pointer changes and shared by calls
+    // that only read its vocabulary, so token counting never waits on a decode.
+    std::shared_mutex vocab_mutex;
+    // Bumped whenever the model or its contexts are replaced; a request that
+    // yielded the scheduler checks it before touching its context again.
+    uint64_t model_epoch = 0;
+    // Metrics as of the last released request, served without the scheduler.
+    std::mutex metrics_mutex;
+    std::string metrics_snapshot;
+    llama_model * model = nullptr;
+    llama_context * ctx = nullptr;
+    llama_context * embed_ctx = nullptr;
+    // Optional draft model for speculative decoding, single sequence.
+    llama_model * draft_model = nullptr;
+    llama_context * draft_ctx = nullptr;
+    common_speculative * spec = nullptr;
+    int draft_max = 0;
+    float draft_p_min = 0.75f;
+    int lookup_max = 0;
+    std::unordered_map<int64_t, ChatNgrams> chat_ngrams;
+    std::string model_path;
+    int n_ctx = 4096;
+    // Threads of batched decodes (prefill, drafts verified) and of single-token
+    // decodes; max_threads bounds both and the calibration.
+    int n_threads = 4;
+    int n_threads_decode = 4;
+    int max_threads = 4;
+    // n_threads for the batch tokenizers, which run beside engine work under
+    // only vocab_mutex while calibration may change the pools.
+    std::atomic<int> tokenize_workers{4};
+    // Read once; the pools below are placed on it.
+    CpuTopology topology;
+    // Persistent ggml worker pools shared by the contexts the scheduler drives.
+    ggml_threadpool * decode_pool = nullptr;
+    ggml_threadpool * batch_pool = nullptr;
+    // Core the thread holding the engine runs on, as worker 0 of the decode
+    // pool; -1 leaves it where the OS puts it.
+    int leader_core = -1;
+    int n_gpu_layers = 0;
+    bool use_vulkan = true;
+    // KV cache type of the generation context, after any F16 fallback.
+    KvPrecision kv_precision = KvPrecision::F16;
+    size_t kv_bytes_per_token = 0;
+    int64_t memory_budget_bytes = 0;
+    EngineMetrics metrics;
+    // Token text of the loaded model, shared by every generation.
+    PieceCache pieces;
+    // Indexed by llama_seq_id; the context's n_seq_max less the auxiliary sequences.
+    std::vector<SessionSlot> sessions;
+    llama_seq_id active_seq = 0;
+    // Auxiliary requests (see AuxSlot). Submitted ones queue in aux_pending
+    // until one of the reserved sequences frees up; aux_active holds the
+    // admitted ones and is only touched under the scheduler.
+    std::mutex aux_mutex;
+    std::condition_variable aux_cv;
+    std::deque<AuxSlot *> aux_pending;
+    std::vector<AuxSlot *> aux_active;
+    // Set while a requesting thread drives auxiliary decoding on its own.
+    bool aux_driving = false;
+    int aux_sequences = 0;
+    uint64_t aux_requests = 0;
+    uint64_t aux_tokens = 0;
+    // Decodes that carried more than one sequence.
+    uint64_t batched_decodes = 0;
+    // Batch index of the active sequence's last logits row; auxiliary tokens
+    // staged into the same batch follow it.
+    int32_t logits_idx = -1;
+    uint64_t session_clock = 0;
+    std::string spill_dir;
+    llama_batch batch{};
+    int32_t batch_capacity = 0;
+    StopReason stop_reason = StopReason::None;
+    std::string stop_sequence;
+    std::atomic<bool> should_abort{false};
+    // Prefill progress of the running generation, readable without the lock.
+    std::atomic<int32_t> prefill_done{0};
+    std::atomic<int32_t> prefill_total{0};
+    std::atomic<int64_t> prefill_started_us{0};
+};
+
+// An auxiliary request (chat title, summary, follow-up suggestions) decoding
+// in one of the reserved sequences, without session reuse, drafting or
+// context shifts. Whichever thread holds the engine steps it: its tokens ride
+// in the same llama_batch as the chat reply being generated, or with no reply
+// running, in a batch of auxiliary tokens only. Text reaches the requesting
+// thread through `outbox`, so a sink is only ever called on its own thread.
+struct AuxSlot {
+    AuxSlot(const GenerationRequest & request, PieceCache & pieces) : req(request), detok(pieces, request.stops) {}
+
+    const GenerationRequest & req;
+    GenerationSummary summary;
+    StreamingDetokenizer detok;
+    std::vector<llama_token> prompt;
+    llama_sampler * sampler = nullptr;
+    llama_seq_id seq = -1;
+    // Cells resident in `seq`; the prompt is decoded first, then one token per step.
+    size_t n_past = 0;
+    // Sampled and delivered, not yet decoded.
+    llama_token next = LLAMA_TOKEN_NULL;
+    // Tokens placed in the batch being decoded and the row holding this slot's logits.
+    int32_t n_staged = 0;
+    int32_t logits_idx = -1;
+    double t_submit_ms = 0.0;
+    double t_start_ms = 0.0;
+    double t_decode_start_ms = 0.0;
+    std::atomic<bool> cancelled{false};
+    // Guarded by g_state.aux_mutex.
+    std::string outbox;
+    bool done = false;
+};
+
+EngineState g_state;
+std::once_flag g_backend_once;
+
+// Dedicated embedding model. Guarded by its own mutex, never held while
+// waiting on the scheduler, so RAG indexing does not wait on a running generation.
+struct EmbedderState {
+    std::mutex mutex;
+    llama_model * model = nullptr;
+    llama_context * ctx = nullptr;
+    std::string model_path;
+};
+
+EmbedderState g_embedder;
+// Readable without either lock; the chat model skips its own embedding context while set.
+std::atomic<bool> g_embedder_loaded{false};
+
+struct SummaryCommit {
+    EngineState & state;
+    GenerationSummary & summary;
+    ~SummaryCommit() {
+        state.metrics = summary.metrics;
+        state.stop_reason = summary.reason;
+        state.stop_sequence = summary.stop_sequence;
+    }
+};
+
+bool ensure_backend_init() {
+    std::call_once(g_backend_once, [] {
+        llama_backend_init();
+        // common/ prints drafting traces to stdout; the engine logs for itself.
+        common_log_set_verbosity_thold(-1);
+        LOGI("llama backend initialized (Vulkan expected)");
+    });
+    return true;
+}
+
+// Upper bound on texts packed into one embedding batch.
+constexpr uint32_t kEmbedMaxSequences = 32;
+// Default context of a dedicated embedder: BERT-class models train on 512,
+// long-context ones would otherwise allocate far more than chunks need.
+constexpr int32_t kEmbedderMaxContext = 2048;
+// Smallest embedding batch: a whole chunk of the default ChunkOptions budget.
+// A text runs as one ubatch, so a longer one cannot be embedded.
+constexpr uint32_t kEmbedMinBatch = 512;
+
+enum llama_pooling_type parse_pooling(const std::string & name) {
+    if (name == "mean") return LLAMA_POOLING_TYPE_MEAN;
+    if (name == "cls") return LLAMA_POOLING_TYPE_CLS;
+    if (name == "last") return LLAMA_POOLING_TYPE_LAST;
+    return LLAMA_POOLING_TYPE_UNSPECIFIED;
+}
+
+void free_embedder_locked() {
+    g_embedder_loaded.store(false);
+    if (g_embedder.ctx) {
+        llama_free(g_embedder.ctx);
+        g_embedder.ctx = nullptr;
+    }
+    if (g_embedder.model) {
+        llama_model_free(g_embedder.model);
+        g_embedder.model = nullptr;
+    }
+    g_embedder.model_path.clear();
+}
+
+void apply_kv_precision(llama_context_params & cparams, KvPrecision precision);
+
+// Points ctx at the engine's pools and thread counts. Only for contexts used
+// under the scheduler: a pool runs one graph at a time.
+void attach_threads_locked(llama_context * ctx) {
+    if (!ctx) {
+        return;
+    }
+    if (g_state.decode_pool && g_state.batch_pool) {
+        llama_attach_threadpool(ctx, g_state.decode_pool, g_state.batch_pool);
+    }
+    llama_set_n_threads(ctx, g_state.n_threads_decode, g_state.n_threads);
+}
+
+// Both pools, or neither when one cannot be created.
+bool create_threadpools(const ThreadPoolPlan & decode, const ThreadPoolPlan & batch,
+                        ggml_threadpool ** decode_pool, ggml_threadpool ** batch_pool) {
+    ggml_threadpool_params decode_params = threadpool_params(g_state.topology, decode);
+    ggml_threadpool_params batch_params = threadpool_params(g_state.topology, batch);
+    *decode_pool = ggml_threadpool_new(&decode_params);
+    *batch_pool = *decode_pool ? ggml_threadpool_new(&batch_params) : nullptr;
+    if (!*batch_pool) {
+        if (*decode_pool) {
+            ggml_threadpool_free(*decode_pool);
+            *decode_pool = nullptr;
+        }
+        return false;
+    }
+    return true;
+}
+
+void free_threadpools_locked() {
+    if (g_state.decode_pool) {
+        ggml_threadpool_free(g_state.decode_pool);
+        g_state.decode_pool = nullptr;
+    }
+    if (g_state.batch_pool) {
+        ggml_threadpool_free(g_state.batch_pool);
+        g_state.batch_pool = nullptr;
+    }
+    g_state.leader_core = -1;
+}
+
+// Replaces the pools with ones of n_decode and n_batch threads and moves the
+// live contexts onto them. Without pools ggml makes its own for every graph.
+void set_threadpools_locked(int n_decode, int n_batch) {
+    const ThreadPoolPlan decode = decode_pool_plan(g_state.topology, n_decode);
+    const ThreadPoolPlan batch = batch_pool_plan(g_state.topology, n_batch);
+    ggml_threadpool * decode_pool = nullptr;
+    ggml_threadpool * batch_pool = nullptr;
+    if (!create_threadpools(decode, batch, &decode_pool, &batch_pool)) {
+        LOGE("threadpools: creation failed, ggml picks threads per graph");
+    }
+    llama_context * contexts[] = {g_state.ctx, g_state.draft_ctx, g_state.embed_ctx};
+    for (llama_context * ctx : contexts) {
+        if (ctx) {
+            llama_detach_threadpool(ctx);
+        }
+    }
+    free_threadpools_locked();
+    g_state.decode_pool = decode_pool;
+    g_state.batch_pool = batch_pool;
+    g_state.n_threads_decode = decode.n_threads;
+    g_state.n_threads = batch.n_threads;
+    g_state.tokenize_workers.store(batch.n_threads, std::memory_order_relaxed);
+    g_state.leader_core = decode_pool ? pool_leader_core(g_state.topology, decode) : -1;
+    for (llama_context * ctx : contexts) {
+        attach_threads_locked(ctx);
+    }
+    LOGI("threadpools: decode=%d%s batch=%d of %zu cores (%d fast)", decode.n_threads,
+         decode.strict_cpu ? " pinned" : "", batch.n_threads, g_state.topology.cores.size(),
+         g_state.topology.n_performance);
+}
+
+bool ensure_embedding_context_locked() {
+    if (g_state.embed_ctx) {
+        return true;
+    }
+    if (!g_state.model) {
+        LOGE("embedding context requested without loaded model");
+        return false;
+    }
+
+    llama_context_params params = llama_context_default_params();
+    params.n_ctx = g_state.n_ctx;
+    params.n_threads = g_state.n_threads_decode;
+    params.n_threads_batch = g_state.n_threads;
+    params.embeddings = true;
+    // Many texts share one batch, one sequence each; a unified cache lets any
+    // of them use the whole context instead of n_ctx / n_seq_max.
+    params.n_seq_max = kEmbedMaxSequences;
+    params.kv_unified = true;
+
+    // Optimize batch sizes for embedding context (typically smaller than inference context)
+    if (g_state.use_vulkan) {
+        // GPU-accelerated embeddings: moderate batch sizes
+        params.n_batch = std::min(1024U, static_cast<uint32_t>(params.n_ctx / 4));
+        params.offload_kqv = true;
+    } else {
+        // CPU embeddings: smaller batches for memory efficiency
+        params.n_batch = std::min(256U, static_cast<uint32_t>(params.n_ctx / 8));
+    }
+    params.n_batch = std::max(params.n_batch, std::min(kEmbedMinBatch, params.n_ctx));
+    // A packed batch must run as one ubatch: non-causal encoders require it and
+    // pooling would otherwise see a sequence split across ubatches.
+    params.n_ubatch = params.n_batch;
+    apply_kv_precision(params, g_state.kv_precision);
+
+    llama_context * embed = llama_init_from_model(g_state.model, params);
+    if (!embed && g_state.kv_precision != KvPrecision::F16) {
+        apply_kv_precision(params, KvPrecision::F16);
+        embed = llama_init_from_model(g_state.model, params);
+    }
+    if (!embed) {
+        LOGE("failed to create embedding context");
+        return false;
+    }
+    attach_threads_locked(embed);
+    g_state.embed_ctx = embed;
+    return true;
+}
+
+bool file_exists(const char * path) {
+    if (!path) return false;
+    struct stat st {};
+    if (stat(path, &st) != 0) {
+        return false;
+    }
+    return S_ISREG(st.st_mode);
+}
+
+void reset_metrics_locked() {
+    g_state.metrics = EngineMetrics{};
+    g_state.stop_reason = StopReason::None;
+    g_state.stop_sequence.clear();
+    g_state.should_abort.store(false, std::memory_order_relaxed);
+}
+
+void fail_active_aux_locked();
+
+// Called after anything rewrites the whole KV cache: chat bindings survive but
+// no slot can trust its resident tokens any more.
+void invalidate_prompt_cache_locked() {
+    fail_active_aux_locked();
+    for (auto & slot : g_state.sessions) {
+        slot.clear_history();
+    }
+}
+
+SessionSlot & active_session_locked() {
+    return g_state.sessions[static_cast<size_t>(g_state.active_seq)];
+}
+
+std::string spill_path_locked(int64_t chat_id) {
+    return g_state.spill_dir + "/seq-" + std::to_string(chat_id) + ".bin";
+}
+
+// Spill files are only valid for the model and context that wrote them.
+void purge_spill_dir_locked() {
+    if (g_state.spill_dir.empty()) {
+        return;
+    }
+    DIR * dir = opendir(g_state.spill_dir.c_str());
+    if (!dir) {
+        return;
+    }
+    while (dirent * entry = readdir(dir)) {
+        const std::string name = entry->d_name;
+        if (name.rfind("seq-", 0) == 0 && name.size() > 4 && name.compare(name.size() - 4, 4, ".bin") == 0) {
+            std::remove((g_state.spill_dir + "/" + name).c_str());
+        }
+    }
+    closedir(dir);
+}
+
+int64_t save_session_compressed_locked(llama_seq_id seq, const std::string & path);
+bool load_session_compressed_locked(int64_t chat_id, const std::string & path);
+
+void evict_session_locked(llama_seq_id seq) {
+    SessionSlot & slot = g_state.sessions[static_cast<size_t>(seq)];
+    if (!g_state.spill_dir.empty() && slot.chat_id != kNoChat && !slot.tokens.empty()) {
+        if (save_session_compressed_locked(seq, spill_path_locked(slot.chat_id)) == 0) {
+            LOGE("session: failed to spill chat=%lld seq=%d", static_cast<long long>(slot.chat_id), seq);
+        }
+    }
+    llama_memory_seq_rm(llama_get_memory(g_state.ctx), seq, -1, -1);
+    LOGI("session: evicted chat=%lld seq=%d tokens=%zu", static_cast<long long>(slot.chat_id), seq, slot.tokens.size());
+    slot = SessionSlot{};
+}
+
+// Least recently used bound slot other than `exclude`, or -1 when none is evictable.
+llama_seq_id find_lru_session_locked(llama_seq_id exclude) {
+    llama_seq_id victim = -1;
+    for (size_t i = 0; i < g_state.sessions.size(); ++i) {
+        const SessionSlot & slot = g_state.sessions[i];
+        if (static_cast<llama_seq_id>(i) == exclude || slot.chat_id == kNoChat) {
+            continue;
+        }
+        if (victim < 0 || slot.last_used < g_state.sessions[static_cast<size_t>(victim)].last_used) {
+            victim = static_cast<llama_seq_id>(i);
+        }
+    }
+    return victim;
+}
+
+size_t resident_cells_locked() {
+    size_t resident = 0;
+    for (const auto & slot : g_state.sessions) {
+        resident += slot.tokens.size();
+    }
+    for (const AuxSlot * aux : g_state.aux_active) {
+        resident += aux->n_past;
+    }
+    return resident;
+}
+
+// All sequences share the unified KV cache, so make room for `needed` more
+// cells by evicting cold sessions before the active one is extended.
+void ensure_session_capacity_locked(size_t needed) {
+    size_t resident = resident_cells_locked();
+    while (resident + needed > static_cast<size_t>(g_state.n_ctx)) {
+        const llama_seq_id victim = find_lru_session_locked(g_state.active_seq);
+        if (victim < 0) {
+            break;
+        }
+        resident -= g_state.sessions[static_cast<size_t>(victim)].tokens.size();
+        evict_session_locked(victim);
+    }
+}
+
+llama_seq_id find_session_locked(int64_t chat_id) {
+    for (size_t i = 0; i < g_state.sessions.size(); ++i) {
+        if (g_state.sessions[i].chat_id == chat_id) {
+            return static_cast<llama_seq_id>(i);
+        }
+    }
+    return -1;
+}
+
+// Binds chat_id to a free (or LRU-evicted) slot with an empty sequence and makes it active.
+llama_seq_id bind_new_session_locked(int64_t chat_id) {
+    llama_seq_id seq = -1;
+    for (size_t i = 0; i < g_state.sessions.size(); ++i) {
+        if (g_state.sessions[i].chat_id == kNoChat) {
+            seq = static_cast<llama_seq_id>(i);
+            break;
+        }
+    }
+    if (seq < 0) {
+        seq = find_lru_session_locked(-1);
+        evict_session_locked(seq);
+    }
+
+    // Drop anything a whole-context restore may have left behind in this sequence.
+    llama_memory_seq_rm(llama_get_memory(g_state.ctx), seq, -1, -1);
+    SessionSlot & slot = g_state.sessions[static_cast<size_t>(seq)];
+    slot = SessionSlot{};
+    slot.chat_id = chat_id;
+    slot.last_used = ++g_state.session_clock;
+    g_state.active_seq = seq;
+    return seq;
+}
+
+// Makes chat_id the active sequence. Returns true when the chat's KV state is
+// already resident or was reloaded from its spill file, false for a fresh slot.
+bool select_session_locked(int64_t chat_id) {
+    const llama_seq_id resident = find_session_locked(chat_id);
+    if (resident >= 0) {
+        g_state.sessions[static_cast<size_t>(resident)].last_used = ++g_state.session_clock;
+        g_state.active_seq = resident;
+        return true;
+    }
+
+    const llama_seq_id seq = bind_new_session_locked(chat_id);
+    if (g_state.spill_dir.empty()) {
+        return false;
+    }
+    const std::string path = spill_path_locked(chat_id);
+    if (!file_exists(path.c_str())) {
+        return false;
+    }
+    const bool restored = load_session_compressed_locked(chat_id, path);
+    std::remove(path.c_str());
+    LOGI("session: chat=%lld seq=%d spill restore=%d tokens=%zu", static_cast<long long>(chat_id), seq,
+         restored ? 1 : 0, g_state.sessions[static_cast<size_t>(seq)].tokens.size());
+    return restored;
+}
+
+void release_session_locked(int64_t chat_id) {
+    const llama_seq_id seq = find_session_locked(chat_id);
+    if (seq >= 0) {
+        llama_memory_seq_rm(llama_get_memory(g_state.ctx), seq, -1, -1);
+        g_state.sessions[static_cast<size_t>(seq)] = SessionSlot{};
+    }
+    if (!g_state.spill_dir.empty()) {
+        std::remove(spill_path_locked(chat_id).c_str());
+    }
+}
+
+// Per-sequence snapshot layout: header, the sequence's resident tokens, the
+// tokens context shifts evicted from it, then the llama_state_seq_get_data_ext
+// payload. Only cells owned by the sequence are written, so the size follows
+// the tokens used rather than n_ctx.
+constexpr uint32_t kSeqSnapshotMagic = 0x51534350; // "PCSQ"
+constexpr uint32_t kSeqSnapshotVersion = 2;
+
+struct SeqSnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint32_t n_tokens;
+    uint32_t n_keep;
+    uint32_t n_shifted;
+};
+
+SeqSnapshotHeader snapshot_header_locked(const SessionSlot & slot, llama_state_seq_flags flags) {
+    return SeqSnapshotHeader{kSeqSnapshotMagic, kSeqSnapshotVersion, flags,
+                             static_cast<uint32_t>(slot.tokens.size()), static_cast<uint32_t>(slot.n_keep),
+                             static_cast<uint32_t>(slot.shifted.size())};
+}
+
+size_t snapshot_tokens_bytes(const SeqSnapshotHeader & header) {
+    return (static_cast<size_t>(header.n_tokens) + header.n_shifted) * sizeof(llama_token);
+}
+
+size_t session_snapshot_size_locked(llama_seq_id seq, llama_state_seq_flags flags) {
+    const SessionSlot & slot = g_state.sessions[static_cast<size_t>(seq)];
+    const size_t payload = llama_state_seq_get_size_ext(g_state.ctx, seq, flags);
+    if (payload == 0) {
+        return 0;
+    }
+    return sizeof(SeqSnapshotHeader) + snapshot_tokens_bytes(snapshot_header_locked(slot, flags)) + payload;
+}
+
+size_t write_session_snapshot_locked(llama_seq_id seq, llama_state_seq_flags flags, uint8_t * dst, size_t capacity) {
+    const SessionSlot & slot = g_state.sessions[static_cast<size_t>(seq)];
+    const SeqSnapshotHeader header = snapshot_header_locked(slot, flags);
+    const size_t resident_bytes = slot.tokens.size() * sizeof(llama_token);
+    const size_t prefix = sizeof(SeqSnapshotHeader) + snapshot_tokens_bytes(header);
+    if (capacity <= prefix) {
+        return 0;
+    }
+    std::memcpy(dst, &header, sizeof(header));
+    std::memcpy(dst + sizeof(header), slot.tokens.data(), resident_bytes);
+    std::memcpy(dst + sizeof(header) + resident_bytes, slot.shifted.data(), slot.shifted.size() * sizeof(llama_token));
+    const size_t written = llama_state_seq_get_data_ext(g_state.ctx, dst + prefix, capacity - prefix, seq, flags);
+    return written == 0 ? 0 : prefix + written;
+}
+
+bool accept_snapshot_header(const SeqSnapshotHeader & header, llama_state_seq_flags flags) {
+    return header.magic == kSeqSnapshotMagic && header.version == kSeqSnapshotVersion &&
+           header.flags == flags && header.n_tokens <= static_cast<uint32_t>(g_state.n_ctx) &&
+           header.n_keep <= header.n_tokens;
+}
+
+// Loads a per-sequence snapshot into chat_id's slot without touching other
+// sequences; `load(seq)` feeds the llama payload. A partial-only snapshot (SWA /
+// recurrent part) is applied on top of the slot's resident full-attention
+// cells, which must match its tokens.
+template <typename LoadFn>
+bool restore_session_locked(int64_t chat_id, llama_state_seq_flags flags, std::vector<llama_token> tokens,
+                            std::vector<llama_token> shifted, size_t n_keep, LoadFn && load) {
+    llama_memory_t mem = llama_get_memory(g_state.ctx);
+    llama_seq_id seq = find_session_locked(chat_id);
+    if (flags & LLAMA_STATE_SEQ_FLAGS_PARTIAL_ONLY) {
+        if (seq < 0) {
+            return false;
+        }
+        const std::vector<llama_token> & resident = g_state.sessions[static_cast<size_t>(seq)].tokens;
+        if (resident.size() < tokens.size() || !std::equal(tokens.begin(), tokens.end(), resident.begin())) {
+            return false;
+        }
+        llama_memory_seq_rm(mem, seq, static_cast<llama_pos>(tokens.size()), -1);
+    } else {
+        if (seq < 0) {
+            seq = bind_new_session_locked(chat_id);
+        } else {
+            llama_memory_seq_rm(mem, seq, -1, -1);
+        }
+        g_state.sessions[static_cast<size_t>(seq)].clear_history();
+    }
+
+    SessionSlot & slot = g_state.sessions[static_cast<size_t>(seq)];
+    slot.last_used = ++g_state.session_clock;
+    g_state.active_seq = seq;
+    if (!(flags & LLAMA_STATE_SEQ_FLAGS_PARTIAL_ONLY)) {
+        ensure_session_capacity_locked(tokens.size());
+    }
+    if (!load(seq)) {
+        LOGE("session: restore failed chat=%lld seq=%d", static_cast<long long>(chat_id), seq);
+        llama_memory_seq_rm(mem, seq, -1, -1);
+        slot.clear_history();
+        return false;
+    }
+    slot.tokens = std::move(tokens);
+    slot.shifted = std::move(shifted);
+    slot.n_keep = n_keep;
+    return true;
+}
+
+bool read_session_snapshot_locked(int64_t chat_id, llama_state_seq_flags flags, const uint8_t * src, size_t size) {
+    SeqSnapshotHeader header{};
+    if (size < sizeof(header)) {
+        return false;
+    }
+    std::memcpy(&header, src, sizeof(header));
+    const size_t tokens_bytes = snapshot_tokens_bytes(header);
+    if (!accept_snapshot_header(header, flags) || size <= sizeof(header) + tokens_bytes) {
+        LOGE("session: rejected snapshot for chat=%lld", static_cast<long long>(chat_id));
+        return false;
+    }
+    const llama_token * stored = reinterpret_cast<const llama_token *>(src + sizeof(header));
+    std::vector<llama_token> tokens(header.n_tokens);
+    std::vector<llama_token> shifted(header.n_shifted);
+    std::memcpy(tokens.data(), stored, tokens.size() * sizeof(llama_token));
+    std::memcpy(shifted.data(), stored + header.n_tokens, shifted.size() * sizeof(llama_token));
+    const uint8_t * payload = src + sizeof(header) + tokens_bytes;
+    const size_t payload_size = size - sizeof(header) - tokens_bytes;
+    return restore_session_locked(chat_id, flags, std::move(tokens), std::move(shifted), header.n_keep,
+                                  [&](llama_seq_id seq) {
+                                      return llama_state_seq_set_data_ext(g_state.ctx, payload, payload_size,
+                                                                          seq, flags) > 0;
+                                  });
+}
+
+// Writes to `path` through a temp file so a failed save never clobbers an older snapshot.
+// Returns the stored (compressed) size, 0 on failure.
+template <typename WriteFn>
+int64_t save_compressed_locked(const std::string & path, StateStreamKind kind, WriteFn && write) {
+    const std::string tmp = path + ".tmp";
+    const int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        LOGE("state: cannot open %s", tmp.c_str());
+        return 0;
+    }
+    StateStreamWriter writer(fd, kind);
+    const bool ok = write(writer) && writer.finish();
+    const bool closed = close(fd) == 0;
+    if (!ok || !closed || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        LOGE("state: compressed save failed for %s", path.c_str());
+        std::remove(tmp.c_str());
+        return 0;
+    }
+    LOGI("state: saved %s raw=%llu stored=%llu", path.c_str(),
+         static_cast<unsigned long long>(writer.raw_bytes()),
+         static_cast<unsigned long long>(writer.stored_bytes()));
+    return static_cast<int64_t>(writer.stored_bytes());
+}
+
+int64_t save_session_compressed_locked(llama_seq_id seq, const std::string & path) {
+    const SessionSlot & slot = g_state.sessions[static_cast<size_t>(seq)];
+    return save_compressed_locked(path, StateStreamKind::Sequence, [&](StateStreamWriter & writer) {
+        const SeqSnapshotHeader header = snapshot_header_locked(slot, 0);
+        return writer.write(&header, sizeof(header)) &&
+               writer.write(slot.tokens.data(), slot.tokens.size() * sizeof(llama_token)) &&
+               writer.write(slot.shifted.data(), slot.shifted.size() * sizeof(llama_token)) &&
+               llama_state_seq_write_stream(g_state.ctx, seq, 0, StateStreamWriter::callback, &writer) > 0;
+    });
+}
+
+bool load_session_compressed_locked(int64_t chat_id, const std::string & path) {
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    StateStreamReader reader(fd, StateStreamKind::Sequence);
+    SeqSnapshotHeader header{};
+    bool ok = reader.read(&header, sizeof(header)) && accept_snapshot_header(header, 0);
+    std::vector<llama_token> tokens;
+    std::vector<llama_token> shifted;
+    if (ok) {
+        tokens.resize(header.n_tokens);
+        shifted.resize(header.n_shifted);
+        ok = reader.read(tokens.data(), tokens.size() * sizeof(llama_token)) &&
+             reader.read(shifted.data(), shifted.size() * sizeof(llama_token));
+    }
+    if (ok) {
+        ok = restore_session_locked(chat_id, 0, std::move(tokens), std::move(shifted), header.n_keep,
+                                    [&](llama_seq_id seq) {
+                                        return llama_state_seq_read_stream(g_state.ctx, seq, 0,
+                                                                           StateStreamReader::callback,
+                                                                           &reader) > 0 &&
+                                               reader.at_end();
+                                    });
+    }
+    close(fd);
+    if (!ok) {
+        LOGE("session: compressed restore failed chat=%lld path=%s", static_cast<long long>(chat_id), path.c_str());
+    }
+    return ok;
+}
+
+bool prepare_prompt_tokens(const llama_vocab * vocab, const std::string & text, std::vector<llama_token> & out_tokens);
+
+// Greedy at temperature 0, otherwise top-k, top-p and temperature before a seeded draw.
+llama_sampler * make_sampler(const GenerationRequest & req) {
+    llama_sampler * sampler = llama_sampler_chain_init(llama_sampler_chain_default_params());
+    if (!sampler) {
+        return nullptr;
+    }
+    if (req.temperature <= 0.0f) {
+        llama_sampler_chain_add(sampler, llama_sampler_init_greedy());
+    } else {
+        if (req.top_k > 0) {
+            llama_sampler_chain_add(sampler, llama_sampler_init_top_k(req.top_k));
+        }
+        if (req.top_p > 0.0f && req.top_p < 1.0f) {
+            llama_sampler_chain_add(sampler, llama_sampler_init_top_p(req.top_p, 1));
+        }
+        llama_sampler_chain_add(sampler, llama_sampler_init_temp(req.temperature));
+        const uint32_t seed = static_cast<uint32_t>(llama_time_us() & 0xFFFFFFFFULL);
+        llama_sampler_chain_add(sampler, llama_sampler_init_dist(seed));
+    }
+    return sampler;
+}
+
+llama_batch & batch_with_capacity_locked(int32_t n_tokens) {
+    if (g_state.batch_capacity < n_tokens) {
+        if (g_state.batch_capacity > 0) {
+            llama_batch_free(g_state.batch);
+        }
+        g_state.batch = llama_batch_init(n_tokens, 0, 1);
+        g_state.batch_capacity = n_tokens;
+    }
+    return g_state.batch;
+}
+
+void publish_aux_text(AuxSlot & slot, std::string_view text) {
+    if (text.empty()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(g_state.aux_mutex);
+        slot.outbox.append(text);
+    }
+    g_state.aux_cv.notify_all();
+}
+
+// Ends an auxiliary request: final metrics, the text still held back, its
+// sequence cleared for the next one. Setting `done` hands the slot back to
+// the requesting thread, so nothing touches it afterwards.
+void finish_aux_locked(AuxSlot & slot, StopReason reason) {
+    GenerationSummary & summary = slot.summary;
+    const double now_ms = llama_time_us() / 1000.0;
+    summary.reason = reason;
+    if (slot.t_decode_start_ms > 0.0) {
+        summary.metrics.decode_ms = now_ms - slot.t_decode_start_ms;
+        if (summary.metrics.decode_ms > 0.0 && summary.metrics.generation_tokens > 0) {
+            summary.metrics.tps = (summary.metrics.generation_tokens * 1000.0) / summary.metrics.decode_ms;
+        }
+    }
+    if (slot.t_start_ms > 0.0) {
+        summary.metrics.total_ms = now_ms - slot.t_start_ms;
+    }
+    summary.metrics.truncated = reason == StopReason::MaxTokens || reason == StopReason::Error;
+    summary.success = reason != StopReason::Error;
+    if (summary.success) {
+        publish_aux_text(slot, slot.detok.flush());
+    }
+    if (slot.sampler) {
+        llama_sampler_free(slot.sampler);
+        slot.sampler = nullptr;
+    }
+    if (slot.seq >= 0 && g_state.ctx) {
+        llama_memory_seq_rm(llama_get_memory(g_state.ctx), slot.seq, -1, -1);
+    }
+    auto & active = g_state.aux_active;
+    active.erase(std::remove(active.begin(), active.end(), &slot), active.end());
+    LOGI("aux: done seq=%d reason=%s tokens=%d", slot.seq, stop_reason_name(reason), summary.metrics.generation_tokens);
+    {
+        std::lock_guard<std::mutex> lock(g_state.aux_mutex);
+        slot.done = true;
+    }
+    g_state.aux_cv.notify_all();
+}
+
+// Before the context is replaced or its cache rewritten.
+void fail_active_aux_locked() {
+    const std::vector<AuxSlot *> active = g_state.aux_active;
+    for (AuxSlot * slot : active) {
+        finish_aux_locked(*slot, StopReason::Error);
+    }
+}
+
+// Queued requests that can never be admitted, with no model loaded.
+void fail_pending_aux_locked() {
+    std::deque<AuxSlot *> pending;
+    {
+        std::lock_guard<std::mutex> lock(g_state.aux_mutex);
+        pending.swap(g_state.aux_pending);
+    }
+    for (AuxSlot * slot : pending) {
+        finish_aux_locked(*slot, StopReason::Error);
+    }
+}
+
+// Tokenizes the request into a free reserved sequence, making room for its
+// prompt and reply by evicting cold chat sessions.
+void start_aux_locked(AuxSlot & slot) {
+    slot.t_start_ms = llama_time_us() / 1000.0;
+    GenerationSummary & summary = slot.summary;
+    summary.metrics.queue_wait_ms = slot.t_start_ms - slot.t_submit_ms;
+    const GenerationRequest & req = slot.req;
+    const std::string full_prompt = req.system_prompt.empty()
+            ? req.prompt
+            : (req.system_prompt + "\n\n" + req.prompt);
+    const llama_vocab * vocab = llama_model_get_vocab(g_state.model);
+    if (!prepare_prompt_tokens(vocab, full_prompt, slot.prompt) || slot.prompt.empty()) {
+        LOGE("aux: failed to tokenize prompt");
+        finish_aux_locked(slot, StopReason::Error);
+        return;
+    }
+    ensure_session_capacity_locked(slot.prompt.size() + static_cast<size_t>(std::max(req.max_tokens, 0)));
+    if (resident_cells_locked() + slot.prompt.size() + 1 > static_cast<size_t>(g_state.n_ctx)) {
+        LOGE("aux: prompt of %zu tokens does not fit the context", slot.prompt.size());
+        finish_aux_locked(slot, StopReason::Error);
+        return;
+    }
+    slot.sampler = make_sampler(req);
+    if (!slot.sampler) {
+        finish_aux_locked(slot, StopReason::Error);
+        return;
+    }
+    const llama_seq_id first = static_cast<llama_seq_id>(g_state.sessions.size());
+    for (llama_seq_id seq = first; seq < first + g_state.aux_sequences; ++seq) {
+        const bool taken = std::any_of(g_state.aux_active.begin(), g_state.aux_active.end(),
+                                       [seq](const AuxSlot * other) { return other->seq == seq; });
+        if (!taken) {
+            slot.seq = seq;
+            break;
+        }
+    }
+    llama_memory_seq_rm(llama_get_memory(g_state.ctx), slot.seq, -1, -1);
+    summary.metrics.prompt_tokens = static_cast<int>(slot.prompt.size());
+    summary.metrics.prefilled_tokens = static_cast<int>(slot.prompt.size());
+    g_state.aux_active.push_back(&slot);
+    ++g_state.aux_requests;
+    LOGI("aux: start seq=%d prompt_tokens=%zu queue_wait_ms=%.2f", slot.seq, slot.prompt.size(),
+         summary.metrics.queue_wait_ms);
+}
+
+// Moves queued requests into free reserved sequences.
+void admit_aux_locked() {
+    std::vector<AuxSlot *> admitted;
+    {
+        std::lock_guard<std::mutex> lock(g_state.aux_mutex);
+        while (!g_state.aux_pending.empty() &&
+               g_state.aux_active.size() + admitted.size() < static_cast<size_t>(g_state.aux_sequences)) {
+            admitted.push_back(g_state.aux_pending.front());
+            g_state.aux_pending.pop_front();
+        }
+    }
+    for (AuxSlot * slot : admitted) {
+        start_aux_locked(*slot);
+    }
+}
+
+// Appends each active request's next tokens after what `batch` already holds:
+// its last sampled token, or the next slice of its prompt, with prompt slices
+// sharing `prompt_budget`. Returns the tokens added. Requests that were
+// cancelled or no longer fit the context end here.
+int32_t stage_aux_locked(llama_batch & batch, int32_t prompt_budget) {
+    const int32_t n_before = batch.n_tokens;
+    size_t resident = resident_cells_locked() + static_cast<size_t>(n_before);
+    const std::vector<AuxSlot *> active = g_state.aux_active;
+    for (AuxSlot * slot : active) {
+        if (slot->cancelled.load(std::memory_order_relaxed)) {
+            finish_aux_locked(*slot, StopReason::Error);
+            continue;
+        }
+        const bool prefilling = slot->n_past < slot->prompt.size();
+        const llama_token * tokens = nullptr;
+        int32_t n = 0;
+        if (prefilling) {
+            n = static_cast<int32_t>(std::min<size_t>(std::max(prompt_budget, 0), slot->prompt.size() - slot->n_past));
+            tokens = slot->prompt.data() + slot->n_past;
+            prompt_budget -= n;
+        } else if (slot->next != LLAMA_TOKEN_NULL) {
+            n = 1;
+            tokens = &slot->next;
+        }
+        if (n == 0) {
+            continue;
+        }
+        if (resident + static_cast<size_t>(n) > static_cast<size_t>(g_state.n_ctx)) {
+            // No shifts for auxiliary replies; a full context ends them.
+            finish_aux_locked(*slot, prefilling ? StopReason::Error : StopReason::MaxTokens);
+            continue;
+        }
+        resident += static_cast<size_t>(n);
+        const bool wants_logits = !prefilling || slot->n_past + static_cast<size_t>(n) == slot->prompt.size();
+        for (int32_t i = 0; i < n; ++i) {
+            const int32_t idx = batch.n_tokens++;
+            batch.token[idx] = tokens[i];
+            batch.pos[idx] = static_cast<llama_pos>(slot->n_past) + i;
+            batch.n_seq_id[idx] = 1;
+            batch.seq_id[idx][0] = slot->seq;
+            batch.logits[idx] = wants_logits && i == n - 1;
+        }
+        slot->n_staged = n;
+        slot->logits_idx = wants_logits ? batch.n_tokens - 1 : -1;
+    }
+    return batch.n_tokens - n_before;
+}
+
+// Samples a token for an auxiliary request and routes its text to the outbox.
+void deliver_aux_locked(AuxSlot & slot, llama_token token) {
+    GenerationSummary & summary = slot.summary;
+    const llama_vocab * vocab = llama_model_get_vocab(g_state.model);
+    if (llama_vocab_is_eog(vocab, token)) {
+        finish_aux_locked(slot, StopReason::Eos);
+        return;
+    }
+    std::string_view matched;
+    publish_aux_text(slot, slot.detok.push(token, matched));
+    if (summary.metrics.generation_tokens == 0) {
+        summary.metrics.ttfs_ms = llama_time_us() / 1000.0 - slot.t_start_ms;
+    }
+    summary.metrics.generation_tokens += 1;
+    ++g_state.aux_tokens;
+    if (!matched.empty()) {
+        summary.stop_sequence.assign(matched);
+        finish_aux_locked(slot, StopReason::StopSequence);
+        return;
+    }
+    if (summary.metrics.generation_tokens >= slot.req.max_tokens) {
+        finish_aux_locked(slot, StopReason::MaxTokens);
+        return;
+    }
+    slot.next = token;
+}
+
+// After the decode that carried the staged tokens: advances every request
+// that had tokens in it and samples those whose logits it produced.
+void commit_aux_locked(int32_t rc) {
+    const std::vector<AuxSlot *> active = g_state.aux_active;
+    for (AuxSlot * slot : active) {
+        const int32_t n = slot->n_staged;
+        const int32_t idx = slot->logits_idx;
+        slot->n_staged = 0;
+        slot->logits_idx = -1;
+        if (n == 0) {
+            continue;
+        }
+        if (rc == 2) {
+            // Aborted with the chat reply; ubatches that landed are dropped and retried.
+            llama_memory_seq_rm(llama_get_memory(g_state.ctx), slot->seq, static_cast<llama_pos>(slot->n_past), -1);
+            continue;
+        }
+        if (rc != 0) {
+            LOGE("aux: decode failed rc=%d", rc);
+            finish_aux_locked(*slot, StopReason::Error);
+            continue;
+        }
+        slot->n_past += static_cast<size_t>(n);
+        if (idx < 0) {
+            continue;
+        }
+        if (slot->t_decode_start_ms == 0.0) {
+            slot->t_decode_start_ms = llama_time_us() / 1000.0;
+            slot->summary.metrics.prefill_ms = slot->t_decode_start_ms - slot->t_start_ms;
+            if (slot->summary.metrics.prefill_ms > 0.0) {
+                slot->summary.metrics.prompt_tps =
+                        (slot->summary.metrics.prefilled_tokens * 1000.0) / slot->summary.metrics.prefill_ms;
+            }
+        }
+        const llama_token token = llama_sampler_sample(slot->sampler, g_state.ctx, idx);
+        llama_sampler_accept(slot->sampler, token);
+        deliver_aux_locked(*slot, token);
+    }
+}
+
+// One decode of auxiliary tokens alone, for when no chat reply is running to
+// carry them. False once no request is left to step.
+bool step_aux_locked() {
+    admit_aux_locked();
+    if (g_state.aux_active.empty()) {
+        return false;
+    }
+    const int32_t n_batch = static_cast<int32_t>(llama_n_batch(g_state.ctx));
+    llama_batch & batch = batch_with_capacity_locked(n_batch);
+    batch.n_tokens = 0;
+    if (stage_aux_locked(batch, n_batch - g_state.aux_sequences) == 0) {
+        return !g_state.aux_active.empty();
+    }
+    const size_t n_sequences = static_cast<size_t>(std::count_if(
+            g_state.aux_active.begin(), g_state.aux_active.end(), [](const AuxSlot * slot) { return slot->n_staged > 0; }));
+    if (n_sequences > 1) {
+        ++g_state.batched_decodes;
+    }
+    commit_aux_locked(llama_decode(g_state.ctx, batch));
+    return true;
+}
+
+enum class BatchLogits {
+    None,
+    Last,
+    // Every position, for verifying a speculative draft.
+    All,
+};
+
+// Appends tokens to the active session's sequence. Steps that produce logits
+// also carry the active auxiliary requests' tokens after them; shift rebuilds
+// and the early slices of a long prefill run alone.
+int32_t decode_session_tokens_locked(const llama_token * tokens, int32_t n_tokens,
+                                     BatchLogits logits = BatchLogits::Last) {
+    SessionSlot & slot = active_session_locked();
+    const llama_pos pos0 = static_cast<llama_pos>(slot.tokens.size());
+    llama_batch & batch = batch_with_capacity_locked(n_tokens + kAuxPrefillPerStep + g_state.aux_sequences);
+    batch.n_tokens = n_tokens;
+    for (int32_t i = 0; i < n_tokens; ++i) {
+        batch.token[i] = tokens[i];
+        batch.pos[i] = pos0 + i;
+        batch.n_seq_id[i] = 1;
+        batch.seq_id[i][0] = g_state.active_seq;
+        batch.logits[i] = logits == BatchLogits::All || (logits == BatchLogits::Last && i == n_tokens - 1);
+    }
+    g_state.logits_idx = n_tokens - 1;
+    int32_t n_aux = 0;
+    const int32_t n_batch = static_cast<int32_t>(llama_n_batch(g_state.ctx));
+    if (logits != BatchLogits::None && n_tokens + g_state.aux_sequences <= n_batch) {
+        admit_aux_locked();
+        n_aux = stage_aux_locked(batch, std::min(kAuxPrefillPerStep, n_batch - n_tokens - g_state.aux_sequences));
+    }
+    const int32_t rc = llama_decode(g_state.ctx, batch);
+    if (rc == 0) {
+        slot.tokens.insert(slot.tokens.end(), tokens, tokens + n_tokens);
+    }
+    if (n_aux > 0) {
+        ++g_state.batched_decodes;
+        commit_aux_locked(rc);
+    }
+    return rc;
+}
+
+// Evicts at least `needed` tokens, and half of what follows the kept head, from
+// the active sequence: the cells after the first n_keep are removed and the
+// rest slide down with llama_memory_seq_add, so decoding continues at the same
+// per-token cost. Memory that cannot shift is rebuilt from the surviving tokens
+// instead. False when the head leaves nothing to evict.
+bool shift_active_session_locked(size_t needed, EngineMetrics & metrics) {
+    llama_memory_t mem = llama_get_memory(g_state.ctx);
+    const llama_seq_id seq = g_state.active_seq;
+    SessionSlot & slot = active_session_locked();
+    const size_t n_keep = std::min(slot.n_keep, slot.tokens.size());
+    const size_t n_evictable = slot.tokens.size() - n_keep;
+    if (needed > n_evictable || n_evictable == 0) {
+        LOGE("context shift: cannot free %zu cells, %zu evictable", needed, n_evictable);
+        return false;
+    }
+    const size_t n_discard = std::max(needed, n_evictable / 2);
+    const auto first = slot.tokens.begin() + static_cast<std::ptrdiff_t>(n_keep);
+    const auto last = first + static_cast<std::ptrdiff_t>(n_discard);
+    const llama_pos p0 = static_cast<llama_pos>(n_keep);
+    const llama_pos p1 = static_cast<llama_pos>(n_keep + n_discard);
+
+    const bool shifted = llama_memory_can_shift(mem) && llama_memory_seq_rm(mem, seq, p0, p1);
+    std::vector<llama_token> rebuild;
+    if (shifted) {
+        llama_memory_seq_add(mem, seq, p1, -1, -static_cast<llama_pos>(n_discard));
+    } else {
+        rebuild.assign(slot.tokens.begin(), first);
+        rebuild.insert(rebuild.end(), last, slot.tokens.end());
+    }
+    slot.shifted.insert(slot.shifted.end(), first, last);
+    slot.tokens.erase(first, last);
+    metrics.context_shifts += 1;
+    metrics.evicted_tokens += static_cast<int>(n_discard);
+    LOGI("context shift: seq=%d keep=%zu evicted=%zu resident=%zu shift=%d", seq, n_keep, n_discard,
+         slot.tokens.size(), shifted ? 1 : 0);
+    if (shifted) {
+        return true;
+    }
+
+    llama_memory_seq_rm(mem, seq, -1, -1);
+    slot.tokens.clear();
+    const int32_t n_batch = std::max<int32_t>(1, static_cast<int32_t>(llama_n_batch(g_state.ctx)));
+    for (size_t done = 0; done < rebuild.size();) {
+        const int32_t n = static_cast<int32_t>(std::min<size_t>(n_batch, rebuild.size() - done));
+        if (decode_session_tokens_locked(rebuild.data() + done, n, BatchLogits::None) != 0) {
+            return false;
+        }
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Ends auxiliary requests, those holding the most cells first, until n_next
+// more cells fit: a side request must never cost the chat its history. One
+// still prefilling fails; a reply is cut short as if it ran out of tokens.
+void end_aux_for_room_locked(size_t n_next) {
+    const size_t n_ctx = static_cast<size_t>(g_state.n_ctx);
+    while (!g_state.aux_active.empty() && resident_cells_locked() + n_next > n_ctx) {
+        AuxSlot & slot = **std::max_element(g_state.aux_active.begin(), g_state.aux_active.end(),
+                                            [](const AuxSlot * a, const AuxSlot * b) { return a->n_past < b->n_past; });
+        if (slot.n_past == 0) {
+            break;
+        }
+        LOGI("aux: seq=%d ended to make room for the chat, %zu cells", slot.seq, slot.n_past);
+        finish_aux_locked(slot, slot.n_past < slot.prompt.size() ? StopReason::Error : StopReason::MaxTokens);
+    }
+}
+
+// Called before every decode into the active sequence: cold sessions are
+// evicted first, then auxiliary requests ended, and the active one is shifted
+// if n_next cells still do not fit.
+bool make_room_locked(size_t n_next, EngineMetrics & metrics) {
+    ensure_session_capacity_locked(n_next);
+    end_aux_for_room_locked(n_next);
+    const size_t resident = resident_cells_locked();
+    const size_t n_ctx = static_cast<size_t>(g_state.n_ctx);
+    return resident + n_next <= n_ctx || shift_active_session_locked(resident + n_next - n_ctx, metrics);
+}
+
+// Decodes the prompt tail in n_batch slices so prompts longer than one batch
+// work, an abort lands between slices, and progress is visible to other
+// threads. Slices that completed stay resident (and reusable) after an abort.
+// A prompt longer than the context slides through it by context shifts.
+int32_t prefill_session_tokens_locked(const llama_token * tokens, int32_t n_tokens, bool & aborted,
+                                      EngineMetrics & metrics) {
+    aborted = false;
+    // A slice must fit beside the kept head for a shift to make room for it.
+    const int32_t n_room = std::max<int32_t>(
+            1, g_state.n_ctx - static_cast<int32_t>(active_session_locked().n_keep));
+    const int32_t n_batch = std::min(n_room, std::max<int32_t>(1, static_cast<int32_t>(llama_n_batch(g_state.ctx))));
+    g_state.prefill_done.store(0, std::memory_order_relaxed);
+    g_state.prefill_total.store(n_tokens, std::memory_order_relaxed);
+    g_state.prefill_started_us.store(llama_time_us(), std::memory_order_relaxed);
+
+    int32_t rc = 0;
+    for (int32_t done = 0; done < n_tokens;) {
+        if (g_state.should_abort.load(std::memory_order_relaxed)) {
+            aborted = true;
+            break;
+        }
+        const int32_t n = std::min(n_batch, n_tokens - done);
+        if (!make_room_locked(static_cast<size_t>(n), metrics)) {
+            rc = -1;
+            break;
+        }
+        rc = decode_session_tokens_locked(tokens + done, n, done + n == n_tokens ? BatchLogits::Last : BatchLogits::None);
+        if (rc == 2) {
+            // Interrupted by the abort callback; the slice's ubatches are not tracked.
+            aborted = true;
+            rc = 0;
+            llama_memory_seq_rm(llama_get_memory(g_state.ctx), g_state.active_seq,
+                                static_cast<llama_pos>(active_session_locked().tokens.size()), -1);
+            break;
+        }
+        if (rc != 0) {
+            break;
+        }
+        done += n;
+        g_state.prefill_done.store(done, std::memory_order_relaxed);
+    }
+    g_state.prefill_total.store(0, std::memory_order_relaxed);
+    return rc;
+}
+
+// Drops the active sequence after a failed decode left its cells in an unknown state.
+void discard_active_session_locked() {
+    llama_memory_seq_rm(llama_get_memory(g_state.ctx), g_state.active_seq, -1, -1);
+    active_session_locked().clear_history();
+}
+
+void free_draft_locked() {
+    common_speculative_free(g_state.spec);
+    g_state.spec = nullptr;
+    if (g_state.draft_ctx) {
+        llama_free(g_state.draft_ctx);
+        g_state.draft_ctx = nullptr;
+    }
+    if (g_state.draft_model) {
+        llama_model_free(g_state.draft_model);
+        g_state.draft_model = nullptr;
+    }
+    g_state.draft_max = 0;
+}
+
+// Loads the draft model next to the target. Failures only disable speculation.
+bool load_draft_locked(const EngineConfig & config) {
+    if (config.draft_model_path.empty() || config.draft_max <= 0) {
+        return false;
+    }
+    if (!file_exists(config.draft_model_path.c_str())) {
+        LOGE("draft model path not found: %s", config.draft_model_path.c_str());
+        return false;
+    }
+
+    llama_model_params mparams = llama_model_default_params();
+    mparams.n_gpu_layers = g_state.use_vulkan ? g_state.n_gpu_layers : 0;
+    mparams.use_mmap = true;
+    mparams.use_mlock = false;
+    llama_model * model = llama_model_load_from_file(config.draft_model_path.c_str(), mparams);
+    if (!model) {
+        LOGE("failed to load draft model");
+        return false;
+    }
+
+    llama_context_params cparams = llama_context_default_params();
+    cparams.n_ctx = static_cast<uint32_t>(g_state.n_ctx);
+    // The draft re-reads the whole prompt in a single batch after a session
+    // switch, so the batch must span the context; ubatches keep compute small.
+    cparams.n_batch = cparams.n_ctx;
+    cparams.n_ubatch = std::min(512U, cparams.n_ctx);
+    cparams.n_seq_max = 1;
+    cparams.n_threads = g_state.n_threads_decode;
+    cparams.n_threads_batch = g_state.n_threads;
+    cparams.offload_kqv = g_state.use_vulkan && g_state.n_gpu_layers > 0;
+    apply_kv_precision(cparams, g_state.kv_precision);
+    llama_context * ctx = llama_init_from_model(model, cparams);
+    if (!ctx) {
+        LOGE("failed to create draft context");
+        llama_model_free(model);
+        return false;
+    }
+    if (!common_speculative_are_compatible(g_state.ctx, ctx)) {
+        LOGE("draft model vocabulary does not match the target; speculation disabled");
+        llama_free(ctx);
+        llama_model_free(model);
+        return false;
+    }
+
+    attach_threads_locked(ctx);
+    g_state.draft_model = model;
+    g_state.draft_ctx = ctx;
+    g_state.spec = common_speculative_init(g_state.ctx, ctx);
+    g_state.draft_max = std::min(config.draft_max, 32);
+    g_state.draft_p_min = config.draft_p_min;
+    LOGI("draft model loaded draft_max=%d p_min=%.2f", g_state.draft_max, g_state.draft_p_min);
+    return true;
+}
+
+void unload_locked() {
+    // Clear abort flag before cleanup
+    g_state.should_abort.store(false, std::memory_order_relaxed);
+    
+    // Clean up context
+    g_state.model_path.clear();
+    purge_spill_dir_locked();
+    fail_active_aux_locked();
+    g_state.aux_sequences = 0;
+    g_state.pieces.reset(nullptr);
+    g_state.sessions.clear();
+    g_state.active_seq = 0;
+    if (g_state.batch_capacity > 0) {
+        llama_batch_free(g_state.batch);
+        g_state.batch = llama_batch{};
+        g_state.batch_capacity = 0;
+    }
+    if (g_state.embed_ctx) {
+        llama_free(g_state.embed_ctx);
+        g_state.embed_ctx = nullptr;
+    }
+    free_draft_locked();
+    g_state.lookup_max = 0;
+    g_state.chat_ngrams.clear();
+    if (g_state.ctx) {
+        llama_free(g_state.ctx);
+        g_state.ctx = nullptr;
+    }
+    free_threadpools_locked();
+    if (g_state.model) {
+        std::unique_lock<std::shared_mutex> vocab_lock(g_state.vocab_mutex);
+        llama_model_free(g_state.model);
+        g_state.model = nullptr;
+    }
+    ++g_state.model_epoch;
+    reset_metrics_locked();
+}
+
+// Abort callback function for llama context
+bool abort_callback_handler(void * data) {
+    (void) data;
+    return g_state.should_abort.load(std::memory_order_relaxed);
+}
+
+std::string escape_json(const std::string & input) {
+    std::ostringstream oss;
+    for (char ch : input) {
+        switch (ch) {
+            case '"': oss << "\\\""; break;
+            case '\\': oss << "\\\\"; break;
+            case '\b': oss << "\\b"; break;
+            case '\f': oss << "\\f"; break;
+            case '\n': oss << "\\n"; break;
+            case '\r': oss << "\\r"; break;
+            case '\t': oss << "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(ch) < 0x20) {
+                    oss << "\\u"
+                        << std::hex << std::uppercase << std::setw(4) << std::setfill('0')
+                        << static_cast<int>(static_cast<unsigned char>(ch))
+                        << std::dec << std::nouppercase;
+                } else {
+                    oss << ch;
+                }
+        }
+    }
+    return oss.str();
+}
+
+// Metrics fields that change only under the scheduler, without the braces;
+// metrics_json() adds the live ones.
+std::string build_metrics_fields_locked() {
+    const EngineMetrics & m = g_state.metrics;
+    std::ostringstream oss;
+    oss.setf(std::ios::fixed);
+    oss.precision(3);
+    oss << "\"nCtx\":" << g_state.n_ctx << ",";
+    oss << "\"nThreads\":" << g_state.n_threads << ",";
+    oss << "\"nThreadsDecode\":" << g_state.n_threads_decode << ",";
+    oss << "\"nGpuLayers\":" << g_state.n_gpu_layers << ",";
+    oss << "\"sessionSlots\":" << g_state.sessions.size() << ",";
+    oss << "\"useVulkan\":" << (g_state.use_vulkan ? "true" : "false") << ",";
+    oss << "\"kvType\":\"" << kv_precision_name(g_state.kv_precision) << "\",";
+    oss << "\"kvBytesPerToken\":" << g_state.kv_bytes_per_token << ",";
+    oss << "\"kvCacheBytes\":" << g_state.kv_bytes_per_token * static_cast<size_t>(g_state.n_ctx) << ",";
+    oss << "\"memoryBudgetBytes\":" << g_state.memory_budget_bytes << ",";
+    oss << "\"queueWaitMs\":" << m.queue_wait_ms << ",";
+    oss << "\"promptTokens\":" << m.prompt_tokens << ",";
+    oss << "\"generationTokens\":" << m.generation_tokens << ",";
+    oss << "\"ttfsMs\":" << m.ttfs_ms << ",";
+    oss << "\"prefillMs\":" << m.prefill_ms << ",";
+    oss << "\"decodeMs\":" << m.decode_ms << ",";
+    oss << "\"totalMs\":" << m.total_ms << ",";
+    oss << "\"tps\":" << m.tps << ",";
+    oss << "\"promptTps\":" << m.prompt_tps << ",";
+    oss << "\"contextUsedPct\":" << m.context_used_pct << ",";
+    oss << "\"reusedTokens\":" << m.reused_tokens << ",";
+    oss << "\"prefilledTokens\":" << m.prefilled_tokens << ",";
+    oss << "\"truncated\":" << (m.truncated ? "true" : "false") << ",";
+    oss << "\"speculative\":" << (g_state.spec || g_state.lookup_max > 0 ? "true" : "false") << ",";
+    oss << "\"draftMode\":\"" << (g_state.spec ? "model" : (g_state.lookup_max > 0 ? "lookup" : "none")) << "\",";
+    oss << "\"draftedTokens\":" << m.drafted_tokens << ",";
+    oss << "\"acceptedTokens\":" << m.accepted_tokens << ",";
+    oss << "\"targetDecodes\":" << m.target_decodes << ",";
+    oss << "\"acceptanceRate\":" << m.acceptance_rate << ",";
+    oss << "\"tokensPerDecode\":" << m.tokens_per_decode << ",";
+    oss << "\"contextShifts\":" << m.context_shifts << ",";
+    oss << "\"evictedTokens\":" << m.evicted_tokens << ",";
+    oss << "\"auxRequests\":" << g_state.aux_requests << ",";
+    oss << "\"auxTokens\":" << g_state.aux_tokens << ",";
+    oss << "\"batchedDecodes\":" << g_state.batched_decodes << ",";
+    oss << "\"stopReason\":\"" << stop_reason_name(g_state.stop_reason) << "\",";
+    oss << "\"stopSequence\":\"" << escape_json(g_state.stop_sequence) << "\"";
+    return oss.str();
+}
+
+// Scheduled access to g_state. Every entry point that touches the model or
+// its contexts holds one for the whole request; releasing it republishes the
+// metrics snapshot so metrics_json() never waits on a running request.
+class EngineLock {
+public:
+    explicit EngineLock(RequestPriority priority)
+        : priority_(priority), wait_ms_(g_state.scheduler.acquire(priority)) {
+        affinity_.pin(g_state.leader_core);
+    }
+
+    ~EngineLock() {
+        publish_metrics_locked();
+        g_state.scheduler.release();
+    }
+
+    EngineLock(const EngineLock &) = delete;
+    EngineLock & operator=(const EngineLock &) = delete;
+
+    double wait_ms() const { return wait_ms_; }
+
+    // Between decodes of a long background request: hands the engine to any
+    // queued higher-priority request and takes it back afterwards. Returns
+    // true when it yielded, after which contexts may have been replaced.
+    bool yield_if_preempted() {
+        if (!g_state.scheduler.should_yield(priority_)) {
+            return false;
+        }
+        publish_metrics_locked();
+        wait_ms_ += g_state.scheduler.yield(priority_);
+        affinity_.pin(g_state.leader_core);
+        return true;
+    }
+
+private:
+    static void publish_metrics_locked() {
+        std::string fields = build_metrics_fields_locked();
+        std::lock_guard<std::mutex> lock(g_state.metrics_mutex);
+        g_state.metrics_snapshot.swap(fields);
+    }
+
+    RequestPriority priority_;
+    double wait_ms_;
+    // The decode pool's worker 0 is whichever thread holds the engine; it is
+    // put back on its own cores when the engine is released.
+    ThreadAffinityGuard affinity_;
+};
+
+bool emit_chunk(TokenSink * sink, std::string_view text) {
+    return !sink || text.empty() || sink->emit(text);
+}
+
+// Signals done on scope exit, after anything declared later has been destroyed.
+struct SinkDoneGuard {
+    explicit SinkDoneGuard(TokenSink * target) : sink(target) {}
+    ~SinkDoneGuard() {
+        if (sink) {
+            sink->done();
+        }
+    }
+    TokenSink * sink;
+};
+
+bool prepare_prompt_tokens(const llama_vocab * vocab,
+                           const std::string & text,
+                           std::vector<llama_token> & out_tokens) {
+    out_tokens.resize(text.size() + 8);
+    int32_t n = llama_tokenize(vocab, text.c_str(), static_cast<int>(text.size()),
+                               out_tokens.data(), static_cast<int>(out_tokens.size()),
+                               /*add_special=*/true, /*parse_special=*/true);
+    if (n < 0) {
+        out_tokens.resize(static_cast<size_t>(-n));
+        n = llama_tokenize(vocab, text.c_str(), static_cast<int>(text.size()),
+                           out_tokens.data(), static_cast<int>(out_tokens.size()),
+                           true, true);
+    }
+    if (n < 0) {
+        return false;
+    }
+    out_tokens.resize(static_cast<size_t>(n));
+    return true;
+}
+
+bool contains_case_insensitive(const std::string & haystack, const std::string & needle) {
+    if (needle.empty()) return false;
+    auto it = std::search(
+        haystack.begin(), haystack.end(),
+        needle.begin(), needle.end(),
+        [](char ch1, char ch2) {
+            return std::tolower(static_cast<unsigned char>(ch1)) ==
+                   std::tolower(static_cast<unsigned char>(ch2));
+        });
+    return it != haystack.end();
+}
+
+std::string read_meta_value(const llama_model * model, const char * key) {
+    if (!model || !key) return {};
+    char buf[2048];
+    int32_t written = llama_model_meta_val_str(model, key, buf, sizeof(buf));
+    if (written < 0) {
+        return {};
+    }
+    if (written >= static_cast<int32_t>(sizeof(buf))) {
+        std::vector<char> big(static_cast<size_t>(written) + 1);
+        llama_model_meta_val_str(model, key, big.data(), big.size());
+        return std::string(big.data());
+    }
+    return std::string(buf);
+}
+
+// K and V head sizes; GGUF states them when they differ from n_embd / n_head.
+void kv_head_dims(const llama_model * model, int64_t & head_k, int64_t & head_v) {
+    head_k = llama_model_n_embd(model) / std::max(1, llama_model_n_head(model));
+    head_v = head_k;
+    const std::string arch = read_meta_value(model, "general.architecture");
+    const std::string key_length = read_meta_value(model, (arch + ".attention.key_length").c_str());
+    const std::string value_length = read_meta_value(model, (arch + ".attention.value_length").c_str());
+    if (!key_length.empty()) {
+        head_k = std::atoll(key_length.c_str());
+    }
+    if (!value_length.empty()) {
+        head_v = std::atoll(value_length.c_str());
+    }
+}
+
+// Quantized caches store whole blocks per head.
+bool kv_type_fits(const llama_model * model, ggml_type type) {
+    int64_t head_k = 0;
+    int64_t head_v = 0;
+    kv_head_dims(model, head_k, head_v);
+    const int64_t block = ggml_blck_size(type);
+    return head_k % block == 0 && head_v % block == 0;
+}
+
+// Bytes one cell takes across all layers of a KV cache with these types.
+// Exact for full attention; SWA layers with a capped cache and recurrent state
+// make the real footprint smaller.
+size_t kv_bytes_per_token(const llama_model * model, ggml_type type_k, ggml_type type_v) {
+    int64_t head_k = 0;
+    int64_t head_v = 0;
+    kv_head_dims(model, head_k, head_v);
+    const int64_t n_head_kv = llama_model_n_head_kv(model);
+    return static_cast<size_t>(std::max(0, llama_model_n_layer(model))) *
+           (ggml_row_size(type_k, head_k * n_head_kv) + ggml_row_size(type_v, head_v * n_head_kv));
+}
+
+// Weight bytes and KV bytes per token of the configured draft model, read
+// from its GGUF header without loading it.
+bool probe_draft_footprint(const EngineConfig & config, ggml_type type, size_t & weight_bytes, size_t & per_token) {
+    GgufModelInfo info;
+    if (config.draft_model_path.empty() || !gguf_probe(config.draft_model_path, info)) {
+        return false;
+    }
+    weight_bytes = static_cast<size_t>(info.weight_bytes);
+    per_token = gguf_kv_bytes_per_token(info, type, type);
+    return true;
+}
+
+// The largest n_ctx, in steps of 256 and at most `requested`, whose KV caches
+// fit in what the budget leaves after the weights: the generation and
+// embedding contexts each hold n_ctx cells of the target's cache (the latter
+// only without a dedicated embedder), the draft context n_ctx of its own. An
+// eighth of the budget stays free for compute buffers and logits.
+uint32_t budgeted_n_ctx(const EngineConfig & config, const llama_model * model, ggml_type type, uint32_t requested) {
+    const int64_t budget = config.memory_budget_bytes;
+    if (budget <= 0) {
+        return requested;
+    }
+    int64_t weights = static_cast<int64_t>(llama_model_size(model));
+    const int64_t contexts = g_embedder_loaded.load() ? 1 : 2;
+    int64_t per_token = contexts * static_cast<int64_t>(kv_bytes_per_token(model, type, type));
+    size_t draft_weights = 0;
+    size_t draft_per_token = 0;
+    if (probe_draft_footprint(config, type, draft_weights, draft_per_token)) {
+        weights += static_cast<int64_t>(draft_weights);
+        per_token += static_cast<int64_t>(draft_per_token);
+    }
+    const int64_t available = budget - budget / 8 - weights;
+    const int64_t fits = per_token > 0 ? std::max<int64_t>(0, available) / per_token : requested;
+    const uint32_t n_ctx = static_cast<uint32_t>(std::clamp<int64_t>(fits / 256 * 256, 512, requested));
+    LOGI("loadModel: budget=%lld weights=%lld kv_per_token=%lld -> n_ctx=%u (requested %u)",
+         static_cast<long long>(budget), static_cast<long long>(weights), static_cast<long long>(per_token),
+         n_ctx, requested);
+    if (available < per_token * 512) {
+        LOGE("loadModel: memory budget too small for the weights plus a 512-token context");
+    }
+    return n_ctx;
+}
+
+void apply_kv_precision(llama_context_params & cparams, KvPrecision precision) {
+    cparams.type_k = kv_ggml_type(precision);
+    cparams.type_v = cparams.type_k;
+    cparams.flash_attn_type = ggml_is_quantized(cparams.type_v) ? LLAMA_FLASH_ATTN_TYPE_ENABLED
+                                                                : LLAMA_FLASH_ATTN_TYPE_AUTO;
+}
+
+llama_context * create_context(llama_model * model, const llama_context_params & cparams) {
+    try {
+        return llama_init_from_model(model, cparams);
+    } catch (const std::exception& e) {
+        LOGE("failed to create llama context: %s", e.what());
+    } catch (...) {
+        LOGE("failed to create llama context: unknown error");
+    }
+    return nullptr;
+}
+
+// Keeps the longest prefix of prompt_tokens that the active sequence already
+// covers and drops everything after it, so only the divergent tail needs
+// prefill. Tokens a context shift evicted count as covered when the prompt
+// matches straight through them. Falls back to dropping the whole sequence
+// when the memory cannot remove a suffix (recurrent state) or the SWA window
+// has already slid past the reusable prefix. Returns the prompt tokens covered.
+size_t reuse_cached_prefix_locked(const std::vector<llama_token> & prompt_tokens) {
+    llama_memory_t mem = llama_get_memory(g_state.ctx);
+    const llama_seq_id seq = g_state.active_seq;
+    SessionSlot & slot = active_session_locked();
+    const std::vector<llama_token> & cached = slot.tokens;
+    const size_t n_keep = slot.shifted.empty() ? 0 : std::min(slot.n_keep, cached.size());
+    const size_t n_shifted = slot.shifted.size();
+    auto history_at = [&](size_t i) {
+        if (i < n_keep) {
+            return cached[i];
+        }
+        return i < n_keep + n_shifted ? slot.shifted[i - n_keep] : cached[i - n_shifted];
+    };
+
+    size_t n_match = 0;
+    const size_t limit = std::min(cached.size() + n_shifted, prompt_tokens.size());
+    while (n_match < limit && history_at(n_match) == prompt_tokens[n_match]) {
+        ++n_match;
+    }
+    // Re-decode at least the final prompt token so sampling has fresh logits.
+    if (n_match == prompt_tokens.size() && n_match > 0) {
+        --n_match;
+    }
+
+    // Resident tokens to keep. A prompt that diverges before the end of the
+    // evicted span needs those tokens back in the cache, so only the head survives.
+    size_t n_past = n_match;
+    if (n_shifted > 0) {
+        if (n_match >= n_keep + n_shifted) {
+            n_past = n_match - n_shifted;
+        } else {
+            n_past = std::min(n_match, n_keep);
+            slot.shifted.clear();
+        }
+    }
+
+    if (n_past > 0) {
+        const llama_pos n_swa = std::max(1, llama_model_n_swa(g_state.model));
+        const llama_pos pos_min = llama_memory_seq_pos_min(mem, seq);
+        if (pos_min < 0 || pos_min > std::max<llama_pos>(0, static_cast<llama_pos>(n_past) - n_swa)) {
+            n_past = 0;
+        }
+    }
+    if (n_past > 0 && !llama_memory_seq_rm(mem, seq, static_cast<llama_pos>(n_past), -1)) {
+        n_past = 0;
+    }
+    if (n_past == 0) {
+        llama_memory_seq_rm(mem, seq, -1, -1);
+        slot.shifted.clear();
+    }
+    slot.tokens.resize(n_past);
+    return n_past + slot.shifted.size();
+}
+
+// Tokens at the front of the prompt that context shifts keep: the sinks, the
+// system prompt and the request's keep_bytes, capped at half the context so a
+// shift always has room to work with.
+size_t keep_tokens_locked(const llama_vocab * vocab, const GenerationRequest & req, size_t n_prompt) {
+    size_t n_keep = kSinkTokens;
+    std::string head = req.prompt.substr(0, std::min(req.keep_bytes, req.prompt.size()));
+    if (!req.system_prompt.empty()) {
+        head = req.system_prompt + "\n\n" + head;
+    }
+    std::vector<llama_token> head_tokens;
+    if (!head.empty() && prepare_prompt_tokens(vocab, head, head_tokens)) {
+        n_keep = std::max(n_keep, head_tokens.size());
+    }
+    return std::min({n_keep, n_prompt, static_cast<size_t>(g_state.n_ctx) / 2});
+}
+
+// Runs sampled tokens through EOG detection and the detokenizer into the sink
+// and the output text, keeping the generation metrics current.
+struct TokenEmitter {
+    const llama_vocab * vocab;
+    StreamingDetokenizer & detok;
+    TokenSink * sink;
+    std::string * out_text;
+    GenerationSummary & summary;
+    double t_start_ms;
+
+    // False once generation must end: EOG or a failed emit, with summary.reason
+    // set. A matched stop sequence is returned through `matched_stop` and left
+    // to the caller, which may still need to decode the token.
+    bool deliver(llama_token token, std::string_view & matched_stop) {
+        matched_stop = {};
+        if (llama_vocab_is_eog(vocab, token)) {
+            LOGI("generate_internal: received EOS token after %d tokens", summary.metrics.generation_tokens);
+            summary.reason = StopReason::Eos;
+            return false;
+        }
+
+        const std::string_view emit = detok.push(token, matched_stop);
+        if (!emit.empty()) {
+            if (!emit_chunk(sink, emit)) {
+                LOGE("generate_internal: emit_chunk failed after %d tokens", summary.metrics.generation_tokens);
+                summary.reason = StopReason::Error;
+                return false;
+            }
+            if (out_text) {
+                out_text->append(emit);
+            }
+        }
+
+        if (summary.metrics.generation_tokens == 0) {
+            summary.metrics.ttfs_ms = llama_time_us() / 1000.0 - t_start_ms;
+            LOGI("generate_internal: first token emitted ttfs_ms=%.2f", summary.metrics.ttfs_ms);
+        }
+        summary.metrics.generation_tokens += 1;
+        const int n = summary.metrics.generation_tokens;
+        if (n <= 3 || n % 32 == 0) {
+            LOGI("generate_internal: streamed token %d released=%zu", n, emit.size());
+        }
+        return true;
+    }
+
+    void stop_on(std::string_view matched_stop) {
+        LOGI("generate_internal: stop sequence '%.*s' at token %d", static_cast<int>(matched_stop.size()),
+             matched_stop.data(), summary.metrics.generation_tokens);
+        summary.reason = StopReason::StopSequence;
+        summary.stop_sequence.assign(matched_stop);
+    }
+};
+
+bool abort_requested_locked(GenerationSummary & summary) {
+    if (!g_state.should_abort.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    LOGI("generate_internal: abort flag raised after %d tokens", summary.metrics.generation_tokens);
+    summary.reason = StopReason::Error;
+    summary.metrics.truncated = true;
+    return true;
+}
+
+void fail_decode_locked(GenerationSummary & summary) {
+    LOGE("decode failed during generation");
+    discard_active_session_locked();
+    summary.reason = StopReason::Error;
+    summary.metrics.truncated = true;
+}
+
+// One target decode per generated token.
+void decode_plain_locked(const GenerationRequest & req, llama_sampler * sampler,
+                         TokenEmitter & emitter, GenerationSummary & summary) {
+    std::string_view matched_stop;
+    for (int i = 0; i < req.max_tokens; ++i) {
+        if (abort_requested_locked(summary)) {
+            break;
+        }
+
+        const llama_token token = llama_sampler_sample(sampler, g_state.ctx, g_state.logits_idx);
+        llama_sampler_accept(sampler, token);
+        if (!emitter.deliver(token, matched_stop)) {
+            break;
+        }
+
+        summary.metrics.target_decodes += 1;
+        if (!make_room_locked(1, summary.metrics) || decode_session_tokens_locked(&token, 1) != 0) {
+            fail_decode_locked(summary);
+            break;
+        }
+        if (!matched_stop.empty()) {
+            emitter.stop_on(matched_stop);
+            break;
+        }
+    }
+}
+
+// Proposes tokens to follow the last sampled one for the target to verify.
+class Drafter {
+public:
+    virtual ~Drafter() = default;
+    // `decoded` is what the target's sequence holds; `id_last` follows it.
+    virtual std::vector<llama_token> draft(const std::vector<llama_token> & decoded, llama_token id_last,
+                                           int n_draft) = 0;
+    // Every token the target commits, in order, starting with the first sample.
+    virtual void accept(llama_token token) { (void) token; }
+};
+
+class ModelDrafter final : public Drafter {
+public:
+    std::vector<llama_token> draft(const std::vector<llama_token> & decoded, llama_token id_last,
+                                   int n_draft) override {
+        common_speculative_params params;
+        params.n_draft = n_draft;
+        params.p_min = g_state.draft_p_min;
+        return common_speculative_gen_draft(g_state.spec, params, decoded, id_last);
+    }
+};
+
+// Prompt lookup: continues the current n-gram from earlier occurrences in the
+// prompt (retrieved passages, quoted code) or in the chat's previous replies.
+// Costs no model memory; a miss leaves the step at a single token.
+class NgramDrafter final : public Drafter {
+public:
+    NgramDrafter(const std::vector<llama_token> & prompt, common_ngram_cache & chat_cache)
+        : history_(prompt), chat_cache_(chat_cache), prompt_size_(prompt.size()) {
+        common_ngram_cache_update(context_, LLAMA_NGRAM_MIN, LLAMA_NGRAM_MAX, history_,
+                                  static_cast<int>(history_.size()), false);
+    }
+
+    // Folds this reply into the chat's n-grams for later turns.
+    ~NgramDrafter() override {
+        const int n_new = static_cast<int>(history_.size() - prompt_size_);
+        if (n_new > 0) {
+            common_ngram_cache_update(chat_cache_, LLAMA_NGRAM_MIN, LLAMA_NGRAM_MAX, history_, n_new, false);
+        }
+    }
+
+    std::vector<llama_token> draft(const std::vector<llama_token> & decoded, llama_token id_last,
+                                   int n_draft) override {
+        (void) decoded;
+        std::vector<llama_token> out(1, id_last);
+        common_ngram_cache_draft(history_, out, n_draft, LLAMA_NGRAM_MIN, LLAMA_NGRAM_MAX,
+                                 context_, chat_cache_, static_cache_);
+        out.erase(out.begin());
+        return out;
+    }
+
+    void accept(llama_token token) override {
+        history_.push_back(token);
+        common_ngram_cache_update(context_, LLAMA_NGRAM_MIN, LLAMA_NGRAM_MAX, history_, 1, false);
+    }
+
+private:
+    std::vector<llama_token> history_;
+    common_ngram_cache & chat_cache_;
+    size_t prompt_size_;
+    common_ngram_cache context_;
+    // No corpus statistics ship with the app.
+    common_ngram_cache static_cache_;
+};
+
+// The active chat's reply n-grams, creating them and dropping the least
+// recently used chat's beyond kMaxLookupChats.
+common_ngram_cache & chat_ngrams_locked() {
+    const int64_t chat_id = active_session_locked().chat_id;
+    auto it = g_state.chat_ngrams.find(chat_id);
+    if (it == g_state.chat_ngrams.end()) {
+        if (g_state.chat_ngrams.size() >= kMaxLookupChats) {
+            auto oldest = std::min_element(g_state.chat_ngrams.begin(), g_state.chat_ngrams.end(),
+                                           [](const auto & a, const auto & b) {
+                                               return a.second.last_used < b.second.last_used;
+                                           });
+            g_state.chat_ngrams.erase(oldest);
+        }
+        it = g_state.chat_ngrams.emplace(chat_id, ChatNgrams{}).first;
+    }
+    it->second.last_used = ++g_state.session_clock;
+    return it->second.cache;
+}
+
+// The drafter proposes up to n_draft tokens after the last sampled one; the
+// target decodes them all in one batch with logits at every position and
+// samples each position in turn. Tokens are kept while they match the draft,
+// and the first mismatch becomes the next step's last token, so every step
+// yields between one and n_draft + 1 tokens from the target's own sampler.
+void decode_speculative_locked(const GenerationRequest & req, llama_sampler * sampler, Drafter & drafter,
+                               int n_draft_max, TokenEmitter & emitter, GenerationSummary & summary) {
+    llama_memory_t mem = llama_get_memory(g_state.ctx);
+    SessionSlot & session = active_session_locked();
+
+    // Sampled and delivered, but not yet decoded by the target.
+    llama_token id_last = llama_sampler_sample(sampler, g_state.ctx, g_state.logits_idx);
+    llama_sampler_accept(sampler, id_last);
+    std::string_view matched_stop;
+    if (!emitter.deliver(id_last, matched_stop)) {
+        return;
+    }
+    drafter.accept(id_last);
+    if (!matched_stop.empty()) {
+        emitter.stop_on(matched_stop);
+        return;
+    }
+
+    std::vector<llama_token> step;
+    while (summary.metrics.generation_tokens < req.max_tokens) {
+        if (abort_requested_locked(summary)) {
+            break;
+        }
+
+        // A step can yield one token more than it drafted; never overshoot max_tokens.
+        const int n_draft = std::min(n_draft_max, req.max_tokens - summary.metrics.generation_tokens - 1);
+        // Shift before drafting so the drafter sees the sequence the step extends.
+        if (!make_room_locked(static_cast<size_t>(std::max(n_draft, 0)) + 1, summary.metrics)) {
+            fail_decode_locked(summary);
+            return;
+        }
+        std::vector<llama_token> draft;
+        if (n_draft > 0) {
+            draft = drafter.draft(session.tokens, id_last, n_draft);
+            if (draft.size() > static_cast<size_t>(n_draft)) {
+                draft.resize(static_cast<size_t>(n_draft));
+            }
+        }
+
+        step.assign(1, id_last);
+        step.insert(step.end(), draft.begin(), draft.end());
+        const size_t n_past = session.tokens.size();
+        summary.metrics.target_decodes += 1;
+        summary.metrics.drafted_tokens += static_cast<int>(draft.size());
+        if (decode_session_tokens_locked(step.data(), static_cast<int32_t>(step.size()), BatchLogits::All) != 0) {
+            fail_decode_locked(summary);
+            return;
+        }
+
+        size_t n_accepted = 0;
+        bool finished = false;
+        for (size_t i = 0; i <= draft.size(); ++i) {
+            const llama_token token = llama_sampler_sample(sampler, g_state.ctx, static_cast<int32_t>(i));
+            llama_sampler_accept(sampler, token);
+            if (!emitter.deliver(token, matched_stop)) {
+                finished = true;
+                break;
+            }
+            drafter.accept(token);
+            if (!matched_stop.empty()) {
+                emitter.stop_on(matched_stop);
+                finished = true;
+                break;
+            }
+            if (i < draft.size() && token == draft[i]) {
+                ++n_accepted;
+                continue;
+            }
+            id_last = token;
+            break;
+        }
+        summary.metrics.accepted_tokens += static_cast<int>(n_accepted);
+
+        // Drop the rejected tail of the draft from the cache.
+        const size_t keep = n_past + 1 + n_accepted;
+        if (session.tokens.size() > keep) {
+            llama_memory_seq_rm(mem, g_state.active_seq, static_cast<llama_pos>(keep), -1);
+            session.tokens.resize(keep);
+        }
+        if (finished) {
+            break;
+        }
+    }
+}
+
+bool generate_internal(const GenerationRequest & req,
+                       TokenSink * sink,
+                       std::string * out_text,
+                       GenerationSummary & summary) {
+    EngineLock lock(RequestPriority::Interactive);
+    summary = GenerationSummary{};
+    summary.metrics.queue_wait_ms = lock.wait_ms();
+    SummaryCommit commit{g_state, summary};
+
+    if (!g_state.ctx || !g_state.model) {
+        summary.reason = StopReason::Error;
+        return false;
+    }
+
+    ensure_backend_init();
+    LOGI("generate_internal: begin prompt_len=%zu system_len=%zu max_tokens=%d", req.prompt.size(), req.system_prompt.size(), req.max_tokens);
+
+    // Reset abort flag for new generation
+    g_state.should_abort.store(false, std::memory_order_relaxed);
+    
+    // Set abort callback for graceful cancellation during generation
+    llama_set_abort_callback(g_state.ctx, abort_callback_handler, nullptr);
+    
+    llama_set_n_threads(g_state.ctx, g_state.n_threads_decode, g_state.n_threads);
+
+    const llama_vocab * vocab = llama_model_get_vocab(g_state.model);
+    if (!vocab) {
+        LOGE("vocab unavailable");
+        summary.reason = StopReason::Error;
+        return false;
+    }
+
+    std::string full_prompt = req.system_prompt.empty()
+            ? req.prompt
+            : (req.system_prompt + "\n\n" + req.prompt);
+
+    std::vector<llama_token> prompt_tokens;
+    if (!prepare_prompt_tokens(vocab, full_prompt, prompt_tokens)) {
+        LOGE("failed to tokenize prompt");
+        summary.reason = StopReason::Error;
+        return false;
+    }
+    if (prompt_tokens.empty()) {
+        LOGE("prompt produced no tokens");
+        summary.reason = StopReason::Error;
+        return false;
+    }
+
+    const double t_start_ms = llama_time_us() / 1000.0;
+    const size_t n_reused = reuse_cached_prefix_locked(prompt_tokens);
+    const size_t n_prefill = prompt_tokens.size() - n_reused;
+    if (active_session_locked().shifted.empty()) {
+        active_session_locked().n_keep = keep_tokens_locked(vocab, req, prompt_tokens.size());
+    }
+    LOGI("generate_internal: tokenized prompt_tokens=%d reused=%zu prefill=%zu",
+         static_cast<int>(prompt_tokens.size()), n_reused, n_prefill);
+
+    // A speculative step holds up to draft_max / lookup_max unverified cells on top.
+    ensure_session_capacity_locked(n_prefill + static_cast<size_t>(req.max_tokens + std::max(g_state.draft_max, g_state.lookup_max)));
+
+    const double t_prefill_start_ms = llama_time_us() / 1000.0;
+    bool prefill_aborted = false;
+    if (prefill_session_tokens_locked(prompt_tokens.data() + n_reused, static_cast<int32_t>(n_prefill),
+                                      prefill_aborted, summary.metrics) != 0) {
+        LOGE("prefill decode failed");
+        discard_active_session_locked();
+        summary.reason = StopReason::Error;
+        return false;
+    }
+    const double t_prefill_end_ms = llama_time_us() / 1000.0;
+    if (prefill_aborted) {
+        const int32_t n_done = g_state.prefill_done.load(std::memory_order_relaxed);
+        LOGI("generate_internal: prefill aborted at %d/%zu tokens", n_done, n_prefill);
+        summary.metrics.prompt_tokens = static_cast<int>(prompt_tokens.size());
+        summary.metrics.reused_tokens = static_cast<int>(n_reused);
+        summary.metrics.prefilled_tokens = n_done;
+        summary.metrics.prefill_ms = t_prefill_end_ms - t_prefill_start_ms;
+        summary.metrics.total_ms = t_prefill_end_ms - t_start_ms;
+        summary.metrics.truncated = true;
+        summary.reason = StopReason::Error;
+        return false;
+    }
+    LOGI("generate_internal: prefill complete ctx=%d", g_state.n_ctx);
+
+    llama_sampler * sampler = make_sampler(req);
+    if (!sampler) {
+        LOGE("failed to init sampler chain");
+        summary.reason = StopReason::Error;
+        return false;
+    }
+
+    StreamingDetokenizer detok(g_state.pieces, req.stops);
+    summary.metrics.prompt_tokens = static_cast<int>(prompt_tokens.size());
+    summary.metrics.reused_tokens = static_cast<int>(n_reused);
+    summary.metrics.prefilled_tokens = static_cast<int>(n_prefill);
+    summary.metrics.prefill_ms = t_prefill_end_ms - t_prefill_start_ms;
+    if (summary.metrics.prefill_ms > 0.0) {
+        summary.metrics.prompt_tps = (summary.metrics.prefilled_tokens * 1000.0) / summary.metrics.prefill_ms;
+    }
+
+    const double t_decode_start_ms = llama_time_us() / 1000.0;
+
+    TokenEmitter emitter{vocab, detok, sink, out_text, summary, t_start_ms};
+    if (g_state.spec) {
+        ModelDrafter drafter;
+        decode_speculative_locked(req, sampler, drafter, g_state.draft_max, emitter, summary);
+    } else if (g_state.lookup_max > 0) {
+        NgramDrafter drafter(active_session_locked().tokens, chat_ngrams_locked());
+        decode_speculative_locked(req, sampler, drafter, g_state.lookup_max, emitter, summary);
+    } else {
+        decode_plain_locked(req, sampler, emitter, summary);
+    }
+
+    LOGI("generate_internal: sampler finalize tokens=%d", summary.metrics.generation_tokens);
+    llama_perf_sampler_data perf_sampler = llama_perf_sampler(sampler);
+    llama_sampler_free(sampler);
+
+    if (summary.reason == StopReason::None) {
+        summary.reason = summary.metrics.generation_tokens >= req.max_tokens
+                ? StopReason::MaxTokens
+                : StopReason::None;
+    }
+
+    const double t_decode_end_ms = llama_time_us() / 1000.0;
+    summary.metrics.decode_ms = t_decode_end_ms - t_decode_start_ms;
+    summary.metrics.total_ms = t_decode_end_ms - t_start_ms;
+    if (summary.metrics.decode_ms > 0.0 && summary.metrics.generation_tokens > 0) {
+        summary.metrics.tps = (summary.metrics.generation_tokens * 1000.0) / summary.metrics.decode_ms;
+    }
+    if (summary.metrics.target_decodes > 0) {
+        summary.metrics.tokens_per_decode =
+                static_cast<double>(summary.metrics.generation_tokens) / summary.metrics.target_decodes;
+    }
+    if (summary.metrics.drafted_tokens > 0) {
+        summary.metrics.acceptance_rate =
+                static_cast<double>(summary.metrics.accepted_tokens) / summary.metrics.drafted_tokens;
+    }
+    if (g_state.n_ctx > 0) {
+        // What the active sequence occupies; shifts keep it under the context.
+        const double used = static_cast<double>(active_session_locked().tokens.size());
+        summary.metrics.context_used_pct = (used * 100.0) / static_cast<double>(g_state.n_ctx);
+    }
+    summary.metrics.truncated = summary.metrics.truncated || (summary.reason == StopReason::MaxTokens);
+
+    const std::string_view tail = detok.flush();
+    if (!tail.empty() && summary.reason != StopReason::Error) {
+        if (!emit_chunk(sink, tail)) {
+            summary.reason = StopReason::Error;
+            LOGE("generate_internal: tail emit failed");
+        } else if (out_text) {
+            out_text->append(tail);
+        }
+    }
+
+    summary.success = summary.reason != StopReason::Error;
+    LOGI("generate_internal: fetching perf context tokens=%d", summary.metrics.generation_tokens);
+    llama_perf_context_data perf_ctx = llama_perf_context(g_state.ctx);
+    LOGI("generate_internal: perf context fetched prompt=%d eval=%d", perf_ctx.n_p_eval, perf_ctx.n_eval);
+    double prompt_tps = perf_ctx.n_p_eval > 0 && perf_ctx.t_p_eval_ms > 0.0
+            ? (perf_ctx.n_p_eval * 1000.0) / perf_ctx.t_p_eval_ms
+            : 0.0;
+    double eval_tps = perf_ctx.n_eval > 0 && perf_ctx.t_eval_ms > 0.0
+            ? (perf_ctx.n_eval * 1000.0) / perf_ctx.t_eval_ms
+            : 0.0;
+    double sample_tps = perf_sampler.n_sample > 0 && perf_sampler.t_sample_ms > 0.0
+            ? (perf_sampler.n_sample * 1000.0) / perf_sampler.t_sample_ms
+            : 0.0;
+
+    LOGI("generate_internal: done reason=%d tokens=%d ttfs=%.2f total_ms=%.2f truncated=%d eval_tps=%.2f prompt_tps=%.2f sample_tps=%.2f",
+         static_cast<int>(summary.reason),
+         summary.metrics.generation_tokens,
+         summary.metrics.ttfs_ms,
+         summary.metrics.total_ms,
+         summary.metrics.truncated ? 1 : 0,
+         eval_tps,
+         prompt_tps,
+         sample_tps);
+    llama_perf_context_reset(g_state.ctx);
+    return summary.success;
+}
+
+// Hands text an auxiliary request produced to its sink and output, on the
+// requesting thread. A sink that refuses it cancels the request.
+void forward_aux_output(AuxSlot & slot, TokenSink * sink, std::string * out_text) {
+    std::string text;
+    {
+        std::lock_guard<std::mutex> lock(g_state.aux_mutex);
+        text.swap(slot.outbox);
+    }
+    if (text.empty()) {
+        return;
+    }
+    if (!emit_chunk(sink, text)) {
+        slot.cancelled.store(true, std::memory_order_relaxed);
+    }
+    if (out_text) {
+        out_text->append(text);
+    }
+}
+
+// Steps every auxiliary request at background priority until `own` is done.
+// A chat reply that arrives meanwhile takes the engine over and carries the
+// requests in its own batches; the driver resumes once it is finished.
+void drive_aux(AuxSlot & own, TokenSink * sink, std::string * out_text) {
+    EngineLock lock(RequestPriority::Background);
+    auto own_done = [&own] {
+        std::lock_guard<std::mutex> guard(g_state.aux_mutex);
+        return own.done;
+    };
+    bool resumed = true;
+    while (!own_done()) {
+        if (resumed || lock.yield_if_preempted()) {
+            resumed = false;
+            if (!g_state.ctx || !g_state.model) {
+                fail_pending_aux_locked();
+                break;
+            }
+            // A chat reply's abort must not cut these decodes short.
+            llama_set_abort_callback(g_state.ctx, nullptr, nullptr);
+            llama_set_n_threads(g_state.ctx, g_state.n_threads_decode, g_state.n_threads);
+        }
+        if (!step_aux_locked() && !own_done()) {
+            LOGE("aux: request could not be admitted");
+            fail_pending_aux_locked();
+            break;
+        }
+        forward_aux_output(own, sink, out_text);
+    }
+}
+
+// Queues an auxiliary request and waits for it. While no other thread is
+// driving auxiliary decoding, this one does, for every queued request.
+bool generate_auxiliary(const GenerationRequest & req, TokenSink * sink, std::string * out_text,
+                        GenerationSummary & summary) {
+    ensure_backend_init();
+    AuxSlot slot(req, g_state.pieces);
+    slot.t_submit_ms = llama_time_us() / 1000.0;
+    std::unique_lock<std::mutex> lock(g_state.aux_mutex);
+    g_state.aux_pending.push_back(&slot);
+    while (true) {
+        if (!slot.outbox.empty()) {
+            lock.unlock();
+            forward_aux_output(slot, sink, out_text);
+            lock.lock();
+            continue;
+        }
+        if (slot.done) {
+            break;
+        }
+        if (!g_state.aux_driving) {
+            g_state.aux_driving = true;
+            lock.unlock();
+            drive_aux(slot, sink, out_text);
+            lock.lock();
+            g_state.aux_driving = false;
+            // Someone still waiting takes over driving.
+            g_state.aux_cv.notify_all();
+            continue;
+        }
+        g_state.aux_cv.wait(lock);
+    }
+    lock.unlock();
+    summary = slot.summary;
+    return summary.success;
+}
+
+std::string build_model_metadata_json(const GgufModelInfo & info) {
+    const bool reasoning = contains_case_insensitive(info.reasoning_flag, "true") ||
+                           contains_case_insensitive(info.capabilities, "reasoning") ||
+                           contains_case_insensitive(info.tags, "reasoning") ||
+                           contains_case_insensitive(info.chat_template, "<think>") ||
+                           contains_case_insensitive(info.chat_template, "<reasoning>");
+
+    // Bytes per tensor type across the file, e.g. {"q4_K":..., "q6_K":..., "f32":...}.
+    std::vector<std::pair<ggml_type, uint64_t>> type_bytes;
+    for (const auto & tensor : info.tensors) {
+        auto it = std::find_if(type_bytes.begin(), type_bytes.end(),
+                               [&](const auto & entry) { return entry.first == tensor.type; });
+        if (it == type_bytes.end()) {
+            type_bytes.emplace_back(tensor.type, tensor.bytes);
+        } else {
+            it->second += tensor.bytes;
+        }
+    }
+
+    std::ostringstream oss;
+    oss << "{"
+        << "\"arch\":\"" << escape_json(info.arch) << "\","
+        << "\"name\":\"" << escape_json(info.name) << "\","
+        << "\"nCtxTrain\":" << info.n_ctx_train << ","
+        << "\"nLayer\":" << info.n_layer << ","
+        << "\"nEmbd\":" << info.n_embd << ","
+        << "\"nHead\":" << info.n_head << ","
+        << "\"nHeadKv\":" << (info.n_head_kv.empty() ? 0 : *std::max_element(info.n_head_kv.begin(), info.n_head_kv.end())) << ","
+        << "\"nVocab\":" << info.n_vocab << ","
+        << "\"chatTemplate\":\"" << escape_json(info.chat_template) << "\","
+        << "\"tokenizerModel\":\"" << escape_json(info.tokenizer_model) << "\","
+        << "\"reasoning\":" << (reasoning ? "true" : "false") << ","
+        << "\"tags\":\"" << escape_json(info.tags) << "\","
+        << "\"weightBytes\":" << info.weight_bytes << ","
+        << "\"sharedBytes\":" << info.shared_bytes << ","
+        << "\"kvBytesPerTokenF16\":" << gguf_kv_bytes_per_token(info, GGML_TYPE_F16, GGML_TYPE_F16) << ",";
+    oss << "\"layerBytes\":[";
+    for (size_t il = 0; il < info.layers.size(); ++il) {
+        oss << (il > 0 ? "," : "") << info.layers[il].bytes;
+    }
+    oss << "],\"layerTypes\":[";
+    for (size_t il = 0; il < info.layers.size(); ++il) {
+        oss << (il > 0 ? "," : "") << "\"" << ggml_type_name(info.layers[il].type) << "\"";
+    }
+    oss << "],\"tensorTypes\":{";
+    for (size_t i = 0; i < type_bytes.size(); ++i) {
+        oss << (i > 0 ? "," : "") << "\"" << ggml_type_name(type_bytes[i].first) << "\":" << type_bytes[i].second;
+    }
+    oss << "}}";
+    return oss.str();
+}
+
+// Reads only the GGUF header and tensor directory: no weights are mapped and
+// the engine lock is not taken, so this stays cheap while a model is loaded
+// or generating.
+std::string detect_model_metadata(const char * path) {
+    if (!path || !file_exists(path)) {
+        return "{}";
+    }
+    GgufModelInfo info;
+    if (!gguf_probe(path, info)) {
+        LOGE("failed to read GGUF header of %s", path);
+        return "{}";
+    }
+    return build_model_metadata_json(info);
+}
+
+// Embeds texts through an embeddings-enabled context, packing as many as fit
+// into each batch, one sequence per text. The caller holds the lock that owns ectx.
+// `resume` runs before every packed batch after the first; returning false
+// abandons the request without touching ectx again.
+bool embed_texts(llama_context * ectx, const llama_model * model,
+                 const std::vector<std::string> & texts, std::vector<std::vector<float>> & out,
+                 const std::function<bool()> & resume = {}) {
+    out.clear();
+    const llama_vocab * vocab = llama_model_get_vocab(model);
+    const bool has_encoder = llama_model_has_encoder(model);
+    const bool has_decoder = llama_model_has_decoder(model);
+    const auto pooling_type = llama_pooling_type(ectx);
+
+    if (has_encoder && has_decoder) {
+        LOGE("hybrid encoder/decoder models are not supported for embeddings");
+        return false;
+    }
+
+    const size_t count = texts.size();
+
+    const int32_t n_batch = static_cast<int32_t>(llama_n_batch(ectx));
+    const int32_t n_seq_max = static_cast<int32_t>(llama_n_seq_max(ectx));
+    const int dim = llama_model_n_embd(model);
+    const bool last_token_only = pooling_type == LLAMA_POOLING_TYPE_NONE;
+
+    TokenBatch tokenized;
+    {
+        const std::vector<std::string_view> views(texts.begin(), texts.end());
+        TokenizeOptions options;
+        options.n_workers = llama_n_threads(ectx);
+        tokenize_batch(vocab, views, options, tokenized);
+    }
+
+    out.resize(count);
+    llama_memory_t mem = llama_get_memory(ectx);
+    llama_batch batch = llama_batch_init(n_batch, 0, 1);
+    // Text index and output row of every sequence packed into the current batch.
+    std::vector<std::pair<size_t, int32_t>> packed;
+    packed.reserve(n_seq_max);
+    int batches = 0;
+    bool abandoned = false;
+
+    llama_set_embeddings(ectx, true);
+
+    auto flush = [&]() {
+        if (packed.empty() || abandoned) {
+            return;
+        }
+        if (batches > 0 && resume && !resume()) {
+            abandoned = true;
+            return;
+        }
+        const int rc = has_encoder && !has_decoder ? llama_encode(ectx, batch) : llama_decode(ectx, batch);
+        if (rc != 0) {
+            LOGE("embed: batch of %zu texts failed rc=%d", packed.size(), rc);
+        }
+        for (size_t seq = 0; seq < packed.size(); ++seq) {
+            const float * emb = nullptr;
+            if (rc == 0) {
+                emb = last_token_only
+                        ? llama_get_embeddings_ith(ectx, packed[seq].second)
+                        : llama_get_embeddings_seq(ectx, static_cast<llama_seq_id>(seq));
+            }
+            if (emb && dim > 0) {
+                out[packed[seq].first].assign(emb, emb + dim);
+            }
+            // Only the sequences this batch used hold cells; leave the rest alone.
+            llama_memory_seq_rm(mem, static_cast<llama_seq_id>(seq), -1, -1);
+        }
+        ++batches;
+        packed.clear();
+        batch.n_tokens = 0;
+    };
+
+    for (size_t i = 0; i < count; ++i) {
+        const llama_token * tokens = tokenized.tokens.data() + tokenized.offsets[i];
+        int32_t n_tokens = static_cast<int32_t>(tokenized.offsets[i + 1] - tokenized.offsets[i]);
+        if (n_tokens == 0) {
+            continue;
+        }
+        if (n_tokens > n_batch) {
+            // Truncating would embed only the head; the caller sees a failed text instead.
+            LOGE("embed: text %zu has %d tokens, more than the batch of %d; not embedded", i, n_tokens, n_batch);
+            continue;
+        }
+        if (batch.n_tokens + n_tokens > n_batch || static_cast<int32_t>(packed.size()) == n_seq_max) {
+            flush();
+        }
+        const llama_seq_id seq = static_cast<llama_seq_id>(packed.size());
+        for (int32_t j = 0; j < n_tokens; ++j) {
+            const int32_t idx = batch.n_tokens++;
+            batch.token[idx] = tokens[j];
+            batch.pos[idx] = j;
+            batch.n_seq_id[idx] = 1;
+            batch.seq_id[idx][0] = seq;
+            // An embeddings context outputs every token regardless (and warns
+            // about any left unmarked); last-token pooling reads its row by batch index.
+            batch.logits[idx] = true;
+        }
+        packed.emplace_back(i, batch.n_tokens - 1);
+    }
+    flush();
+
+    llama_batch_free(batch);
+    if (abandoned) {
+        LOGE("embed: context replaced while yielded, %zu texts dropped after %d batches", count, batches);
+        out.clear();
+        return false;
+    }
+    llama_set_embeddings(ectx, false);
+    LOGI("embed: %zu texts in %d batches n_batch=%d n_seq_max=%d", count, batches, n_batch, n_seq_max);
+    return true;
+}
+
+// Times n_threads in a scratch context of the loaded model on pools of that
+// size: kCalibrationPrompt tokens as one batch, then kCalibrationDecode tokens
+// one at a time. False if the context or the pools cannot be created.
+bool time_thread_count_locked(int n_threads, ThreadTrial & trial) {
+    llama_context_params cparams = llama_context_default_params();
+    cparams.n_ctx = 256;
+    cparams.n_batch = kCalibrationPrompt;
+    cparams.n_ubatch = kCalibrationPrompt;
+    cparams.n_seq_max = 1;
+    cparams.offload_kqv = g_state.use_vulkan && g_state.n_gpu_layers > 0;
+    apply_kv_precision(cparams, g_state.kv_precision);
+    const ThreadPoolPlan decode = decode_pool_plan(g_state.topology, n_threads);
+    const ThreadPoolPlan batch = batch_pool_plan(g_state.topology, n_threads);
+    cparams.n_threads = decode.n_threads;
+    cparams.n_threads_batch = batch.n_threads;
+
+    // Creating the pools pins this thread; the guard undoes it.
+    ThreadAffinityGuard affinity;
+    affinity.pin(pool_leader_core(g_state.topology, decode));
+    llama_context * ctx = create_context(g_state.model, cparams);
+    ggml_threadpool * decode_pool = nullptr;
+    ggml_threadpool * batch_pool = nullptr;
+    if (!ctx || !create_threadpools(decode, batch, &decode_pool, &batch_pool)) {
+        if (ctx) {
+            llama_free(ctx);
+        }
+        return false;
+    }
+    llama_attach_threadpool(ctx, decode_pool, batch_pool);
+
+    // Any tokens do; the timing only depends on how many.
+    const int32_t n_vocab = std::max(1, llama_vocab_n_tokens(llama_model_get_vocab(g_state.model)));
+    llama_batch tokens = llama_batch_init(kCalibrationPrompt, 0, 1);
+    auto decode_at = [&](int32_t pos, int32_t n) {
+        tokens.n_tokens = n;
+        for (int32_t i = 0; i < n; ++i) {
+            tokens.token[i] = static_cast<llama_token>((static_cast<int64_t>(pos + i) * 7919 + 13) % n_vocab);
+            tokens.pos[i] = pos + i;
+            tokens.n_seq_id[i] = 1;
+            tokens.seq_id[i][0] = 0;
+            tokens.logits[i] = i == n - 1;
+        }
+        return llama_decode(ctx, tokens) == 0;
+    };
+
+    // The first decode wakes the workers and touches the compute buffers; untimed.
+    bool ok = decode_at(0, 1);
+    llama_memory_clear(llama_get_memory(ctx), true);
+    const int64_t t_start = llama_time_us();
+    ok = ok && decode_at(0, kCalibrationPrompt);
+    const int64_t t_prefilled = llama_time_us();
+    for (int32_t i = 0; i < kCalibrationDecode && ok; ++i) {
+        ok = decode_at(kCalibrationPrompt + i, 1);
+    }
+    const int64_t t_end = llama_time_us();
+
+    llama_batch_free(tokens);
+    llama_free(ctx);
+    ggml_threadpool_free(decode_pool);
+    ggml_threadpool_free(batch_pool);
+    if (!ok) {
+        return false;
+    }
+    trial.n_threads = n_threads;
+    trial.prefill_tps = kCalibrationPrompt * 1e6 / std::max<int64_t>(1, t_prefilled - t_start);
+    trial.decode_tps = kCalibrationDecode * 1e6 / std::max<int64_t>(1, t_end - t_prefilled);
+    return true;
+}
+
+} // namespace
+
+bool RingSink::emit(std::string_view text) {
+    return ring_->push(text.data(), text.size(), g_state.should_abort);
+}
+
+void RingSink::done() {
+    ring_->close();
+}
+
+const char * stop_reason_name(StopReason reason) {
+    switch (reason) {
+        case StopReason::None: return "none";
+        case StopReason::Eos: return "eos";
+        case StopReason::StopSequence: return "stop_sequence";
+        case StopReason::MaxTokens: return "max_tokens";
+        case StopReason::Error: return "error";
+    }
+    return "unknown";
+}
+
+const char * kv_precision_name(KvPrecision precision) {
+    switch (precision) {
+        case KvPrecision::F16: return "f16";
+        case KvPrecision::Q8_0: return "q8_0";
+        case KvPrecision::Q4_0: return "q4_0";
+    }
+    return "f16";
+}
+
+ggml_type kv_ggml_type(KvPrecision precision) {
+    switch (precision) {
+        case KvPrecision::Q8_0: return GGML_TYPE_Q8_0;
+        case KvPrecision::Q4_0: return GGML_TYPE_Q4_0;
+        case KvPrecision::F16: break;
+    }
+    return GGML_TYPE_F16;
+}
+
+KvPrecision parse_kv_precision(const std::string & name) {
+    if (name == "q8_0") {
+        return KvPrecision::Q8_0;
+    }
+    if (name == "q4_0") {
+        return KvPrecision::Q4_0;
+    }
+    return KvPrecision::F16;
+}
+
+std::string thread_calibration_json(const ThreadCalibration & calibration) {
+    std::ostringstream oss;
+    oss << std::fixed;
+    oss.precision(2);
+    oss << "{\"decodeThreads\":" << calibration.decode_threads
+        << ",\"batchThreads\":" << calibration.batch_threads
+        << ",\"decodeTps\":" << calibration.decode_tps
+        << ",\"prefillTps\":" << calibration.prefill_tps
+        << ",\"trials\":[";
+    for (size_t i = 0; i < calibration.trials.size(); ++i) {
+        const ThreadTrial & trial = calibration.trials[i];
+        oss << (i > 0 ? "," : "") << "{\"threads\":" << trial.n_threads << ",\"decodeTps\":" << trial.decode_tps
+            << ",\"prefillTps\":" << trial.prefill_tps << "}";
+    }
+    oss << "]}";
+    return oss.str();
+}
+
+namespace engine {
+
+void init() {
+    ensure_backend_init();
+}
+
+bool load(const EngineConfig & config) {
+    if (!file_exists(config.model_path.c_str())) {
+        LOGE("model path not found: %s", config.model_path.c_str());
+        return false;
+    }
+
+    ensure_backend_init();
+
+    EngineLock lock(RequestPriority::Interactive);
+    unload_locked();
+
+    const bool use_vulkan = config.use_vulkan;
+    const int n_gpu_layers = config.n_gpu_layers;
+
+    llama_model_params mparams = llama_model_default_params();
+    mparams.n_gpu_layers = use_vulkan ? n_gpu_layers : 0;
+    mparams.use_mmap = true;
+    mparams.use_mlock = false;
+
+    llama_model * model = llama_model_load_from_file(config.model_path.c_str(), mparams);
+    if (!model) {
+        LOGE("failed to load model");
+        return false;
+    }
+
+    KvPrecision precision = config.kv_precision;
+    if (precision != KvPrecision::F16 && !kv_type_fits(model, kv_ggml_type(precision))) {
+        LOGI("loadModel: head size does not split into %s blocks, using f16 KV", kv_precision_name(precision));
+        precision = KvPrecision::F16;
+    }
+    const uint32_t n_ctx_requested = static_cast<uint32_t>(std::max(
+            512, config.n_ctx > 0 ? config.n_ctx : llama_model_n_ctx_train(model)));
+
+    llama_context_params cparams = llama_context_default_params();
+    cparams.n_ctx = budgeted_n_ctx(config, model, kv_ggml_type(precision), n_ctx_requested);
+    apply_kv_precision(cparams, precision);
+    if (g_state.topology.cores.empty()) {
+        g_state.topology = detect_cpu_topology();
+    }
+    const int max_threads = std::max(1, config.n_threads);
+    const int n_decode = config.decode_threads > 0 ? std::min(config.decode_threads, max_threads)
+                                                   : default_decode_threads(g_state.topology, max_threads);
+    const int n_batch = config.batch_threads > 0 ? std::min(config.batch_threads, max_threads)
+                                                 : default_batch_threads(g_state.topology, max_threads);
+    cparams.n_threads = n_decode;
+    cparams.n_threads_batch = n_batch;
+    // Every hot chat gets its own sequence, and auxiliary requests a few more;
+    // a unified cache lets each of them use the full context instead of n_ctx / n_seq_max.
+    cparams.n_seq_max = static_cast<uint32_t>(std::clamp(config.session_slots, 1, 64) + kAuxSequences);
+    cparams.kv_unified = true;
+
+    // Dynamic batch size optimization based on context length, GPU layers, and device capabilities
+    if (use_vulkan && n_gpu_layers > 0) {
+        // GPU-accelerated inference: optimize batch sizes for GPU utilization
+        // Batch size scales with context length and GPU layers
+        // More GPU layers = can handle larger batches
+        const uint32_t baseBatch = std::min(2048U, static_cast<uint32_t>(cparams.n_ctx / 4));
+        
+        // Scale batch size based on GPU layers (more layers = better GPU utilization)
+        const float gpuLayerScale = std::min(1.5f, 1.0f + (n_gpu_layers / 50.0f));
+        const uint32_t scaledBatch = static_cast<uint32_t>(baseBatch * gpuLayerScale);
+        
+        // Context-aware batch sizing: larger contexts benefit from larger batches
+        const float contextScale = cparams.n_ctx >= 8192 ? 1.2f : (cparams.n_ctx >= 4096 ? 1.0f : 0.8f);
+        cparams.n_batch = std::min(4096U, static_cast<uint32_t>(scaledBatch * contextScale));
+        
+        // Unified batch: smaller for memory efficiency, scales with main batch
+        cparams.n_ubatch = std::min(1024U, std::max(256U, cparams.n_batch / 4));
+        
+        // Optimize for GPU memory usage
+        cparams.offload_kqv = true;
+        
+        LOGI("loadModel: GPU batch optimization n_batch=%u ubatch=%u layers=%d ctx=%d scale=%.2f",
+             cparams.n_batch, cparams.n_ubatch, n_gpu_layers, cparams.n_ctx, gpuLayerScale);
+    } else {
+        // CPU-only inference: conservative batch sizes
+        // Smaller batches reduce memory pressure on CPU; prompts longer than
+        // n_batch are prefilled slice by slice, so this only bounds abort latency
+        cparams.n_batch = std::min(512U, static_cast<uint32_t>(cparams.n_ctx / 8));
+        cparams.n_ubatch = std::min(128U, cparams.n_batch / 4);
+        
+        LOGI("loadModel: CPU batch optimization n_batch=%u ubatch=%u ctx=%d",
+             cparams.n_batch, cparams.n_ubatch, cparams.n_ctx);
+    }
+
+    LOGI("loadModel: context n_ctx=%d threads=%d/%d batch=%u ubatch=%u seq_max=%u offload_kqv=%d use_vulkan=%d kv=%s",
+         cparams.n_ctx,
+         cparams.n_threads,
+         cparams.n_threads_batch,
+         cparams.n_batch,
+         cparams.n_ubatch,
+         cparams.n_seq_max,
+         cparams.offload_kqv ? 1 : 0,
+         use_vulkan ? 1 : 0,
+         kv_precision_name(precision));
+
+    llama_context * ctx = create_context(model, cparams);
+    if (!ctx && precision != KvPrecision::F16) {
+        // Typically flash attention missing on the backend; F16 cells take
+        // more room, so the budget may shrink the context.
+        LOGE("loadModel: %s KV context failed, retrying with f16", kv_precision_name(precision));
+        precision = KvPrecision::F16;
+        apply_kv_precision(cparams, precision);
+        cparams.n_ctx = std::min(cparams.n_ctx, budgeted_n_ctx(config, model, GGML_TYPE_F16, n_ctx_requested));
+        cparams.n_batch = std::min(cparams.n_batch, cparams.n_ctx);
+        cparams.n_ubatch = std::min(cparams.n_ubatch, cparams.n_batch);
+        ctx = create_context(model, cparams);
+    }
+
+    if (!ctx) {
+        LOGE("failed to create llama context: null context returned");
+        llama_model_free(model);
+        return false;
+    }
+
+    {
+        std::unique_lock<std::shared_mutex> vocab_lock(g_state.vocab_mutex);
+        g_state.model = model;
+    }
+    ++g_state.model_epoch;
+    g_state.ctx = ctx;
+    g_state.n_ctx = cparams.n_ctx;
+    g_state.max_threads = max_threads;
+    g_state.n_gpu_layers = use_vulkan ? n_gpu_layers : 0;
+    g_state.use_vulkan = use_vulkan;
+    g_state.kv_precision = precision;
+    g_state.kv_bytes_per_token = kv_bytes_per_token(model, cparams.type_k, cparams.type_v);
+    g_state.memory_budget_bytes = std::max<int64_t>(0, config.memory_budget_bytes);
+    g_state.model_path = config.model_path;
+    g_state.aux_sequences = kAuxSequences;
+    g_state.pieces.reset(llama_model_get_vocab(model));
+    g_state.sessions.assign(llama_n_seq_max(ctx) - kAuxSequences, SessionSlot{});
+    g_state.active_seq = 0;
+    reset_metrics_locked();
+
+    set_threadpools_locked(n_decode, n_batch);
+    if (!g_embedder_loaded.load() && !ensure_embedding_context_locked()) {
+        LOGE("failed to prepare embedding context");
+        unload_locked();
+        return false;
+    }
+    if (!load_draft_locked(config)) {
+        g_state.lookup_max = std::clamp(config.lookup_max, 0, 32);
+    }
+    LOGI("model loaded n_ctx=%d n_threads=%d/%d gpu_layers=%d batch=%u ubatch=%u kv=%s kv_bytes_per_token=%zu",
+         g_state.n_ctx, g_state.n_threads_decode, g_state.n_threads, g_state.n_gpu_layers, cparams.n_batch, cparams.n_ubatch,
+         kv_precision_name(g_state.kv_precision), g_state.kv_bytes_per_token);
+    return true;
+}
+
+void unload() {
+    EngineLock lock(RequestPriority::Interactive);
+    unload_locked();
+    LOGI("engine unloaded");
+}
+
+bool generate(const GenerationRequest & req, TokenSink * sink, std::string * out_text, GenerationSummary & summary) {
+    if (req.auxiliary) {
+        return generate_auxiliary(req, sink, out_text, summary);
+    }
+    return generate_internal(req, sink, out_text, summary);
+}
+
+void generate_stream(const GenerationRequest & req, TokenSink * sink) {
+    // Declared first so done fires after generate released the engine
+    // lock and committed its metrics; the consumer reads them on done.
+    SinkDoneGuard done_guard(sink);
+    GenerationSummary summary;
+    try {
+        generate(req, sink, nullptr, summary);
+    } catch (const std::exception& e) {
+        LOGE("generateStream: internal error: %s", e.what());
+        summary.success = false;
+        summary.reason = StopReason::Error;
+    } catch (...) {
+        LOGE("generateStream: unknown internal error");
+        summary.success = false;
+        summary.reason = StopReason::Error;
+    }
+
+    LOGI("generateStream: exit success=%d reason=%d tokens=%d", summary.success ? 1 : 0, static_cast<int>(summary.reason), summary.metrics.generation_tokens);
+}
+
+
+bool embed(const std::vector<std::string> & texts, std::vector<std::vector<float>> & out, double * queue_wait_ms) {
+    if (queue_wait_ms) {
+        *queue_wait_ms = 0.0;
+    }
+    {
+        std::lock_guard<std::mutex> lock(g_embedder.mutex);
+        if (g_embedder.ctx) {
+            return embed_texts(g_embedder.ctx, g_embedder.model, texts, out);
+        }
+    }
+    // Indexing through the chat model gives way to generation between batches.
+    EngineLock lock(RequestPriority::Background);
+    out.clear();
+    bool ok = false;
+    if (!g_state.model) {
+        LOGE("embed: no model loaded");
+    } else if (!ensure_embedding_context_locked()) {
+        LOGE("embed: failed to ensure embedding context");
+    } else {
+        llama_context * ectx = g_state.embed_ctx;
+        const uint64_t epoch = g_state.model_epoch;
+        ok = embed_texts(ectx, g_state.model, texts, out, [&] {
+            return !lock.yield_if_preempted() || (g_state.model_epoch == epoch && g_state.embed_ctx == ectx);
+        });
+    }
+    if (queue_wait_ms) {
+        *queue_wait_ms = lock.wait_ms();
+    }
+    return ok;
+}
+
+bool load_embedder(const EmbedderConfig & config) {
+    ensure_backend_init();
+    if (config.model_path.empty() || !file_exists(config.model_path.c_str())) {
+        LOGE("loadEmbedder: model not found: %s", config.model_path.c_str());
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(g_embedder.mutex);
+        free_embedder_locked();
+
+        llama_model_params mparams = llama_model_default_params();
+        mparams.n_gpu_layers = std::max(0, config.n_gpu_layers);
+        mparams.use_mmap = true;
+        llama_model * model = llama_model_load_from_file(config.model_path.c_str(), mparams);
+        if (!model) {
+            LOGE("loadEmbedder: failed to load %s", config.model_path.c_str());
+            return false;
+        }
+
+        // Sized for RAG chunks rather than chat history: one packed batch of
+        // up to kEmbedMaxSequences texts shares the context, as one ubatch. A
+        // configured context still holds a whole chunk where the model's
+        // positions reach that far.
+        const int32_t n_ctx_train = llama_model_n_ctx_train(model);
+        const uint32_t n_chunk = std::min(kEmbedMinBatch, static_cast<uint32_t>(std::max(n_ctx_train, 1)));
+        const uint32_t n_ctx = std::max(n_chunk, static_cast<uint32_t>(config.n_ctx > 0
+                ? config.n_ctx
+                : std::clamp<int32_t>(n_ctx_train, 512, kEmbedderMaxContext)));
+        llama_context_params params = llama_context_default_params();
+        params.n_ctx = n_ctx;
+        params.n_batch = n_ctx;
+        params.n_ubatch = n_ctx;
+        params.n_seq_max = kEmbedMaxSequences;
+        params.kv_unified = true;
+        params.embeddings = true;
+        params.pooling_type = parse_pooling(config.pooling);
+        params.n_threads = std::max(1, config.n_threads);
+        params.n_threads_batch = params.n_threads;
+        params.offload_kqv = config.n_gpu_layers > 0;
+        llama_context * ctx = create_context(model, params);
+        if (!ctx) {
+            llama_model_free(model);
+            return false;
+        }
+        g_embedder.model = model;
+        g_embedder.ctx = ctx;
+        g_embedder.model_path = config.model_path;
+        g_embedder_loaded.store(true);
+        LOGI("loadEmbedder: %s n_ctx=%u threads=%d dim=%d pooling=%d",
+             config.model_path.c_str(), n_ctx, params.n_threads, llama_model_n_embd(model),
+             static_cast<int>(llama_pooling_type(ctx)));
+    }
+
+    // The chat model no longer serves embeddings; drop its full-size context.
+    EngineLock lock(RequestPriority::Interactive);
+    if (g_state.embed_ctx) {
+        llama_free(g_state.embed_ctx);
+        g_state.embed_ctx = nullptr;
+    }
+    return true;
+}
+
+void unload_embedder() {
+    std::lock_guard<std::mutex> lock(g_embedder.mutex);
+    free_embedder_locked();
+}
+
+int count_tokens(const std::string & text) {
+    // Tokenizing only reads the vocabulary, which is safe next to a decode.
+    std::shared_lock<std::shared_mutex> lock(g_state.vocab_mutex);
+    if (!g_state.model) {
+        return 0;
+    }
+    const llama_vocab * vocab = llama_model_get_vocab(g_state.model);
+    std::vector<llama_token> tokens;
+    return prepare_prompt_tokens(vocab, text, tokens) ? static_cast<int>(tokens.size()) : 0;
+}
+
+bool chunk_text(const std::string & text, const ChunkOptions & options, std::vector<ChunkSpan> & out) {
+    out.clear();
+    std::shared_lock<std::shared_mutex> lock(g_state.vocab_mutex);
+    if (!g_state.model) {
+        return false;
+    }
+    return chunk_document(llama_model_get_vocab(g_state.model), text, options, out);
+}
+
+bool tokenize_batch(const std::vector<std::string_view> & texts, bool add_special,
+                    std::vector<int32_t> & tokens, std::vector<uint32_t> & offsets) {
+    std::shared_lock<std::shared_mutex> lock(g_state.vocab_mutex);
+    if (!g_state.model) {
+        return false;
+    }
+    TokenizeOptions options;
+    options.add_special = add_special;
+    options.n_workers = g_state.tokenize_workers.load(std::memory_order_relaxed);
+    TokenBatch batch;
+    peerchat::tokenize_batch(llama_model_get_vocab(g_state.model), texts, options, batch);
+    tokens = std::move(batch.tokens);
+    offsets = std::move(batch.offsets);
+    return true;
+}
+
+bool count_tokens_batch(const std::vector<std::string_view> & texts, std::vector<int32_t> & counts) {
+    std::shared_lock<std::shared_mutex> lock(g_state.vocab_mutex);
+    if (!g_state.model) {
+        return false;
+    }
+    TokenizeOptions options;
+    options.n_workers = g_state.tokenize_workers.load(std::memory_order_relaxed);
+    peerchat::count_tokens_batch(llama_model_get_vocab(g_state.model), texts, options, counts);
+    return true;
+}
+
+bool calibrate_threads(ThreadCalibration & out) {
+    out = ThreadCalibration{};
+    uint64_t epoch = 0;
+    std::vector<int> candidates;
+    {
+        EngineLock lock(RequestPriority::Background);
+        if (!g_state.model) {
+            return false;
+        }
+        epoch = g_state.model_epoch;
+        candidates = thread_count_candidates(g_state.topology, g_state.max_threads);
+    }
+    // A lock per candidate, so generation waits for one trial at most.
+    for (const int n_threads : candidates) {
+        EngineLock lock(RequestPriority::Background);
+        if (!g_state.model || g_state.model_epoch != epoch) {
+            LOGI("calibrate: model replaced, stopping");
+            return false;
+        }
+        ThreadTrial trial;
+        if (!time_thread_count_locked(n_threads, trial)) {
+            LOGE("calibrate: %d threads could not run", n_threads);
+            continue;
+        }
+        LOGI("calibrate: %d threads decode=%.2f tok/s prefill=%.2f tok/s", n_threads, trial.decode_tps,
+             trial.prefill_tps);
+        out.trials.push_back(trial);
+    }
+    if (out.trials.empty()) {
+        return false;
+    }
+    for (const ThreadTrial & trial : out.trials) {
+        if (trial.decode_tps > out.decode_tps) {
+            out.decode_tps = trial.decode_tps;
+            out.decode_threads = trial.n_threads;
+        }
+        if (trial.prefill_tps > out.prefill_tps) {
+            out.prefill_tps = trial.prefill_tps;
+            out.batch_threads = trial.n_threads;
+        }
+    }
+    EngineLock lock(RequestPriority::Background);
+    if (!g_state.model || g_state.model_epoch != epoch) {
+        return false;
+    }
+    set_threadpools_locked(out.decode_threads, out.batch_threads);
+    return true;
+}
+
+std::string metrics_json() {
+    std::string fields;
+    {
+        std::lock_guard<std::mutex> lock(g_state.metrics_mutex);
+        fields = g_state.metrics_snapshot;
+    }
+    std::ostringstream oss;
+    oss << "{" << fields << (fields.empty() ? "" : ",")
+        << "\"embedderLoaded\":" << (g_embedder_loaded.load() ? "true" : "false")
+        << ",\"scheduler\":" << scheduler_stats_json(g_state.scheduler.stats())
+        << "}";
+    return oss.str();
+}
+
+std::string detect_model(const std::string & path) {
+    return detect_model_metadata(path.c_str());
+}
+
+PrefillProgress prefill_progress() {
+    PrefillProgress progress;
+    progress.total = g_state.prefill_total.load(std::memory_order_relaxed);
+    if (progress.total <= 0) {
+        progress.total = 0;
+        return progress;
+    }
+    progress.done = std::min(progress.total, g_state.prefill_done.load(std::memory_order_relaxed));
+    if (progress.done > 0) {
+        const double elapsed_ms = (llama_time_us() - g_state.prefill_started_us.load(std::memory_order_relaxed)) / 1000.0;
+        progress.eta_ms = elapsed_ms * (progress.total - progress.done) / progress.done;
+    }
+    return progress;
+}
+
+void request_abort() {
+    g_state.should_abort.store(true, std::memory_order_release);
+    LOGI("abort requested");
+}
+
+void recover() {
+    LOGI("recover: attempting to recover engine state");
+
+    EngineLock lock(RequestPriority::Interactive);
+
+    // Clear abort flag
+    g_state.should_abort.store(false, std::memory_order_release);
+
+    // Try to clear memory if context exists
+    if (g_state.ctx) {
+        try {
+            llama_memory_clear(llama_get_memory(g_state.ctx), false);
+            invalidate_prompt_cache_locked();
+            LOGI("recover: cleared context memory");
+        } catch (const std::exception& e) {
+            LOGE("recover: failed to clear context memory: %s", e.what());
+        } catch (...) {
+            LOGE("recover: failed to clear context memory: unknown error");
+        }
+    }
+
+    // Try to clear embedding context memory if it exists
+    if (g_state.embed_ctx) {
+        try {
+            llama_memory_clear(llama_get_memory(g_state.embed_ctx), false);
+            LOGI("recover: cleared embedding context memory");
+        } catch (const std::exception& e) {
+            LOGE("recover: failed to clear embedding context memory: %s", e.what());
+        } catch (...) {
+            LOGE("recover: failed to clear embedding context memory: unknown error");
+        }
+    }
+
+    // The speculation helper mirrors the draft cache; rebuild both together.
+    if (g_state.spec) {
+        common_speculative_free(g_state.spec);
+        llama_memory_clear(llama_get_memory(g_state.draft_ctx), false);
+        g_state.spec = common_speculative_init(g_state.ctx, g_state.draft_ctx);
+        LOGI("recover: reset draft context");
+    }
+
+    // Reset metrics
+    reset_metrics_locked();
+
+    LOGI("recover: engine state recovery completed");
+}
+
+size_t state_size() {
+    EngineLock lock(RequestPriority::Background);
+    return g_state.ctx ? llama_state_get_size(g_state.ctx) : 0;
+}
+
+size_t state_capture_into(uint8_t * dst, size_t capacity) {
+    EngineLock lock(RequestPriority::Background);
+    if (!g_state.ctx || !dst || capacity == 0) {
+        return 0;
+    }
+    const size_t total = llama_state_get_size(g_state.ctx);
+    if (total == 0) {
+        return 0;
+    }
+    return llama_state_get_data(g_state.ctx, dst, std::min(capacity, total));
+}
+
+std::vector<uint8_t> state_capture() {
+    EngineLock lock(RequestPriority::Background);
+    std::vector<uint8_t> buffer;
+    if (!g_state.ctx) {
+        return buffer;
+    }
+    const size_t size = llama_state_get_size(g_state.ctx);
+    if (size == 0) {
+        return buffer;
+    }
+    buffer.resize(size);
+    buffer.resize(llama_state_get_data(g_state.ctx, buffer.data(), buffer.size()));
+    return buffer;
+}
+
+bool state_restore(const uint8_t * src, size_t size) {
+    EngineLock lock(RequestPriority::Interactive);
+    if (!g_state.ctx || !src || size == 0) {
+        return false;
+    }
+    llama_memory_clear(llama_get_memory(g_state.ctx), false);
+    invalidate_prompt_cache_locked();
+    const bool ok = llama_state_set_data(g_state.ctx, src, size) > 0;
+    if (ok) {
+        reset_metrics_locked();
+    }
+    return ok;
+}
+
+void state_clear(bool clear_data) {
+    EngineLock lock(RequestPriority::Interactive);
+    if (!g_state.ctx) {
+        return;
+    }
+    llama_memory_clear(llama_get_memory(g_state.ctx), clear_data);
+    invalidate_prompt_cache_locked();
+    reset_metrics_locked();
+}
+
+int64_t state_save_compressed(const std::string & path) {
+    EngineLock lock(RequestPriority::Background);
+    if (!g_state.ctx || path.empty()) {
+        return 0;
+    }
+    return save_compressed_locked(path, StateStreamKind::Context, [](StateStreamWriter & writer) {
+        return llama_state_write_stream(g_state.ctx, StateStreamWriter::callback, &writer) > 0;
+    });
+}
+
+bool state_load_compressed(const std::string & path) {
+    EngineLock lock(RequestPriority::Interactive);
+    if (!g_state.ctx || path.empty()) {
+        return false;
+    }
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    StateStreamReader reader(fd, StateStreamKind::Context);
+    llama_memory_clear(llama_get_memory(g_state.ctx), false);
+    invalidate_prompt_cache_locked();
+    const bool ok = reader.ok() &&
+                    llama_state_read_stream(g_state.ctx, StateStreamReader::callback, &reader) > 0 &&
+                    reader.at_end();
+    close(fd);
+    if (ok) {
+        reset_metrics_locked();
+    } else {
+        LOGE("state: compressed restore failed path=%s", path.c_str());
+        llama_memory_clear(llama_get_memory(g_state.ctx), true);
+    }
+    return ok;
+}
+
+bool session_select(int64_t chat_id) {
+    EngineLock lock(RequestPriority::Interactive);
+    if (!g_state.ctx || g_state.sessions.empty()) {
+        return false;
+    }
+    return select_session_locked(chat_id);
+}
+
+void session_release(int64_t chat_id) {
+    EngineLock lock(RequestPriority::Interactive);
+    if (!g_state.ctx) {
+        return;
+    }
+    release_session_locked(chat_id);
+}
+
+void session_spill_dir(const std::string & path) {
+    std::string dir = path;
+    while (dir.size() > 1 && dir.back() == '/') {
+        dir.pop_back();
+    }
+    EngineLock lock(RequestPriority::Interactive);
+    g_state.spill_dir = dir;
+    purge_spill_dir_locked();
+}
+
+size_t session_state_size(int64_t chat_id, bool partial_only) {
+    EngineLock lock(RequestPriority::Background);
+    if (!g_state.ctx) {
+        return 0;
+    }
+    const llama_seq_id seq = find_session_locked(chat_id);
+    if (seq < 0) {
+        return 0;
+    }
+    return session_snapshot_size_locked(seq, partial_only ? LLAMA_STATE_SEQ_FLAGS_PARTIAL_ONLY : 0);
+}
+
+size_t session_state_capture_into(int64_t chat_id, bool partial_only, uint8_t * dst, size_t capacity) {
+    EngineLock lock(RequestPriority::Background);
+    if (!g_state.ctx || !dst) {
+        return 0;
+    }
+    const llama_seq_id seq = find_session_locked(chat_id);
+    if (seq < 0) {
+        return 0;
+    }
+    return write_session_snapshot_locked(seq, partial_only ? LLAMA_STATE_SEQ_FLAGS_PARTIAL_ONLY : 0, dst, capacity);
+}
+
+std::vector<uint8_t> session_state_capture(int64_t chat_id, bool partial_only) {
+    EngineLock lock(RequestPriority::Background);
+    std::vector<uint8_t> buffer;
+    if (!g_state.ctx) {
+        return buffer;
+    }
+    const llama_seq_id seq = find_session_locked(chat_id);
+    if (seq < 0) {
+        return buffer;
+    }
+    const llama_state_seq_flags flags = partial_only ? LLAMA_STATE_SEQ_FLAGS_PARTIAL_ONLY : 0;
+    const size_t size = session_snapshot_size_locked(seq, flags);
+    if (size == 0) {
+        return buffer;
+    }
+    buffer.resize(size);
+    buffer.resize(write_session_snapshot_locked(seq, flags, buffer.data(), buffer.size()));
+    return buffer;
+}
+
+bool session_state_restore(int64_t chat_id, bool partial_only, const uint8_t * src, size_t size) {
+    EngineLock lock(RequestPriority::Interactive);
+    if (!g_state.ctx || g_state.sessions.empty() || !src) {
+        return false;
+    }
+    return read_session_snapshot_locked(chat_id, partial_only ? LLAMA_STATE_SEQ_FLAGS_PARTIAL_ONLY : 0, src, size);
+}
+
+int64_t session_state_save_compressed(int64_t chat_id, const std::string & path) {
+    EngineLock lock(RequestPriority::Background);
+    if (!g_state.ctx || path.empty()) {
+        return 0;
+    }
+    const llama_seq_id seq = find_session_locked(chat_id);
+    if (seq < 0 || g_state.sessions[static_cast<size_t>(seq)].tokens.empty()) {
+        return 0;
+    }
+    return save_session_compressed_locked(seq, path);
+}
+
+bool session_state_load_compressed(int64_t chat_id, const std::string & path) {
+    EngineLock lock(RequestPriority::Interactive);
+    if (!g_state.ctx || g_state.sessions.empty() || path.empty()) {
+        return false;
+    }
+    return load_session_compressed_locked(chat_id, path);
+}
+
+} // namespace engine
+
+} // namespace peerchat
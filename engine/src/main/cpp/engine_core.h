@@ -0,0 +1,283 @@
+#pragma once
+
+#include "chunker.h"
+#include "ggml.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace peerchat {
+
+class TokenRing;
+
+// JNI-free engine core: one model, one generation context with a KV sequence
+// per hot chat plus a few for auxiliary requests, and a lazily created
+// embedding context. Calls that touch the contexts run one at a time through a
+// priority scheduler (scheduler.h): generation and other interactive requests
+// first, embedding and snapshot capture in the background. request_abort(),
+// prefill_progress(), metrics_json() and count_tokens() never queue. The
+// Android shim and the host benchmark both drive the engine through this
+// interface.
+
+enum class StopReason {
+    None,
+    Eos,
+    StopSequence,
+    MaxTokens,
+    Error,
+};
+
+enum class KvPrecision {
+    F16,
+    Q8_0,
+    Q4_0,
+};
+
+struct EngineMetrics {
+    int prompt_tokens = 0;
+    int generation_tokens = 0;
+    double ttfs_ms = 0.0;
+    double prefill_ms = 0.0;
+    double decode_ms = 0.0;
+    double total_ms = 0.0;
+    double tps = 0.0;
+    double prompt_tps = 0.0;
+    double context_used_pct = 0.0;
+    int reused_tokens = 0;
+    int prefilled_tokens = 0;
+    bool truncated = false;
+    // Speculative decoding: tokens proposed by the draft model or the n-gram
+    // lookup, how many the target confirmed, and the target decodes spent.
+    int drafted_tokens = 0;
+    int accepted_tokens = 0;
+    int target_decodes = 0;
+    double acceptance_rate = 0.0;
+    // Generated tokens per target decode; 1.0 for plain decoding.
+    double tokens_per_decode = 0.0;
+    // Context shifts: how often the oldest tokens after the kept head were
+    // evicted to make room, and how many tokens that dropped in total.
+    int context_shifts = 0;
+    int evicted_tokens = 0;
+    // Time the request spent queued behind other engine work before it ran.
+    double queue_wait_ms = 0.0;
+};
+
+struct EngineConfig {
+    std::string model_path;
+    // Most threads any decode uses.
+    int n_threads = 4;
+    // Threads of single-token decodes, pinned to the fastest cores, and of
+    // prompt batches, spread over the fastest n cores; each capped at
+    // n_threads. 0 picks from the core layout (cpu_topology.h): the fast cores
+    // for decode and n_threads for batches.
+    int decode_threads = 0;
+    int batch_threads = 0;
+    // Upper bound on the context; <= 0 asks for the model's training context.
+    int n_ctx = 4096;
+    int n_gpu_layers = 0;
+    bool use_vulkan = true;
+    int session_slots = 1;
+    // Optional small model sharing the target's vocabulary. When it loads,
+    // generation drafts up to draft_max tokens per step and the target verifies
+    // them in one batched decode; otherwise decoding is token by token.
+    std::string draft_model_path;
+    int draft_max = 8;
+    // Drafting stops early once the draft's top candidate falls below this.
+    float draft_p_min = 0.75f;
+    // Without a draft model: prompt-lookup drafting of up to lookup_max tokens
+    // from n-grams of the prompt and of the chat's earlier replies; 0 disables.
+    int lookup_max = 0;
+    // KV cache element type for K and V. Quantized V needs flash attention,
+    // which is then forced on; if the context cannot be created that way the
+    // engine falls back to F16.
+    KvPrecision kv_precision = KvPrecision::F16;
+    // Bytes the weights and KV caches may take together; when set, n_ctx is
+    // lowered to the largest context that fits. 0 leaves n_ctx as requested.
+    int64_t memory_budget_bytes = 0;
+};
+
+// Small embedding model (BERT, nomic, bge class) hosted next to the chat model
+// with its own context, pooling and threads.
+struct EmbedderConfig {
+    std::string model_path;
+    int n_threads = 2;
+    // Tokens per packed batch; 0 uses the training context, capped at 2048.
+    int n_ctx = 0;
+    int n_gpu_layers = 0;
+    // "mean", "cls" or "last"; empty keeps the model's own pooling.
+    std::string pooling;
+};
+
+// Throughput of one thread count in calibrate_threads.
+struct ThreadTrial {
+    int n_threads = 0;
+    double decode_tps = 0.0;
+    double prefill_tps = 0.0;
+};
+
+struct ThreadCalibration {
+    // Best count per phase, applied to the loaded model; store them and pass
+    // them back as EngineConfig::decode_threads / batch_threads.
+    int decode_threads = 0;
+    int batch_threads = 0;
+    double decode_tps = 0.0;
+    double prefill_tps = 0.0;
+    std::vector<ThreadTrial> trials;
+};
+
+struct GenerationRequest {
+    std::string prompt;
+    std::string system_prompt;
+    // Leading bytes of `prompt` (template header, system block) that context
+    // shifts never evict; the system prompt and a few sink tokens always stay.
+    size_t keep_bytes = 0;
+    float temperature = 0.8f;
+    float top_p = 0.9f;
+    int top_k = 40;
+    int max_tokens = 512;
+    std::vector<std::string> stops;
+    // Side requests (titles, summaries, suggestions) that need no chat session:
+    // they decode in a reserved sequence, batched with each other and with the
+    // chat reply being generated instead of queueing behind it. No prefix
+    // reuse, drafting or context shifts; abort does not reach them.
+    bool auxiliary = false;
+};
+
+struct GenerationSummary {
+    EngineMetrics metrics;
+    StopReason reason = StopReason::None;
+    std::string stop_sequence;
+    bool success = false;
+};
+
+// Snapshot of the running prefill; total is 0 when none is in progress.
+struct PrefillProgress {
+    int32_t done = 0;
+    int32_t total = 0;
+    // Remaining time extrapolated from the slices decoded so far; 0 until the first one lands.
+    double eta_ms = 0.0;
+};
+
+// Receives generated text once it has cleared stop-string matching. Chunks end
+// on UTF-8 character boundaries; the view is only valid during the call.
+class TokenSink {
+public:
+    virtual ~TokenSink() = default;
+    // Returning false ends generation with StopReason::Error.
+    virtual bool emit(std::string_view text) = 0;
+    // Signalled once by engine::generate_stream, after the engine lock is
+    // released and the metrics are committed.
+    virtual void done() = 0;
+};
+
+// Publishes into a TokenRing; done() closes the ring. A full ring blocks the
+// producer until the consumer catches up or the generation is aborted.
+class RingSink final : public TokenSink {
+public:
+    explicit RingSink(TokenRing * ring) : ring_(ring) {}
+    bool emit(std::string_view text) override;
+    void done() override;
+
+private:
+    TokenRing * ring_;
+};
+
+// {"decodeThreads":..,"batchThreads":..,"decodeTps":..,"prefillTps":..,"trials":[{"threads":..,..}]}
+std::string thread_calibration_json(const ThreadCalibration & calibration);
+
+const char * stop_reason_name(StopReason reason);
+const char * kv_precision_name(KvPrecision precision);
+// Accepts "f16", "q8_0" and "q4_0"; anything else is F16.
+KvPrecision parse_kv_precision(const std::string & name);
+// Cache tensor type of a precision, for the context and the memory planner.
+ggml_type kv_ggml_type(KvPrecision precision);
+
+namespace engine {
+
+void init();
+// Replaces any loaded model. Fails when the file is missing or the contexts cannot be created.
+bool load(const EngineConfig & config);
+void unload();
+
+// Generates into the active session, or with req.auxiliary into a reserved
+// sequence alongside whatever else is decoding. `sink` and `out_text` are
+// optional; `sink` is only called on the calling thread.
+bool generate(const GenerationRequest & req, TokenSink * sink, std::string * out_text, GenerationSummary & summary);
+// Same as generate but never throws and always signals sink->done().
+void generate_stream(const GenerationRequest & req, TokenSink * sink);
+
+// One vector per text (empty when that text failed); false without a usable model.
+// Uses the dedicated embedder when one is loaded, otherwise the chat model at
+// background priority, yielding to generation between packed batches.
+bool embed(const std::vector<std::string> & texts, std::vector<std::vector<float>> & out,
+           double * queue_wait_ms = nullptr);
+// Loads or replaces the dedicated embedder. It has its own lock, so embedding
+// does not wait on generation, and it survives chat model loads and unloads.
+bool load_embedder(const EmbedderConfig & config);
+void unload_embedder();
+// Reads only the vocabulary; runs alongside a decode instead of queueing.
+int count_tokens(const std::string & text);
+// Tokenizes a whole document once and splits it into chunks under a token
+// budget (chunker.h), with byte offsets into `text`. Reads only the
+// vocabulary, like count_tokens; false without a model. One token of the budget
+// is kept back for what a chunk gains when tokenized on its own.
+bool chunk_text(const std::string & text, const ChunkOptions & options, std::vector<ChunkSpan> & out);
+// Tokens of many texts at once, tokenized on the engine's threads
+// (token_batch.h); text i owns tokens[offsets[i], offsets[i + 1]). Reads only
+// the vocabulary, like count_tokens; false without a model.
+bool tokenize_batch(const std::vector<std::string_view> & texts, bool add_special,
+                    std::vector<int32_t> & tokens, std::vector<uint32_t> & offsets);
+// count_tokens for many texts at once, without keeping the tokens.
+bool count_tokens_batch(const std::vector<std::string_view> & texts, std::vector<int32_t> & counts);
+
+// Times a short prefill and a few single-token decodes of the loaded model at
+// each candidate thread count (cpu_topology.h) in a scratch context, then moves
+// the engine's pools to the fastest count per phase. Runs at background
+// priority, one candidate per turn; false without a model or if the model was
+// replaced meanwhile.
+bool calibrate_threads(ThreadCalibration & out);
+
+// Last generation's metrics plus the context configuration, as of the last
+// finished request, and the scheduler's per-priority queue-wait statistics.
+// Never waits for a running request.
+std::string metrics_json();
+// Architecture, template and capability hints plus per-layer weight bytes and
+// quant types, from the GGUF header alone; "{}" when the file cannot be read.
+std::string detect_model(const std::string & path);
+
+// Thread-safe and lock-free, for polling while generate runs. The prompt is
+// decoded in n_batch slices; progress advances once per slice.
+PrefillProgress prefill_progress();
+// Thread-safe; interrupts the running generation. During prefill it takes
+// effect at the next slice boundary, or sooner via the llama abort callback.
+void request_abort();
+// Clears KV memory and abort/metric state after an error without unloading.
+void recover();
+
+// Whole-context snapshots.
+size_t state_size();
+size_t state_capture_into(uint8_t * dst, size_t capacity);
+std::vector<uint8_t> state_capture();
+bool state_restore(const uint8_t * src, size_t size);
+void state_clear(bool clear_data);
+// Streamed, chunk-compressed; the save returns the stored size or 0.
+int64_t state_save_compressed(const std::string & path);
+bool state_load_compressed(const std::string & path);
+
+// Chat sessions: each chat owns one KV sequence, cold ones are spilled to disk.
+bool session_select(int64_t chat_id);
+void session_release(int64_t chat_id);
+void session_spill_dir(const std::string & path);
+size_t session_state_size(int64_t chat_id, bool partial_only);
+size_t session_state_capture_into(int64_t chat_id, bool partial_only, uint8_t * dst, size_t capacity);
+std::vector<uint8_t> session_state_capture(int64_t chat_id, bool partial_only);
+bool session_state_restore(int64_t chat_id, bool partial_only, const uint8_t * src, size_t size);
+int64_t session_state_save_compressed(int64_t chat_id, const std::string & path);
+bool session_state_load_compressed(int64_t chat_id, const std::string & path);
+
+} // namespace engine
+
+} // namespace peerchat
@@ -0,0 +1,40 @@
+#include "engine_log.h"
+
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+
+#if defined(__ANDROID__)
+#include <android/log.h>
+#endif
+
+namespace peerchat {
+
+namespace {
+
+constexpr const char * kTag = "PeerChatEngine";
+
+std::atomic<LogLevel> g_min_level{LogLevel::Info};
+
+} // namespace
+
+void log_print(LogLevel level, const char * fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+#if defined(__ANDROID__)
+    __android_log_vprint(level == LogLevel::Error ? ANDROID_LOG_ERROR : ANDROID_LOG_INFO, kTag, fmt, args);
+#else
+    if (level >= g_min_level.load(std::memory_order_relaxed)) {
+        std::fprintf(stderr, "%s %s: ", level == LogLevel::Error ? "E" : "I", kTag);
+        std::vfprintf(stderr, fmt, args);
+        std::fputc('\n', stderr);
+    }
+#endif
+    va_end(args);
+}
+
+void set_log_level(LogLevel level) {
+    g_min_level.store(level, std::memory_order_relaxed);
+}
+
+} // namespace peerchat
@@ -0,0 +1,19 @@
+#pragma once
+
+namespace peerchat {
+
+// Engine logging: logcat on Android, stderr on host builds.
+enum class LogLevel {
+    Info,
+    Error,
+};
+
+void log_print(LogLevel level, const char * fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// Host builds only: messages below `level` are dropped. Android always forwards to logcat.
+void set_log_level(LogLevel level);
+
+} // namespace peerchat
+
+#define LOGI(...) ::peerchat::log_print(::peerchat::LogLevel::Info, __VA_ARGS__)
+#define LOGE(...) ::peerchat::log_print(::peerchat::LogLevel::Error, __VA_ARGS__)
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <unistd.h>
+
+namespace peerchat {
+
+// Full-length read/write on a file descriptor, retrying on EINTR and short
+// transfers. read_all fails on EOF before `size` bytes.
+
+inline bool write_all(int fd, const void * src, size_t size) {
+    const uint8_t * p = static_cast<const uint8_t *>(src);
+    while (size > 0) {
+        const ssize_t n = ::write(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+inline bool read_all(int fd, void * dst, size_t size) {
+    uint8_t * p = static_cast<uint8_t *>(dst);
+    while (size > 0) {
+        const ssize_t n = ::read(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (n == 0) {
+            return false;
+        }
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+} // namespace peerchat
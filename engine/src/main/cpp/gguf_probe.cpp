@@ -0,0 +1,252 @@
+#include "gguf_probe.h"
+
+#include "gguf.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <sstream>
+
+namespace peerchat {
+
+namespace {
+
+int64_t scalar_at(gguf_type type, const void * data, size_t i) {
+    switch (type) {
+        case GGUF_TYPE_UINT8:   return static_cast<const uint8_t *>(data)[i];
+        case GGUF_TYPE_INT8:    return static_cast<const int8_t *>(data)[i];
+        case GGUF_TYPE_UINT16:  return static_cast<const uint16_t *>(data)[i];
+        case GGUF_TYPE_INT16:   return static_cast<const int16_t *>(data)[i];
+        case GGUF_TYPE_UINT32:  return static_cast<const uint32_t *>(data)[i];
+        case GGUF_TYPE_INT32:   return static_cast<const int32_t *>(data)[i];
+        case GGUF_TYPE_UINT64:  return static_cast<int64_t>(static_cast<const uint64_t *>(data)[i]);
+        case GGUF_TYPE_INT64:   return static_cast<const int64_t *>(data)[i];
+        case GGUF_TYPE_FLOAT32: return static_cast<int64_t>(static_cast<const float *>(data)[i]);
+        case GGUF_TYPE_FLOAT64: return static_cast<int64_t>(static_cast<const double *>(data)[i]);
+        case GGUF_TYPE_BOOL:    return static_cast<const int8_t *>(data)[i] != 0;
+        default:                return 0;
+    }
+}
+
+// Integer value of `key`; arrays yield one entry per element, scalars one.
+std::vector<int64_t> read_ints(const gguf_context * ctx, const std::string & key) {
+    const int64_t id = gguf_find_key(ctx, key.c_str());
+    if (id < 0) {
+        return {};
+    }
+    const gguf_type type = gguf_get_kv_type(ctx, id);
+    if (type == GGUF_TYPE_ARRAY) {
+        const gguf_type arr_type = gguf_get_arr_type(ctx, id);
+        if (arr_type == GGUF_TYPE_STRING || arr_type == GGUF_TYPE_ARRAY) {
+            return {};
+        }
+        const size_t n = gguf_get_arr_n(ctx, id);
+        const void * data = gguf_get_arr_data(ctx, id);
+        std::vector<int64_t> values(n);
+        for (size_t i = 0; i < n; ++i) {
+            values[i] = scalar_at(arr_type, data, i);
+        }
+        return values;
+    }
+    if (type == GGUF_TYPE_STRING) {
+        return {};
+    }
+    return {scalar_at(type, gguf_get_val_data(ctx, id), 0)};
+}
+
+uint32_t read_u32(const gguf_context * ctx, const std::string & key) {
+    const std::vector<int64_t> values = read_ints(ctx, key);
+    if (values.empty()) {
+        return 0;
+    }
+    return static_cast<uint32_t>(std::max<int64_t>(0, *std::max_element(values.begin(), values.end())));
+}
+
+// Matches llama_model_meta_val_str: strings verbatim, string arrays as
+// ["a", "b"], scalars in decimal, bools as true/false.
+std::string read_string(const gguf_context * ctx, const std::string & key) {
+    const int64_t id = gguf_find_key(ctx, key.c_str());
+    if (id < 0) {
+        return {};
+    }
+    const gguf_type type = gguf_get_kv_type(ctx, id);
+    std::ostringstream oss;
+    switch (type) {
+        case GGUF_TYPE_STRING:
+            return gguf_get_val_str(ctx, id);
+        case GGUF_TYPE_BOOL:
+            return gguf_get_val_bool(ctx, id) ? "true" : "false";
+        case GGUF_TYPE_FLOAT32:
+            oss << gguf_get_val_f32(ctx, id);
+            return oss.str();
+        case GGUF_TYPE_FLOAT64:
+            oss << gguf_get_val_f64(ctx, id);
+            return oss.str();
+        case GGUF_TYPE_ARRAY: {
+            const gguf_type arr_type = gguf_get_arr_type(ctx, id);
+            const size_t n = gguf_get_arr_n(ctx, id);
+            oss << "[";
+            for (size_t i = 0; i < n; ++i) {
+                if (i > 0) {
+                    oss << ", ";
+                }
+                if (arr_type == GGUF_TYPE_STRING) {
+                    oss << '"';
+                    for (const char * p = gguf_get_arr_str(ctx, id, i); *p; ++p) {
+                        if (*p == '"' || *p == '\\') {
+                            oss << '\\';
+                        }
+                        oss << *p;
+                    }
+                    oss << '"';
+                } else if (arr_type == GGUF_TYPE_ARRAY) {
+                    oss << "???";
+                } else {
+                    oss << scalar_at(arr_type, gguf_get_arr_data(ctx, id), i);
+                }
+            }
+            oss << "]";
+            return oss.str();
+        }
+        default:
+            oss << scalar_at(type, gguf_get_val_data(ctx, id), 0);
+            return oss.str();
+    }
+}
+
+// "blk.12.attn_q.weight" -> 12; -1 for tensors outside the repeating blocks.
+int32_t layer_of(const char * name) {
+    if (std::strncmp(name, "blk.", 4) != 0) {
+        return -1;
+    }
+    char * end = nullptr;
+    const long layer = std::strtol(name + 4, &end, 10);
+    return end != name + 4 && *end == '.' ? static_cast<int32_t>(layer) : -1;
+}
+
+} // namespace
+
+bool gguf_probe(const std::string & path, GgufModelInfo & out) {
+    gguf_init_params params{};
+    params.no_alloc = true;
+    params.ctx = nullptr;
+    gguf_context * ctx = gguf_init_from_file(path.c_str(), params);
+    if (!ctx) {
+        return false;
+    }
+
+    GgufModelInfo info;
+    info.arch = read_string(ctx, "general.architecture");
+    info.name = read_string(ctx, "general.name");
+    info.chat_template = read_string(ctx, "tokenizer.chat_template");
+    if (info.chat_template.empty()) {
+        info.chat_template = read_string(ctx, "llama.chat_template");
+    }
+    info.tokenizer_model = read_string(ctx, "tokenizer.ggml.model");
+    info.tags = read_string(ctx, "general.tags");
+    info.capabilities = read_string(ctx, "general.capabilities");
+    info.reasoning_flag = read_string(ctx, "general.capabilities.reasoning");
+
+    const std::string & arch = info.arch;
+    info.n_ctx_train = read_u32(ctx, arch + ".context_length");
+    info.n_layer = read_u32(ctx, arch + ".block_count");
+    info.n_embd = read_u32(ctx, arch + ".embedding_length");
+    info.n_head = read_u32(ctx, arch + ".attention.head_count");
+    const int64_t tokens_id = gguf_find_key(ctx, "tokenizer.ggml.tokens");
+    info.n_vocab = tokens_id >= 0 ? static_cast<int64_t>(gguf_get_arr_n(ctx, tokens_id))
+                                  : read_u32(ctx, arch + ".vocab_size");
+
+    const uint32_t head_default = info.n_head > 0 ? info.n_embd / info.n_head : 0;
+    info.head_k = read_u32(ctx, arch + ".attention.key_length");
+    info.head_v = read_u32(ctx, arch + ".attention.value_length");
+    if (info.head_k == 0) info.head_k = head_default;
+    if (info.head_v == 0) info.head_v = head_default;
+
+    std::vector<int64_t> head_kv = read_ints(ctx, arch + ".attention.head_count_kv");
+    if (head_kv.empty()) {
+        head_kv.push_back(info.n_head);
+    }
+    info.n_head_kv.resize(info.n_layer);
+    for (uint32_t il = 0; il < info.n_layer; ++il) {
+        const int64_t n = head_kv.size() == 1 ? head_kv[0] : (il < head_kv.size() ? head_kv[il] : 0);
+        info.n_head_kv[il] = static_cast<uint32_t>(std::max<int64_t>(0, n));
+    }
+
+    info.n_ff = read_u32(ctx, arch + ".feed_forward_length");
+    info.n_ff_exp = read_u32(ctx, arch + ".expert_feed_forward_length");
+    info.n_expert_used = read_u32(ctx, arch + ".expert_used_count");
+    info.ssm_d_conv = read_u32(ctx, arch + ".ssm.conv_kernel");
+    info.ssm_d_inner = read_u32(ctx, arch + ".ssm.inner_size");
+    info.ssm_d_state = read_u32(ctx, arch + ".ssm.state_size");
+    info.ssm_n_group = read_u32(ctx, arch + ".ssm.group_count");
+    info.wkv_head_size = read_u32(ctx, arch + ".wkv.head_size");
+    info.token_shift_count = read_u32(ctx, arch + ".token_shift_count");
+    if (info.wkv_head_size != 0 && info.token_shift_count == 0) {
+        info.token_shift_count = 2;
+    }
+    info.shortconv_l_cache = read_u32(ctx, arch + ".shortconv.l_cache");
+
+    const int64_t n_tensors = gguf_get_n_tensors(ctx);
+    info.tensors.reserve(static_cast<size_t>(std::max<int64_t>(0, n_tensors)));
+    info.layers.resize(info.n_layer);
+    std::vector<std::map<ggml_type, uint64_t>> layer_types(info.n_layer);
+    for (int64_t i = 0; i < n_tensors; ++i) {
+        GgufTensorInfo tensor;
+        tensor.name = gguf_get_tensor_name(ctx, i);
+        tensor.type = gguf_get_tensor_type(ctx, i);
+        tensor.bytes = gguf_get_tensor_size(ctx, i);
+        tensor.layer = layer_of(tensor.name.c_str());
+        info.weight_bytes += tensor.bytes;
+        if (tensor.layer >= 0 && static_cast<uint32_t>(tensor.layer) < info.n_layer) {
+            info.layers[tensor.layer].bytes += tensor.bytes;
+            layer_types[tensor.layer][tensor.type] += tensor.bytes;
+        } else {
+            info.shared_bytes += tensor.bytes;
+        }
+        info.tensors.push_back(std::move(tensor));
+    }
+    for (uint32_t il = 0; il < info.n_layer; ++il) {
+        const auto & types = layer_types[il];
+        const auto dominant = std::max_element(types.begin(), types.end(),
+                                               [](const auto & a, const auto & b) { return a.second < b.second; });
+        if (dominant != types.end()) {
+            info.layers[il].type = dominant->first;
+        }
+    }
+
+    gguf_free(ctx);
+    out = std::move(info);
+    return true;
+}
+
+size_t gguf_kv_bytes_per_token(const GgufModelInfo & info, ggml_type type_k, ggml_type type_v) {
+    size_t bytes = 0;
+    for (const uint32_t n_head_kv : info.n_head_kv) {
+        bytes += ggml_row_size(type_k, static_cast<int64_t>(info.head_k) * n_head_kv) +
+                 ggml_row_size(type_v, static_cast<int64_t>(info.head_v) * n_head_kv);
+    }
+    return bytes;
+}
+
+bool gguf_is_recurrent(const GgufModelInfo & info) {
+    return info.ssm_d_state != 0 || info.wkv_head_size != 0 || info.shortconv_l_cache != 0;
+}
+
+uint64_t gguf_recurrent_elements_per_layer(const GgufModelInfo & info) {
+    uint64_t r = 0;
+    uint64_t s = 0;
+    if (info.wkv_head_size != 0) {
+        r = static_cast<uint64_t>(info.token_shift_count) * info.n_embd;
+        s = static_cast<uint64_t>(info.n_embd) * info.wkv_head_size;
+    } else if (info.shortconv_l_cache != 0) {
+        r = static_cast<uint64_t>(info.n_embd) * (info.shortconv_l_cache - 1);
+    } else {
+        r = static_cast<uint64_t>(info.ssm_d_conv > 0 ? info.ssm_d_conv - 1 : 0) *
+            (info.ssm_d_inner + 2ull * info.ssm_n_group * info.ssm_d_state);
+        s = static_cast<uint64_t>(info.ssm_d_state) * info.ssm_d_inner;
+    }
+    return r + s;
+}
+
+} // namespace peerchat
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "ggml.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace peerchat {
+
+// Header-only view of a GGUF file: the KV section and the tensor directory,
+// read with gguf's no_alloc reader. No tensor data is mapped or touched, so a
+// probe costs milliseconds regardless of model size and leaves the page cache
+// to the real load.
+struct GgufTensorInfo {
+    std::string name;
+    ggml_type type = GGML_TYPE_F32;
+    uint64_t bytes = 0;
+    // Block index for "blk.N.*" tensors, -1 for embeddings, output and norms.
+    int32_t layer = -1;
+};
+
+struct GgufLayerInfo {
+    uint64_t bytes = 0;
+    // The type holding most of the layer's bytes.
+    ggml_type type = GGML_TYPE_F32;
+};
+
+struct GgufModelInfo {
+    std::string arch;
+    std::string name;
+    std::string chat_template;
+    std::string tokenizer_model;
+    std::string tags;
+    std::string capabilities;
+    std::string reasoning_flag;
+    uint32_t n_ctx_train = 0;
+    uint32_t n_layer = 0;
+    uint32_t n_embd = 0;
+    uint32_t n_head = 0;
+    int64_t n_vocab = 0;
+    uint32_t head_k = 0;
+    uint32_t head_v = 0;
+    // KV heads per layer; architectures with a single count repeat it.
+    std::vector<uint32_t> n_head_kv;
+    // Widest dense FFN; MoE models add the per-expert width and experts used.
+    uint32_t n_ff = 0;
+    uint32_t n_ff_exp = 0;
+    uint32_t n_expert_used = 0;
+    // Recurrent state shapes (Mamba, RWKV, LFM2 short convolutions); all zero
+    // for pure attention models.
+    uint32_t ssm_d_conv = 0;
+    uint32_t ssm_d_inner = 0;
+    uint32_t ssm_d_state = 0;
+    uint32_t ssm_n_group = 0;
+    uint32_t wkv_head_size = 0;
+    uint32_t token_shift_count = 0;
+    uint32_t shortconv_l_cache = 0;
+
+    std::vector<GgufTensorInfo> tensors;
+    std::vector<GgufLayerInfo> layers;
+    uint64_t weight_bytes = 0;
+    // Tensors outside the repeating blocks (token embedding, output head, norms).
+    uint64_t shared_bytes = 0;
+};
+
+// False when the file is missing or its header does not parse.
+bool gguf_probe(const std::string & path, GgufModelInfo & out);
+
+// Bytes one cell takes across all layers of a KV cache with these types.
+size_t gguf_kv_bytes_per_token(const GgufModelInfo & info, ggml_type type_k, ggml_type type_v);
+
+// F32 elements of one sequence's recurrent state per recurrent layer
+// (convolution / token-shift part and SSM / WKV part), as llama_hparams sizes them.
+uint64_t gguf_recurrent_elements_per_layer(const GgufModelInfo & info);
+bool gguf_is_recurrent(const GgufModelInfo & info);
+
+} // namespace peerchat
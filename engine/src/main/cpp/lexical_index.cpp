@@ -0,0 +1,383 @@
+#include "lexical_index.h"
+
+#include "file_io.h"
+#include "llama/src/unicode.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace peerchat {
+
+namespace {
+
+struct FileHeader {
+    uint32_t magic;
+    uint32_t version;
+    float k1;
+    float b;
+    uint64_t docs;
+    uint64_t terms;
+    uint64_t pairs;
+    uint64_t term_bytes;
+};
+
+// Terms longer than this are almost always base64, hashes or URLs.
+constexpr size_t kMaxTermBytes = 64;
+
+thread_local std::vector<float> t_scores;
+thread_local std::vector<uint32_t> t_touched;
+
+bool is_word_cpt(uint32_t cpt) {
+    if (cpt < 0x80) {
+        return (cpt >= 'a' && cpt <= 'z') || (cpt >= 'A' && cpt <= 'Z') || (cpt >= '0' && cpt <= '9');
+    }
+    const unicode_cpt_flags flags = unicode_cpt_flags_from_cpt(cpt);
+    return flags.is_letter || flags.is_number || flags.is_accent_mark;
+}
+
+uint32_t lower_cpt(uint32_t cpt) {
+    if (cpt < 0x80) {
+        return (cpt >= 'A' && cpt <= 'Z') ? cpt + ('a' - 'A') : cpt;
+    }
+    return unicode_tolower(cpt);
+}
+
+void flush_term(std::string & term, std::vector<std::string> & out) {
+    if (!term.empty() && term.size() <= kMaxTermBytes) {
+        out.push_back(term);
+    }
+    term.clear();
+}
+
+} // namespace
+
+std::vector<std::string> lexical_terms(const std::string & text) {
+    std::vector<std::string> out;
+    std::string term;
+    for (uint32_t cpt : unicode_cpts_from_utf8(text)) {
+        if (cpt >= 0x80 && unicode_cpt_is_han(cpt)) {
+            flush_term(term, out);
+            out.push_back(unicode_cpt_to_utf8(cpt));
+        } else if (is_word_cpt(cpt)) {
+            const uint32_t lower = lower_cpt(cpt);
+            if (lower < 0x80) {
+                term.push_back(static_cast<char>(lower));
+            } else {
+                term += unicode_cpt_to_utf8(lower);
+            }
+        } else {
+            flush_term(term, out);
+        }
+    }
+    flush_term(term, out);
+    return out;
+}
+
+uint32_t Bm25Index::intern(const std::string & term) {
+    auto it = terms_.find(term);
+    if (it != terms_.end()) {
+        return it->second;
+    }
+    const uint32_t id = static_cast<uint32_t>(term_text_.size());
+    terms_.emplace(term, id);
+    term_text_.push_back(term);
+    postings_.emplace_back();
+    doc_freq_.push_back(0);
+    return id;
+}
+
+void Bm25Index::append(int64_t id, const std::vector<TermFreq> & term_freqs, uint32_t length) {
+    const uint32_t doc = static_cast<uint32_t>(doc_ids_.size());
+    doc_ids_.push_back(id);
+    doc_lengths_.push_back(length);
+    deleted_.push_back(0);
+    for (const TermFreq & tf : term_freqs) {
+        doc_terms_.push_back(tf);
+        postings_[tf.term].push_back({doc, tf.tf});
+        ++doc_freq_[tf.term];
+    }
+    doc_offsets_.push_back(static_cast<uint32_t>(doc_terms_.size()));
+    id_to_doc_[id] = doc;
+    live_length_ += length;
+}
+
+bool Bm25Index::add(int64_t id, const std::string & text) {
+    const std::vector<std::string> words = lexical_terms(text);
+    if (words.empty()) {
+        return false;
+    }
+    remove(id);
+
+    std::unordered_map<uint32_t, uint32_t> counts;
+    for (const std::string & word : words) {
+        ++counts[intern(word)];
+    }
+    std::vector<TermFreq> term_freqs;
+    term_freqs.reserve(counts.size());
+    for (const auto & [term, tf] : counts) {
+        term_freqs.push_back({term, tf});
+    }
+    std::sort(term_freqs.begin(), term_freqs.end(), [](const TermFreq & a, const TermFreq & b) { return a.term < b.term; });
+    append(id, term_freqs, static_cast<uint32_t>(words.size()));
+    return true;
+}
+
+bool Bm25Index::remove(int64_t id) {
+    auto it = id_to_doc_.find(id);
+    if (it == id_to_doc_.end()) {
+        return false;
+    }
+    const uint32_t doc = it->second;
+    id_to_doc_.erase(it);
+    deleted_[doc] = 1;
+    live_length_ -= doc_lengths_[doc];
+    for (uint32_t i = doc_offsets_[doc]; i < doc_offsets_[doc + 1]; ++i) {
+        --doc_freq_[doc_terms_[i].term];
+    }
+    if (doc_ids_.size() - id_to_doc_.size() > std::max<size_t>(id_to_doc_.size(), 1024)) {
+        compact();
+    }
+    return true;
+}
+
+// Drops tombstoned documents and terms no live document uses any more.
+void Bm25Index::compact() {
+    std::vector<int64_t> doc_ids;
+    std::vector<uint32_t> doc_lengths;
+    std::vector<uint32_t> doc_offsets{0};
+    std::vector<TermFreq> doc_terms;
+    std::vector<uint32_t> remap(term_text_.size(), UINT32_MAX);
+    std::vector<std::string> term_text;
+    doc_ids.reserve(id_to_doc_.size());
+    doc_lengths.reserve(id_to_doc_.size());
+
+    for (size_t doc = 0; doc < doc_ids_.size(); ++doc) {
+        if (deleted_[doc]) {
+            continue;
+        }
+        for (uint32_t i = doc_offsets_[doc]; i < doc_offsets_[doc + 1]; ++i) {
+            TermFreq tf = doc_terms_[i];
+            if (remap[tf.term] == UINT32_MAX) {
+                remap[tf.term] = static_cast<uint32_t>(term_text.size());
+                term_text.push_back(std::move(term_text_[tf.term]));
+            }
+            tf.term = remap[tf.term];
+            doc_terms.push_back(tf);
+        }
+        doc_ids.push_back(doc_ids_[doc]);
+        doc_lengths.push_back(doc_lengths_[doc]);
+        doc_offsets.push_back(static_cast<uint32_t>(doc_terms.size()));
+    }
+
+    doc_ids_ = std::move(doc_ids);
+    doc_lengths_ = std::move(doc_lengths);
+    deleted_.assign(doc_ids_.size(), 0);
+    doc_offsets_ = std::move(doc_offsets);
+    doc_terms_ = std::move(doc_terms);
+    term_text_ = std::move(term_text);
+    rebuild_postings();
+}
+
+// Derives the dictionary, postings, frequencies and id map from the per-document tables.
+void Bm25Index::rebuild_postings() {
+    terms_.clear();
+    terms_.reserve(term_text_.size());
+    for (uint32_t term = 0; term < term_text_.size(); ++term) {
+        terms_.emplace(term_text_[term], term);
+    }
+    postings_.assign(term_text_.size(), {});
+    doc_freq_.assign(term_text_.size(), 0);
+    id_to_doc_.clear();
+    id_to_doc_.reserve(doc_ids_.size());
+    live_length_ = 0;
+    for (uint32_t doc = 0; doc < doc_ids_.size(); ++doc) {
+        if (deleted_[doc]) {
+            continue;
+        }
+        for (uint32_t i = doc_offsets_[doc]; i < doc_offsets_[doc + 1]; ++i) {
+            const TermFreq & tf = doc_terms_[i];
+            postings_[tf.term].push_back({doc, tf.tf});
+            ++doc_freq_[tf.term];
+        }
+        id_to_doc_[doc_ids_[doc]] = doc;
+        live_length_ += doc_lengths_[doc];
+    }
+}
+
+size_t Bm25Index::search(const std::string & query, size_t k, int64_t * out_ids, float * out_scores) const {
+    const size_t live = id_to_doc_.size();
+    if (k == 0 || live == 0) {
+        return 0;
+    }
+    std::vector<std::string> words = lexical_terms(query);
+    std::sort(words.begin(), words.end());
+    words.erase(std::unique(words.begin(), words.end()), words.end());
+
+    std::vector<float> & scores = t_scores;
+    std::vector<uint32_t> & touched = t_touched;
+    if (scores.size() < doc_ids_.size()) {
+        scores.resize(doc_ids_.size(), 0.0f);
+    }
+    touched.clear();
+
+    const float avg_length = static_cast<float>(live_length_) / static_cast<float>(live);
+    const float k1 = params_.k1;
+    const float b = params_.b;
+    for (const std::string & word : words) {
+        auto it = terms_.find(word);
+        if (it == terms_.end() || doc_freq_[it->second] == 0) {
+            continue;
+        }
+        const float df = static_cast<float>(doc_freq_[it->second]);
+        const float idf = std::log(1.0f + (static_cast<float>(live) - df + 0.5f) / (df + 0.5f));
+        for (const Posting & p : postings_[it->second]) {
+            if (deleted_[p.doc]) {
+                continue;
+            }
+            const float tf = static_cast<float>(p.tf);
+            const float norm = k1 * (1.0f - b + b * static_cast<float>(doc_lengths_[p.doc]) / avg_length);
+            if (scores[p.doc] == 0.0f) {
+                touched.push_back(p.doc);
+            }
+            scores[p.doc] += idf * tf * (k1 + 1.0f) / (tf + norm);
+        }
+    }
+
+    using Scored = std::pair<float, uint32_t>;
+    std::vector<Scored> hits;
+    hits.reserve(touched.size());
+    for (uint32_t doc : touched) {
+        hits.emplace_back(scores[doc], doc);
+        scores[doc] = 0.0f;
+    }
+    const size_t out = std::min(k, hits.size());
+    std::partial_sort(hits.begin(), hits.begin() + out, hits.end(), std::greater<Scored>());
+    for (size_t i = 0; i < out; ++i) {
+        out_ids[i] = doc_ids_[hits[i].second];
+        if (out_scores) {
+            out_scores[i] = hits[i].first;
+        }
+    }
+    return out;
+}
+
+bool Bm25Index::save(const std::string & path) const {
+    std::vector<uint32_t> term_offsets;
+    term_offsets.reserve(term_text_.size() + 1);
+    std::string term_bytes;
+    term_offsets.push_back(0);
+    for (const std::string & term : term_text_) {
+        term_bytes += term;
+        term_offsets.push_back(static_cast<uint32_t>(term_bytes.size()));
+    }
+
+    const std::string tmp = path + ".tmp";
+    const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    const FileHeader header{
+        kLexicalIndexMagic,
+        kLexicalIndexVersion,
+        params_.k1,
+        params_.b,
+        static_cast<uint64_t>(doc_ids_.size()),
+        static_cast<uint64_t>(term_text_.size()),
+        static_cast<uint64_t>(doc_terms_.size()),
+        static_cast<uint64_t>(term_bytes.size()),
+    };
+    const bool ok = write_all(fd, &header, sizeof(header)) &&
+                    write_all(fd, term_offsets.data(), term_offsets.size() * sizeof(uint32_t)) &&
+                    write_all(fd, term_bytes.data(), term_bytes.size()) &&
+                    write_all(fd, doc_ids_.data(), doc_ids_.size() * sizeof(int64_t)) &&
+                    write_all(fd, doc_lengths_.data(), doc_lengths_.size() * sizeof(uint32_t)) &&
+                    write_all(fd, deleted_.data(), deleted_.size()) &&
+                    write_all(fd, doc_offsets_.data(), doc_offsets_.size() * sizeof(uint32_t)) &&
+                    write_all(fd, doc_terms_.data(), doc_terms_.size() * sizeof(TermFreq));
+    ::close(fd);
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        ::unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::unique_ptr<Bm25Index> Bm25Index::open(const std::string & path) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st {};
+    FileHeader header{};
+    if (fstat(fd, &st) != 0 || !read_all(fd, &header, sizeof(header)) ||
+        header.magic != kLexicalIndexMagic || header.version != kLexicalIndexVersion ||
+        header.docs >= UINT32_MAX || header.terms >= UINT32_MAX ||
+        header.pairs >= UINT32_MAX || header.term_bytes >= UINT32_MAX) {
+        ::close(fd);
+        return nullptr;
+    }
+    const size_t docs = static_cast<size_t>(header.docs);
+    const size_t terms = static_cast<size_t>(header.terms);
+    const size_t pairs = static_cast<size_t>(header.pairs);
+    const size_t expected = sizeof(FileHeader) + (terms + 1) * sizeof(uint32_t) + header.term_bytes +
+                            docs * (sizeof(int64_t) + sizeof(uint32_t) + 1) + (docs + 1) * sizeof(uint32_t) +
+                            pairs * sizeof(TermFreq);
+    if (static_cast<size_t>(st.st_size) != expected) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    Params params;
+    params.k1 = header.k1;
+    params.b = header.b;
+    std::unique_ptr<Bm25Index> index(new Bm25Index(params));
+    std::vector<uint32_t> term_offsets(terms + 1);
+    std::string term_bytes(header.term_bytes, '\0');
+    index->doc_ids_.resize(docs);
+    index->doc_lengths_.resize(docs);
+    index->deleted_.resize(docs);
+    index->doc_offsets_.resize(docs + 1);
+    index->doc_terms_.resize(pairs);
+    const bool ok = read_all(fd, term_offsets.data(), term_offsets.size() * sizeof(uint32_t)) &&
+                    read_all(fd, term_bytes.data(), term_bytes.size()) &&
+                    read_all(fd, index->doc_ids_.data(), docs * sizeof(int64_t)) &&
+                    read_all(fd, index->doc_lengths_.data(), docs * sizeof(uint32_t)) &&
+                    read_all(fd, index->deleted_.data(), docs) &&
+                    read_all(fd, index->doc_offsets_.data(), (docs + 1) * sizeof(uint32_t)) &&
+                    read_all(fd, index->doc_terms_.data(), pairs * sizeof(TermFreq));
+    ::close(fd);
+    if (!ok || term_offsets[0] != 0 || term_offsets[terms] != term_bytes.size() ||
+        index->doc_offsets_[0] != 0 || index->doc_offsets_[docs] != pairs) {
+        return nullptr;
+    }
+
+    index->term_text_.reserve(terms);
+    for (size_t t = 0; t < terms; ++t) {
+        if (term_offsets[t] > term_offsets[t + 1]) {
+            return nullptr;
+        }
+        index->term_text_.emplace_back(term_bytes, term_offsets[t], term_offsets[t + 1] - term_offsets[t]);
+    }
+    for (size_t doc = 0; doc < docs; ++doc) {
+        if (index->doc_offsets_[doc] > index->doc_offsets_[doc + 1]) {
+            return nullptr;
+        }
+    }
+    for (const TermFreq & tf : index->doc_terms_) {
+        if (tf.term >= terms) {
+            return nullptr;
+        }
+    }
+    index->rebuild_postings();
+    if (index->terms_.size() != terms) {
+        return nullptr;
+    }
+    return index;
+}
+
+} // namespace peerchat
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace peerchat {
+
+// BM25 inverted index over chunk text, keyed by the same ids as the vector index.
+//
+// Terms come from a Unicode word splitter (llama's codepoint tables): runs of
+// letters, digits and combining marks, lowercased, with each Han character as
+// its own term. Postings are appended in document order, so a query walks a few
+// contiguous arrays and accumulates into a dense score buffer.
+//
+// Deletes are tombstones that drop out of document frequencies immediately;
+// postings are compacted once tombstones outnumber live documents.
+//
+// Not internally synchronised: callers serialise mutations against searches.
+constexpr uint32_t kLexicalIndexMagic = 0x584c4350; // "PCLX"
+constexpr uint32_t kLexicalIndexVersion = 1;
+
+// Splits text into lowercase terms.
+std::vector<std::string> lexical_terms(const std::string & text);
+
+class Bm25Index {
+public:
+    struct Params {
+        float k1 = 1.2f;
+        float b = 0.75f;
+    };
+
+    Bm25Index() = default;
+    explicit Bm25Index(const Params & params) : params_(params) {}
+
+    Bm25Index(const Bm25Index &) = delete;
+    Bm25Index & operator=(const Bm25Index &) = delete;
+
+    // Reads a file written by save(); nullptr when missing or malformed.
+    static std::unique_ptr<Bm25Index> open(const std::string & path);
+    // Writes to path via a temporary file and rename.
+    bool save(const std::string & path) const;
+
+    // Re-adding an id replaces its text. Text without terms is rejected.
+    bool add(int64_t id, const std::string & text);
+    bool remove(int64_t id);
+
+    // Fills up to k ids/scores, best first.
+    size_t search(const std::string & query, size_t k, int64_t * out_ids, float * out_scores) const;
+
+    size_t size() const { return id_to_doc_.size(); }
+    size_t term_count() const { return terms_.size(); }
+
+private:
+    struct Posting {
+        uint32_t doc;
+        uint32_t tf;
+    };
+    struct TermFreq {
+        uint32_t term;
+        uint32_t tf;
+    };
+
+    uint32_t intern(const std::string & term);
+    void append(int64_t id, const std::vector<TermFreq> & term_freqs, uint32_t length);
+    void rebuild_postings();
+    void compact();
+
+    Params params_;
+
+    // Per document: id, token length, tombstone, and (term, tf) pairs at
+    // doc_terms_[doc_offsets_[doc] .. doc_offsets_[doc + 1]).
+    std::vector<int64_t> doc_ids_;
+    std::vector<uint32_t> doc_lengths_;
+    std::vector<uint8_t> deleted_;
+    std::vector<uint32_t> doc_offsets_{0};
+    std::vector<TermFreq> doc_terms_;
+
+    std::unordered_map<std::string, uint32_t> terms_;
+    std::vector<std::string> term_text_;
+    std::vector<std::vector<Posting>> postings_;
+    std::vector<uint32_t> doc_freq_;
+
+    std::unordered_map<int64_t, uint32_t> id_to_doc_;
+    uint64_t live_length_ = 0;
+};
+
+} // namespace peerchat
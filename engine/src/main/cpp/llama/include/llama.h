@@ -822,6 +822,36 @@ extern "C" {
                     llama_seq_id   dest_seq_id,
            llama_state_seq_flags   flags);
 
+    // Streaming state save/load: the state is passed through the callback in
+    // pieces instead of one contiguous buffer. Returning false from the callback
+    // aborts the operation, in which case 0 is returned.
+    typedef bool (*llama_state_write_callback)(const void * src, size_t size, void * user_data);
+    typedef bool (*llama_state_read_callback)(void * dst, size_t size, void * user_data);
+
+    LLAMA_API size_t llama_state_write_stream(
+            struct llama_context * ctx,
+      llama_state_write_callback   cb,
+                            void * user_data);
+
+    LLAMA_API size_t llama_state_read_stream(
+            struct llama_context * ctx,
+       llama_state_read_callback   cb,
+                            void * user_data);
+
+    LLAMA_API size_t llama_state_seq_write_stream(
+            struct llama_context * ctx,
+                    llama_seq_id   seq_id,
+           llama_state_seq_flags   flags,
+      llama_state_write_callback   cb,
+                            void * user_data);
+
+    LLAMA_API size_t llama_state_seq_read_stream(
+            struct llama_context * ctx,
+                    llama_seq_id   dest_seq_id,
+           llama_state_seq_flags   flags,
+       llama_state_read_callback   cb,
+                            void * user_data);
+
     //
     // Decoding
     //
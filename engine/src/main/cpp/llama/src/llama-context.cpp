@@ -1593,6 +1593,70 @@ private:
     size_t size_read = 0;
 };
 
+// forwards the state to a user callback; tensor data is fetched in bounded slices
+// so the peak temporary allocation does not scale with the cache size
+class llama_io_write_callback : public llama_io_write_i {
+public:
+    llama_io_write_callback(llama_state_write_callback cb, void * user_data) : cb(cb), user_data(user_data) {}
+
+    void write(const void * src, size_t size) override {
+        if (!cb(src, size, user_data)) {
+            throw std::runtime_error("state write callback failed");
+        }
+        size_written += size;
+    }
+
+    void write_tensor(const ggml_tensor * tensor, size_t offset, size_t size) override {
+        static constexpr size_t max_slice = 1u << 20;
+        temp_buffer.resize(std::min(size, max_slice));
+        while (size > 0) {
+            const size_t n = std::min(size, max_slice);
+            ggml_backend_tensor_get(tensor, temp_buffer.data(), offset, n);
+            write(temp_buffer.data(), n);
+            offset += n;
+            size   -= n;
+        }
+    }
+
+    size_t n_bytes() override {
+        return size_written;
+    }
+
+private:
+    llama_state_write_callback cb;
+    void * user_data;
+    size_t size_written = 0;
+    std::vector<uint8_t> temp_buffer;
+};
+
+class llama_io_read_callback : public llama_io_read_i {
+public:
+    llama_io_read_callback(llama_state_read_callback cb, void * user_data) : cb(cb), user_data(user_data) {}
+
+    void read_to(void * dst, size_t size) override {
+        if (!cb(dst, size, user_data)) {
+            throw std::runtime_error("state read callback failed");
+        }
+        size_read += size;
+    }
+
+    const uint8_t * read(size_t size) override {
+        temp_buffer.resize(size);
+        read_to(temp_buffer.data(), size);
+        return temp_buffer.data();
+    }
+
+    size_t n_bytes() override {
+        return size_read;
+    }
+
+private:
+    llama_state_read_callback cb;
+    void * user_data;
+    size_t size_read = 0;
+    std::vector<uint8_t> temp_buffer;
+};
+
 class llama_io_write_file : public llama_io_write_i {
 public:
     llama_io_write_file(llama_file * f) : file(f) {}
@@ -1703,6 +1767,46 @@ size_t llama_context::state_seq_set_data(llama_seq_id seq_id, const uint8_t * sr
     }
 }
 
+size_t llama_context::state_write_stream(llama_state_write_callback cb, void * user_data) {
+    llama_io_write_callback io(cb, user_data);
+    try {
+        return state_write_data(io);
+    } catch (const std::exception & err) {
+        LLAMA_LOG_ERROR("%s: error saving state: %s\n", __func__, err.what());
+        return 0;
+    }
+}
+
+size_t llama_context::state_read_stream(llama_state_read_callback cb, void * user_data) {
+    llama_io_read_callback io(cb, user_data);
+    try {
+        return state_read_data(io);
+    } catch (const std::exception & err) {
+        LLAMA_LOG_ERROR("%s: error loading state: %s\n", __func__, err.what());
+        return 0;
+    }
+}
+
+size_t llama_context::state_seq_write_stream(llama_seq_id seq_id, llama_state_seq_flags flags, llama_state_write_callback cb, void * user_data) {
+    llama_io_write_callback io(cb, user_data);
+    try {
+        return state_seq_write_data(io, seq_id, flags);
+    } catch (const std::exception & err) {
+        LLAMA_LOG_ERROR("%s: error saving state: %s\n", __func__, err.what());
+        return 0;
+    }
+}
+
+size_t llama_context::state_seq_read_stream(llama_seq_id seq_id, llama_state_seq_flags flags, llama_state_read_callback cb, void * user_data) {
+    llama_io_read_callback io(cb, user_data);
+    try {
+        return state_seq_read_data(io, seq_id, flags);
+    } catch (const std::exception & err) {
+        LLAMA_LOG_ERROR("%s: error loading state: %s\n", __func__, err.what());
+        return 0;
+    }
+}
+
 bool llama_context::state_load_file(const char * filepath, llama_token * tokens_out, size_t n_token_capacity, size_t * n_token_count_out) {
     llama_file file(filepath, "rb");
 
@@ -2712,6 +2816,30 @@ size_t llama_state_seq_set_data_ext(llama_context * ctx, const uint8_t * src, si
     return ctx->state_seq_set_data(seq_id, src, size, flags);
 }
 
+size_t llama_state_write_stream(llama_context * ctx, llama_state_write_callback cb, void * user_data) {
+    ctx->synchronize();
+
+    return ctx->state_write_stream(cb, user_data);
+}
+
+size_t llama_state_read_stream(llama_context * ctx, llama_state_read_callback cb, void * user_data) {
+    ctx->synchronize();
+
+    return ctx->state_read_stream(cb, user_data);
+}
+
+size_t llama_state_seq_write_stream(llama_context * ctx, llama_seq_id seq_id, llama_state_seq_flags flags, llama_state_write_callback cb, void * user_data) {
+    ctx->synchronize();
+
+    return ctx->state_seq_write_stream(seq_id, flags, cb, user_data);
+}
+
+size_t llama_state_seq_read_stream(llama_context * ctx, llama_seq_id seq_id, llama_state_seq_flags flags, llama_state_read_callback cb, void * user_data) {
+    ctx->synchronize();
+
+    return ctx->state_seq_read_stream(seq_id, flags, cb, user_data);
+}
+
 size_t llama_state_seq_save_file(llama_context * ctx, const char * filepath, llama_seq_id seq_id, const llama_token * tokens, size_t n_token_count) {
     ctx->synchronize();
 
@@ -51,6 +51,9 @@ enum llama_vocab_pre_type {
     LLAMA_VOCAB_PRE_TYPE_GRANITE_DOCLING = 40,
 };
 
+// expressions the BPE tokenizer pre-splits text with for the given pre-tokenization type
+std::vector<std::string> llama_vocab_pre_regex_exprs(enum llama_vocab_pre_type type);
+
 struct LLM_KV;
 struct llama_model_loader;
 
@@ -6,12 +6,14 @@
 #include "unicode-data.h"
 
 #include <algorithm>
+#include <array>
 #include <cassert>
 #include <codecvt>
 #include <cstddef>
 #include <cstdint>
 #include <locale>
 #include <map>
+#include <mutex>
 #include <regex>
 #include <stdexcept>
 #include <string>
@@ -220,31 +222,40 @@ static inline std::wstring unicode_wstring_from_utf8(const std::string & s) {
     return conv.from_bytes(s);
 }
 
-static std::vector<std::string> unicode_byte_encoding_process(const std::vector<std::string> & bpe_words) {
-    std::vector<std::string> bpe_encoded_words;
-    for (const auto & word : bpe_words) {
-        std::string text_utf;
-        auto utf_word =  unicode_cpts_from_utf8(word);
-        for (size_t i = 0; i < utf_word.size(); ++i) {
-            text_utf += unicode_cpt_to_utf8(utf_word[i]);
+// the byte-level BPE encoding of each word, straight from its codepoints
+static std::vector<std::string> unicode_byte_encoding_process(const std::vector<uint32_t> & cpts, const std::vector<size_t> & offsets) {
+    static const std::array<std::string, 256> byte_to_utf8 = [] {
+        const auto map = unicode_byte_to_utf8_map();
+        std::array<std::string, 256> table;
+        for (int ch = 0; ch < 256; ++ch) {
+            table[ch] = map.at(ch);
         }
+        return table;
+    }();
+
+    std::vector<std::string> bpe_encoded_words;
+    bpe_encoded_words.reserve(offsets.size());
 
+    size_t start = 0;
+    for (const size_t offset : offsets) {
         std::string encoded_token;
-        for (char & c : text_utf) {
-            encoded_token += unicode_byte_to_utf8(c);
+        encoded_token.reserve(2 * offset);
+        for (size_t i = start; i < start + offset; ++i) {
+            for (const char c : unicode_cpt_to_utf8(cpts[i])) {
+                encoded_token += byte_to_utf8[(uint8_t) c];
+            }
         }
-        bpe_encoded_words.emplace_back(encoded_token);
+        bpe_encoded_words.push_back(std::move(encoded_token));
+        start += offset;
     }
     return bpe_encoded_words;
 }
 
 // GPT2 system regex:  's|'t|'re|'ve|'m|'ll|'d| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+
-static std::vector<size_t> unicode_regex_split_custom_gpt2(const std::string & text, const std::vector<size_t> & offsets) {
+static std::vector<size_t> unicode_regex_split_custom_gpt2(const std::vector<uint32_t> & cpts, const std::vector<size_t> & offsets) {
     std::vector<size_t> bpe_offsets; // store the offset of each word
     bpe_offsets.reserve(offsets.size()); // Reserve memory for the approximate size
 
-    const auto cpts = unicode_cpts_from_utf8(text);
-
     size_t start = 0;
     for (auto offset : offsets) {
         const size_t offset_ini = start;
@@ -357,12 +368,10 @@ static std::vector<size_t> unicode_regex_split_custom_gpt2(const std::string & t
 }
 
 // LLAMA3 system regex: "(?i:'s|'t|'re|'ve|'m|'ll|'d)|[^\r\n\p{L}\p{N}]?\p{L}+|\p{N}{1,3}| ?[^\s\p{L}\p{N}]+[\r\n]*|\s*[\r\n]+|\s+(?!\S)|\s+"
-static std::vector<size_t> unicode_regex_split_custom_llama3(const std::string & text, const std::vector<size_t> & offsets) {
+static std::vector<size_t> unicode_regex_split_custom_llama3(const std::vector<uint32_t> & cpts, const std::vector<size_t> & offsets) {
     std::vector<size_t> bpe_offsets; // store the offset of each word
     bpe_offsets.reserve(offsets.size()); // Reserve memory for the approximate size
 
-    const auto cpts = unicode_cpts_from_utf8(text);
-
     size_t start = 0;
     for (auto offset : offsets) {
         const size_t offset_ini = start;
@@ -559,12 +568,10 @@ static std::vector<size_t> unicode_regex_split_stl(const std::string & text, con
 
 // K2 system regex patterns (from tokenization_kimi.py):
 // [\p{Han}]+|[^\r\n\p{L}\p{N}]?[\p{Lu}\p{Lt}\p{Lm}\p{Lo}\p{M}&&[^\p{Han}]]*[\p{Ll}\p{Lm}\p{Lo}\p{M}&&[^\p{Han}]]+(?i:'s|'t|'re|'ve|'m|'ll|'d)?|[^\r\n\p{L}\p{N}]?[\p{Lu}\p{Lt}\p{Lm}\p{Lo}\p{M}&&[^\p{Han}]]+[\p{Ll}\p{Lm}\p{Lo}\p{M}&&[^\p{Han}]]*(?i:'s|'t|'re|'ve|'m|'ll|'d)?|\p{N}{1,3}| ?[^\s\p{L}\p{N}]+[\r\n]*|\s*[\r\n]+|\s+(?!\S)|\s+
-static std::vector<size_t> unicode_regex_split_custom_kimi_k2(const std::string & text, const std::vector<size_t> & offsets) {
+static std::vector<size_t> unicode_regex_split_custom_kimi_k2(const std::vector<uint32_t> & cpts, const std::vector<size_t> & offsets) {
     std::vector<size_t> bpe_offsets;
     bpe_offsets.reserve(offsets.size());
 
-    const auto cpts = unicode_cpts_from_utf8(text);
-
     size_t start = 0;
     for (auto offset : offsets) {
         const size_t offset_ini = start;
@@ -729,22 +736,530 @@ static std::vector<size_t> unicode_regex_split_custom_kimi_k2(const std::string
     return bpe_offsets;
 }
 
-static std::vector<size_t> unicode_regex_split_custom(const std::string & text, const std::string & regex_expr, const std::vector<size_t> & offsets) {
+//
+// splitters for the other pre-tokenizer expressions
+//
+// Each reproduces what unicode_regex_split_stl does with its expression:
+// leftmost matches, first alternative wins, and the codepoints between two
+// matches kept together as one word. Classes follow the std::regex view of the
+// text: \s is is_whitespace, \p{..} the codepoint's category, and literal
+// characters and ranges see non-ASCII whitespace as 0x0B.
+//
+
+// One fragment of the text; positions past its end read as no codepoint.
+struct unicode_split_fragment {
+    const std::vector<uint32_t> & cpts;
+    const size_t end;
+
+    static constexpr uint32_t OUT_OF_RANGE = 0xFFFFFFFF;
+
+    uint32_t cpt(const size_t pos) const {
+        return pos < end ? cpts[pos] : OUT_OF_RANGE;
+    }
+
+    unicode_cpt_flags flags(const size_t pos) const {
+        return pos < end ? unicode_cpt_flags_from_cpt(cpts[pos]) : unicode_cpt_flags{};
+    }
+
+    // the codepoint as literal characters in std::wregex compare against it
+    uint32_t literal(const size_t pos) const {
+        const uint32_t c = cpt(pos);
+        return c != OUT_OF_RANGE && c > 0x7F && unicode_cpt_flags_from_cpt(c).is_whitespace ? 0x0B : c;
+    }
+
+    template <typename Pred>
+    size_t run(const size_t pos, const Pred & pred) const {
+        size_t n = 0;
+        while (pos + n < end && pred(pos + n)) {
+            ++n;
+        }
+        return n;
+    }
+};
+
+// Splits every fragment given the length of the match starting at a position, 0 for none.
+template <typename Match>
+static std::vector<size_t> unicode_regex_split_search(const std::vector<uint32_t> & cpts, const std::vector<size_t> & offsets, const Match & match) {
     std::vector<size_t> bpe_offsets;
+    bpe_offsets.reserve(offsets.size());
+
+    size_t start = 0;
+    for (auto offset : offsets) {
+        const unicode_split_fragment frag{cpts, start + offset};
+        assert(frag.end <= cpts.size());
+
+        size_t unmatched = start;
+        for (size_t pos = start; pos < frag.end; ) {
+            const size_t len = match(frag, pos);
+            if (len == 0) {
+                ++pos;
+                continue;
+            }
+            if (pos > unmatched) {
+                bpe_offsets.push_back(pos - unmatched);
+            }
+            bpe_offsets.push_back(len);
+            pos += len;
+            unmatched = pos;
+        }
+        if (frag.end > unmatched) {
+            bpe_offsets.push_back(frag.end - unmatched);
+        }
+        start = frag.end;
+    }
+
+    return bpe_offsets;
+}
+
+static bool unicode_is_ascii_alpha(uint32_t cpt) {
+    return ('A' <= cpt && cpt <= 'Z') || ('a' <= cpt && cpt <= 'z');
+}
+
+// !-/ :-@ [-` {-~
+static bool unicode_is_ascii_punct(uint32_t cpt) {
+    return (0x21 <= cpt && cpt <= 0x2F) || (0x3A <= cpt && cpt <= 0x40) || (0x5B <= cpt && cpt <= 0x60) || (0x7B <= cpt && cpt <= 0x7E);
+}
+
+// regex: '[sS]|'[tT]|'[rR][eE]|'[vV][eE]|'[mM]|'[lL][lL]|'[dD]
+static size_t unicode_match_contraction(const unicode_split_fragment & frag, const size_t pos) {
+    if (frag.cpt(pos) != '\'') {
+        return 0;
+    }
+    const uint32_t c1 = frag.cpt(pos + 1) | 0x20;
+    if (c1 == 's' || c1 == 't' || c1 == 'm' || c1 == 'd') {
+        return 2;
+    }
+    const uint32_t c2 = frag.cpt(pos + 2) | 0x20;
+    if ((c1 == 'r' && c2 == 'e') || (c1 == 'v' && c2 == 'e') || (c1 == 'l' && c2 == 'l')) {
+        return 3;
+    }
+    return 0;
+}
+
+// regex: \s*[\r\n]+|\s+(?!\S)|\s+
+static size_t unicode_match_whitespace(const unicode_split_fragment & frag, const size_t pos) {
+    size_t n = 0;
+    size_t last_r_or_n = 0;
+    while (frag.flags(pos + n).is_whitespace) {
+        const uint32_t cpt = frag.cpt(pos + n);
+        if (cpt == '\r' || cpt == '\n') {
+            last_r_or_n = n + 1;
+        }
+        ++n;
+    }
+    if (last_r_or_n > 0) {
+        return last_r_or_n;
+    }
+    // the last whitespace stays with the word after it
+    if (n > 1 && pos + n < frag.end) {
+        return n - 1;
+    }
+    return n;
+}
+
+// regex: <space>?[^\s\p{L}\p{N}]+ followed by [\r\n]* (with_newlines) and / (with_slashes)
+static size_t unicode_match_symbols(const unicode_split_fragment & frag, const size_t pos, bool with_newlines, bool with_slashes) {
+    auto is_symbol = [&] (const size_t p) {
+        const auto flags = frag.flags(p);
+        return p < frag.end && !(flags.is_whitespace || flags.is_letter || flags.is_number);
+    };
+    const size_t lead = frag.cpt(pos) == ' ' && is_symbol(pos + 1) ? 1 : 0;
+    if (lead == 0 && !is_symbol(pos)) {
+        return 0;
+    }
+    size_t n = lead + frag.run(pos + lead, is_symbol);
+    if (with_newlines) {
+        n += frag.run(pos + n, [&] (const size_t p) {
+            const uint32_t cpt = frag.cpt(p);
+            return cpt == '\r' || cpt == '\n' || (with_slashes && cpt == '/');
+        });
+    }
+    return n;
+}
+
+// Qwen2, StableLM2, Hunyuan, Grok-2, BailingMoE and Seed-Coder: the LLAMA3 regex with another
+// digit group, and Seed-Coder keeps newlines out of symbol runs
+// regex: (?:'[sS]|'[tT]|'[rR][eE]|'[vV][eE]|'[mM]|'[lL][lL]|'[dD])|[^\r\n\p{L}\p{N}]?\p{L}+|\p{N}{1,max_digits}| ?[^\s\p{L}\p{N}]+[\r\n]*|\s*[\r\n]+|\s+(?!\S)|\s+
+static size_t unicode_match_llama3_like(const unicode_split_fragment & frag, const size_t pos, size_t max_digits, bool symbol_newlines) {
+    if (const size_t n = unicode_match_contraction(frag, pos)) {
+        return n;
+    }
+
+    const uint32_t cpt = frag.cpt(pos);
+    const auto flags = frag.flags(pos);
+    auto is_letter = [&] (const size_t p) { return frag.flags(p).is_letter; };
+
+    // regex: [^\r\n\p{L}\p{N}]?\p{L}+
+    if (!(cpt == '\r' || cpt == '\n' || flags.is_letter || flags.is_number) && is_letter(pos + 1)) {
+        return 1 + frag.run(pos + 1, is_letter);
+    }
+    if (flags.is_letter) {
+        return frag.run(pos, is_letter);
+    }
+
+    // regex: \p{N}{1,max_digits}
+    if (flags.is_number) {
+        return std::min(max_digits, frag.run(pos, [&] (const size_t p) { return frag.flags(p).is_number; }));
+    }
+
+    if (const size_t n = unicode_match_symbols(frag, pos, symbol_newlines, false)) {
+        return n;
+    }
+    return unicode_match_whitespace(frag, pos);
+}
+
+// DeepSeek-V3 and Hunyuan-Dense words
+// regex: [!"#$%&'()*+,\-./:;<=>?@\[\\\]^_`{|}~][A-Za-z]+|[^\r\n\p{L}\p{P}\p{S}]?[\p{L}\p{M}]+| ?[\p{P}\p{S}]+[\r\n]*|\s*[\r\n]+|\s+(?!\S)|\s+
+static size_t unicode_match_deepseek3(const unicode_split_fragment & frag, const size_t pos) {
+    const uint32_t cpt = frag.cpt(pos);
+    const auto flags = frag.flags(pos);
+
+    if (unicode_is_ascii_punct(cpt) && unicode_is_ascii_alpha(frag.cpt(pos + 1))) {
+        return 1 + frag.run(pos + 1, [&] (const size_t p) { return unicode_is_ascii_alpha(frag.cpt(p)); });
+    }
+
+    // regex: [^\r\n\p{L}\p{P}\p{S}]?[\p{L}\p{M}]+
+    auto is_letter_or_mark = [&] (const size_t p) {
+        const auto f = frag.flags(p);
+        return f.is_letter || f.is_accent_mark;
+    };
+    if (!(cpt == '\r' || cpt == '\n' || flags.is_letter || flags.is_punctuation || flags.is_symbol) && is_letter_or_mark(pos + 1)) {
+        return 1 + frag.run(pos + 1, is_letter_or_mark);
+    }
+    if (is_letter_or_mark(pos)) {
+        return frag.run(pos, is_letter_or_mark);
+    }
+
+    // regex: <space>?[\p{P}\p{S}]+[\r\n]*
+    auto is_punct_or_symbol = [&] (const size_t p) {
+        const auto f = frag.flags(p);
+        return f.is_punctuation || f.is_symbol;
+    };
+    const size_t lead = cpt == ' ' && is_punct_or_symbol(pos + 1) ? 1 : 0;
+    if (lead || is_punct_or_symbol(pos)) {
+        const size_t n = lead + frag.run(pos + lead, is_punct_or_symbol);
+        return n + frag.run(pos + n, [&] (const size_t p) { return frag.cpt(p) == '\r' || frag.cpt(p) == '\n'; });
+    }
+
+    return unicode_match_whitespace(frag, pos);
+}
+
+// Tekken and GPT-4o: words split at lower-to-upper case changes, where a letter
+// without ASCII case counts as both. GPT-4o also takes a trailing contraction
+// and groups three digits.
+// regex: [^\r\n\p{L}\p{N}]?((?=[\p{L}])([^a-z]))*((?=[\p{L}])([^A-Z]))+(contraction)?|[^\r\n\p{L}\p{N}]?((?=[\p{L}])([^a-z]))+((?=[\p{L}])([^A-Z]))*(contraction)?|\p{N}{1,max_digits}| ?[^\s\p{L}\p{N}]+[\r\n/]*|\s*[\r\n]+|\s+(?!\S)|\s+
+static size_t unicode_match_cased(const unicode_split_fragment & frag, const size_t pos, size_t max_digits, bool contractions) {
+    const uint32_t cpt = frag.cpt(pos);
+    const auto flags = frag.flags(pos);
+
+    auto is_upper = [&] (const size_t p) { return frag.flags(p).is_letter && !('a' <= frag.cpt(p) && frag.cpt(p) <= 'z'); };
+    auto is_lower = [&] (const size_t p) { return frag.flags(p).is_letter && !('A' <= frag.cpt(p) && frag.cpt(p) <= 'Z'); };
+
+    size_t word = pos;
+    if (!(cpt == '\r' || cpt == '\n' || flags.is_letter || flags.is_number)) {
+        word = frag.flags(pos + 1).is_letter ? pos + 1 : frag.end;
+    }
+    if (word < frag.end && frag.flags(word).is_letter) {
+        // upper* lower+ backtracks to the last letter of the upper run that is also lower;
+        // failing that, upper+ lower* takes the upper run alone
+        const size_t upper_end = word + frag.run(word, is_upper);
+        size_t end = upper_end;
+        if (is_lower(upper_end)) {
+            end = upper_end + frag.run(upper_end, is_lower);
+        } else {
+            while (end > word && !is_lower(end - 1)) {
+                --end;
+            }
+            if (end == word) {
+                end = upper_end;
+            }
+        }
+        if (contractions) {
+            end += unicode_match_contraction(frag, end);
+        }
+        return end - pos;
+    }
+
+    if (flags.is_number) {
+        return std::min(max_digits, frag.run(pos, [&] (const size_t p) { return frag.flags(p).is_number; }));
+    }
+
+    if (const size_t n = unicode_match_symbols(frag, pos, true, true)) {
+        return n;
+    }
+    return unicode_match_whitespace(frag, pos);
+}
+
+// Sorted, merged codepoint ranges of the bracket expression in a regex made of
+// literal characters and ranges only.
+static std::vector<std::pair<uint32_t, uint32_t>> unicode_regex_class_ranges(const std::string & regex_expr) {
+    const size_t open = regex_expr.find('[');
+    const size_t close = regex_expr.rfind(']');
+    assert(open != std::string::npos && close != std::string::npos && open < close);
+    const auto cpts = unicode_cpts_from_utf8(regex_expr.substr(open + 1, close - open - 1));
+
+    std::vector<std::pair<uint32_t, uint32_t>> ranges;
+    for (size_t i = 0; i < cpts.size(); ++i) {
+        if (i + 2 < cpts.size() && cpts[i + 1] == '-') {
+            ranges.emplace_back(cpts[i], cpts[i + 2]);
+            i += 2;
+        } else {
+            ranges.emplace_back(cpts[i], cpts[i]);
+        }
+    }
+    std::sort(ranges.begin(), ranges.end());
+
+    std::vector<std::pair<uint32_t, uint32_t>> merged;
+    for (const auto & range : ranges) {
+        if (!merged.empty() && range.first <= merged.back().second + 1) {
+            merged.back().second = std::max(merged.back().second, range.second);
+        } else {
+            merged.push_back(range);
+        }
+    }
+    return merged;
+}
+
+static bool unicode_in_ranges(const std::vector<std::pair<uint32_t, uint32_t>> & ranges, uint32_t cpt) {
+    auto it = std::upper_bound(ranges.begin(), ranges.end(), cpt, [] (uint32_t c, const std::pair<uint32_t, uint32_t> & range) {
+        return c < range.first;
+    });
+    return it != ranges.begin() && cpt <= (it - 1)->second;
+}
+
+// regex: \s?[class]+ (optional_space) or [class]+
+template <typename Pred>
+static size_t unicode_match_class_run(const unicode_split_fragment & frag, const size_t pos, bool optional_space, const Pred & in_class) {
+    if (optional_space && frag.flags(pos).is_whitespace && pos + 1 < frag.end && in_class(pos + 1)) {
+        return 1 + frag.run(pos + 1, in_class);
+    }
+    return frag.run(pos, in_class);
+}
+
+// regex: \s+$
+static std::vector<size_t> unicode_regex_split_custom_trailing_whitespace(const std::vector<uint32_t> & cpts, const std::vector<size_t> & offsets) {
+    std::vector<size_t> bpe_offsets;
+    bpe_offsets.reserve(offsets.size());
+
+    size_t start = 0;
+    for (auto offset : offsets) {
+        size_t trailing = 0;
+        while (trailing < offset && unicode_cpt_flags_from_cpt(cpts[start + offset - trailing - 1]).is_whitespace) {
+            ++trailing;
+        }
+        if (offset > trailing) {
+            bpe_offsets.push_back(offset - trailing);
+        }
+        if (trailing > 0) {
+            bpe_offsets.push_back(trailing);
+        }
+        start += offset;
+    }
+
+    return bpe_offsets;
+}
+
+// SuperBPE thousands groups: an empty match before every run of ASCII digits
+// whose length is a multiple of three, which leaves an empty word there
+// regex: (?=(\d{3})+(?!\d))
+static std::vector<size_t> unicode_regex_split_custom_digit_groups(const std::vector<uint32_t> & cpts, const std::vector<size_t> & offsets) {
+    std::vector<size_t> bpe_offsets;
+    bpe_offsets.reserve(offsets.size());
+
+    size_t start = 0;
+    for (auto offset : offsets) {
+        const size_t end = start + offset;
+        size_t word = start;
+        for (size_t pos = start; pos < end; ) {
+            if (!('0' <= cpts[pos] && cpts[pos] <= '9')) {
+                ++pos;
+                continue;
+            }
+            size_t run_end = pos;
+            while (run_end < end && '0' <= cpts[run_end] && cpts[run_end] <= '9') {
+                ++run_end;
+            }
+            for (size_t group = pos + (run_end - pos) % 3; group < run_end; group += 3) {
+                if (group > word) {
+                    bpe_offsets.push_back(group - word);
+                }
+                bpe_offsets.push_back(0);
+                word = group;
+            }
+            pos = run_end;
+        }
+        if (end > word) {
+            bpe_offsets.push_back(end - word);
+        }
+        start = end;
+    }
+
+    return bpe_offsets;
+}
+
+// Hand-written splitter for regex_expr, if there is one.
+static bool unicode_regex_split_custom(const std::vector<uint32_t> & cpts, const std::string & regex_expr, const std::vector<size_t> & offsets, std::vector<size_t> & bpe_offsets) {
+    using fragment = unicode_split_fragment;
+
+    auto is_number = [] (const fragment & frag) {
+        return [&frag] (const size_t p) { return (bool) frag.flags(p).is_number; };
+    };
 
     if (regex_expr == "'s|'t|'re|'ve|'m|'ll|'d| ?\\p{L}+| ?\\p{N}+| ?[^\\s\\p{L}\\p{N}]+|\\s+(?!\\S)") {
-        bpe_offsets = unicode_regex_split_custom_gpt2(text, offsets);
+        bpe_offsets = unicode_regex_split_custom_gpt2(cpts, offsets);
     } else if (
             regex_expr == "(?i:'s|'t|'re|'ve|'m|'ll|'d)|[^\\r\\n\\p{L}\\p{N}]?\\p{L}+|\\p{N}{1,3}| ?[^\\s\\p{L}\\p{N}]+[\\r\\n]*|\\s*[\\r\\n]+|\\s+(?!\\S)|\\s+" ||
             regex_expr == "(?:'[sS]|'[tT]|'[rR][eE]|'[vV][eE]|'[mM]|'[lL][lL]|'[dD])|[^\\r\\n\\p{L}\\p{N}]?\\p{L}+|\\p{N}{1,3}| ?[^\\s\\p{L}\\p{N}]+[\\r\\n]*|\\s*[\\r\\n]+|\\s+(?!\\S)|\\s+") {
 
-        bpe_offsets = unicode_regex_split_custom_llama3(text, offsets);
+        bpe_offsets = unicode_regex_split_custom_llama3(cpts, offsets);
     } else if (regex_expr == "\\p{Han}+") {
         // K2's first pattern - handle all K2 patterns together
-        bpe_offsets = unicode_regex_split_custom_kimi_k2(text, offsets);
+        bpe_offsets = unicode_regex_split_custom_kimi_k2(cpts, offsets);
+    } else if (
+            regex_expr == "(?:'[sS]|'[tT]|'[rR][eE]|'[vV][eE]|'[mM]|'[lL][lL]|'[dD])|[^\\r\\n\\p{L}\\p{N}]?\\p{L}+|\\p{N}| ?[^\\s\\p{L}\\p{N}]+[\\r\\n]*|\\s*[\\r\\n]+|\\s+(?!\\S)|\\s+" ||
+            // \s*[\r\n] ends at the same newline as \s*[\r\n]+: the last one in the whitespace run
+            regex_expr == "'(?:[sSdDmMtT]|[lL][lL]|[vV][eE]|[rR][eE])|[^\\r\\n\\p{L}\\p{N}]?\\p{L}+|\\p{N}| ?[^\\s\\p{L}\\p{N}]+[\\r\\n]*|\\s*[\\r\\n]|\\s+(?!\\S)|\\s+") {
+        bpe_offsets = unicode_regex_split_search(cpts, offsets, [] (const fragment & frag, size_t pos) {
+            return unicode_match_llama3_like(frag, pos, 1, true);
+        });
+    } else if (regex_expr == "(?:'[sS]|'[tT]|'[rR][eE]|'[vV][eE]|'[mM]|'[lL][lL]|'[dD])|[^\\r\\n\\p{L}\\p{N}]?\\p{L}+|\\p{N}{1}| ?[^\\s\\p{L}\\p{N}\\r\\n]+|\\s*[\\r\\n]+|\\s+(?!\\S)|\\s+") {
+        bpe_offsets = unicode_regex_split_search(cpts, offsets, [] (const fragment & frag, size_t pos) {
+            return unicode_match_llama3_like(frag, pos, 1, false);
+        });
+    } else if (regex_expr == "[!\"#$%&'()*+,\\-./:;<=>?@\\[\\\\\\]^_`{|}~][A-Za-z]+|[^\r\n\\p{L}\\p{P}\\p{S}]?[\\p{L}\\p{M}]+| ?[\\p{P}\\p{S}]+[\r\n]*|\\s*[\r\n]+|\\s+(?!\\S)|\\s+") {
+        bpe_offsets = unicode_regex_split_search(cpts, offsets, unicode_match_deepseek3);
+    } else if (regex_expr == "[^\\r\\n\\p{L}\\p{N}]?((?=[\\p{L}])([^a-z]))*((?=[\\p{L}])([^A-Z]))+|[^\\r\\n\\p{L}\\p{N}]?((?=[\\p{L}])([^a-z]))+((?=[\\p{L}])([^A-Z]))*|\\p{N}| ?[^\\s\\p{L}\\p{N}]+[\\r\\n/]*|\\s*[\\r\\n]+|\\s+(?!\\S)|\\s+") {
+        bpe_offsets = unicode_regex_split_search(cpts, offsets, [] (const fragment & frag, size_t pos) {
+            return unicode_match_cased(frag, pos, 1, false);
+        });
+    } else if (regex_expr == "[^\\r\\n\\p{L}\\p{N}]?((?=[\\p{L}])([^a-z]))*((?=[\\p{L}])([^A-Z]))+(?:'[sS]|'[tT]|'[rR][eE]|'[vV][eE]|'[mM]|'[lL][lL]|'[dD])?|[^\\r\\n\\p{L}\\p{N}]?((?=[\\p{L}])([^a-z]))+((?=[\\p{L}])([^A-Z]))*(?:'[sS]|'[tT]|'[rR][eE]|'[vV][eE]|'[mM]|'[lL][lL]|'[dD])?|\\p{N}{1,3}| ?[^\\s\\p{L}\\p{N}]+[\\r\\n/]*|\\s*[\\r\\n]+|\\s+(?!\\S)|\\s+") {
+        bpe_offsets = unicode_regex_split_search(cpts, offsets, [] (const fragment & frag, size_t pos) {
+            return unicode_match_cased(frag, pos, 3, true);
+        });
+    } else if (regex_expr == "\\p{N}") {
+        bpe_offsets = unicode_regex_split_search(cpts, offsets, [] (const fragment & frag, size_t pos) {
+            return (size_t) frag.flags(pos).is_number;
+        });
+    } else if (regex_expr == "\\p{N}+") {
+        bpe_offsets = unicode_regex_split_search(cpts, offsets, [&] (const fragment & frag, size_t pos) {
+            return frag.run(pos, is_number(frag));
+        });
+    } else if (regex_expr == "\\p{N}{1,3}") {
+        bpe_offsets = unicode_regex_split_search(cpts, offsets, [&] (const fragment & frag, size_t pos) {
+            return std::min<size_t>(3, frag.run(pos, is_number(frag)));
+        });
+    } else if (regex_expr == "[0-9][0-9][0-9]") {
+        bpe_offsets = unicode_regex_split_search(cpts, offsets, [] (const fragment & frag, size_t pos) {
+            return frag.run(pos, [&] (const size_t p) { return p < pos + 3 && '0' <= frag.cpt(p) && frag.cpt(p) <= '9'; }) == 3 ? 3 : 0;
+        });
+    } else if (regex_expr == "[\r\n]") {
+        bpe_offsets = unicode_regex_split_search(cpts, offsets, [] (const fragment & frag, size_t pos) {
+            return (size_t) (frag.cpt(pos) == '\r' || frag.cpt(pos) == '\n');
+        });
+    } else if (regex_expr == "\\s+$") {
+        bpe_offsets = unicode_regex_split_custom_trailing_whitespace(cpts, offsets);
+    } else if (regex_expr == "(?=(\\d{3})+(?!\\d))") {
+        bpe_offsets = unicode_regex_split_custom_digit_groups(cpts, offsets);
+    } else if (regex_expr == "\\s?\\p{L}+") {
+        bpe_offsets = unicode_regex_split_search(cpts, offsets, [] (const fragment & frag, size_t pos) {
+            return unicode_match_class_run(frag, pos, true, [&] (const size_t p) { return (bool) frag.flags(p).is_letter; });
+        });
+    } else if (regex_expr == "\\s?\\p{P}+") {
+        bpe_offsets = unicode_regex_split_search(cpts, offsets, [] (const fragment & frag, size_t pos) {
+            return unicode_match_class_run(frag, pos, true, [&] (const size_t p) { return (bool) frag.flags(p).is_punctuation; });
+        });
+    } else if (
+            regex_expr == "\\s?[A-Za-zµÀ-ÖØ-öø-ƺƼ-ƿǄ-ʓʕ-ʯͰ-ͳͶͷͻ-ͽͿΆΈ-ΊΌΎ-ΡΣ-ϵϷ-ҁҊ-ԯԱ-ՖႠ-ჅᎠ-Ᏽᏸ-ᏽᲐ-ᲺᲽ-Ჿᴀ-ᴫᵫ-ᵷᵹ-ᶚḀ-ἕἘ-Ἕἠ-ὅὈ-Ὅὐ-ὗὙὛὝὟ-ώᾀ-ᾴᾶ-ᾼιῂ-ῄῆ-ῌῐ-ΐῖ-Ίῠ-Ῥῲ-ῴῶ-ῼℂℇℊ-ℓℕℙ-ℝℤΩℨK-ℭℯ-ℴℹℼ-ℿⅅ-ⅉⅎↃↄⰀ-ⱻⱾ-ⳤⳫ-ⳮⳲⳳꙀ-ꙭꚀ-ꚛꜢ-ꝯꝱ-ꞇꞋ-ꞎꭰ-ꮿﬀ-ﬆﬓ-ﬗＡ-Ｚａ-ｚ𐐀-𐑏𐒰-𐓓𐓘-𐓻𐲀-𐲲𐳀-𐳲𑢠-𑣟𞤀-𞥃]+" ||
+            regex_expr == "\\s?[!-/:-~！-／：-～‘-‟　-。]+" ||
+            regex_expr == "[一-龥ࠀ-一가-퟿]+" ||
+            regex_expr == "[一-龥぀-ゟ゠-ヿ]+") {
+        // DeepSeek literal classes, parsed once per expression
+        static std::map<std::string, std::vector<std::pair<uint32_t, uint32_t>>> class_ranges;
+        static std::mutex class_ranges_mutex;
+        const std::vector<std::pair<uint32_t, uint32_t>> * ranges;
+        {
+            std::lock_guard<std::mutex> lock(class_ranges_mutex);
+            auto it = class_ranges.find(regex_expr);
+            if (it == class_ranges.end()) {
+                it = class_ranges.emplace(regex_expr, unicode_regex_class_ranges(regex_expr)).first;
+            }
+            ranges = &it->second;
+        }
+        const bool optional_space = regex_expr[0] == '\\';
+        bpe_offsets = unicode_regex_split_search(cpts, offsets, [&] (const fragment & frag, size_t pos) {
+            return unicode_match_class_run(frag, pos, optional_space, [&] (const size_t p) { return unicode_in_ranges(*ranges, frag.literal(p)); });
+        });
+    } else if (regex_expr == " ?[^(\\s|.,!?…。，、।۔،)]+") {
+        // Bloom, Poro, GPT-3 Finnish and Viking
+        bpe_offsets = unicode_regex_split_search(cpts, offsets, [] (const fragment & frag, size_t pos) {
+            auto in_class = [&] (const size_t p) {
+                if (p >= frag.end || frag.flags(p).is_whitespace) {
+                    return false;
+                }
+                switch (frag.literal(p)) {
+                    case '(': case '|': case '.': case ',': case '!': case '?': case ')':
+                    case 0x2026: case 0x3002: case 0xFF0C: case 0x3001: case 0x0964: case 0x06D4: case 0x060C:
+                        return false;
+                    default:
+                        return true;
+                }
+            };
+            const size_t lead = frag.cpt(pos) == ' ' && in_class(pos + 1) ? 1 : 0;
+            return lead + frag.run(pos + lead, in_class);
+        });
+    } else if (regex_expr == "[\\p{P}\\$\\+<=>\\^~\\|`]+" || regex_expr == "[\\p{P}\\$\\+<=>\\^~\\|]+") {
+        // Falcon, and the default for unknown BPE pre-tokenizers
+        const bool backtick = regex_expr.find('`') != std::string::npos;
+        bpe_offsets = unicode_regex_split_search(cpts, offsets, [backtick] (const fragment & frag, size_t pos) {
+            return frag.run(pos, [&] (const size_t p) {
+                const uint32_t cpt = frag.cpt(p);
+                return frag.flags(p).is_punctuation || cpt == '$' || cpt == '+' || cpt == '<' || cpt == '=' || cpt == '>' ||
+                       cpt == '^' || cpt == '~' || cpt == '|' || (backtick && cpt == '`');
+            });
+        });
+    } else if (regex_expr == "<sentinel:[0-9]+>") {
+        // Chameleon
+        bpe_offsets = unicode_regex_split_search(cpts, offsets, [] (const fragment & frag, size_t pos) {
+            static const char prefix[] = "<sentinel:";
+            const size_t n = sizeof(prefix) - 1;
+            for (size_t i = 0; i < n; ++i) {
+                if (frag.cpt(pos + i) != (uint32_t) prefix[i]) {
+                    return (size_t) 0;
+                }
+            }
+            const size_t digits = frag.run(pos + n, [&] (const size_t p) { return '0' <= frag.cpt(p) && frag.cpt(p) <= '9'; });
+            return digits > 0 && frag.cpt(pos + n + digits) == '>' ? n + digits + 1 : 0;
+        });
+    } else if (regex_expr == "(IMGIMG)((A|B|C|D|E|F|G|H|I){1,4})Z") {
+        bpe_offsets = unicode_regex_split_search(cpts, offsets, [] (const fragment & frag, size_t pos) {
+            static const char prefix[] = "IMGIMG";
+            const size_t n = sizeof(prefix) - 1;
+            for (size_t i = 0; i < n; ++i) {
+                if (frag.cpt(pos + i) != (uint32_t) prefix[i]) {
+                    return (size_t) 0;
+                }
+            }
+            const size_t letters = frag.run(pos + n, [&] (const size_t p) { return p < pos + n + 5 && 'A' <= frag.cpt(p) && frag.cpt(p) <= 'I'; });
+            return 1 <= letters && letters <= 4 && frag.cpt(pos + n + letters) == 'Z' ? n + letters + 1 : 0;
+        });
+    } else if (regex_expr == "([\\t\\n]|    |  )") {
+        bpe_offsets = unicode_regex_split_search(cpts, offsets, [] (const fragment & frag, size_t pos) {
+            const uint32_t cpt = frag.cpt(pos);
+            if (cpt == '\t' || cpt == '\n') {
+                return (size_t) 1;
+            }
+            const size_t spaces = frag.run(pos, [&] (const size_t p) { return p < pos + 4 && frag.cpt(p) == ' '; });
+            return spaces == 4 ? (size_t) 4 : spaces >= 2 ? (size_t) 2 : (size_t) 0;
+        });
+    } else if (regex_expr == "[\\p{P}!-/:-@\\[-`{-~]") {
+        bpe_offsets = unicode_regex_split_search(cpts, offsets, [] (const fragment & frag, size_t pos) {
+            return (size_t) (frag.flags(pos).is_punctuation || unicode_is_ascii_punct(frag.cpt(pos)));
+        });
+    } else {
+        return false;
     }
 
-    return bpe_offsets;
+    return true;
 }
 
 //
@@ -879,7 +1394,7 @@ bool unicode_cpt_is_han(uint32_t cpt) {
     return false;
 }
 
-std::vector<std::string> unicode_regex_split(const std::string & text, const std::vector<std::string> & regex_exprs) {
+std::vector<std::string> unicode_regex_split(const std::string & text, const std::vector<std::string> & regex_exprs, bool use_custom) {
     // unicode categories
     static const std::map<std::string, int> k_ucat_enum = {
         { "\\p{N}", unicode_cpt_flags::NUMBER },
@@ -902,7 +1417,7 @@ std::vector<std::string> unicode_regex_split(const std::string & text, const std
         { unicode_cpt_flags::LETTER,      "\x41-\x5A\x61-\x7A" }, // A-Za-z
         { unicode_cpt_flags::PUNCTUATION, "\x21-\x23\x25-\x2A\x2C-\x2F\x3A-\x3B\x3F-\x40\\\x5B-\\\x5D\x5F\\\x7B\\\x7D" }, // !-#%-*,-/:-;?-@\[-\]_\{\}
         { unicode_cpt_flags::ACCENT_MARK, "" }, // no sub-128 codepoints
-        { unicode_cpt_flags::SYMBOL,      "\\\x24\\\x2B\x3C-\x3E\x5E\x60\\\x7C" }, // $+<=>^`|
+        { unicode_cpt_flags::SYMBOL,      "\\\x24\\\x2B\x3C-\x3E\x5E\x60\\\x7C\x7E" }, // $+<=>^`|~
     };
 
     // compute collapsed codepoints only if needed by at least one regex
@@ -951,9 +1466,8 @@ std::vector<std::string> unicode_regex_split(const std::string & text, const std
 
     for (const auto & regex_expr : regex_exprs) {
         // first, see if we have an efficient custom regex implementation
-        auto tmp = unicode_regex_split_custom(text, regex_expr, bpe_offsets);
-
-        if (!tmp.empty()) {
+        std::vector<size_t> tmp;
+        if (use_custom && unicode_regex_split_custom(cpts, regex_expr, bpe_offsets, tmp)) {
             bpe_offsets = std::move(tmp);
             continue;
         }
@@ -1045,17 +1559,5 @@ std::vector<std::string> unicode_regex_split(const std::string & text, const std
         }
     }
 
-    std::vector<std::string> bpe_words;
-    bpe_words.reserve(bpe_offsets.size()); // reserve memory for the approximate size
-
-    size_t start = 0;
-    for (size_t & offset : bpe_offsets) {
-        bpe_words.emplace_back();
-        for (size_t i = start; i < start + offset; ++i) {
-            bpe_words.back() += unicode_cpt_to_utf8(cpts[i]);
-        }
-        start += offset;
-    }
-
-    return unicode_byte_encoding_process(bpe_words);
+    return unicode_byte_encoding_process(cpts, bpe_offsets);
 }
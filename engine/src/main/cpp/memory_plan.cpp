@@ -0,0 +1,156 @@
+#include "memory_plan.h"
+
+#include "gguf_probe.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace peerchat {
+
+namespace {
+
+// Tensors llama.cpp places with the output head rather than the input layer.
+bool is_output_tensor(const std::string & name) {
+    return name.rfind("output.", 0) == 0 || name.rfind("output_norm.", 0) == 0;
+}
+
+// Estimated peak compute-buffer bytes of one n_ubatch graph, split into the
+// attention, FFN and logits stages; the graph allocator reuses memory between
+// stages, so each backend needs the largest stage it runs. The terms are
+// tuned by hand against llama.cpp's graphs, not derived from them.
+struct ComputeStages {
+    int64_t attention = 0;
+    int64_t ffn = 0;
+    int64_t logits = 0;
+    int64_t hidden = 0;
+};
+
+ComputeStages compute_stages(const GgufModelInfo & info, int64_t n_kv, int64_t n_tokens, bool flash_attn) {
+    const int64_t f32 = 4;
+    const uint32_t n_head_kv = info.n_head_kv.empty() ? 0 : *std::max_element(info.n_head_kv.begin(), info.n_head_kv.end());
+    ComputeStages stages;
+    stages.hidden = static_cast<int64_t>(info.n_embd) * n_tokens * f32;
+
+    // Q, K and V projections plus the KQ mask: f32 rows padded to GGML_KQ_MASK_PAD,
+    // with an f16 copy for flash attention.
+    const int64_t qkv = (static_cast<int64_t>(info.n_head) * info.head_k +
+                         static_cast<int64_t>(n_head_kv) * (info.head_k + info.head_v)) * n_tokens * f32;
+    const int64_t mask = n_kv * GGML_PAD(n_tokens, GGML_KQ_MASK_PAD) * (flash_attn ? f32 + 2 : f32);
+    // Without flash attention the full KQ matrix is materialised; soft_max runs in place.
+    const int64_t kq = flash_attn ? 0 : static_cast<int64_t>(info.n_head) * n_kv * n_tokens * f32;
+    stages.attention = kq + mask + qkv + 4 * stages.hidden;
+
+    const int64_t n_ff = std::max<int64_t>(info.n_ff, static_cast<int64_t>(info.n_ff_exp) * std::max<uint32_t>(1, info.n_expert_used));
+    stages.ffn = 3 * n_ff * n_tokens * f32 + 2 * stages.hidden;
+
+    stages.logits = info.n_vocab * n_tokens * f32 + 2 * stages.hidden;
+    return stages;
+}
+
+} // namespace
+
+bool plan_memory(const MemoryPlanRequest & req, MemoryPlan & plan) {
+    GgufModelInfo info;
+    if (!gguf_probe(req.model_path, info)) {
+        return false;
+    }
+
+    const ggml_type type_k = kv_ggml_type(req.type_k);
+    const ggml_type type_v = kv_ggml_type(req.type_v);
+    const bool flash_attn = req.flash_attn || ggml_is_quantized(type_v);
+    const int64_t n_ctx = std::max(1, req.n_ctx > 0 ? req.n_ctx : static_cast<int>(info.n_ctx_train));
+    const int64_t n_seq = std::max(1, req.n_seq);
+    const int64_t n_ubatch = std::clamp<int64_t>(req.n_ubatch, 1, std::max(1, req.n_batch));
+    const int n_layer = static_cast<int>(info.n_layer);
+    const bool recurrent = gguf_is_recurrent(info);
+    const int64_t recurrent_per_layer = static_cast<int64_t>(gguf_recurrent_elements_per_layer(info)) * 4 * n_seq;
+    const ComputeStages stages = compute_stages(info, n_ctx, n_ubatch, flash_attn);
+
+    auto plan_for = [&](int n_gpu_layers) {
+        MemoryPlan p;
+        p.n_layer = n_layer;
+        p.n_gpu_layers = std::clamp(n_gpu_layers, 0, n_layer + 1);
+        p.output_offloaded = p.n_gpu_layers > n_layer;
+        const int first_gpu_layer = n_layer - std::min(p.n_gpu_layers, n_layer);
+
+        bool has_output_weight = false;
+        int64_t token_embd_bytes = 0;
+        for (const auto & tensor : info.tensors) {
+            const int64_t bytes = static_cast<int64_t>(tensor.bytes);
+            bool on_gpu = false;
+            if (tensor.layer >= 0) {
+                on_gpu = tensor.layer >= first_gpu_layer;
+            } else if (is_output_tensor(tensor.name)) {
+                on_gpu = p.output_offloaded;
+                has_output_weight = has_output_weight || tensor.name == "output.weight";
+            } else if (tensor.name.rfind("token_embd.", 0) == 0) {
+                token_embd_bytes += bytes;
+            }
+            (on_gpu ? p.gpu : p.cpu).weights += bytes;
+        }
+        // Tied embeddings: the output head reuses token_embd, duplicated onto the GPU when offloaded.
+        if (!has_output_weight && p.output_offloaded) {
+            p.gpu.weights += token_embd_bytes;
+        }
+
+        for (int il = 0; il < n_layer; ++il) {
+            BackendBytes & backend = il >= first_gpu_layer ? p.gpu : p.cpu;
+            const uint32_t n_head_kv = info.n_head_kv[il];
+            if (n_head_kv > 0) {
+                const int64_t per_token = static_cast<int64_t>(
+                        ggml_row_size(type_k, static_cast<int64_t>(info.head_k) * n_head_kv) +
+                        ggml_row_size(type_v, static_cast<int64_t>(info.head_v) * n_head_kv));
+                backend.kv += per_token * n_ctx;
+                p.kv_bytes_per_token += per_token;
+            } else if (recurrent) {
+                backend.recurrent += recurrent_per_layer;
+            }
+        }
+
+        // Layers run where their weights live; the CPU always embeds the input.
+        const int64_t layer_stage = std::max(stages.attention, stages.ffn);
+        const bool cpu_layers = first_gpu_layer > 0;
+        const bool gpu_layers = p.n_gpu_layers > 0;
+        p.cpu.compute = std::max({cpu_layers ? layer_stage : 0,
+                                  p.output_offloaded ? 0 : stages.logits,
+                                  stages.hidden});
+        p.gpu.compute = gpu_layers ? std::max(layer_stage, p.output_offloaded ? stages.logits : 0) : 0;
+        // One row of logits per sequence, kept in host memory.
+        p.cpu.output = info.n_vocab * n_seq * 4;
+        return p;
+    };
+
+    int n_gpu_layers = std::clamp(req.n_gpu_layers, 0, n_layer + 1);
+    plan = plan_for(n_gpu_layers);
+    if (req.gpu_budget_bytes > 0) {
+        while (n_gpu_layers > 0 && plan.gpu.total() > req.gpu_budget_bytes) {
+            plan = plan_for(--n_gpu_layers);
+        }
+    }
+    return true;
+}
+
+std::string memory_plan_json(const MemoryPlan & plan) {
+    auto backend_json = [](std::ostringstream & oss, const BackendBytes & b) {
+        oss << "{\"weights\":" << b.weights
+            << ",\"kv\":" << b.kv
+            << ",\"recurrent\":" << b.recurrent
+            << ",\"compute\":" << b.compute
+            << ",\"output\":" << b.output
+            << ",\"total\":" << b.total() << "}";
+    };
+    std::ostringstream oss;
+    oss << "{\"nLayer\":" << plan.n_layer
+        << ",\"nGpuLayers\":" << plan.n_gpu_layers
+        << ",\"outputOffloaded\":" << (plan.output_offloaded ? "true" : "false")
+        << ",\"kvBytesPerToken\":" << plan.kv_bytes_per_token
+        << ",\"computeEstimated\":true"
+        << ",\"cpu\":";
+    backend_json(oss, plan.cpu);
+    oss << ",\"gpu\":";
+    backend_json(oss, plan.gpu);
+    oss << ",\"total\":" << plan.total() << "}";
+    return oss.str();
+}
+
+} // namespace peerchat
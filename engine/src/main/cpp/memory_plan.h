@@ -0,0 +1,65 @@
+#pragma once
+
+#include "engine_core.h"
+
+#include <cstdint>
+#include <string>
+
+namespace peerchat {
+
+// Dry-run memory planner: predicts what loading a model and creating one
+// context would allocate, per backend, from the GGUF header alone. Nothing is
+// mapped or allocated, so it runs the same on a CPU-only host as on a phone.
+//
+// Layer placement follows llama.cpp: the last n_gpu_layers blocks go to the
+// GPU, the output head only once n_gpu_layers exceeds the block count, and the
+// token embedding always stays on the CPU. The KV cache is unified and sized
+// n_ctx cells per attention layer (an upper bound for sliding-window layers);
+// recurrent layers hold one state per sequence. Weights and caches are exact
+// sizes; compute buffers are an estimate. They are hand-tuned formulas for the
+// peak of the attention, FFN and logits stages of an n_ubatch graph, standing
+// in for what the reserve pass of llama_context measures, and can drift when
+// llama.cpp changes its graphs. The JSON marks them with "computeEstimated".
+struct MemoryPlanRequest {
+    std::string model_path;
+    int n_ctx = 4096;
+    int n_batch = 512;
+    int n_ubatch = 512;
+    int n_seq = 1;
+    KvPrecision type_k = KvPrecision::F16;
+    KvPrecision type_v = KvPrecision::F16;
+    // Flash attention; forced on when V is quantized, as the engine does.
+    bool flash_attn = false;
+    int n_gpu_layers = 0;
+    // When set, n_gpu_layers is lowered until the GPU share fits.
+    int64_t gpu_budget_bytes = 0;
+};
+
+struct BackendBytes {
+    int64_t weights = 0;
+    int64_t kv = 0;
+    int64_t recurrent = 0;
+    // Estimated, not measured (see above).
+    int64_t compute = 0;
+    // Logits and embeddings handed back to the caller (host memory).
+    int64_t output = 0;
+
+    int64_t total() const { return weights + kv + recurrent + compute + output; }
+};
+
+struct MemoryPlan {
+    BackendBytes cpu;
+    BackendBytes gpu;
+    int n_layer = 0;
+    int n_gpu_layers = 0;
+    bool output_offloaded = false;
+    int64_t kv_bytes_per_token = 0;
+
+    int64_t total() const { return cpu.total() + gpu.total(); }
+};
+
+// False when the file is missing or its header does not parse.
+bool plan_memory(const MemoryPlanRequest & req, MemoryPlan & plan);
+std::string memory_plan_json(const MemoryPlan & plan);
+
+} // namespace peerchat
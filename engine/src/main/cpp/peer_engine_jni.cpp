@@ -1,679 +1,286 @@
 #include <jni.h>
-#include <android/log.h>
-#include "llama.h"
+#include "engine_core.h"
+#include "engine_log.h"
+#include "lexical_index.h"
+#include "memory_plan.h"
+#include "retrieval.h"
+#include "token_ring.h"
+#include "vector_index.h"
+#include "vector_kernels.h"
+#include "vector_store.h"
 
 #include <algorithm>
-#include <atomic>
-#include <cctype>
 #include <chrono>
-#include <iomanip>
-#include <ios>
+#include <cstdint>
+#include <cstring>
+#include <memory>
 #include <mutex>
-#include <sstream>
+#include <shared_mutex>
 #include <string>
-#include <sys/stat.h>
+#include <string_view>
 #include <vector>
 
-namespace {
-
-constexpr const char * kTag = "PeerChatEngine";
+// JNI shim over peerchat::engine: argument marshalling only. Generation,
+// embedding, sessions and state snapshots live in engine_core.cpp.
 
-#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, kTag, __VA_ARGS__)
-#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, kTag, __VA_ARGS__)
+namespace {
 
-enum class StopReason {
-    None,
-    Eos,
-    StopSequence,
-    MaxTokens,
-    Error,
-};
+using peerchat::GenerationRequest;
+using peerchat::GenerationSummary;
 
-struct EngineMetrics {
-    int prompt_tokens = 0;
-    int generation_tokens = 0;
-    double ttfs_ms = 0.0;
-    double prefill_ms = 0.0;
-    double decode_ms = 0.0;
-    double total_ms = 0.0;
-    double tps = 0.0;
-    double prompt_tps = 0.0;
-    double context_used_pct = 0.0;
-    bool truncated = false;
-};
+std::string jstring_to_utf8(JNIEnv * env, jstring js) {
+    if (!js) return std::string();
+    const char * c = env->GetStringUTFChars(js, nullptr);
+    std::string s(c ? c : "");
+    env->ReleaseStringUTFChars(js, c);
+    return s;
+}
 
-struct EngineState {
-    std::mutex mutex;
-    llama_model * model = nullptr;
-    llama_context * ctx = nullptr;
-    llama_context * embed_ctx = nullptr;
-    std::string model_path;
-    int n_ctx = 4096;
-    int n_threads = 4;
-    int n_gpu_layers = 0;
-    bool use_vulkan = true;
-    EngineMetrics metrics;
-    StopReason stop_reason = StopReason::None;
-    std::string stop_sequence;
-    std::atomic<bool> should_abort{false};
-};
+// Byte length of the first n_chars UTF-16 units of js in the modified UTF-8
+// that jstring_to_utf8 produces, for offsets into the converted text.
+size_t utf8_prefix_bytes(JNIEnv * env, jstring js, jint n_chars) {
+    if (!js || n_chars <= 0) return 0;
+    const jsize n = std::min<jsize>(n_chars, env->GetStringLength(js));
+    std::vector<jchar> chars(static_cast<size_t>(n));
+    env->GetStringRegion(js, 0, n, chars.data());
+    size_t bytes = 0;
+    for (const jchar c : chars) {
+        bytes += (c != 0 && c < 0x80) ? 1 : (c < 0x800 ? 2 : 3);
+    }
+    return bytes;
+}
 
-struct StopBuffer {
-    explicit StopBuffer(const std::vector<std::string> & stops) : stops_(stops) {
-        max_stop_ = 0;
-        for (const auto & s : stops_) {
-            max_stop_ = std::max(max_stop_, s.size());
+// Standard UTF-8 to a Java string through UTF-16: NewStringUTF expects modified
+// UTF-8 and mangles four-byte sequences such as emoji. Malformed bytes become
+// U+FFFD. `units` is scratch space reused across calls.
+jstring utf8_to_jstring(JNIEnv * env, std::string_view text, std::vector<jchar> & units) {
+    units.clear();
+    const auto * s = reinterpret_cast<const uint8_t *>(text.data());
+    const size_t n = text.size();
+    for (size_t i = 0; i < n;) {
+        const uint8_t lead = s[i];
+        size_t len = 1;
+        uint32_t cp = lead;
+        uint32_t min_cp = 0;
+        if (lead >= 0xF0 && lead < 0xF5) {
+            len = 4; cp = lead & 0x07; min_cp = 0x10000;
+        } else if (lead >= 0xE0 && lead < 0xF0) {
+            len = 3; cp = lead & 0x0F; min_cp = 0x800;
+        } else if (lead >= 0xC2 && lead < 0xE0) {
+            len = 2; cp = lead & 0x1F; min_cp = 0x80;
+        } else if (lead >= 0x80) {
+            len = 0;
         }
-    }
-
-    std::string push(const std::string & piece, bool & hit_stop, std::string & matched) {
-        hit_stop = false;
-        matched.clear();
-        pending_.append(piece);
-        if (max_stop_ == 0) {
-            std::string emit = pending_;
-            pending_.clear();
-            return emit;
+        bool valid = len > 0 && i + len <= n;
+        for (size_t k = 1; valid && k < len; ++k) {
+            valid = (s[i + k] & 0xC0) == 0x80;
+            cp = (cp << 6) | (s[i + k] & 0x3F);
         }
-        for (const auto & stop : stops_) {
-            if (stop.empty()) {
-                continue;
-            }
-            if (pending_.size() >= stop.size() &&
-                pending_.compare(pending_.size() - stop.size(), stop.size(), stop) == 0) {
-                hit_stop = true;
-                matched = stop;
-                std::string emit = pending_.substr(0, pending_.size() - stop.size());
-                pending_.clear();
-                return emit;
-            }
+        valid = valid && cp >= min_cp && cp <= 0x10FFFF && (cp < 0xD800 || cp > 0xDFFF);
+        if (!valid) {
+            units.push_back(0xFFFD);
+            ++i;
+            continue;
         }
-        if (pending_.size() >= max_stop_) {
-            const size_t emit_len = pending_.size() - (max_stop_ - 1);
-            std::string emit = pending_.substr(0, emit_len);
-            pending_.erase(0, emit_len);
-            return emit;
+        if (cp >= 0x10000) {
+            cp -= 0x10000;
+            units.push_back(static_cast<jchar>(0xD800 + (cp >> 10)));
+            units.push_back(static_cast<jchar>(0xDC00 + (cp & 0x3FF)));
+        } else {
+            units.push_back(static_cast<jchar>(cp));
         }
-        return std::string();
+        i += len;
     }
+    return env->NewString(units.data(), static_cast<jsize>(units.size()));
+}
 
-    std::string flush() {
-        std::string emit = pending_;
-        pending_.clear();
-        return emit;
-    }
-
-private:
-    std::vector<std::string> stops_;
-    size_t max_stop_ = 0;
-    std::string pending_;
-};
-
-struct StreamContext {
-    JNIEnv * env = nullptr;
-    jobject callback = nullptr;
-    jmethodID on_token = nullptr;
-};
-
-struct GenerationRequest {
-    std::string prompt;
-    std::string system_prompt;
-    float temperature = 0.8f;
-    float top_p = 0.9f;
-    int top_k = 40;
-    int max_tokens = 512;
-    std::vector<std::string> stops;
-};
+jstring utf8_to_jstring(JNIEnv * env, std::string_view text) {
+    std::vector<jchar> units;
+    units.reserve(text.size());
+    return utf8_to_jstring(env, text, units);
+}
 
-struct GenerationSummary {
-    EngineMetrics metrics;
-    StopReason reason = StopReason::None;
-    std::string stop_sequence;
-    bool success = false;
-};
+// Standard UTF-8 of js (GetStringUTFChars yields modified UTF-8, which splits
+// emoji into surrogate halves) plus the UTF-16 index each byte belongs to, with
+// one extra entry for the end, so byte offsets map back to Kotlin indices.
+std::string jstring_to_utf8_indexed(JNIEnv * env, jstring js, std::vector<jint> & unit_of_byte) {
+    std::string out;
+    unit_of_byte.clear();
+    const jsize n = js ? env->GetStringLength(js) : 0;
+    std::vector<jchar> units(static_cast<size_t>(n));
+    if (n > 0) {
+        env->GetStringRegion(js, 0, n, units.data());
+    }
+    out.reserve(units.size() * 3 / 2);
+    unit_of_byte.reserve(units.size() * 3 / 2 + 1);
+    for (jsize i = 0; i < n; ++i) {
+        uint32_t cp = units[static_cast<size_t>(i)];
+        const jsize first = i;
+        if (cp >= 0xD800 && cp < 0xDC00 && i + 1 < n &&
+            units[static_cast<size_t>(i) + 1] >= 0xDC00 && units[static_cast<size_t>(i) + 1] < 0xE000) {
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (units[static_cast<size_t>(++i)] - 0xDC00);
+        } else if (cp >= 0xD800 && cp < 0xE000) {
+            cp = 0xFFFD;
+        }
+        const size_t before = out.size();
+        if (cp < 0x80) {
+            out.push_back(static_cast<char>(cp));
+        } else if (cp < 0x800) {
+            out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else if (cp < 0x10000) {
+            out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else {
+            out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+        unit_of_byte.insert(unit_of_byte.end(), out.size() - before, first);
+    }
+    unit_of_byte.push_back(n);
+    return out;
+}
 
-EngineState g_state;
-bool g_backend_initialized = false;
+// Forwards chunks to TokenCallback.onToken on the calling thread.
+class CallbackSink final : public peerchat::TokenSink {
+public:
+    CallbackSink(JNIEnv * env, jobject callback, jmethodID on_token)
+        : env_(env), callback_(callback), on_token_(on_token) {}
 
-struct SummaryCommit {
-    EngineState & state;
-    GenerationSummary & summary;
-    ~SummaryCommit() {
-        state.metrics = summary.metrics;
-        state.stop_reason = summary.reason;
-        state.stop_sequence = summary.stop_sequence;
+    bool emit(std::string_view text) override {
+        return dispatch(text, false);
     }
-};
 
-bool ensure_backend_init() {
-    if (!g_backend_initialized) {
-        llama_backend_init();
-        g_backend_initialized = true;
-        LOGI("llama backend initialized (Vulkan expected)");
+    void done() override {
+        LOGI("emit_chunk: done signal dispatched");
+        dispatch(std::string_view(), true);
     }
-    return true;
-}
 
-bool ensure_embedding_context_locked() {
-    if (g_state.embed_ctx) {
+private:
+    bool dispatch(std::string_view text, bool done) {
+        jstring jChunk = utf8_to_jstring(env_, text, units_);
+        if (!jChunk) {
+            LOGE("failed to allocate chunk string");
+            return false;
+        }
+        env_->CallVoidMethod(callback_, on_token_, jChunk, done ? JNI_TRUE : JNI_FALSE);
+        env_->DeleteLocalRef(jChunk);
+        if (env_->ExceptionCheck()) {
+            LOGE("exception thrown from token callback");
+            env_->ExceptionClear();
+            return false;
+        }
         return true;
     }
-    if (!g_state.model) {
-        LOGE("embedding context requested without loaded model");
-        return false;
-    }
 
-    llama_context_params params = llama_context_default_params();
-    params.n_ctx = g_state.n_ctx;
-    params.n_threads = g_state.n_threads;
-    params.n_threads_batch = g_state.n_threads;
-    params.embeddings = true;
+    JNIEnv * env_;
+    jobject callback_;
+    jmethodID on_token_;
+    std::vector<jchar> units_;
+};
 
-    // Optimize batch sizes for embedding context (typically smaller than inference context)
-    if (g_state.use_vulkan) {
-        // GPU-accelerated embeddings: moderate batch sizes
-        params.n_batch = std::min(1024U, static_cast<uint32_t>(params.n_ctx / 4));
-        params.n_ubatch = std::min(256U, params.n_batch / 4);
-        params.offload_kqv = true;
-    } else {
-        // CPU embeddings: smaller batches for memory efficiency
-        params.n_batch = std::min(256U, static_cast<uint32_t>(params.n_ctx / 8));
-        params.n_ubatch = std::min(64U, params.n_batch / 4);
-    }
+// Reads the generateStream arguments; false when a JNI exception was raised.
+bool read_stream_request(JNIEnv * env,
+                         jstring jPrompt,
+                         jstring jSystem,
+                         jfloat temperature,
+                         jfloat topP,
+                         jint topK,
+                         jint maxTokens,
+                         jobjectArray jStop,
+                         jint keepPrefix,
+                         GenerationRequest & req) {
+    req.prompt = jstring_to_utf8(env, jPrompt);
+    req.system_prompt = jstring_to_utf8(env, jSystem);
+    req.keep_bytes = utf8_prefix_bytes(env, jPrompt, keepPrefix);
+    req.temperature = temperature;
+    req.top_p = topP;
+    req.top_k = topK;
+    req.max_tokens = std::max(1, maxTokens);
 
-    llama_context * embed = llama_init_from_model(g_state.model, params);
-    if (!embed) {
-        LOGE("failed to create embedding context");
+    // Check for exceptions after string conversion
+    if (env->ExceptionCheck()) {
+        LOGE("generateStream: exception during string conversion");
+        env->ExceptionClear();
         return false;
     }
-    llama_set_n_threads(embed, g_state.n_threads, g_state.n_threads);
-    g_state.embed_ctx = embed;
-    return true;
-}
 
-bool file_exists(const char * path) {
-    if (!path) return false;
-    struct stat st {};
-    if (stat(path, &st) != 0) {
-        return false;
-    }
-    return S_ISREG(st.st_mode);
-}
-
-void reset_metrics_locked() {
-    g_state.metrics = EngineMetrics{};
-    g_state.stop_reason = StopReason::None;
-    g_state.stop_sequence.clear();
-    g_state.should_abort.store(false, std::memory_order_relaxed);
-}
-
-void unload_locked() {
-    // Clear abort flag before cleanup
-    g_state.should_abort.store(false, std::memory_order_relaxed);
-    
-    // Clean up context
-    g_state.model_path.clear();
-    if (g_state.embed_ctx) {
-        llama_free(g_state.embed_ctx);
-        g_state.embed_ctx = nullptr;
-    }
-    if (g_state.ctx) {
-        llama_free(g_state.ctx);
-        g_state.ctx = nullptr;
-    }
-    if (g_state.model) {
-        llama_model_free(g_state.model);
-        g_state.model = nullptr;
-    }
-    reset_metrics_locked();
-}
-
-// Abort callback function for llama context
-bool abort_callback_handler(void * data) {
-    (void) data;
-    return g_state.should_abort.load(std::memory_order_relaxed);
-}
-
-std::string stop_reason_to_string(StopReason reason) {
-    switch (reason) {
-        case StopReason::None: return "none";
-        case StopReason::Eos: return "eos";
-        case StopReason::StopSequence: return "stop_sequence";
-        case StopReason::MaxTokens: return "max_tokens";
-        case StopReason::Error: return "error";
-    }
-    return "unknown";
-}
-
-std::string escape_json(const std::string & input) {
-    std::ostringstream oss;
-    for (char ch : input) {
-        switch (ch) {
-            case '"': oss << "\\\""; break;
-            case '\\': oss << "\\\\"; break;
-            case '\b': oss << "\\b"; break;
-            case '\f': oss << "\\f"; break;
-            case '\n': oss << "\\n"; break;
-            case '\r': oss << "\\r"; break;
-            case '\t': oss << "\\t"; break;
-            default:
-                if (static_cast<unsigned char>(ch) < 0x20) {
-                    oss << "\\u"
-                        << std::hex << std::uppercase << std::setw(4) << std::setfill('0')
-                        << static_cast<int>(static_cast<unsigned char>(ch))
-                        << std::dec << std::nouppercase;
-                } else {
-                    oss << ch;
-                }
+    jsize stop_len = jStop ? env->GetArrayLength(jStop) : 0;
+    for (jsize i = 0; i < stop_len; ++i) {
+        jstring js = static_cast<jstring>(env->GetObjectArrayElement(jStop, i));
+        if (js) {
+            req.stops.push_back(jstring_to_utf8(env, js));
+            env->DeleteLocalRef(js);
         }
-    }
-    return oss.str();
-}
-
-std::string build_metrics_json_locked() {
-    const EngineMetrics & m = g_state.metrics;
-    std::ostringstream oss;
-    oss.setf(std::ios::fixed);
-    oss.precision(3);
-    oss << "{";
-    oss << "\"nCtx\":" << g_state.n_ctx << ",";
-    oss << "\"nThreads\":" << g_state.n_threads << ",";
-    oss << "\"nGpuLayers\":" << g_state.n_gpu_layers << ",";
-    oss << "\"useVulkan\":" << (g_state.use_vulkan ? "true" : "false") << ",";
-    oss << "\"promptTokens\":" << m.prompt_tokens << ",";
-    oss << "\"generationTokens\":" << m.generation_tokens << ",";
-    oss << "\"ttfsMs\":" << m.ttfs_ms << ",";
-    oss << "\"prefillMs\":" << m.prefill_ms << ",";
-    oss << "\"decodeMs\":" << m.decode_ms << ",";
-    oss << "\"totalMs\":" << m.total_ms << ",";
-    oss << "\"tps\":" << m.tps << ",";
-    oss << "\"promptTps\":" << m.prompt_tps << ",";
-    oss << "\"contextUsedPct\":" << m.context_used_pct << ",";
-    oss << "\"truncated\":" << (m.truncated ? "true" : "false") << ",";
-    oss << "\"stopReason\":\"" << stop_reason_to_string(g_state.stop_reason) << "\",";
-    oss << "\"stopSequence\":\"" << escape_json(g_state.stop_sequence) << "\"";
-    oss << "}";
-    return oss.str();
-}
-
-std::string jstring_to_utf8(JNIEnv * env, jstring js) {
-    if (!js) return std::string();
-    const char * c = env->GetStringUTFChars(js, nullptr);
-    std::string s(c ? c : "");
-    env->ReleaseStringUTFChars(js, c);
-    return s;
-}
 
-bool emit_chunk(StreamContext * stream, const std::string & text, bool done) {
-    if (!stream || !stream->callback || !stream->on_token) {
-        return true;
-    }
-    if (!done && text.empty()) {
-        return true;
-    }
-    jstring jChunk = stream->env->NewStringUTF(text.c_str());
-    if (!jChunk) {
-        LOGE("failed to allocate chunk string");
-        return false;
-    }
-    if (done) {
-        LOGI("emit_chunk: done signal dispatched");
-    }
-    stream->env->CallVoidMethod(stream->callback, stream->on_token, jChunk, done ? JNI_TRUE : JNI_FALSE);
-    stream->env->DeleteLocalRef(jChunk);
-    if (stream->env->ExceptionCheck()) {
-        LOGE("exception thrown from token callback");
-        stream->env->ExceptionClear();
-        return false;
+        // Check for exceptions in loop
+        if (env->ExceptionCheck()) {
+            LOGE("generateStream: exception during stop sequence processing");
+            env->ExceptionClear();
+            return false;
+        }
     }
     return true;
 }
 
-struct StreamDoneGuard {
-    explicit StreamDoneGuard(StreamContext * ctx) : stream(ctx) {}
-    ~StreamDoneGuard() {
-        if (stream) {
-            emit_chunk(stream, "", true);
-        }
+jbyteArray to_byte_array(JNIEnv * env, const std::vector<uint8_t> & bytes) {
+    if (bytes.empty() || bytes.size() > 0x7fffffffULL) {
+        return env->NewByteArray(0);
     }
-    void dismiss() { stream = nullptr; }
-    StreamContext * stream;
-};
-
-bool prepare_prompt_tokens(const llama_vocab * vocab,
-                           const std::string & text,
-                           std::vector<llama_token> & out_tokens) {
-    out_tokens.resize(text.size() + 8);
-    int32_t n = llama_tokenize(vocab, text.c_str(), static_cast<int>(text.size()),
-                               out_tokens.data(), static_cast<int>(out_tokens.size()),
-                               /*add_special=*/true, /*parse_special=*/true);
-    if (n < 0) {
-        out_tokens.resize(static_cast<size_t>(-n));
-        n = llama_tokenize(vocab, text.c_str(), static_cast<int>(text.size()),
-                           out_tokens.data(), static_cast<int>(out_tokens.size()),
-                           true, true);
-    }
-    if (n < 0) {
-        return false;
+    jbyteArray result = env->NewByteArray(static_cast<jsize>(bytes.size()));
+    if (!result) {
+        return nullptr;
     }
-    out_tokens.resize(static_cast<size_t>(n));
-    return true;
+    env->SetByteArrayRegion(result, 0, static_cast<jsize>(bytes.size()),
+            reinterpret_cast<const jbyte *>(bytes.data()));
+    return result;
 }
 
-bool contains_case_insensitive(const std::string & haystack, const std::string & needle) {
-    if (needle.empty()) return false;
-    auto it = std::search(
-        haystack.begin(), haystack.end(),
-        needle.begin(), needle.end(),
-        [](char ch1, char ch2) {
-            return std::tolower(static_cast<unsigned char>(ch1)) ==
-                   std::tolower(static_cast<unsigned char>(ch2));
-        });
-    return it != haystack.end();
-}
-
-std::string read_meta_value(const llama_model * model, const char * key) {
-    if (!model || !key) return {};
-    char buf[2048];
-    int32_t written = llama_model_meta_val_str(model, key, buf, sizeof(buf));
-    if (written < 0) {
-        return {};
-    }
-    if (written >= static_cast<int32_t>(sizeof(buf))) {
-        std::vector<char> big(static_cast<size_t>(written) + 1);
-        llama_model_meta_val_str(model, key, big.data(), big.size());
-        return std::string(big.data());
-    }
-    return std::string(buf);
-}
-
-bool generate_internal(const GenerationRequest & req,
-                       StreamContext * stream,
-                       std::string * out_text,
-                       GenerationSummary & summary) {
-    StreamDoneGuard done_guard(stream);
-    std::lock_guard<std::mutex> lock(g_state.mutex);
-    summary = GenerationSummary{};
-    SummaryCommit commit{g_state, summary};
-
-    if (!g_state.ctx || !g_state.model) {
-        summary.reason = StopReason::Error;
-        return false;
-    }
-
-    ensure_backend_init();
-    LOGI("generate_internal: begin prompt_len=%zu system_len=%zu max_tokens=%d", req.prompt.size(), req.system_prompt.size(), req.max_tokens);
-
-    // Reset abort flag for new generation
-    g_state.should_abort.store(false, std::memory_order_relaxed);
-    
-    // Set abort callback for graceful cancellation during generation
-    llama_set_abort_callback(g_state.ctx, abort_callback_handler, nullptr);
-    
-    llama_memory_clear(llama_get_memory(g_state.ctx), true);
-    llama_set_n_threads(g_state.ctx, g_state.n_threads, g_state.n_threads);
-
-    const llama_vocab * vocab = llama_model_get_vocab(g_state.model);
-    if (!vocab) {
-        LOGE("vocab unavailable");
-        summary.reason = StopReason::Error;
-        return false;
+std::vector<uint8_t> from_byte_array(JNIEnv * env, jbyteArray jBytes) {
+    std::vector<uint8_t> bytes;
+    const jsize len = jBytes ? env->GetArrayLength(jBytes) : 0;
+    if (len > 0) {
+        bytes.resize(static_cast<size_t>(len));
+        env->GetByteArrayRegion(jBytes, 0, len, reinterpret_cast<jbyte *>(bytes.data()));
     }
+    return bytes;
+}
 
-    std::string full_prompt = req.system_prompt.empty()
-            ? req.prompt
-            : (req.system_prompt + "\n\n" + req.prompt);
+jint clamp_jint(size_t value) {
+    return static_cast<jint>(value > 0x7fffffffULL ? 0x7fffffff : value);
+}
 
-    std::vector<llama_token> prompt_tokens;
-    if (!prepare_prompt_tokens(vocab, full_prompt, prompt_tokens)) {
-        LOGE("failed to tokenize prompt");
-        summary.reason = StopReason::Error;
+// Views of the UTF-8 texts packed in a direct buffer, text i at bytes
+// [offsets[i], offsets[i + 1]). False when the offsets do not fit the buffer.
+bool texts_from_direct_buffer(JNIEnv * env, jobject jBuffer, jintArray jOffsets,
+                              std::vector<std::string_view> & texts) {
+    texts.clear();
+    if (!jBuffer || !jOffsets) {
         return false;
     }
-    LOGI("generate_internal: tokenized prompt_tokens=%d", static_cast<int>(prompt_tokens.size()));
-
-    llama_batch prefill = llama_batch_get_one(prompt_tokens.data(), static_cast<int32_t>(prompt_tokens.size()));
-
-    const double t_start_ms = llama_time_us() / 1000.0;
-    const double t_prefill_start_ms = t_start_ms;
-    if (llama_decode(g_state.ctx, prefill) != 0) {
-        LOGE("prefill decode failed");
-        summary.reason = StopReason::Error;
+    const char * base = static_cast<const char *>(env->GetDirectBufferAddress(jBuffer));
+    const jlong capacity = env->GetDirectBufferCapacity(jBuffer);
+    const jsize n_offsets = env->GetArrayLength(jOffsets);
+    if (!base || capacity < 0 || n_offsets < 1) {
         return false;
     }
-    LOGI("generate_internal: prefill complete ctx=%d", g_state.n_ctx);
-    const double t_prefill_end_ms = llama_time_us() / 1000.0;
-
-    auto sparams = llama_sampler_chain_default_params();
-    llama_sampler * sampler = llama_sampler_chain_init(sparams);
-    if (!sampler) {
-        LOGE("failed to init sampler chain");
-        summary.reason = StopReason::Error;
+    std::vector<jint> offsets(static_cast<size_t>(n_offsets));
+    env->GetIntArrayRegion(jOffsets, 0, n_offsets, offsets.data());
+    if (offsets[0] < 0) {
         return false;
     }
-
-    if (req.temperature <= 0.0f) {
-        llama_sampler_chain_add(sampler, llama_sampler_init_greedy());
-    } else {
-        if (req.top_k > 0) {
-            llama_sampler_chain_add(sampler, llama_sampler_init_top_k(req.top_k));
-        }
-        if (req.top_p > 0.0f && req.top_p < 1.0f) {
-            llama_sampler_chain_add(sampler, llama_sampler_init_top_p(req.top_p, 1));
-        }
-        llama_sampler_chain_add(sampler, llama_sampler_init_temp(req.temperature));
-        const uint32_t seed = static_cast<uint32_t>(llama_time_us() & 0xFFFFFFFFULL);
-        llama_sampler_chain_add(sampler, llama_sampler_init_dist(seed));
-    }
-
-    StopBuffer stop_buffer(req.stops);
-    summary.metrics.prompt_tokens = static_cast<int>(prompt_tokens.size());
-    summary.metrics.prefill_ms = t_prefill_end_ms - t_prefill_start_ms;
-    if (summary.metrics.prefill_ms > 0.0) {
-        summary.metrics.prompt_tps = (summary.metrics.prompt_tokens * 1000.0) / summary.metrics.prefill_ms;
-    }
-
-    const double t_decode_start_ms = llama_time_us() / 1000.0;
-
-    for (int i = 0; i < req.max_tokens; ++i) {
-        // Check abort flag before each token generation
-        if (g_state.should_abort.load(std::memory_order_relaxed)) {
-            LOGI("generate_internal: abort flag raised after %d tokens", i);
-            summary.reason = StopReason::Error;
-            summary.metrics.truncated = true;
-            break;
-        }
-        
-        const llama_token token = llama_sampler_sample(sampler, g_state.ctx, -1);
-        llama_sampler_accept(sampler, token);
-
-        if (llama_vocab_is_eog(vocab, token)) {
-            LOGI("generate_internal: received EOS token after %d tokens", i);
-            summary.reason = StopReason::Eos;
-            break;
-        }
-
-        char buffer[512];
-        const int32_t written = llama_token_to_piece(vocab, token, buffer, static_cast<int32_t>(sizeof(buffer)), 0, false);
-        std::string piece;
-        if (written > 0) {
-            piece.assign(buffer, static_cast<size_t>(written));
-        }
-
-        bool hit_stop = false;
-        std::string matched_stop;
-        std::string emit = stop_buffer.push(piece, hit_stop, matched_stop);
-        if (!emit.empty()) {
-            if (!emit_chunk(stream, emit, false)) {
-                LOGE("generate_internal: emit_chunk failed after %d tokens", i);
-                summary.reason = StopReason::Error;
-                break;
-            }
-            if (out_text) {
-                out_text->append(emit);
-            }
-        }
-
-        if (summary.metrics.generation_tokens == 0) {
-            summary.metrics.ttfs_ms = llama_time_us() / 1000.0 - t_start_ms;
-            LOGI("generate_internal: first token emitted ttfs_ms=%.2f", summary.metrics.ttfs_ms);
-        }
-        summary.metrics.generation_tokens += 1;
-
-        llama_token to_feed = token;
-        llama_batch cont = llama_batch_get_one(&to_feed, 1);
-        if (llama_decode(g_state.ctx, cont) != 0) {
-            LOGE("decode failed during generation");
-            summary.reason = StopReason::Error;
-            summary.metrics.truncated = true;
-            break;
-        }
-
-        if (hit_stop) {
-            LOGI("generate_internal: stop sequence '%s' at token %d", matched_stop.c_str(), i);
-            summary.reason = StopReason::StopSequence;
-            summary.stop_sequence = matched_stop;
-            break;
-        }
-
-        if (i < 3 || (i + 1) % 32 == 0) {
-            LOGI("generate_internal: streamed token %d piece_len=%zu", i + 1, piece.size());
-        }
-    }
-
-    LOGI("generate_internal: sampler finalize tokens=%d", summary.metrics.generation_tokens);
-    llama_perf_sampler_data perf_sampler = llama_perf_sampler(sampler);
-    llama_sampler_free(sampler);
-
-    if (summary.reason == StopReason::None) {
-        summary.reason = summary.metrics.generation_tokens >= req.max_tokens
-                ? StopReason::MaxTokens
-                : StopReason::None;
-    }
-
-    const double t_decode_end_ms = llama_time_us() / 1000.0;
-    summary.metrics.decode_ms = t_decode_end_ms - t_decode_start_ms;
-    summary.metrics.total_ms = t_decode_end_ms - t_start_ms;
-    if (summary.metrics.decode_ms > 0.0 && summary.metrics.generation_tokens > 0) {
-        summary.metrics.tps = (summary.metrics.generation_tokens * 1000.0) / summary.metrics.decode_ms;
-    }
-    if (g_state.n_ctx > 0) {
-        const double used = static_cast<double>(summary.metrics.prompt_tokens + summary.metrics.generation_tokens);
-        summary.metrics.context_used_pct = (used * 100.0) / static_cast<double>(g_state.n_ctx);
-    }
-    summary.metrics.truncated = summary.metrics.truncated || (summary.reason == StopReason::MaxTokens);
-
-    std::string tail = stop_buffer.flush();
-    if (!tail.empty() && summary.reason != StopReason::Error) {
-        if (!emit_chunk(stream, tail, false)) {
-            summary.reason = StopReason::Error;
-            LOGE("generate_internal: tail emit failed");
-        } else if (out_text) {
-            out_text->append(tail);
-        }
-    }
-
-    summary.success = summary.reason != StopReason::Error;
-    if (summary.success && stream) {
-        emit_chunk(stream, "", true);
-        done_guard.dismiss();
-    }
-    LOGI("generate_internal: fetching perf context tokens=%d", summary.metrics.generation_tokens);
-    llama_perf_context_data perf_ctx = llama_perf_context(g_state.ctx);
-    LOGI("generate_internal: perf context fetched prompt=%d eval=%d", perf_ctx.n_p_eval, perf_ctx.n_eval);
-    double prompt_tps = perf_ctx.n_p_eval > 0 && perf_ctx.t_p_eval_ms > 0.0
-            ? (perf_ctx.n_p_eval * 1000.0) / perf_ctx.t_p_eval_ms
-            : 0.0;
-    double eval_tps = perf_ctx.n_eval > 0 && perf_ctx.t_eval_ms > 0.0
-            ? (perf_ctx.n_eval * 1000.0) / perf_ctx.t_eval_ms
-            : 0.0;
-    double sample_tps = perf_sampler.n_sample > 0 && perf_sampler.t_sample_ms > 0.0
-            ? (perf_sampler.n_sample * 1000.0) / perf_sampler.t_sample_ms
-            : 0.0;
-
-    LOGI("generate_internal: done reason=%d tokens=%d ttfs=%.2f total_ms=%.2f truncated=%d eval_tps=%.2f prompt_tps=%.2f sample_tps=%.2f",
-         static_cast<int>(summary.reason),
-         summary.metrics.generation_tokens,
-         summary.metrics.ttfs_ms,
-         summary.metrics.total_ms,
-         summary.metrics.truncated ? 1 : 0,
-         eval_tps,
-         prompt_tps,
-         sample_tps);
-    llama_perf_context_reset(g_state.ctx);
-    return summary.success;
-}
-
-static std::string build_model_metadata_json(llama_model * mdl) {
-    if (!mdl) {
-        return "{}";
-    }
-
-    const int32_t n_ctx_train = llama_model_n_ctx_train(mdl);
-    const int32_t n_layer = llama_model_n_layer(mdl);
-    const int32_t n_embd = llama_model_n_embd(mdl);
-    const llama_vocab * vocab = llama_model_get_vocab(mdl);
-    const int32_t n_vocab = vocab ? llama_vocab_n_tokens(vocab) : 0;
-
-    std::string arch = read_meta_value(mdl, "general.architecture");
-    std::string chat_template = read_meta_value(mdl, "tokenizer.chat_template");
-    if (chat_template.empty()) {
-        chat_template = read_meta_value(mdl, "llama.chat_template");
-    }
-    std::string tokenizer_model = read_meta_value(mdl, "tokenizer.ggml.model");
-    std::string tags = read_meta_value(mdl, "general.tags");
-    std::string capabilities = read_meta_value(mdl, "general.capabilities");
-    std::string reasoning_flag = read_meta_value(mdl, "general.capabilities.reasoning");
-
-    const bool reasoning = contains_case_insensitive(reasoning_flag, "true") ||
-                           contains_case_insensitive(capabilities, "reasoning") ||
-                           contains_case_insensitive(tags, "reasoning") ||
-                           contains_case_insensitive(chat_template, "<think>") ||
-                           contains_case_insensitive(chat_template, "<reasoning>");
-
-    std::ostringstream oss;
-    oss << "{"
-        << "\"arch\":\"" << escape_json(arch) << "\","
-        << "\"nCtxTrain\":" << n_ctx_train << ","
-        << "\"nLayer\":" << n_layer << ","
-        << "\"nEmbd\":" << n_embd << ","
-        << "\"nVocab\":" << n_vocab << ","
-        << "\"chatTemplate\":\"" << escape_json(chat_template) << "\","
-        << "\"tokenizerModel\":\"" << escape_json(tokenizer_model) << "\","
-        << "\"reasoning\":" << (reasoning ? "true" : "false") << ","
-        << "\"tags\":\"" << escape_json(tags) << "\""
-        << "}";
-    return oss.str();
-}
-
-std::string detect_model_metadata(const char * path) {
-    if (!path || !file_exists(path)) {
-        return "{}";
-    }
-
-    ensure_backend_init();
-
-    {
-        std::lock_guard<std::mutex> guard(g_state.mutex);
-        if (g_state.model && g_state.model_path == path) {
-            return build_model_metadata_json(g_state.model);
+    texts.reserve(offsets.size() - 1);
+    for (size_t i = 1; i < offsets.size(); ++i) {
+        if (offsets[i] < offsets[i - 1] || offsets[i] > capacity) {
+            texts.clear();
+            return false;
         }
+        texts.emplace_back(base + offsets[i - 1], static_cast<size_t>(offsets[i] - offsets[i - 1]));
     }
-
-    llama_model_params mparams = llama_model_default_params();
-    mparams.n_gpu_layers = 0;
-    mparams.use_mmap = true;
-    mparams.use_mlock = false;
-
-    llama_model * mdl = llama_model_load_from_file(path, mparams);
-    if (!mdl) {
-        LOGE("failed to load model metadata for %s", path);
-        return "{}";
-    }
-
-    std::string json = build_model_metadata_json(mdl);
-    llama_model_free(mdl);
-    return json;
+    return true;
 }
 
 } // namespace
@@ -682,16 +289,24 @@ extern "C" JNIEXPORT void JNICALL
 Java_com_peerchat_engine_EngineNative_init(JNIEnv * env, jobject thiz) {
     (void) env;
     (void) thiz;
-    ensure_backend_init();
+    peerchat::engine::init();
 }
 
 extern "C" JNIEXPORT jboolean JNICALL
 Java_com_peerchat_engine_EngineNative_loadModel(JNIEnv * env, jobject thiz,
                                                 jstring jModelPath,
                                                 jint nThreads,
+                                                jint decodeThreads,
+                                                jint batchThreads,
                                                 jint nCtx,
                                                 jint nGpuLayers,
-                                                jboolean useVulkan) {
+                                                jboolean useVulkan,
+                                                jint nSessionSlots,
+                                                jstring jDraftModelPath,
+                                                jint draftMax,
+                                                jint lookupMax,
+                                                jstring jKvPrecision,
+                                                jlong memoryBudgetBytes) {
     (void) thiz;
 
     // Check for JNI exceptions early
@@ -701,129 +316,63 @@ Java_com_peerchat_engine_EngineNative_loadModel(JNIEnv * env, jobject thiz,
         return JNI_FALSE;
     }
 
-    const char * path = env->GetStringUTFChars(jModelPath, nullptr);
+    peerchat::EngineConfig config;
+    config.model_path = jstring_to_utf8(env, jModelPath);
     if (env->ExceptionCheck()) {
         LOGE("loadModel: failed to get model path string");
         env->ExceptionClear();
         return JNI_FALSE;
     }
-
-    const std::string path_str = path ? path : "";
-    if (!file_exists(path)) {
-        LOGE("model path not found: %s", path ? path : "(null)");
-        env->ReleaseStringUTFChars(jModelPath, path);
-        return JNI_FALSE;
-    }
-
-    ensure_backend_init();
-
-    std::lock_guard<std::mutex> lock(g_state.mutex);
-    unload_locked();
-
-    llama_model_params mparams = llama_model_default_params();
-    mparams.n_gpu_layers = useVulkan ? nGpuLayers : 0;
-    mparams.use_mmap = true;
-    mparams.use_mlock = false;
-
-    llama_model * model = llama_model_load_from_file(path, mparams);
-    env->ReleaseStringUTFChars(jModelPath, path);
-    if (!model) {
-        LOGE("failed to load model");
-        return JNI_FALSE;
-    }
-
-    llama_context_params cparams = llama_context_default_params();
-    cparams.n_ctx = std::max(512, nCtx);
-    cparams.n_threads = std::max(1, nThreads);
-    cparams.n_threads_batch = std::max(1, nThreads);
-
-    // Dynamic batch size optimization based on context length, GPU layers, and device capabilities
-    if (useVulkan && nGpuLayers > 0) {
-        // GPU-accelerated inference: optimize batch sizes for GPU utilization
-        // Batch size scales with context length and GPU layers
-        // More GPU layers = can handle larger batches
-        const uint32_t baseBatch = std::min(2048U, static_cast<uint32_t>(cparams.n_ctx / 4));
-        
-        // Scale batch size based on GPU layers (more layers = better GPU utilization)
-        const float gpuLayerScale = std::min(1.5f, 1.0f + (nGpuLayers / 50.0f));
-        const uint32_t scaledBatch = static_cast<uint32_t>(baseBatch * gpuLayerScale);
-        
-        // Context-aware batch sizing: larger contexts benefit from larger batches
-        const float contextScale = cparams.n_ctx >= 8192 ? 1.2f : (cparams.n_ctx >= 4096 ? 1.0f : 0.8f);
-        cparams.n_batch = std::min(4096U, static_cast<uint32_t>(scaledBatch * contextScale));
-        
-        // Unified batch: smaller for memory efficiency, scales with main batch
-        cparams.n_ubatch = std::min(1024U, std::max(256U, cparams.n_batch / 4));
-        
-        // Optimize for GPU memory usage
-        cparams.offload_kqv = true;
-        
-        LOGI("loadModel: GPU batch optimization n_batch=%u ubatch=%u layers=%d ctx=%d scale=%.2f",
-             cparams.n_batch, cparams.n_ubatch, nGpuLayers, cparams.n_ctx, gpuLayerScale);
-    } else {
-        // CPU-only inference: conservative batch sizes
-        // Smaller batches reduce memory pressure on CPU
-        cparams.n_batch = std::min(512U, static_cast<uint32_t>(cparams.n_ctx / 8));
-        cparams.n_ubatch = std::min(128U, cparams.n_batch / 4);
-        
-        LOGI("loadModel: CPU batch optimization n_batch=%u ubatch=%u ctx=%d",
-             cparams.n_batch, cparams.n_ubatch, cparams.n_ctx);
-    }
-
-    LOGI("loadModel: context n_ctx=%d threads=%d batch=%u ubatch=%u offload_kqv=%d use_vulkan=%d",
-         cparams.n_ctx,
-         cparams.n_threads,
-         cparams.n_batch,
-         cparams.n_ubatch,
-         cparams.offload_kqv ? 1 : 0,
-         useVulkan ? 1 : 0);
-
-    llama_context * ctx = nullptr;
-    try {
-        ctx = llama_init_from_model(model, cparams);
-    } catch (const std::exception& e) {
-        LOGE("failed to create llama context: %s", e.what());
-        llama_model_free(model);
-        return JNI_FALSE;
-    } catch (...) {
-        LOGE("failed to create llama context: unknown error");
-        llama_model_free(model);
-        return JNI_FALSE;
-    }
-
-    if (!ctx) {
-        LOGE("failed to create llama context: null context returned");
-        llama_model_free(model);
-        return JNI_FALSE;
+    config.n_threads = nThreads;
+    config.decode_threads = decodeThreads;
+    config.batch_threads = batchThreads;
+    config.n_ctx = nCtx;
+    config.n_gpu_layers = nGpuLayers;
+    config.use_vulkan = useVulkan == JNI_TRUE;
+    config.session_slots = nSessionSlots;
+    if (jDraftModelPath) {
+        config.draft_model_path = jstring_to_utf8(env, jDraftModelPath);
+        if (env->ExceptionCheck()) {
+            env->ExceptionClear();
+            config.draft_model_path.clear();
+        }
     }
+    config.draft_max = draftMax;
+    config.lookup_max = lookupMax;
+    config.kv_precision = peerchat::parse_kv_precision(jstring_to_utf8(env, jKvPrecision));
+    config.memory_budget_bytes = static_cast<int64_t>(memoryBudgetBytes);
+    return peerchat::engine::load(config) ? JNI_TRUE : JNI_FALSE;
+}
 
-    g_state.model = model;
-    g_state.ctx = ctx;
-    g_state.n_ctx = cparams.n_ctx;
-    g_state.n_threads = cparams.n_threads;
-    g_state.n_gpu_layers = useVulkan ? nGpuLayers : 0;
-    g_state.use_vulkan = useVulkan;
-    g_state.model_path = path_str;
-    reset_metrics_locked();
+extern "C" JNIEXPORT void JNICALL
+Java_com_peerchat_engine_EngineNative_unload(JNIEnv * env, jobject thiz) {
+    (void) env;
+    (void) thiz;
+    peerchat::engine::unload();
+}
 
-    llama_set_n_threads(g_state.ctx, g_state.n_threads, g_state.n_threads);
-    if (!ensure_embedding_context_locked()) {
-        LOGE("failed to prepare embedding context");
-        unload_locked();
-        return JNI_FALSE;
-    }
-    LOGI("model loaded n_ctx=%d n_threads=%d gpu_layers=%d batch=%u ubatch=%u",
-         g_state.n_ctx, g_state.n_threads, g_state.n_gpu_layers, cparams.n_batch, cparams.n_ubatch);
-    return JNI_TRUE;
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_peerchat_engine_EngineNative_loadEmbedder(JNIEnv * env, jobject thiz,
+                                                   jstring jModelPath,
+                                                   jint nThreads,
+                                                   jint nCtx,
+                                                   jint nGpuLayers,
+                                                   jstring jPooling) {
+    (void) thiz;
+    peerchat::EmbedderConfig config;
+    config.model_path = jstring_to_utf8(env, jModelPath);
+    config.n_threads = nThreads;
+    config.n_ctx = nCtx;
+    config.n_gpu_layers = nGpuLayers;
+    config.pooling = jstring_to_utf8(env, jPooling);
+    return peerchat::engine::load_embedder(config) ? JNI_TRUE : JNI_FALSE;
 }
 
 extern "C" JNIEXPORT void JNICALL
-Java_com_peerchat_engine_EngineNative_unload(JNIEnv * env, jobject thiz) {
+Java_com_peerchat_engine_EngineNative_unloadEmbedder(JNIEnv * env, jobject thiz) {
     (void) env;
     (void) thiz;
-    std::lock_guard<std::mutex> lock(g_state.mutex);
-    unload_locked();
-    LOGI("engine unloaded");
+    peerchat::engine::unload_embedder();
 }
 
 extern "C" JNIEXPORT jstring JNICALL
@@ -835,13 +384,15 @@ Java_com_peerchat_engine_EngineNative_generate(JNIEnv * env, jobject thiz,
                                                jfloat topP,
                                                jint topK,
                                                jint maxTokens,
-                                               jobjectArray jStop) {
+                                               jobjectArray jStop,
+                                               jint keepPrefix) {
     (void) thiz;
     (void) jTemplate;
 
     GenerationRequest req;
     req.prompt = jstring_to_utf8(env, jPrompt);
     req.system_prompt = jstring_to_utf8(env, jSystem);
+    req.keep_bytes = utf8_prefix_bytes(env, jPrompt, keepPrefix);
     req.temperature = temperature;
     req.top_p = topP;
     req.top_k = topK;
@@ -856,11 +407,46 @@ Java_com_peerchat_engine_EngineNative_generate(JNIEnv * env, jobject thiz,
 
     std::string output;
     GenerationSummary summary;
-    bool ok = generate_internal(req, nullptr, &output, summary);
+    bool ok = peerchat::engine::generate(req, nullptr, &output, summary);
     if (!ok) {
         return env->NewStringUTF("");
     }
-    return env->NewStringUTF(output.c_str());
+    return utf8_to_jstring(env, output);
+}
+
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_peerchat_engine_EngineNative_generateAuxiliary(JNIEnv * env, jobject thiz,
+                                                        jstring jPrompt,
+                                                        jstring jSystem,
+                                                        jfloat temperature,
+                                                        jfloat topP,
+                                                        jint topK,
+                                                        jint maxTokens,
+                                                        jobjectArray jStop) {
+    (void) thiz;
+
+    GenerationRequest req;
+    req.prompt = jstring_to_utf8(env, jPrompt);
+    req.system_prompt = jstring_to_utf8(env, jSystem);
+    req.temperature = temperature;
+    req.top_p = topP;
+    req.top_k = topK;
+    req.max_tokens = std::max(1, maxTokens);
+    req.auxiliary = true;
+
+    jsize stop_len = jStop ? env->GetArrayLength(jStop) : 0;
+    for (jsize i = 0; i < stop_len; ++i) {
+        jstring js = static_cast<jstring>(env->GetObjectArrayElement(jStop, i));
+        req.stops.push_back(jstring_to_utf8(env, js));
+        env->DeleteLocalRef(js);
+    }
+
+    std::string output;
+    GenerationSummary summary;
+    if (!peerchat::engine::generate(req, nullptr, &output, summary)) {
+        return env->NewStringUTF("");
+    }
+    return utf8_to_jstring(env, output);
 }
 
 extern "C" JNIEXPORT void JNICALL
@@ -873,6 +459,7 @@ Java_com_peerchat_engine_EngineNative_generateStream(JNIEnv * env, jobject thiz,
                                                      jint topK,
                                                      jint maxTokens,
                                                      jobjectArray jStop,
+                                                     jint keepPrefix,
                                                      jobject jCallback) {
     (void) thiz;
     (void) jTemplate;
@@ -886,18 +473,16 @@ Java_com_peerchat_engine_EngineNative_generateStream(JNIEnv * env, jobject thiz,
         return;
     }
 
-    StreamContext stream{};
+    std::unique_ptr<CallbackSink> sink;
     if (jCallback) {
-        stream.env = env;
-        stream.callback = jCallback;
         jclass cbCls = env->GetObjectClass(jCallback);
         if (!cbCls) {
             LOGE("generateStream: failed to get callback class");
             return;
         }
-        stream.on_token = env->GetMethodID(cbCls, "onToken", "(Ljava/lang/String;Z)V");
+        jmethodID on_token = env->GetMethodID(cbCls, "onToken", "(Ljava/lang/String;Z)V");
         env->DeleteLocalRef(cbCls);
-        if (!stream.on_token) {
+        if (!on_token) {
             LOGE("TokenCallback.onToken not found");
             return;
         }
@@ -908,169 +493,127 @@ Java_com_peerchat_engine_EngineNative_generateStream(JNIEnv * env, jobject thiz,
             env->ExceptionClear();
             return;
         }
+        sink = std::make_unique<CallbackSink>(env, jCallback, on_token);
     }
 
     GenerationRequest req;
-    req.prompt = jstring_to_utf8(env, jPrompt);
-    req.system_prompt = jstring_to_utf8(env, jSystem);
-    req.temperature = temperature;
-    req.top_p = topP;
-    req.top_k = topK;
-    req.max_tokens = std::max(1, maxTokens);
-
-    // Check for exceptions after string conversion
-    if (env->ExceptionCheck()) {
-        LOGE("generateStream: exception during string conversion");
-        env->ExceptionClear();
+    if (!read_stream_request(env, jPrompt, jSystem, temperature, topP, topK, maxTokens, jStop, keepPrefix, req)) {
         return;
     }
+    peerchat::engine::generate_stream(req, sink.get());
+}
 
-    jsize stop_len = jStop ? env->GetArrayLength(jStop) : 0;
-    for (jsize i = 0; i < stop_len; ++i) {
-        jstring js = static_cast<jstring>(env->GetObjectArrayElement(jStop, i));
-        if (js) {
-            req.stops.push_back(jstring_to_utf8(env, js));
-            env->DeleteLocalRef(js);
-        }
+extern "C" JNIEXPORT void JNICALL
+Java_com_peerchat_engine_EngineNative_generateStreamRing(JNIEnv * env, jobject thiz,
+                                                         jstring jPrompt,
+                                                         jstring jSystem,
+                                                         jstring jTemplate,
+                                                         jfloat temperature,
+                                                         jfloat topP,
+                                                         jint topK,
+                                                         jint maxTokens,
+                                                         jobjectArray jStop,
+                                                         jint keepPrefix,
+                                                         jlong ringHandle) {
+    (void) thiz;
+    (void) jTemplate;
 
-        // Check for exceptions in loop
-        if (env->ExceptionCheck()) {
-            LOGE("generateStream: exception during stop sequence processing");
-            env->ExceptionClear();
-            return;
-        }
+    auto * ring = reinterpret_cast<peerchat::TokenRing *>(ringHandle);
+    if (!ring) {
+        LOGE("generateStreamRing: null ring");
+        return;
     }
+    ring->reset();
+    LOGI("generateStreamRing: entry temp=%.2f topP=%.2f topK=%d maxTokens=%d", temperature, topP, topK, maxTokens);
 
-    GenerationSummary summary;
-    try {
-        generate_internal(req, jCallback ? &stream : nullptr, nullptr, summary);
-    } catch (const std::exception& e) {
-        LOGE("generateStream: internal error: %s", e.what());
-        summary.success = false;
-        summary.reason = StopReason::Error;
-    } catch (...) {
-        LOGE("generateStream: unknown internal error");
-        summary.success = false;
-        summary.reason = StopReason::Error;
+    if (env->ExceptionCheck()) {
+        LOGE("generateStreamRing: JNI exception pending at entry, clearing");
+        env->ExceptionClear();
+        ring->close();
+        return;
     }
 
-    LOGI("generateStream: exit success=%d reason=%d tokens=%d", summary.success ? 1 : 0, static_cast<int>(summary.reason), summary.metrics.generation_tokens);
+    GenerationRequest req;
+    if (!read_stream_request(env, jPrompt, jSystem, temperature, topP, topK, maxTokens, jStop, keepPrefix, req)) {
+        ring->close();
+        return;
+    }
+    peerchat::RingSink sink(ring);
+    peerchat::engine::generate_stream(req, &sink);
 }
 
-extern "C" JNIEXPORT jobjectArray JNICALL
-Java_com_peerchat_engine_EngineNative_embed(JNIEnv * env, jobject thiz, jobjectArray jTexts) {
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_peerchat_engine_EngineNative_tokenRingCreate(JNIEnv * env, jobject thiz, jint capacity) {
+    (void) env;
     (void) thiz;
-    std::lock_guard<std::mutex> lock(g_state.mutex);
+    const uint32_t bytes = capacity > 0 ? static_cast<uint32_t>(capacity) : peerchat::kTokenRingDefaultCapacity;
+    peerchat::TokenRing * ring = peerchat::TokenRing::create(bytes);
+    if (!ring) {
+        LOGE("tokenRingCreate: allocation failed capacity=%u", bytes);
+    }
+    return reinterpret_cast<jlong>(ring);
+}
 
-    // Check for JNI exceptions early
-    if (env->ExceptionCheck()) {
-        LOGE("embed: JNI exception pending at entry, clearing");
-        env->ExceptionClear();
+extern "C" JNIEXPORT jobject JNICALL
+Java_com_peerchat_engine_EngineNative_tokenRingBuffer(JNIEnv * env, jobject thiz, jlong ringHandle) {
+    (void) thiz;
+    auto * ring = reinterpret_cast<peerchat::TokenRing *>(ringHandle);
+    if (!ring) {
         return nullptr;
     }
+    return env->NewDirectByteBuffer(ring->region(), static_cast<jlong>(ring->region_size()));
+}
 
-    jclass floatArrayClass = env->FindClass("[F");
-    if (env->ExceptionCheck()) {
-        LOGE("embed: failed to find float[] class");
-        env->ExceptionClear();
-        return nullptr;
-    }
-
-    if (!g_state.model || !floatArrayClass) {
-        LOGE("embed: no model loaded or cannot resolve float[] class");
-        // Fallback to empty object array if we cannot resolve float[] class
-        jclass objClass = env->FindClass("java/lang/Object");
-        if (objClass && !env->ExceptionCheck()) {
-            return static_cast<jobjectArray>(env->NewObjectArray(0, objClass, nullptr));
-        } else {
-            env->ExceptionClear();
-            return nullptr;
-        }
+extern "C" JNIEXPORT jint JNICALL
+Java_com_peerchat_engine_EngineNative_tokenRingAwait(JNIEnv * env, jobject thiz, jlong ringHandle,
+                                                     jint consumed, jint timeoutMs) {
+    (void) env;
+    (void) thiz;
+    auto * ring = reinterpret_cast<peerchat::TokenRing *>(ringHandle);
+    if (!ring) {
+        return -1;
     }
+    const int64_t available = ring->await(static_cast<uint32_t>(std::max(0, consumed)), timeoutMs);
+    return static_cast<jint>(available);
+}
 
-    if (!ensure_embedding_context_locked()) {
-        LOGE("embed: failed to ensure embedding context");
-        return static_cast<jobjectArray>(env->NewObjectArray(0, floatArrayClass, nullptr));
-    }
+extern "C" JNIEXPORT void JNICALL
+Java_com_peerchat_engine_EngineNative_tokenRingDestroy(JNIEnv * env, jobject thiz, jlong ringHandle) {
+    (void) env;
+    (void) thiz;
+    delete reinterpret_cast<peerchat::TokenRing *>(ringHandle);
+}
 
-    llama_context * ectx = g_state.embed_ctx;
-    const llama_vocab * vocab = llama_model_get_vocab(g_state.model);
-    const bool has_encoder = llama_model_has_encoder(g_state.model);
-    const bool has_decoder = llama_model_has_decoder(g_state.model);
-    const auto pooling_type = llama_pooling_type(ectx);
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_com_peerchat_engine_EngineNative_embed(JNIEnv * env, jobject thiz, jobjectArray jTexts) {
+    (void) thiz;
 
-    if (has_encoder && has_decoder) {
-        LOGE("hybrid encoder/decoder models are not supported for embeddings");
-        return static_cast<jobjectArray>(env->NewObjectArray(0, floatArrayClass, nullptr));
+    // Check for JNI exceptions early
+    if (env->ExceptionCheck()) {
+        LOGE("embed: JNI exception pending at entry, clearing");
+        env->ExceptionClear();
+        return nullptr;
     }
 
-    jsize count = jTexts ? env->GetArrayLength(jTexts) : 0;
-
-    std::vector<std::vector<float>> embeddings;
-    embeddings.reserve(count);
-
-    // Non-destructive clear to avoid aggressive deallocation under Scudo
-    llama_memory_clear(llama_get_memory(ectx), false);
-    llama_set_embeddings(ectx, true);
+    jclass floatArrayClass = env->FindClass("[F");
+    if (env->ExceptionCheck() || !floatArrayClass) {
+        LOGE("embed: failed to find float[] class");
+        env->ExceptionClear();
+        return nullptr;
+    }
 
+    const jsize count = jTexts ? env->GetArrayLength(jTexts) : 0;
+    std::vector<std::string> texts(count);
     for (jsize i = 0; i < count; ++i) {
         jstring jt = static_cast<jstring>(env->GetObjectArrayElement(jTexts, i));
-        std::string text = jstring_to_utf8(env, jt);
+        texts[i] = jstring_to_utf8(env, jt);
         env->DeleteLocalRef(jt);
-
-        std::vector<llama_token> tokens;
-        if (!prepare_prompt_tokens(vocab, text, tokens)) {
-            embeddings.emplace_back();
-            continue;
-        }
-        if (tokens.empty()) {
-            embeddings.emplace_back();
-            continue;
-        }
-
-        llama_batch batch = llama_batch_get_one(tokens.data(), static_cast<int32_t>(tokens.size()));
-
-        int rc = 0;
-        if (has_encoder && !has_decoder) {
-            rc = llama_encode(ectx, batch);
-        } else {
-            rc = llama_decode(ectx, batch);
-        }
-        if (rc != 0) {
-            LOGE("llama_encode failed for embeddings");
-            embeddings.emplace_back();
-            continue;
-        }
-
-        const float * emb = nullptr;
-        switch (pooling_type) {
-            case LLAMA_POOLING_TYPE_NONE: {
-                const int32_t last_index = std::max(0, static_cast<int32_t>(tokens.size()) - 1);
-                emb = llama_get_embeddings_ith(ectx, last_index);
-                if (!emb) {
-                    emb = llama_get_embeddings(ectx);
-                }
-                break;
-            }
-            default: {
-                emb = llama_get_embeddings_seq(ectx, 0);
-                if (!emb) {
-                    emb = llama_get_embeddings(ectx);
-                }
-                break;
-            }
-        }
-        const int dim = llama_model_n_embd(g_state.model);
-        std::vector<float> vec;
-        if (emb && dim > 0) {
-            vec.assign(emb, emb + dim);
-        }
-        embeddings.push_back(std::move(vec));
     }
 
-    // Non-destructive clear to keep allocator state stable between calls
-    llama_memory_clear(llama_get_memory(ectx), false);
-    llama_set_embeddings(ectx, false);
+    std::vector<std::vector<float>> embeddings;
+    if (!peerchat::engine::embed(texts, embeddings)) {
+        return static_cast<jobjectArray>(env->NewObjectArray(0, floatArrayClass, nullptr));
+    }
 
     jobjectArray outer = env->NewObjectArray(count, floatArrayClass, nullptr);
     for (jsize i = 0; i < count; ++i) {
@@ -1089,95 +632,267 @@ Java_com_peerchat_engine_EngineNative_embed(JNIEnv * env, jobject thiz, jobjectA
 extern "C" JNIEXPORT jint JNICALL
 Java_com_peerchat_engine_EngineNative_countTokens(JNIEnv * env, jobject thiz, jstring jText) {
     (void) thiz;
-    std::lock_guard<std::mutex> lock(g_state.mutex);
-    if (!g_state.model) {
-        return 0;
+    return static_cast<jint>(peerchat::engine::count_tokens(jstring_to_utf8(env, jText)));
+}
+
+extern "C" JNIEXPORT jintArray JNICALL
+Java_com_peerchat_engine_EngineNative_chunkText(JNIEnv * env, jobject thiz, jstring jText,
+                                                jint maxTokens, jint overlapTokens) {
+    (void) thiz;
+    std::vector<jint> unit_of_byte;
+    const std::string text = jstring_to_utf8_indexed(env, jText, unit_of_byte);
+    peerchat::ChunkOptions options;
+    options.max_tokens = std::max(1, maxTokens);
+    options.overlap_tokens = std::max(0, overlapTokens);
+    std::vector<peerchat::ChunkSpan> chunks;
+    if (!peerchat::engine::chunk_text(text, options, chunks)) {
+        return nullptr;
+    }
+    // [start, end, tokens] per chunk, as UTF-16 indices into the Java string.
+    std::vector<jint> flat;
+    flat.reserve(chunks.size() * 3);
+    for (const auto & chunk : chunks) {
+        flat.push_back(unit_of_byte[chunk.start]);
+        flat.push_back(unit_of_byte[chunk.end]);
+        flat.push_back(chunk.tokens);
+    }
+    jintArray result = env->NewIntArray(static_cast<jsize>(flat.size()));
+    if (!result) {
+        return nullptr;
+    }
+    env->SetIntArrayRegion(result, 0, static_cast<jsize>(flat.size()), flat.data());
+    return result;
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_peerchat_engine_EngineNative_tokenizeBatch(JNIEnv * env, jobject thiz, jobject jInput, jintArray jOffsets,
+                                                    jboolean addSpecial, jobject jTokens, jintArray jTokenOffsets) {
+    (void) thiz;
+    std::vector<std::string_view> texts;
+    if (!texts_from_direct_buffer(env, jInput, jOffsets, texts) || !jTokenOffsets ||
+        env->GetArrayLength(jTokenOffsets) != static_cast<jsize>(texts.size() + 1)) {
+        return -1;
+    }
+    std::vector<int32_t> tokens;
+    std::vector<uint32_t> offsets;
+    if (!peerchat::engine::tokenize_batch(texts, addSpecial == JNI_TRUE, tokens, offsets)) {
+        return -1;
+    }
+    env->SetIntArrayRegion(jTokenOffsets, 0, static_cast<jsize>(offsets.size()),
+                           reinterpret_cast<const jint *>(offsets.data()));
+    // Tokens only when they all fit; the count tells the caller how much to allocate.
+    void * addr = jTokens ? env->GetDirectBufferAddress(jTokens) : nullptr;
+    const jlong capacity = jTokens ? env->GetDirectBufferCapacity(jTokens) : 0;
+    if (addr && capacity >= 0 && tokens.size() * sizeof(int32_t) <= static_cast<size_t>(capacity)) {
+        std::memcpy(addr, tokens.data(), tokens.size() * sizeof(int32_t));
+    }
+    return clamp_jint(tokens.size());
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_peerchat_engine_EngineNative_countTokensBatch(JNIEnv * env, jobject thiz, jobject jInput,
+                                                       jintArray jOffsets, jintArray jCounts) {
+    (void) thiz;
+    std::vector<std::string_view> texts;
+    if (!texts_from_direct_buffer(env, jInput, jOffsets, texts) || !jCounts ||
+        env->GetArrayLength(jCounts) != static_cast<jsize>(texts.size())) {
+        return JNI_FALSE;
+    }
+    std::vector<int32_t> counts;
+    if (!peerchat::engine::count_tokens_batch(texts, counts)) {
+        return JNI_FALSE;
     }
-    const char * text = env->GetStringUTFChars(jText, nullptr);
-    const llama_vocab * vocab = llama_model_get_vocab(g_state.model);
-    std::vector<llama_token> tokens;
-    bool ok = prepare_prompt_tokens(vocab, text, tokens);
-    env->ReleaseStringUTFChars(jText, text);
-    return ok ? static_cast<jint>(tokens.size()) : 0;
+    env->SetIntArrayRegion(jCounts, 0, static_cast<jsize>(counts.size()), reinterpret_cast<const jint *>(counts.data()));
+    return JNI_TRUE;
 }
 
 extern "C" JNIEXPORT jstring JNICALL
 Java_com_peerchat_engine_EngineNative_metrics(JNIEnv * env, jobject thiz) {
     (void) thiz;
-    std::lock_guard<std::mutex> lock(g_state.mutex);
-    std::string json = build_metrics_json_locked();
+    const std::string json = peerchat::engine::metrics_json();
     return env->NewStringUTF(json.c_str());
 }
 
 extern "C" JNIEXPORT jstring JNICALL
 Java_com_peerchat_engine_EngineNative_detectModel(JNIEnv * env, jobject thiz, jstring jModelPath) {
     (void) thiz;
-    const char * path = env->GetStringUTFChars(jModelPath, nullptr);
-    std::string json = detect_model_metadata(path);
-    env->ReleaseStringUTFChars(jModelPath, path);
+    const std::string json = peerchat::engine::detect_model(jstring_to_utf8(env, jModelPath));
     return env->NewStringUTF(json.c_str());
 }
 
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_peerchat_engine_EngineNative_calibrateThreads(JNIEnv * env, jobject thiz) {
+    (void) thiz;
+    peerchat::ThreadCalibration calibration;
+    if (!peerchat::engine::calibrate_threads(calibration)) {
+        return env->NewStringUTF("{}");
+    }
+    return env->NewStringUTF(peerchat::thread_calibration_json(calibration).c_str());
+}
+
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_peerchat_engine_EngineNative_planMemory(JNIEnv * env, jobject thiz, jstring jModelPath,
+                                                 jint nCtx, jint nBatch, jint nUbatch,
+                                                 jstring jTypeK, jstring jTypeV, jboolean flashAttn,
+                                                 jint nGpuLayers, jint nSeq, jlong gpuBudgetBytes) {
+    (void) thiz;
+    peerchat::MemoryPlanRequest req;
+    req.model_path = jstring_to_utf8(env, jModelPath);
+    req.n_ctx = nCtx;
+    req.n_batch = nBatch;
+    req.n_ubatch = nUbatch;
+    req.type_k = peerchat::parse_kv_precision(jstring_to_utf8(env, jTypeK));
+    req.type_v = peerchat::parse_kv_precision(jstring_to_utf8(env, jTypeV));
+    req.flash_attn = flashAttn == JNI_TRUE;
+    req.n_gpu_layers = nGpuLayers;
+    req.n_seq = nSeq;
+    req.gpu_budget_bytes = gpuBudgetBytes;
+    peerchat::MemoryPlan plan;
+    if (!peerchat::plan_memory(req, plan)) {
+        return env->NewStringUTF("{}");
+    }
+    return env->NewStringUTF(peerchat::memory_plan_json(plan).c_str());
+}
+
 extern "C" JNIEXPORT jbyteArray JNICALL
 Java_com_peerchat_engine_EngineNative_stateCapture(JNIEnv * env, jobject thiz) {
     (void) thiz;
-    std::lock_guard<std::mutex> lock(g_state.mutex);
-    if (!g_state.ctx) {
-        return env->NewByteArray(0);
-    }
-    const size_t size = llama_state_get_size(g_state.ctx);
-    if (size == 0) {
-        return env->NewByteArray(0);
-    }
-    std::vector<uint8_t> buffer(size);
-    const size_t written = llama_state_get_data(g_state.ctx, buffer.data(), buffer.size());
-    if (written == 0) {
-        return env->NewByteArray(0);
+    return to_byte_array(env, peerchat::engine::state_capture());
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_peerchat_engine_EngineNative_stateRestore(JNIEnv * env, jobject thiz, jbyteArray jState) {
+    (void) thiz;
+    const std::vector<uint8_t> state = from_byte_array(env, jState);
+    return peerchat::engine::state_restore(state.data(), state.size()) ? JNI_TRUE : JNI_FALSE;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_peerchat_engine_EngineNative_stateClear(JNIEnv * env, jobject thiz, jboolean clearData) {
+    (void) env;
+    (void) thiz;
+    peerchat::engine::state_clear(clearData == JNI_TRUE);
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_peerchat_engine_EngineNative_sessionSelect(JNIEnv * env, jobject thiz, jlong chatId) {
+    (void) env;
+    (void) thiz;
+    return peerchat::engine::session_select(static_cast<int64_t>(chatId)) ? JNI_TRUE : JNI_FALSE;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_peerchat_engine_EngineNative_sessionRelease(JNIEnv * env, jobject thiz, jlong chatId) {
+    (void) env;
+    (void) thiz;
+    peerchat::engine::session_release(static_cast<int64_t>(chatId));
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_peerchat_engine_EngineNative_sessionSpillDir(JNIEnv * env, jobject thiz, jstring jPath) {
+    (void) thiz;
+    peerchat::engine::session_spill_dir(jstring_to_utf8(env, jPath));
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_peerchat_engine_EngineNative_sessionStateSize(JNIEnv * env, jobject thiz, jlong chatId, jboolean partialOnly) {
+    (void) env;
+    (void) thiz;
+    return clamp_jint(peerchat::engine::session_state_size(static_cast<int64_t>(chatId), partialOnly == JNI_TRUE));
+}
+
+extern "C" JNIEXPORT jbyteArray JNICALL
+Java_com_peerchat_engine_EngineNative_sessionStateCapture(JNIEnv * env, jobject thiz, jlong chatId, jboolean partialOnly) {
+    (void) thiz;
+    return to_byte_array(env, peerchat::engine::session_state_capture(static_cast<int64_t>(chatId),
+                                                                       partialOnly == JNI_TRUE));
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_peerchat_engine_EngineNative_sessionStateCaptureInto(JNIEnv * env, jobject thiz, jlong chatId,
+                                                               jobject jBuffer, jboolean partialOnly) {
+    (void) thiz;
+    if (!jBuffer) {
+        return 0;
     }
-    jbyteArray result = env->NewByteArray(static_cast<jsize>(written));
-    if (!result) {
-        return nullptr;
+    void * addr = env->GetDirectBufferAddress(jBuffer);
+    const jlong capacity = env->GetDirectBufferCapacity(jBuffer);
+    if (!addr || capacity <= 0) {
+        return 0;
     }
-    env->SetByteArrayRegion(result, 0, static_cast<jsize>(written),
-            reinterpret_cast<const jbyte *>(buffer.data()));
-    return result;
+    return clamp_jint(peerchat::engine::session_state_capture_into(static_cast<int64_t>(chatId), partialOnly == JNI_TRUE,
+                                                                   static_cast<uint8_t *>(addr),
+                                                                   static_cast<size_t>(capacity)));
 }
 
 extern "C" JNIEXPORT jboolean JNICALL
-Java_com_peerchat_engine_EngineNative_stateRestore(JNIEnv * env, jobject thiz, jbyteArray jState) {
+Java_com_peerchat_engine_EngineNative_sessionStateRestore(JNIEnv * env, jobject thiz, jlong chatId,
+                                                           jbyteArray jState, jboolean partialOnly) {
     (void) thiz;
-    if (!jState) {
+    const std::vector<uint8_t> state = from_byte_array(env, jState);
+    if (state.empty()) {
         return JNI_FALSE;
     }
-    std::lock_guard<std::mutex> lock(g_state.mutex);
-    if (!g_state.ctx) {
+    const bool ok = peerchat::engine::session_state_restore(static_cast<int64_t>(chatId), partialOnly == JNI_TRUE,
+                                                            state.data(), state.size());
+    return ok ? JNI_TRUE : JNI_FALSE;
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_peerchat_engine_EngineNative_sessionStateRestoreFrom(JNIEnv * env, jobject thiz, jlong chatId,
+                                                               jobject jBuffer, jint length, jboolean partialOnly) {
+    (void) thiz;
+    if (!jBuffer || length <= 0) {
         return JNI_FALSE;
     }
-    const jsize len = env->GetArrayLength(jState);
-    if (len <= 0) {
+    void * addr = env->GetDirectBufferAddress(jBuffer);
+    // The length comes from Kotlin; never read past the buffer.
+    if (!addr || static_cast<jlong>(length) > env->GetDirectBufferCapacity(jBuffer)) {
         return JNI_FALSE;
     }
-    std::vector<uint8_t> buffer(static_cast<size_t>(len));
-    env->GetByteArrayRegion(jState, 0, len, reinterpret_cast<jbyte *>(buffer.data()));
-    llama_memory_clear(llama_get_memory(g_state.ctx), false);
-    const size_t read = llama_state_set_data(g_state.ctx, buffer.data(), buffer.size());
-    const bool ok = read > 0;
-    if (ok) {
-        reset_metrics_locked();
-    }
+    const bool ok = peerchat::engine::session_state_restore(static_cast<int64_t>(chatId), partialOnly == JNI_TRUE,
+                                                            static_cast<const uint8_t *>(addr),
+                                                            static_cast<size_t>(length));
     return ok ? JNI_TRUE : JNI_FALSE;
 }
 
-extern "C" JNIEXPORT void JNICALL
-Java_com_peerchat_engine_EngineNative_stateClear(JNIEnv * env, jobject thiz, jboolean clearData) {
-    (void) env;
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_peerchat_engine_EngineNative_stateSaveCompressed(JNIEnv * env, jobject thiz, jstring jPath) {
     (void) thiz;
-    std::lock_guard<std::mutex> lock(g_state.mutex);
-    if (!g_state.ctx) {
-        return;
+    return static_cast<jlong>(peerchat::engine::state_save_compressed(jstring_to_utf8(env, jPath)));
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_peerchat_engine_EngineNative_stateLoadCompressed(JNIEnv * env, jobject thiz, jstring jPath) {
+    (void) thiz;
+    return peerchat::engine::state_load_compressed(jstring_to_utf8(env, jPath)) ? JNI_TRUE : JNI_FALSE;
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_peerchat_engine_EngineNative_sessionStateSaveCompressed(JNIEnv * env, jobject thiz, jlong chatId, jstring jPath) {
+    (void) thiz;
+    return static_cast<jlong>(
+        peerchat::engine::session_state_save_compressed(static_cast<int64_t>(chatId), jstring_to_utf8(env, jPath)));
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_peerchat_engine_EngineNative_sessionStateLoadCompressed(JNIEnv * env, jobject thiz, jlong chatId, jstring jPath) {
+    (void) thiz;
+    const bool ok = peerchat::engine::session_state_load_compressed(static_cast<int64_t>(chatId),
+                                                                    jstring_to_utf8(env, jPath));
+    return ok ? JNI_TRUE : JNI_FALSE;
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_peerchat_engine_EngineNative_prefillProgress(JNIEnv * env, jobject thiz, jlongArray jOut) {
+    (void) thiz;
+    const peerchat::PrefillProgress progress = peerchat::engine::prefill_progress();
+    if (progress.total <= 0 || !jOut || env->GetArrayLength(jOut) < 3) {
+        return JNI_FALSE;
     }
-    llama_memory_clear(llama_get_memory(g_state.ctx), clearData == JNI_TRUE);
-    reset_metrics_locked();
+    const jlong values[3] = {progress.done, progress.total, static_cast<jlong>(progress.eta_ms)};
+    env->SetLongArrayRegion(jOut, 0, 3, values);
+    return JNI_TRUE;
 }
 
 extern "C" JNIEXPORT void JNICALL
@@ -1185,23 +900,14 @@ Java_com_peerchat_engine_EngineNative_abort(JNIEnv * env, jobject thiz) {
     (void) env;
     (void) thiz;
     // Thread-safe abort flag set
-    g_state.should_abort.store(true, std::memory_order_release);
-    LOGI("abort requested");
+    peerchat::engine::request_abort();
 }
 
 extern "C" JNIEXPORT jint JNICALL
 Java_com_peerchat_engine_EngineNative_stateSize(JNIEnv * env, jobject thiz) {
     (void) env;
     (void) thiz;
-    std::lock_guard<std::mutex> lock(g_state.mutex);
-    if (!g_state.ctx) {
-        return 0;
-    }
-    const size_t size = llama_state_get_size(g_state.ctx);
-    if (size == 0) {
-        return 0;
-    }
-    return static_cast<jint>(size > 0x7fffffffULL ? 0x7fffffff : size);
+    return clamp_jint(peerchat::engine::state_size());
 }
 
 extern "C" JNIEXPORT jint JNICALL
@@ -1215,17 +921,7 @@ Java_com_peerchat_engine_EngineNative_stateCaptureInto(JNIEnv * env, jobject thi
     if (!addr || capacity <= 0) {
         return 0;
     }
-    std::lock_guard<std::mutex> lock(g_state.mutex);
-    if (!g_state.ctx) {
-        return 0;
-    }
-    const size_t total = llama_state_get_size(g_state.ctx);
-    if (total == 0) {
-        return 0;
-    }
-    const size_t to_write = static_cast<size_t>(capacity < static_cast<jlong>(total) ? capacity : static_cast<jlong>(total));
-    const size_t written = llama_state_get_data(g_state.ctx, static_cast<uint8_t*>(addr), to_write);
-    return static_cast<jint>(written > 0x7fffffffULL ? 0x7fffffff : written);
+    return clamp_jint(peerchat::engine::state_capture_into(static_cast<uint8_t *>(addr), static_cast<size_t>(capacity)));
 }
 
 extern "C" JNIEXPORT jboolean JNICALL
@@ -1235,67 +931,582 @@ Java_com_peerchat_engine_EngineNative_stateRestoreFrom(JNIEnv * env, jobject thi
         return JNI_FALSE;
     }
     void * addr = env->GetDirectBufferAddress(jBuffer);
-    if (!addr) {
+    // The length comes from Kotlin; never read past the buffer.
+    if (!addr || static_cast<jlong>(length) > env->GetDirectBufferCapacity(jBuffer)) {
         return JNI_FALSE;
     }
-    std::lock_guard<std::mutex> lock(g_state.mutex);
-    if (!g_state.ctx) {
-        return JNI_FALSE;
-    }
-    llama_memory_clear(llama_get_memory(g_state.ctx), false);
-    const size_t read = llama_state_set_data(g_state.ctx, static_cast<const uint8_t*>(addr), static_cast<size_t>(length));
-    const bool ok = read > 0;
-    if (ok) {
-        reset_metrics_locked();
-    }
+    const bool ok = peerchat::engine::state_restore(static_cast<const uint8_t *>(addr), static_cast<size_t>(length));
     return ok ? JNI_TRUE : JNI_FALSE;
 }
 
 extern "C" JNIEXPORT void JNICALL
 Java_com_peerchat_engine_EngineNative_recover(JNIEnv * env, jobject thiz) {
-    (void) env;
     (void) thiz;
 
-    LOGI("recover: attempting to recover engine state");
-
     // Check for JNI exceptions early
     if (env->ExceptionCheck()) {
         LOGE("recover: JNI exception pending at entry, clearing");
         env->ExceptionClear();
         return;
     }
+    peerchat::engine::recover();
+}
+
+namespace {
+
+// Native RAG structures behind a jlong handle. Searches share the lock;
+// inserts, deletes and saves take it exclusively.
+template <typename T>
+struct SharedHandle {
+    std::unique_ptr<T> index;
+    std::shared_mutex lock;
+};
+
+using VectorIndexHandle = SharedHandle<peerchat::HnswIndex>;
+using VectorStoreHandle = SharedHandle<peerchat::QuantizedStore>;
+using LexicalIndexHandle = SharedHandle<peerchat::Bm25Index>;
+
+VectorIndexHandle * vector_index_from(jlong handle) {
+    return reinterpret_cast<VectorIndexHandle *>(handle);
+}
+
+VectorStoreHandle * vector_store_from(jlong handle) {
+    return reinterpret_cast<VectorStoreHandle *>(handle);
+}
+
+LexicalIndexHandle * lexical_index_from(jlong handle) {
+    return reinterpret_cast<LexicalIndexHandle *>(handle);
+}
+
+// Copies `count` row-major vectors of `dim` floats out of Java; false on a size mismatch.
+bool read_vectors(JNIEnv * env, jlongArray jIds, jfloatArray jVectors, size_t dim,
+                  std::vector<jlong> & ids, std::vector<float> & vectors) {
+    const jsize count = env->GetArrayLength(jIds);
+    if (static_cast<size_t>(env->GetArrayLength(jVectors)) != static_cast<size_t>(count) * dim) {
+        LOGE("vector rows: expected %zu floats for %d rows", static_cast<size_t>(count) * dim, count);
+        return false;
+    }
+    ids.resize(count);
+    vectors.resize(static_cast<size_t>(count) * dim);
+    env->GetLongArrayRegion(jIds, 0, count, ids.data());
+    env->GetFloatArrayRegion(jVectors, 0, static_cast<jsize>(vectors.size()), vectors.data());
+    return true;
+}
+
+} // namespace
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_peerchat_engine_EngineNative_vectorIndexCreate(JNIEnv * env, jobject thiz, jint dim, jint m,
+                                                        jint efConstruction, jboolean halfPrecision) {
+    (void) env;
+    (void) thiz;
+    if (dim <= 0) {
+        LOGE("vectorIndexCreate: invalid dim=%d", dim);
+        return 0;
+    }
+    peerchat::HnswIndex::Params params;
+    params.dim = static_cast<uint32_t>(dim);
+    params.m = static_cast<uint32_t>(std::clamp(m, 2, 64));
+    params.ef_construction = static_cast<uint32_t>(std::max(efConstruction, 16));
+    params.type = halfPrecision ? peerchat::VectorType::F16 : peerchat::VectorType::F32;
+    auto * handle = new VectorIndexHandle();
+    handle->index = std::make_unique<peerchat::HnswIndex>(params);
+    return reinterpret_cast<jlong>(handle);
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_peerchat_engine_EngineNative_vectorIndexOpen(JNIEnv * env, jobject thiz, jstring jPath) {
+    (void) thiz;
+    const std::string path = jstring_to_utf8(env, jPath);
+    std::unique_ptr<peerchat::HnswIndex> index = peerchat::HnswIndex::open(path);
+    if (!index) {
+        LOGE("vectorIndexOpen: cannot map %s", path.c_str());
+        return 0;
+    }
+    LOGI("vectorIndexOpen: mapped %zu vectors dim=%u", index->size(), index->dim());
+    auto * handle = new VectorIndexHandle();
+    handle->index = std::move(index);
+    return reinterpret_cast<jlong>(handle);
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_peerchat_engine_EngineNative_vectorIndexSave(JNIEnv * env, jobject thiz, jlong handle, jstring jPath) {
+    (void) thiz;
+    VectorIndexHandle * h = vector_index_from(handle);
+    if (!h) {
+        return JNI_FALSE;
+    }
+    const std::string path = jstring_to_utf8(env, jPath);
+    std::shared_lock<std::shared_mutex> lock(h->lock);
+    const bool ok = h->index->save(path);
+    if (!ok) {
+        LOGE("vectorIndexSave: failed to write %s", path.c_str());
+    }
+    return ok ? JNI_TRUE : JNI_FALSE;
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_peerchat_engine_EngineNative_vectorIndexAdd(JNIEnv * env, jobject thiz, jlong handle,
+                                                     jlongArray jIds, jfloatArray jVectors) {
+    (void) thiz;
+    VectorIndexHandle * h = vector_index_from(handle);
+    if (!h || !jIds || !jVectors) {
+        return 0;
+    }
+    const size_t dim = h->index->dim();
+    std::vector<jlong> ids;
+    std::vector<float> vectors;
+    if (!read_vectors(env, jIds, jVectors, dim, ids, vectors)) {
+        return 0;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(h->lock);
+    jint added = 0;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        if (h->index->add(ids[i], vectors.data() + static_cast<size_t>(i) * dim)) {
+            ++added;
+        }
+    }
+    return added;
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_peerchat_engine_EngineNative_vectorIndexRemove(JNIEnv * env, jobject thiz, jlong handle, jlongArray jIds) {
+    (void) thiz;
+    VectorIndexHandle * h = vector_index_from(handle);
+    if (!h || !jIds) {
+        return 0;
+    }
+    const jsize count = env->GetArrayLength(jIds);
+    std::vector<jlong> ids(count);
+    env->GetLongArrayRegion(jIds, 0, count, ids.data());
+
+    std::unique_lock<std::shared_mutex> lock(h->lock);
+    jint removed = 0;
+    for (jlong id : ids) {
+        if (h->index->remove(id)) {
+            ++removed;
+        }
+    }
+    return removed;
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_peerchat_engine_EngineNative_vectorIndexSearch(JNIEnv * env, jobject thiz, jlong handle,
+                                                        jfloatArray jQuery, jint topK, jint ef,
+                                                        jlongArray jOutIds, jfloatArray jOutScores) {
+    (void) thiz;
+    VectorIndexHandle * h = vector_index_from(handle);
+    if (!h || !jQuery || !jOutIds || topK <= 0) {
+        return 0;
+    }
+    if (static_cast<uint32_t>(env->GetArrayLength(jQuery)) != h->index->dim()) {
+        return 0;
+    }
+    const size_t k = std::min<size_t>(topK, env->GetArrayLength(jOutIds));
+    std::vector<float> query(h->index->dim());
+    env->GetFloatArrayRegion(jQuery, 0, static_cast<jsize>(query.size()), query.data());
+
+    std::vector<jlong> ids(k);
+    std::vector<float> scores(k);
+    size_t found = 0;
+    {
+        std::shared_lock<std::shared_mutex> lock(h->lock);
+        found = h->index->search(query.data(), k, static_cast<size_t>(std::max(ef, 0)), ids.data(), scores.data());
+    }
+    env->SetLongArrayRegion(jOutIds, 0, static_cast<jsize>(found), ids.data());
+    if (jOutScores) {
+        const jsize n = std::min(static_cast<jsize>(found), env->GetArrayLength(jOutScores));
+        env->SetFloatArrayRegion(jOutScores, 0, n, scores.data());
+    }
+    return static_cast<jint>(found);
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_peerchat_engine_EngineNative_vectorIndexSize(JNIEnv * env, jobject thiz, jlong handle) {
+    (void) env;
+    (void) thiz;
+    VectorIndexHandle * h = vector_index_from(handle);
+    if (!h) {
+        return 0;
+    }
+    std::shared_lock<std::shared_mutex> lock(h->lock);
+    return static_cast<jint>(h->index->size());
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_peerchat_engine_EngineNative_vectorIndexDim(JNIEnv * env, jobject thiz, jlong handle) {
+    (void) env;
+    (void) thiz;
+    VectorIndexHandle * h = vector_index_from(handle);
+    return h ? static_cast<jint>(h->index->dim()) : 0;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_peerchat_engine_EngineNative_vectorIndexDestroy(JNIEnv * env, jobject thiz, jlong handle) {
+    (void) env;
+    (void) thiz;
+    delete vector_index_from(handle);
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_peerchat_engine_EngineNative_vectorStoreCreate(JNIEnv * env, jobject thiz, jint dim) {
+    (void) env;
+    (void) thiz;
+    if (dim <= 0 || dim > 65535) {
+        LOGE("vectorStoreCreate: invalid dim=%d", dim);
+        return 0;
+    }
+    auto * handle = new VectorStoreHandle();
+    handle->index = std::make_unique<peerchat::QuantizedStore>(static_cast<uint32_t>(dim));
+    return reinterpret_cast<jlong>(handle);
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_peerchat_engine_EngineNative_vectorStoreOpen(JNIEnv * env, jobject thiz, jstring jPath) {
+    (void) thiz;
+    const std::string path = jstring_to_utf8(env, jPath);
+    std::unique_ptr<peerchat::QuantizedStore> store = peerchat::QuantizedStore::open(path);
+    if (!store) {
+        LOGE("vectorStoreOpen: cannot read %s", path.c_str());
+        return 0;
+    }
+    LOGI("vectorStoreOpen: %zu rows dim=%u resident=%zu bytes", store->size(), store->dim(), store->resident_bytes());
+    auto * handle = new VectorStoreHandle();
+    handle->index = std::move(store);
+    return reinterpret_cast<jlong>(handle);
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_peerchat_engine_EngineNative_vectorStoreSave(JNIEnv * env, jobject thiz, jlong handle, jstring jPath) {
+    (void) thiz;
+    VectorStoreHandle * h = vector_store_from(handle);
+    if (!h) {
+        return JNI_FALSE;
+    }
+    const std::string path = jstring_to_utf8(env, jPath);
+    std::shared_lock<std::shared_mutex> lock(h->lock);
+    const bool ok = h->index->save(path);
+    if (!ok) {
+        LOGE("vectorStoreSave: failed to write %s", path.c_str());
+    }
+    return ok ? JNI_TRUE : JNI_FALSE;
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_peerchat_engine_EngineNative_vectorStoreAdd(JNIEnv * env, jobject thiz, jlong handle,
+                                                     jlongArray jIds, jfloatArray jVectors) {
+    (void) thiz;
+    VectorStoreHandle * h = vector_store_from(handle);
+    if (!h || !jIds || !jVectors) {
+        return 0;
+    }
+    const size_t dim = h->index->dim();
+    std::vector<jlong> ids;
+    std::vector<float> vectors;
+    if (!read_vectors(env, jIds, jVectors, dim, ids, vectors)) {
+        return 0;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(h->lock);
+    jint added = 0;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        if (h->index->add(ids[i], vectors.data() + i * dim)) {
+            ++added;
+        }
+    }
+    return added;
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_peerchat_engine_EngineNative_vectorStoreRemove(JNIEnv * env, jobject thiz, jlong handle, jlongArray jIds) {
+    (void) thiz;
+    VectorStoreHandle * h = vector_store_from(handle);
+    if (!h || !jIds) {
+        return 0;
+    }
+    const jsize count = env->GetArrayLength(jIds);
+    std::vector<jlong> ids(count);
+    env->GetLongArrayRegion(jIds, 0, count, ids.data());
+
+    std::unique_lock<std::shared_mutex> lock(h->lock);
+    jint removed = 0;
+    for (jlong id : ids) {
+        if (h->index->remove(id)) {
+            ++removed;
+        }
+    }
+    return removed;
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_peerchat_engine_EngineNative_vectorStoreSearch(JNIEnv * env, jobject thiz, jlong handle,
+                                                        jfloatArray jQuery, jint topK, jint candidates,
+                                                        jlongArray jOutIds, jfloatArray jOutScores) {
+    (void) thiz;
+    VectorStoreHandle * h = vector_store_from(handle);
+    if (!h || !jQuery || !jOutIds || topK <= 0) {
+        return 0;
+    }
+    if (static_cast<uint32_t>(env->GetArrayLength(jQuery)) != h->index->dim()) {
+        return 0;
+    }
+    const size_t k = std::min<size_t>(topK, env->GetArrayLength(jOutIds));
+    std::vector<float> query(h->index->dim());
+    env->GetFloatArrayRegion(jQuery, 0, static_cast<jsize>(query.size()), query.data());
+
+    std::vector<jlong> ids(k);
+    std::vector<float> scores(k);
+    size_t found = 0;
+    {
+        std::shared_lock<std::shared_mutex> lock(h->lock);
+        found = h->index->search(query.data(), k, static_cast<size_t>(std::max(candidates, 0)), ids.data(),
+                                 scores.data());
+    }
+    env->SetLongArrayRegion(jOutIds, 0, static_cast<jsize>(found), ids.data());
+    if (jOutScores) {
+        const jsize n = std::min(static_cast<jsize>(found), env->GetArrayLength(jOutScores));
+        env->SetFloatArrayRegion(jOutScores, 0, n, scores.data());
+    }
+    return static_cast<jint>(found);
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_peerchat_engine_EngineNative_vectorStoreSize(JNIEnv * env, jobject thiz, jlong handle) {
+    (void) env;
+    (void) thiz;
+    VectorStoreHandle * h = vector_store_from(handle);
+    if (!h) {
+        return 0;
+    }
+    std::shared_lock<std::shared_mutex> lock(h->lock);
+    return static_cast<jint>(h->index->size());
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_peerchat_engine_EngineNative_vectorStoreDim(JNIEnv * env, jobject thiz, jlong handle) {
+    (void) env;
+    (void) thiz;
+    VectorStoreHandle * h = vector_store_from(handle);
+    return h ? static_cast<jint>(h->index->dim()) : 0;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_peerchat_engine_EngineNative_vectorStoreDestroy(JNIEnv * env, jobject thiz, jlong handle) {
+    (void) env;
+    (void) thiz;
+    delete vector_store_from(handle);
+}
+
+// Cosine of query against float32 little-endian blobs as stored in the embedding
+// table, so candidate re-ranking never materialises FloatArrays on the Java heap.
+extern "C" JNIEXPORT void JNICALL
+Java_com_peerchat_engine_EngineNative_vectorRerank(JNIEnv * env, jobject thiz, jfloatArray jQuery,
+                                                   jobjectArray jRows, jfloatArray jOutScores) {
+    (void) thiz;
+    if (!jQuery || !jRows || !jOutScores) {
+        return;
+    }
+    const jsize dim = env->GetArrayLength(jQuery);
+    const jsize count = std::min(env->GetArrayLength(jRows), env->GetArrayLength(jOutScores));
+    std::vector<float> query(dim);
+    env->GetFloatArrayRegion(jQuery, 0, dim, query.data());
+    const float query_norm = peerchat::normalize_f32(query.data(), query.size());
+
+    std::vector<float> row(dim);
+    std::vector<float> scores(count, 0.0f);
+    for (jsize i = 0; i < count && query_norm > 0.0f; ++i) {
+        auto blob = static_cast<jbyteArray>(env->GetObjectArrayElement(jRows, i));
+        if (!blob) {
+            continue;
+        }
+        if (env->GetArrayLength(blob) == static_cast<jsize>(dim * sizeof(float))) {
+            env->GetByteArrayRegion(blob, 0, static_cast<jsize>(dim * sizeof(float)),
+                                    reinterpret_cast<jbyte *>(row.data()));
+            const float norm = std::sqrt(peerchat::dot_f32(row.data(), row.data(), row.size()));
+            if (norm > 0.0f) {
+                scores[i] = peerchat::dot_f32(query.data(), row.data(), row.size()) / norm;
+            }
+        }
+        env->DeleteLocalRef(blob);
+    }
+    env->SetFloatArrayRegion(jOutScores, 0, count, scores.data());
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_peerchat_engine_EngineNative_lexicalIndexCreate(JNIEnv * env, jobject thiz) {
+    (void) env;
+    (void) thiz;
+    auto * handle = new LexicalIndexHandle();
+    handle->index = std::make_unique<peerchat::Bm25Index>();
+    return reinterpret_cast<jlong>(handle);
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_peerchat_engine_EngineNative_lexicalIndexOpen(JNIEnv * env, jobject thiz, jstring jPath) {
+    (void) thiz;
+    const std::string path = jstring_to_utf8(env, jPath);
+    std::unique_ptr<peerchat::Bm25Index> index = peerchat::Bm25Index::open(path);
+    if (!index) {
+        LOGE("lexicalIndexOpen: cannot read %s", path.c_str());
+        return 0;
+    }
+    LOGI("lexicalIndexOpen: %zu docs, %zu terms", index->size(), index->term_count());
+    auto * handle = new LexicalIndexHandle();
+    handle->index = std::move(index);
+    return reinterpret_cast<jlong>(handle);
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_peerchat_engine_EngineNative_lexicalIndexSave(JNIEnv * env, jobject thiz, jlong handle, jstring jPath) {
+    (void) thiz;
+    LexicalIndexHandle * h = lexical_index_from(handle);
+    if (!h) {
+        return JNI_FALSE;
+    }
+    const std::string path = jstring_to_utf8(env, jPath);
+    std::shared_lock<std::shared_mutex> lock(h->lock);
+    const bool ok = h->index->save(path);
+    if (!ok) {
+        LOGE("lexicalIndexSave: failed to write %s", path.c_str());
+    }
+    return ok ? JNI_TRUE : JNI_FALSE;
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_peerchat_engine_EngineNative_lexicalIndexAdd(JNIEnv * env, jobject thiz, jlong handle,
+                                                      jlongArray jIds, jobjectArray jTexts) {
+    (void) thiz;
+    LexicalIndexHandle * h = lexical_index_from(handle);
+    if (!h || !jIds || !jTexts) {
+        return 0;
+    }
+    const jsize count = env->GetArrayLength(jIds);
+    if (env->GetArrayLength(jTexts) != count) {
+        LOGE("lexicalIndexAdd: %d ids but %d texts", count, env->GetArrayLength(jTexts));
+        return 0;
+    }
+    std::vector<jlong> ids(count);
+    env->GetLongArrayRegion(jIds, 0, count, ids.data());
+    std::vector<std::string> texts(count);
+    for (jsize i = 0; i < count; ++i) {
+        auto text = static_cast<jstring>(env->GetObjectArrayElement(jTexts, i));
+        texts[i] = jstring_to_utf8(env, text);
+        env->DeleteLocalRef(text);
+    }
 
-    std::lock_guard<std::mutex> lock(g_state.mutex);
+    std::unique_lock<std::shared_mutex> lock(h->lock);
+    jint added = 0;
+    for (jsize i = 0; i < count; ++i) {
+        if (h->index->add(ids[i], texts[i])) {
+            ++added;
+        }
+    }
+    return added;
+}
 
-    // Clear abort flag
-    g_state.should_abort.store(false, std::memory_order_release);
+extern "C" JNIEXPORT jint JNICALL
+Java_com_peerchat_engine_EngineNative_lexicalIndexRemove(JNIEnv * env, jobject thiz, jlong handle, jlongArray jIds) {
+    (void) thiz;
+    LexicalIndexHandle * h = lexical_index_from(handle);
+    if (!h || !jIds) {
+        return 0;
+    }
+    const jsize count = env->GetArrayLength(jIds);
+    std::vector<jlong> ids(count);
+    env->GetLongArrayRegion(jIds, 0, count, ids.data());
 
-    // Try to clear memory if context exists
-    if (g_state.ctx) {
-        try {
-            llama_memory_clear(llama_get_memory(g_state.ctx), false);
-            LOGI("recover: cleared context memory");
-        } catch (const std::exception& e) {
-            LOGE("recover: failed to clear context memory: %s", e.what());
-        } catch (...) {
-            LOGE("recover: failed to clear context memory: unknown error");
+    std::unique_lock<std::shared_mutex> lock(h->lock);
+    jint removed = 0;
+    for (jlong id : ids) {
+        if (h->index->remove(id)) {
+            ++removed;
         }
     }
+    return removed;
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_peerchat_engine_EngineNative_lexicalIndexSize(JNIEnv * env, jobject thiz, jlong handle) {
+    (void) env;
+    (void) thiz;
+    LexicalIndexHandle * h = lexical_index_from(handle);
+    if (!h) {
+        return 0;
+    }
+    std::shared_lock<std::shared_mutex> lock(h->lock);
+    return static_cast<jint>(h->index->size());
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_peerchat_engine_EngineNative_lexicalIndexDestroy(JNIEnv * env, jobject thiz, jlong handle) {
+    (void) env;
+    (void) thiz;
+    delete lexical_index_from(handle);
+}
 
-    // Try to clear embedding context memory if it exists
-    if (g_state.embed_ctx) {
-        try {
-            llama_memory_clear(llama_get_memory(g_state.embed_ctx), false);
-            LOGI("recover: cleared embedding context memory");
-        } catch (const std::exception& e) {
-            LOGE("recover: failed to clear embedding context memory: %s", e.what());
-        } catch (...) {
-            LOGE("recover: failed to clear embedding context memory: unknown error");
+// Hybrid retrieval in one call: semantic candidates from the HNSW index and/or the
+// quantized store (merged, best score per id), lexical candidates from BM25, then
+// rank fusion. Any handle may be 0 to skip that source; so may the query vector.
+extern "C" JNIEXPORT jint JNICALL
+Java_com_peerchat_engine_EngineNative_retrieveFused(JNIEnv * env, jobject thiz, jlong indexHandle,
+                                                    jlong storeHandle, jlong lexicalHandle,
+                                                    jfloatArray jQueryVector, jstring jQueryText,
+                                                    jint topK, jint depth, jint mode, jfloat semanticWeight,
+                                                    jlongArray jOutIds, jfloatArray jOutScores) {
+    (void) thiz;
+    if (!jOutIds || topK <= 0) {
+        return 0;
+    }
+    const size_t k = std::min<size_t>(topK, env->GetArrayLength(jOutIds));
+    const size_t per_source = std::max<size_t>(k, depth > 0 ? static_cast<size_t>(depth) : k * 4);
+
+    std::vector<float> query;
+    if (jQueryVector) {
+        query.resize(env->GetArrayLength(jQueryVector));
+        env->GetFloatArrayRegion(jQueryVector, 0, static_cast<jsize>(query.size()), query.data());
+    }
+
+    peerchat::RankedList from_index;
+    if (VectorIndexHandle * h = vector_index_from(indexHandle); h && !query.empty()) {
+        std::shared_lock<std::shared_mutex> lock(h->lock);
+        if (query.size() == h->index->dim()) {
+            from_index.resize(per_source);
+            from_index.resize(h->index->search(query.data(), per_source, per_source * 2,
+                                               from_index.ids.data(), from_index.scores.data()));
+        }
+    }
+    peerchat::RankedList from_store;
+    if (VectorStoreHandle * h = vector_store_from(storeHandle); h && !query.empty()) {
+        std::shared_lock<std::shared_mutex> lock(h->lock);
+        if (query.size() == h->index->dim()) {
+            from_store.resize(per_source);
+            from_store.resize(h->index->search(query.data(), per_source, 0,
+                                               from_store.ids.data(), from_store.scores.data()));
         }
     }
+    const peerchat::RankedList semantic = peerchat::merge_ranked(from_index, from_store);
 
-    // Reset metrics
-    reset_metrics_locked();
+    peerchat::RankedList lexical;
+    if (LexicalIndexHandle * h = lexical_index_from(lexicalHandle); h && jQueryText) {
+        const std::string text = jstring_to_utf8(env, jQueryText);
+        std::shared_lock<std::shared_mutex> lock(h->lock);
+        lexical.resize(per_source);
+        lexical.resize(h->index->search(text, per_source, lexical.ids.data(), lexical.scores.data()));
+    }
+
+    peerchat::FusionParams params;
+    params.mode = mode == static_cast<jint>(peerchat::FusionMode::Weighted) ? peerchat::FusionMode::Weighted
+                                                                           : peerchat::FusionMode::Rrf;
+    params.semantic_weight = semanticWeight;
+    std::vector<jlong> ids(k);
+    std::vector<float> scores(k);
+    const size_t found = peerchat::fuse_ranked(semantic, lexical, params, k, ids.data(), scores.data());
 
-    LOGI("recover: engine state recovery completed");
+    env->SetLongArrayRegion(jOutIds, 0, static_cast<jsize>(found), ids.data());
+    if (jOutScores) {
+        const jsize n = std::min(static_cast<jsize>(found), env->GetArrayLength(jOutScores));
+        env->SetFloatArrayRegion(jOutScores, 0, n, scores.data());
+    }
+    return static_cast<jint>(found);
 }
@@ -0,0 +1,99 @@
+#include "retrieval.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+
+namespace peerchat {
+
+namespace {
+
+using Scored = std::pair<float, int64_t>;
+
+// Highest first; ties keep the lower id first so results are deterministic.
+bool better(const Scored & a, const Scored & b) {
+    return a.first != b.first ? a.first > b.first : a.second < b.second;
+}
+
+void normalise(const RankedList & list, std::unordered_map<int64_t, float> & out) {
+    if (list.ids.empty()) {
+        return;
+    }
+    const auto [lo, hi] = std::minmax_element(list.scores.begin(), list.scores.end());
+    const float span = *hi - *lo;
+    for (size_t i = 0; i < list.ids.size(); ++i) {
+        out[list.ids[i]] = span > 0.0f ? (list.scores[i] - *lo) / span : 1.0f;
+    }
+}
+
+} // namespace
+
+RankedList merge_ranked(const RankedList & a, const RankedList & b) {
+    std::unordered_map<int64_t, float> best;
+    best.reserve(a.ids.size() + b.ids.size());
+    for (const RankedList * list : {&a, &b}) {
+        for (size_t i = 0; i < list->ids.size(); ++i) {
+            auto [it, inserted] = best.emplace(list->ids[i], list->scores[i]);
+            if (!inserted) {
+                it->second = std::max(it->second, list->scores[i]);
+            }
+        }
+    }
+    std::vector<Scored> merged;
+    merged.reserve(best.size());
+    for (const auto & [id, score] : best) {
+        merged.emplace_back(score, id);
+    }
+    std::sort(merged.begin(), merged.end(), better);
+
+    RankedList out;
+    out.resize(merged.size());
+    for (size_t i = 0; i < merged.size(); ++i) {
+        out.ids[i] = merged[i].second;
+        out.scores[i] = merged[i].first;
+    }
+    return out;
+}
+
+size_t fuse_ranked(const RankedList & semantic, const RankedList & lexical, const FusionParams & params,
+                   size_t k, int64_t * out_ids, float * out_scores) {
+    std::unordered_map<int64_t, float> fused;
+    fused.reserve(semantic.ids.size() + lexical.ids.size());
+
+    if (params.mode == FusionMode::Rrf) {
+        for (const RankedList * list : {&semantic, &lexical}) {
+            for (size_t rank = 0; rank < list->ids.size(); ++rank) {
+                fused[list->ids[rank]] += 1.0f / (params.rrf_k + static_cast<float>(rank + 1));
+            }
+        }
+    } else {
+        const float w = std::clamp(params.semantic_weight, 0.0f, 1.0f);
+        std::unordered_map<int64_t, float> sem;
+        std::unordered_map<int64_t, float> lex;
+        normalise(semantic, sem);
+        normalise(lexical, lex);
+        for (const auto & [id, score] : sem) {
+            fused[id] += w * score;
+        }
+        for (const auto & [id, score] : lex) {
+            fused[id] += (1.0f - w) * score;
+        }
+    }
+
+    std::vector<Scored> ranked;
+    ranked.reserve(fused.size());
+    for (const auto & [id, score] : fused) {
+        ranked.emplace_back(score, id);
+    }
+    const size_t n = std::min(k, ranked.size());
+    std::partial_sort(ranked.begin(), ranked.begin() + n, ranked.end(), better);
+    for (size_t i = 0; i < n; ++i) {
+        out_ids[i] = ranked[i].second;
+        if (out_scores) {
+            out_scores[i] = ranked[i].first;
+        }
+    }
+    return n;
+}
+
+} // namespace peerchat
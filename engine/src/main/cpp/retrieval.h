@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace peerchat {
+
+// Rank fusion for hybrid retrieval: combines best-first candidate lists from
+// the vector and lexical indexes into one ranking.
+
+enum class FusionMode : uint32_t {
+    // Sum of 1 / (rrf_k + rank) over the lists a hit appears in; ignores raw scores.
+    Rrf = 0,
+    // semantic_weight * semantic + (1 - semantic_weight) * lexical, each min-max normalised.
+    Weighted = 1,
+};
+
+struct FusionParams {
+    FusionMode mode = FusionMode::Rrf;
+    float semantic_weight = 0.7f;
+    float rrf_k = 60.0f;
+};
+
+struct RankedList {
+    std::vector<int64_t> ids;
+    std::vector<float> scores;
+
+    void resize(size_t n) {
+        ids.resize(n);
+        scores.resize(n);
+    }
+};
+
+// Union of two best-first lists keeping each id's higher score, re-sorted best first.
+RankedList merge_ranked(const RankedList & a, const RankedList & b);
+
+// Writes up to k fused ids/scores, best first; returns the count.
+size_t fuse_ranked(const RankedList & semantic, const RankedList & lexical, const FusionParams & params,
+                   size_t k, int64_t * out_ids, float * out_scores);
+
+} // namespace peerchat
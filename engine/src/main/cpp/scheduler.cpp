@@ -0,0 +1,116 @@
+#include "scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <ios>
+#include <sstream>
+
+namespace peerchat {
+
+double RequestScheduler::acquire(RequestPriority priority) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return acquire_locked(lock, priority);
+}
+
+double RequestScheduler::acquire_locked(std::unique_lock<std::mutex> & lock, RequestPriority priority) {
+    const int lane = static_cast<int>(priority);
+    const auto start = std::chrono::steady_clock::now();
+    const uint64_t ticket = next_ticket_[lane]++;
+    waiting_[lane].fetch_add(1, std::memory_order_release);
+    cv_.wait(lock, [&] {
+        if (busy_ || serving_[lane] != ticket) {
+            return false;
+        }
+        for (int higher = 0; higher < lane; ++higher) {
+            if (waiting_[higher].load(std::memory_order_relaxed) > 0) {
+                return false;
+            }
+        }
+        return true;
+    });
+    waiting_[lane].fetch_sub(1, std::memory_order_release);
+    ++serving_[lane];
+    busy_ = true;
+
+    const double wait_ms =
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    SchedulerLaneStats & stats = stats_.lanes[lane];
+    ++stats.requests;
+    stats.wait_ms_total += wait_ms;
+    stats.wait_ms_max = std::max(stats.wait_ms_max, wait_ms);
+    stats.last_wait_ms = wait_ms;
+    // The next ticket of this lane may already be queued behind us.
+    cv_.notify_all();
+    return wait_ms;
+}
+
+void RequestScheduler::release() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        busy_ = false;
+    }
+    cv_.notify_all();
+}
+
+bool RequestScheduler::should_yield(RequestPriority priority) const {
+    for (int higher = 0; higher < static_cast<int>(priority); ++higher) {
+        if (waiting_[higher].load(std::memory_order_acquire) > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+double RequestScheduler::yield(RequestPriority priority) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    busy_ = false;
+    ++stats_.lanes[static_cast<int>(priority)].yields;
+    cv_.notify_all();
+    // Back of its own lane; the queued higher-priority requests run first.
+    const double wait_ms = acquire_locked(lock, priority);
+    // Still the same request; only its wait grows.
+    --stats_.lanes[static_cast<int>(priority)].requests;
+    return wait_ms;
+}
+
+SchedulerStats RequestScheduler::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    SchedulerStats out = stats_;
+    for (int lane = 0; lane < kRequestPriorityCount; ++lane) {
+        out.lanes[lane].waiting = waiting_[lane].load(std::memory_order_relaxed);
+    }
+    return out;
+}
+
+const char * request_priority_name(RequestPriority priority) {
+    switch (priority) {
+        case RequestPriority::Interactive: return "interactive";
+        case RequestPriority::Background: return "background";
+    }
+    return "unknown";
+}
+
+std::string scheduler_stats_json(const SchedulerStats & stats) {
+    std::ostringstream oss;
+    oss.setf(std::ios::fixed);
+    oss.precision(3);
+    oss << "{";
+    for (int lane = 0; lane < kRequestPriorityCount; ++lane) {
+        const SchedulerLaneStats & s = stats.lanes[lane];
+        if (lane > 0) {
+            oss << ",";
+        }
+        oss << "\"" << request_priority_name(static_cast<RequestPriority>(lane)) << "\":{"
+            << "\"requests\":" << s.requests
+            << ",\"yields\":" << s.yields
+            << ",\"waiting\":" << s.waiting
+            << ",\"waitMsTotal\":" << s.wait_ms_total
+            << ",\"waitMsMax\":" << s.wait_ms_max
+            << ",\"lastWaitMs\":" << s.last_wait_ms
+            << "}";
+    }
+    oss << "}";
+    return oss.str();
+}
+
+} // namespace peerchat
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace peerchat {
+
+// Admission control for the engine's single llama context. One request runs
+// at a time; queued requests are served strictly by priority and FIFO within
+// a priority, so a user's message never waits behind more than the batch a
+// background job is currently decoding. Long background requests (embedding
+// a document) call should_yield() between decodes and hand the engine over
+// when an interactive request is queued.
+enum class RequestPriority : int {
+    // Generation and anything the user is waiting on: load, session switch, restore.
+    Interactive = 0,
+    // Indexing and cache maintenance: embeddings, snapshot capture and spill.
+    Background = 1,
+};
+
+constexpr int kRequestPriorityCount = 2;
+
+struct SchedulerLaneStats {
+    uint64_t requests = 0;
+    // Times a running request of this lane gave way to a higher lane.
+    uint64_t yields = 0;
+    int waiting = 0;
+    double wait_ms_total = 0.0;
+    double wait_ms_max = 0.0;
+    double last_wait_ms = 0.0;
+};
+
+struct SchedulerStats {
+    SchedulerLaneStats lanes[kRequestPriorityCount];
+};
+
+class RequestScheduler {
+public:
+    // Blocks until the request may run; returns the time spent queued.
+    double acquire(RequestPriority priority);
+    void release();
+
+    // Lock-free: true when a request of higher priority is queued.
+    bool should_yield(RequestPriority priority) const;
+    // Releases the engine to the queued higher-priority requests and waits
+    // for it again at the same priority; returns the time spent waiting.
+    double yield(RequestPriority priority);
+
+    SchedulerStats stats() const;
+
+private:
+    double acquire_locked(std::unique_lock<std::mutex> & lock, RequestPriority priority);
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    bool busy_ = false;
+    // Tickets handed out and served per lane, for FIFO order within a lane.
+    uint64_t next_ticket_[kRequestPriorityCount] = {};
+    uint64_t serving_[kRequestPriorityCount] = {};
+    std::atomic<int> waiting_[kRequestPriorityCount] = {};
+    SchedulerStats stats_;
+};
+
+const char * request_priority_name(RequestPriority priority);
+// {"interactive":{...},"background":{...}} with request counts, yields,
+// queue depth and queue-wait totals per lane.
+std::string scheduler_stats_json(const SchedulerStats & stats);
+
+} // namespace peerchat
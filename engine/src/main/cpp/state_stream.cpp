@@ -0,0 +1,200 @@
+#include "state_stream.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+namespace peerchat {
+
+namespace {
+
+struct StreamHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t kind;
+    uint32_t chunk_size;
+};
+
+struct FrameHeader {
+    uint32_t raw_size;
+    uint32_t stored_size;
+    uint32_t crc;
+};
+
+// KV data is mostly fp16 noise; the fastest level keeps the stream I/O bound.
+constexpr int kDeflateLevel = 1;
+constexpr uint32_t kMaxChunk = 64u << 20;
+
+} // namespace
+
+StateStreamWriter::StateStreamWriter(int fd, StateStreamKind kind, uint32_t chunk_size)
+    : fd_(fd), chunk_size_(std::max<uint32_t>(chunk_size, 4096)) {
+    raw_.reserve(chunk_size_);
+    packed_.resize(compressBound(chunk_size_));
+    const StreamHeader header{kStateStreamMagic, kStateStreamVersion, static_cast<uint32_t>(kind), chunk_size_};
+    ok_ = write_fd(&header, sizeof(header));
+}
+
+bool StateStreamWriter::write(const void * src, size_t size) {
+    const uint8_t * p = static_cast<const uint8_t *>(src);
+    while (ok_ && size > 0) {
+        const size_t n = std::min(size, static_cast<size_t>(chunk_size_) - raw_.size());
+        raw_.insert(raw_.end(), p, p + n);
+        p += n;
+        size -= n;
+        raw_bytes_ += n;
+        if (raw_.size() == chunk_size_) {
+            ok_ = flush_chunk();
+        }
+    }
+    return ok_;
+}
+
+bool StateStreamWriter::finish() {
+    if (ok_ && !raw_.empty()) {
+        ok_ = flush_chunk();
+    }
+    if (ok_) {
+        const FrameHeader end{0, 0, 0};
+        ok_ = write_fd(&end, sizeof(end));
+    }
+    return ok_;
+}
+
+bool StateStreamWriter::callback(const void * src, size_t size, void * self) {
+    return static_cast<StateStreamWriter *>(self)->write(src, size);
+}
+
+bool StateStreamWriter::flush_chunk() {
+    FrameHeader frame{};
+    frame.raw_size = static_cast<uint32_t>(raw_.size());
+    frame.crc = static_cast<uint32_t>(crc32(0L, raw_.data(), static_cast<uInt>(raw_.size())));
+
+    uLongf packed_size = static_cast<uLongf>(packed_.size());
+    const int rc = compress2(packed_.data(), &packed_size, raw_.data(), static_cast<uLong>(raw_.size()), kDeflateLevel);
+    const bool store_raw = rc != Z_OK || packed_size >= raw_.size();
+    frame.stored_size = store_raw ? frame.raw_size : static_cast<uint32_t>(packed_size);
+
+    const bool written = write_fd(&frame, sizeof(frame)) &&
+                         write_fd(store_raw ? raw_.data() : packed_.data(), frame.stored_size);
+    stored_bytes_ += frame.stored_size;
+    raw_.clear();
+    return written;
+}
+
+bool StateStreamWriter::write_fd(const void * src, size_t size) {
+    const uint8_t * p = static_cast<const uint8_t *>(src);
+    while (size > 0) {
+        const ssize_t n = ::write(fd_, p, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+StateStreamReader::StateStreamReader(int fd, StateStreamKind kind) : fd_(fd) {
+    StreamHeader header{};
+    ok_ = read_fd(&header, sizeof(header)) &&
+          header.magic == kStateStreamMagic &&
+          header.version == kStateStreamVersion &&
+          header.kind == static_cast<uint32_t>(kind) &&
+          header.chunk_size > 0 && header.chunk_size <= kMaxChunk;
+    if (ok_) {
+        chunk_size_ = header.chunk_size;
+        raw_.reserve(chunk_size_);
+        packed_.reserve(compressBound(chunk_size_));
+    }
+}
+
+bool StateStreamReader::read(void * dst, size_t size) {
+    uint8_t * p = static_cast<uint8_t *>(dst);
+    while (ok_ && size > 0) {
+        if (raw_pos_ == raw_.size()) {
+            if (eof_ || !next_chunk()) {
+                ok_ = false;
+                break;
+            }
+            continue;
+        }
+        const size_t n = std::min(size, raw_.size() - raw_pos_);
+        std::memcpy(p, raw_.data() + raw_pos_, n);
+        raw_pos_ += n;
+        p += n;
+        size -= n;
+    }
+    return ok_;
+}
+
+bool StateStreamReader::at_end() {
+    while (ok_ && !eof_ && raw_pos_ == raw_.size()) {
+        ok_ = next_chunk();
+    }
+    return ok_ && eof_ && raw_pos_ == raw_.size();
+}
+
+bool StateStreamReader::callback(void * dst, size_t size, void * self) {
+    return static_cast<StateStreamReader *>(self)->read(dst, size);
+}
+
+bool StateStreamReader::next_chunk() {
+    FrameHeader frame{};
+    if (!read_fd(&frame, sizeof(frame))) {
+        return false;
+    }
+    raw_.clear();
+    raw_pos_ = 0;
+    if (frame.raw_size == 0) {
+        eof_ = true;
+        return true;
+    }
+    if (frame.raw_size > chunk_size_ || frame.stored_size > compressBound(chunk_size_)) {
+        return false;
+    }
+    raw_.resize(frame.raw_size);
+    if (frame.stored_size == frame.raw_size) {
+        if (!read_fd(raw_.data(), frame.stored_size)) {
+            return false;
+        }
+    } else {
+        packed_.resize(frame.stored_size);
+        if (!read_fd(packed_.data(), frame.stored_size)) {
+            return false;
+        }
+        uLongf raw_size = frame.raw_size;
+        if (uncompress(raw_.data(), &raw_size, packed_.data(), frame.stored_size) != Z_OK ||
+            raw_size != frame.raw_size) {
+            return false;
+        }
+    }
+    return static_cast<uint32_t>(crc32(0L, raw_.data(), static_cast<uInt>(raw_.size()))) == frame.crc;
+}
+
+bool StateStreamReader::read_fd(void * dst, size_t size) {
+    uint8_t * p = static_cast<uint8_t *>(dst);
+    while (size > 0) {
+        const ssize_t n = ::read(fd_, p, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (n == 0) {
+            return false;
+        }
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+} // namespace peerchat
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace peerchat {
+
+// Chunked, checksummed compression stream used for KV snapshots on disk.
+//
+// Layout: StreamHeader, then frames of {raw_size, stored_size, crc32(raw)}
+// followed by stored_size bytes (deflate, or raw when it does not shrink),
+// terminated by a frame with raw_size == 0. Only one raw and one compressed
+// chunk are held in memory at a time on either side.
+constexpr uint32_t kStateStreamMagic = 0x5a4b4350; // "PCKZ"
+constexpr uint32_t kStateStreamVersion = 1;
+constexpr uint32_t kStateStreamChunk = 1u << 20;
+
+enum class StateStreamKind : uint32_t {
+    Context = 0,
+    Sequence = 1,
+};
+
+class StateStreamWriter {
+public:
+    // Does not take ownership of fd; the caller closes it.
+    StateStreamWriter(int fd, StateStreamKind kind, uint32_t chunk_size = kStateStreamChunk);
+
+    bool write(const void * src, size_t size);
+    // Flushes the pending chunk and writes the end frame.
+    bool finish();
+
+    bool ok() const { return ok_; }
+    uint64_t raw_bytes() const { return raw_bytes_; }
+    uint64_t stored_bytes() const { return stored_bytes_; }
+
+    // Adapter for llama_state_*_write_stream.
+    static bool callback(const void * src, size_t size, void * self);
+
+private:
+    bool flush_chunk();
+    bool write_fd(const void * src, size_t size);
+
+    int fd_;
+    uint32_t chunk_size_;
+    std::vector<uint8_t> raw_;
+    std::vector<uint8_t> packed_;
+    uint64_t raw_bytes_ = 0;
+    uint64_t stored_bytes_ = 0;
+    bool ok_ = true;
+};
+
+class StateStreamReader {
+public:
+    StateStreamReader(int fd, StateStreamKind kind);
+
+    // Fills exactly size bytes, decompressing further chunks as needed.
+    bool read(void * dst, size_t size);
+    // True once the end frame was consumed and no decoded bytes remain.
+    bool at_end();
+
+    bool ok() const { return ok_; }
+
+    // Adapter for llama_state_*_read_stream.
+    static bool callback(void * dst, size_t size, void * self);
+
+private:
+    bool next_chunk();
+    bool read_fd(void * dst, size_t size);
+
+    int fd_;
+    uint32_t chunk_size_ = 0;
+    std::vector<uint8_t> raw_;
+    std::vector<uint8_t> packed_;
+    size_t raw_pos_ = 0;
+    bool eof_ = false;
+    bool ok_ = true;
+};
+
+} // namespace peerchat
@@ -0,0 +1,228 @@
+// Token alignment and chunk boundaries, on synthetic tokens and on the
+// vocab-only models vendored with llama.cpp (directory given as argv[1]).
+
+#include "chunker.h"
+
+#include "check.h"
+
+#include "llama.h"
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace peerchat;
+
+namespace {
+
+// One synthetic token per space-separated word (the space leads the token,
+// as in SPM) or per UTF-8 character for text without spaces.
+std::vector<uint32_t> word_starts(std::string_view text) {
+    std::vector<uint32_t> starts;
+    for (size_t i = 0; i < text.size(); ++i) {
+        const bool spaced = text.find(' ') != std::string_view::npos;
+        const uint8_t c = static_cast<uint8_t>(text[i]);
+        const bool starts_token = spaced ? (i == 0 || (text[i] == ' ' && text[i - 1] != ' '))
+                                         : (c & 0xC0) != 0x80;
+        if (starts_token) {
+            starts.push_back(static_cast<uint32_t>(i));
+        }
+    }
+    return starts;
+}
+
+// The spans partition the token sequence with the given overlap rules.
+void check_spans(std::string_view text, const std::vector<uint32_t> & starts, const ChunkOptions & options,
+                 const std::vector<ChunkSpan> & chunks) {
+    CHECK(!chunks.empty());
+    CHECK(chunks.front().start == 0);
+    CHECK(chunks.back().end == text.size());
+    auto is_boundary = [&](size_t at) {
+        return at == text.size() || std::binary_search(starts.begin(), starts.end(), static_cast<uint32_t>(at));
+    };
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        const ChunkSpan & chunk = chunks[i];
+        CHECK(chunk.start < chunk.end);
+        CHECK(chunk.tokens > 0 && chunk.tokens <= options.max_tokens);
+        CHECK(is_boundary(chunk.start) && is_boundary(chunk.end));
+        if (i > 0) {
+            CHECK(chunk.start > chunks[i - 1].start);
+            CHECK(chunk.start <= chunks[i - 1].end);
+        }
+    }
+}
+
+void test_align_token_starts() {
+    // SPM puts a space in front of the first word; pieces laid end to end.
+    const std::string_view text = "Hello world\nagain";
+    const std::vector<uint32_t> starts = align_token_starts(text, " Hello world\n again", {6, 6, 1, 6});
+    CHECK((starts == std::vector<uint32_t>{0, 5, 11, 12}));
+
+    // Folded case still lines up.
+    CHECK((align_token_starts("ABC def", "abc def", {3, 4}) == std::vector<uint32_t>{0, 3}));
+
+    // Pieces that never match keep the starts ordered and inside the text.
+    const std::vector<uint32_t> lost = align_token_starts("abc", "xxxxyyyyzz", {4, 4, 2});
+    CHECK(lost.size() == 3);
+    CHECK(std::is_sorted(lost.begin(), lost.end()));
+    CHECK(lost.back() <= 3);
+}
+
+void test_sentence_breaks_preferred() {
+    std::string text;
+    for (int i = 0; i < 40; ++i) {
+        text += "word";
+        text += (i % 7 == 6) ? ". " : " ";
+    }
+    text += "end";
+    const std::vector<uint32_t> starts = word_starts(text);
+    ChunkOptions options;
+    options.max_tokens = 10;
+    options.overlap_tokens = 2;
+    const std::vector<ChunkSpan> chunks = chunk_tokens(text, starts, options);
+    check_spans(text, starts, options, chunks);
+    for (size_t i = 0; i + 1 < chunks.size(); ++i) {
+        // Every window's back half holds a sentence end; the chunk stops there.
+        const std::string_view head = std::string_view(text).substr(0, chunks[i].end);
+        CHECK(head.size() >= 1 && head.substr(head.size() - 1) == ".");
+    }
+}
+
+void test_overlap() {
+    std::string text;
+    for (int i = 0; i < 100; ++i) {
+        text += "w" + std::to_string(i) + " ";
+    }
+    const std::vector<uint32_t> starts = word_starts(text);
+    ChunkOptions options;
+    options.max_tokens = 16;
+    options.overlap_tokens = 4;
+    const std::vector<ChunkSpan> chunks = chunk_tokens(text, starts, options);
+    check_spans(text, starts, options, chunks);
+    for (size_t i = 1; i < chunks.size(); ++i) {
+        CHECK(chunks[i].start < chunks[i - 1].end);
+    }
+
+    // Overlap at or past the budget is clamped; the chunking still advances.
+    options.overlap_tokens = 100;
+    check_spans(text, starts, options, chunk_tokens(text, starts, options));
+    options.max_tokens = 1;
+    const std::vector<ChunkSpan> singles = chunk_tokens(text, starts, options);
+    check_spans(text, starts, options, singles);
+    CHECK(singles.size() == starts.size());
+}
+
+void test_cjk() {
+    // Three characters and a full stop per sentence, no spaces.
+    std::string text;
+    for (int i = 0; i < 30; ++i) {
+        text += "文字文。";
+    }
+    const std::vector<uint32_t> starts = word_starts(text);
+    ChunkOptions options;
+    options.max_tokens = 10;
+    options.overlap_tokens = 3;
+    const std::vector<ChunkSpan> chunks = chunk_tokens(text, starts, options);
+    check_spans(text, starts, options, chunks);
+    for (size_t i = 0; i + 1 < chunks.size(); ++i) {
+        CHECK(std::string_view(text).substr(0, chunks[i].end).substr(chunks[i].end - 3) == "。");
+        CHECK(chunks[i + 1].start < chunks[i].end);
+    }
+
+    // No break anywhere: the overlap stays on the raw token boundary.
+    std::string run;
+    for (int i = 0; i < 40; ++i) {
+        run += "文";
+    }
+    const std::vector<uint32_t> run_starts = word_starts(run);
+    const std::vector<ChunkSpan> run_chunks = chunk_tokens(run, run_starts, options);
+    check_spans(run, run_starts, options, run_chunks);
+    for (size_t i = 1; i < run_chunks.size(); ++i) {
+        CHECK(run_chunks[i - 1].end - run_chunks[i].start == 3 * 3);
+    }
+}
+
+std::string sample_document() {
+    std::string text;
+    const char * paragraphs[] = {
+        "PeerChat keeps every document on the device. It splits each one into chunks, embeds them, "
+        "and answers questions from the closest matches; nothing leaves the phone.",
+        "Numbers like 3.14, 2,048 and e.g. abbreviations do not end sentences. Neither does "
+        "<b>markup</b> or a URL such as https://example.com/a-b?c=d.",
+        "文字は空白なしで書かれます。"
+        "これは二番目の文です！三番目、"
+        "そして四番目。",
+        "   Leading spaces,\ttabs\tand ALL CAPS WORDS; tokenizers fold or split them differently.",
+    };
+    for (int round = 0; round < 6; ++round) {
+        for (const char * paragraph : paragraphs) {
+            text += paragraph;
+            text += round % 2 ? "\n" : "\n\n";
+        }
+    }
+    return text;
+}
+
+int32_t count_tokens(const llama_vocab * vocab, std::string_view text) {
+    std::vector<llama_token> tokens(text.size() + 8);
+    const int32_t n = llama_tokenize(vocab, text.data(), static_cast<int32_t>(text.size()), tokens.data(),
+                                     static_cast<int32_t>(tokens.size()), false, false);
+    CHECK(n >= 0);
+    return n;
+}
+
+// Every chunk, tokenized again on its own, fits the budget.
+void test_vocab(const std::string & path) {
+    llama_model_params params = llama_model_default_params();
+    params.vocab_only = true;
+    llama_model * model = llama_model_load_from_file(path.c_str(), params);
+    CHECK(model != nullptr);
+    const llama_vocab * vocab = llama_model_get_vocab(model);
+
+    const std::string text = sample_document();
+    for (const int32_t max_tokens : {8, 24, 64}) {
+        ChunkOptions options;
+        options.max_tokens = max_tokens;
+        options.overlap_tokens = max_tokens / 4;
+        std::vector<ChunkSpan> chunks;
+        CHECK(chunk_document(vocab, text, options, chunks));
+        CHECK(!chunks.empty());
+        CHECK(chunks.front().start == 0 && chunks.back().end == text.size());
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            const ChunkSpan & chunk = chunks[i];
+            CHECK(chunk.start < chunk.end && chunk.end <= text.size());
+            CHECK(chunk.tokens <= max_tokens - 1);
+            const std::string_view slice = std::string_view(text).substr(chunk.start, chunk.end - chunk.start);
+            if (count_tokens(vocab, slice) > max_tokens) {
+                std::fprintf(stderr, "%s: chunk %zu over %d tokens: [%.*s]\n", path.c_str(), i, max_tokens,
+                             static_cast<int>(slice.size()), slice.data());
+                CHECK(false);
+            }
+            if (i > 0) {
+                CHECK(chunk.start > chunks[i - 1].start && chunk.start <= chunks[i - 1].end);
+            }
+        }
+    }
+    llama_model_free(model);
+}
+
+} // namespace
+
+int main(int argc, char ** argv) {
+    test_align_token_starts();
+    test_sentence_breaks_preferred();
+    test_overlap();
+    test_cjk();
+
+    CHECK(argc > 1);
+    llama_log_set([](ggml_log_level, const char *, void *) {}, nullptr);
+    llama_backend_init();
+    const std::string models = argv[1];
+    for (const char * name : {"llama-spm", "gpt-2", "phi-3", "deepseek-llm", "bert-bge"}) {
+        test_vocab(models + "/ggml-vocab-" + name + ".gguf");
+    }
+    llama_backend_free();
+    std::printf("chunker: ok\n");
+    return 0;
+}
@@ -0,0 +1,143 @@
+// StopMatcher and StreamingDetokenizer over raw bytes; no model needed.
+
+#include "detokenizer.h"
+
+#include "check.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace peerchat;
+
+namespace {
+
+struct Pushed {
+    std::string text;
+    std::string matched;
+};
+
+Pushed push(StreamingDetokenizer & detok, std::string_view bytes) {
+    std::string_view matched;
+    const std::string_view text = detok.push_bytes(bytes, matched);
+    return {std::string(text), std::string(matched)};
+}
+
+int first_match(StopMatcher & matcher, std::string_view input) {
+    for (const char ch : input) {
+        const int stop = matcher.step(static_cast<uint8_t>(ch));
+        if (stop >= 0) return stop;
+    }
+    return -1;
+}
+
+void test_matcher_overlapping_stops() {
+    // The shorter stop is complete first and ends the match.
+    StopMatcher prefix({"a", "ab"});
+    const int stop = first_match(prefix, "xab");
+    CHECK(stop >= 0 && prefix.stop(stop) == "a");
+
+    // Both end on the same byte: the longest wins.
+    StopMatcher suffix({"b", "ab"});
+    const int both = first_match(suffix, "xab");
+    CHECK(both >= 0 && suffix.stop(both) == "ab");
+
+    // Reached through a failure link: "aab" has to fall back to "ab".
+    StopMatcher fallback({"ab"});
+    const int via_fail = first_match(fallback, "aab");
+    CHECK(via_fail >= 0 && fallback.stop(via_fail) == "ab");
+
+    // Empty and repeated stops are dropped.
+    StopMatcher dedup({"", "ab", "ab"});
+    CHECK(dedup.max_length() == 2);
+    CHECK(first_match(dedup, "xyz") < 0);
+    CHECK(dedup.depth() == 0);
+}
+
+void test_overlapping_stops_in_stream() {
+    PieceCache pieces;
+    StreamingDetokenizer detok(pieces, {"a", "ab"});
+    const Pushed out = push(detok, "xab");
+    CHECK(out.text == "x");
+    CHECK(out.matched == "a");
+}
+
+void test_stop_split_across_pieces() {
+    PieceCache pieces;
+    StreamingDetokenizer detok(pieces, {"</s>"});
+    Pushed out = push(detok, "hello </");
+    CHECK(out.text == "hello ");
+    CHECK(out.matched.empty());
+    out = push(detok, "s");
+    CHECK(out.text.empty());
+    out = push(detok, ">tail");
+    CHECK(out.text.empty());
+    CHECK(out.matched == "</s>");
+}
+
+void test_held_prefix_released_when_stop_breaks() {
+    PieceCache pieces;
+    StreamingDetokenizer detok(pieces, {"</s>"});
+    CHECK(push(detok, "a<").text == "a");
+    // "<" turned out not to start the stop; it goes out with the next piece.
+    const Pushed out = push(detok, "b>");
+    CHECK(out.text == "<b>");
+    CHECK(out.matched.empty());
+}
+
+void test_multibyte_char_split_across_pieces() {
+    PieceCache pieces;
+    StreamingDetokenizer detok(pieces, {});
+    // "é" is C3 A9, "€" is E2 82 AC.
+    CHECK(push(detok, "caf\xC3").text == "caf");
+    CHECK(push(detok, "\xA9 \xE2").text == "\xC3\xA9 ");
+    CHECK(push(detok, "\x82").text.empty());
+    CHECK(push(detok, "\xAC!").text == "\xE2\x82\xAC!");
+}
+
+void test_stop_after_partial_char() {
+    PieceCache pieces;
+    StreamingDetokenizer detok(pieces, {"\xE2\x82\xAC"});
+    CHECK(push(detok, "1 \xE2").text == "1 ");
+    const Pushed out = push(detok, "\x82\xAC");
+    CHECK(out.text.empty());
+    CHECK(out.matched == "\xE2\x82\xAC");
+}
+
+void test_flush_at_end_of_stream() {
+    PieceCache pieces;
+    StreamingDetokenizer held_stop(pieces, {"</s>"});
+    CHECK(push(held_stop, "done</").text == "done");
+    CHECK(held_stop.flush() == "</");
+
+    // A dangling lead byte is handed over as is once nothing more can come.
+    StreamingDetokenizer held_char(pieces, {});
+    CHECK(push(held_char, "ok\xC3").text == "ok");
+    CHECK(held_char.flush() == "\xC3");
+    CHECK(held_char.flush().empty());
+}
+
+void test_utf8_helpers() {
+    CHECK(utf8_sequence_length('a') == 1);
+    CHECK(utf8_sequence_length(0xC3) == 2);
+    CHECK(utf8_sequence_length(0xE2) == 3);
+    CHECK(utf8_sequence_length(0xF0) == 4);
+    CHECK(utf8_sequence_length(0x80) == 1);
+    CHECK(utf8_complete_prefix("ab\xF0\x9F\x98", 5) == 2);
+    CHECK(utf8_complete_prefix("ab\xF0\x9F\x98\x80", 6) == 6);
+}
+
+} // namespace
+
+int main() {
+    test_matcher_overlapping_stops();
+    test_overlapping_stops_in_stream();
+    test_stop_split_across_pieces();
+    test_held_prefix_released_when_stop_breaks();
+    test_multibyte_char_split_across_pieces();
+    test_stop_after_partial_char();
+    test_flush_at_end_of_stream();
+    test_utf8_helpers();
+    std::printf("detokenizer: ok\n");
+    return 0;
+}
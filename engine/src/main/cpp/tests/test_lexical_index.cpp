@@ -0,0 +1,249 @@
+// Bm25Index round trips and rank fusion over the three retrieval sources.
+
+#include "lexical_index.h"
+#include "retrieval.h"
+#include "vector_index.h"
+#include "vector_store.h"
+
+#include "check.h"
+
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace peerchat;
+
+namespace {
+
+struct Results {
+    std::vector<int64_t> ids;
+    std::vector<float> scores;
+};
+
+Results search(const Bm25Index & index, const std::string & query, size_t k = 10) {
+    Results r;
+    r.ids.resize(k);
+    r.scores.resize(k);
+    const size_t n = index.search(query, k, r.ids.data(), r.scores.data());
+    r.ids.resize(n);
+    r.scores.resize(n);
+    return r;
+}
+
+bool has(const Results & r, int64_t id) {
+    for (const int64_t x : r.ids) {
+        if (x == id) return true;
+    }
+    return false;
+}
+
+void test_terms() {
+    CHECK((lexical_terms("Hello, WORLD! x2 café") == std::vector<std::string>{"hello", "world", "x2", "café"}));
+    CHECK((lexical_terms("检索") == std::vector<std::string>{"检", "索"}));
+    CHECK(lexical_terms(" ,.; ").empty());
+}
+
+void test_ranking() {
+    Bm25Index index;
+    CHECK(index.add(1, "the quick brown fox"));
+    CHECK(index.add(2, "fox fox fox jumps"));
+    CHECK(index.add(3, "a lazy dog sleeps all day long in the warm afternoon sun"));
+    CHECK(index.add(4, "the dog"));
+    CHECK(!index.add(5, "... !!"));
+    CHECK(index.size() == 4);
+
+    // More occurrences rank higher; a shorter document wins at equal tf.
+    Results r = search(index, "fox");
+    CHECK((r.ids == std::vector<int64_t>{2, 1}));
+    r = search(index, "DOG");
+    CHECK((r.ids == std::vector<int64_t>{4, 3}));
+    CHECK(search(index, "cat").ids.empty());
+}
+
+void test_round_trip() {
+    const std::string path = "test_lexical_index.bin";
+    Bm25Index index;
+    std::mt19937 rng(3);
+    const std::vector<std::string> words = {"alpha", "beta", "gamma", "delta", "epsilon", "zeta", "eta",
+                                            "theta", "iota", "kappa", "lambda", "mu", "数", "据"};
+    std::uniform_int_distribution<size_t> pick(0, words.size() - 1);
+    std::uniform_int_distribution<int> length(3, 20);
+    for (int64_t id = 0; id < 200; ++id) {
+        std::string text;
+        for (int i = length(rng); i > 0; --i) {
+            text += words[pick(rng)] + " ";
+        }
+        text += "doc" + std::to_string(id);
+        CHECK(index.add(id, text));
+    }
+
+    // Removed ids never come back, even when queried by their unique term;
+    // enough of them to compact the postings.
+    std::vector<int64_t> removed;
+    for (int64_t id = 0; id < 200; id += 2) {
+        CHECK(index.remove(id));
+        removed.push_back(id);
+    }
+    for (int64_t id = 1; id < 200; id += 3) {
+        if (id % 2 == 0) continue;
+        CHECK(index.remove(id));
+        removed.push_back(id);
+    }
+    CHECK(!index.remove(0));
+
+    // Re-adding an id replaces its text.
+    CHECK(index.add(5, "replacement omega"));
+    CHECK(!has(search(index, "doc5"), 5));
+    CHECK(search(index, "omega").ids == std::vector<int64_t>{5});
+
+    auto check_index = [&](const Bm25Index & idx) {
+        for (const int64_t id : removed) {
+            CHECK(!has(search(idx, "doc" + std::to_string(id)), id));
+            CHECK(!has(search(idx, "alpha beta gamma", 300), id));
+        }
+        CHECK(search(idx, "omega").ids == std::vector<int64_t>{5});
+        CHECK(!has(search(idx, "doc5"), 5));
+        CHECK(search(idx, "doc9").ids == std::vector<int64_t>{9});
+    };
+    check_index(index);
+
+    CHECK(index.save(path));
+    std::unique_ptr<Bm25Index> reopened = Bm25Index::open(path);
+    CHECK(reopened != nullptr);
+    CHECK(reopened->size() == index.size());
+    for (const std::string query : {"alpha", "beta gamma", "数据", "kappa mu doc9", "theta"}) {
+        const Results a = search(index, query, 50);
+        const Results b = search(*reopened, query, 50);
+        CHECK(a.ids == b.ids);
+        CHECK(a.scores == b.scores);
+    }
+    check_index(*reopened);
+
+    // Still mutable after a reload.
+    CHECK(reopened->add(9, "renamed"));
+    CHECK(search(*reopened, "renamed").ids == std::vector<int64_t>{9});
+    CHECK(!has(search(*reopened, "doc9"), 9));
+    CHECK(reopened->remove(5));
+    CHECK(search(*reopened, "omega").ids.empty());
+
+    CHECK(Bm25Index::open(path + ".missing") == nullptr);
+    std::remove(path.c_str());
+}
+
+void test_fuse_ranked() {
+    RankedList semantic;
+    semantic.ids = {10, 20, 30};
+    semantic.scores = {0.9f, 0.8f, 0.1f};
+    RankedList lexical;
+    lexical.ids = {30, 40, 20};
+    lexical.scores = {12.0f, 6.0f, 1.0f};
+
+    int64_t ids[4];
+    float scores[4];
+    FusionParams rrf;
+    // 20 and 30 are in both lists; 30's ranks (3, 1) edge out 20's (2, 3).
+    CHECK(fuse_ranked(semantic, lexical, rrf, 4, ids, scores) == 4);
+    CHECK(ids[0] == 30 && ids[1] == 20);
+    CHECK(scores[0] >= scores[1] && scores[1] >= scores[2] && scores[2] >= scores[3]);
+
+    FusionParams weighted;
+    weighted.mode = FusionMode::Weighted;
+    weighted.semantic_weight = 1.0f;
+    CHECK(fuse_ranked(semantic, lexical, weighted, 1, ids, scores) == 1);
+    CHECK(ids[0] == 10);
+    weighted.semantic_weight = 0.0f;
+    CHECK(fuse_ranked(semantic, lexical, weighted, 1, ids, scores) == 1);
+    CHECK(ids[0] == 30);
+
+    // Best score per id across the two semantic sources.
+    RankedList other;
+    other.ids = {20, 50};
+    other.scores = {0.95f, 0.2f};
+    const RankedList merged = merge_ranked(semantic, other);
+    CHECK((merged.ids == std::vector<int64_t>{20, 10, 50, 30}));
+    CHECK(merged.scores[0] == 0.95f);
+
+    CHECK(fuse_ranked(RankedList{}, RankedList{}, rrf, 4, ids, nullptr) == 0);
+}
+
+// The retrieveFused pipeline over real indexes: a chunk that matches both the
+// embedding and the words outranks chunks that match only one.
+void test_fused_retrieval() {
+    constexpr uint32_t kDim = 16;
+    std::mt19937 rng(11);
+    std::normal_distribution<float> dist;
+    auto random_vector = [&] {
+        std::vector<float> v(kDim);
+        for (float & x : v) x = dist(rng);
+        return v;
+    };
+
+    HnswIndex::Params params;
+    params.dim = kDim;
+    HnswIndex hnsw(params);
+    QuantizedStore store(kDim);
+    Bm25Index bm25;
+
+    const std::vector<float> query = random_vector();
+    auto near_query = [&](float noise) {
+        std::vector<float> v = query;
+        for (float & x : v) x += noise * dist(rng);
+        return v;
+    };
+    std::vector<std::pair<int64_t, std::vector<float>>> rows;
+    // 1: close in embedding space and lexically; 2: embedding only; 3: words only.
+    rows.emplace_back(1, near_query(0.3f));
+    rows.emplace_back(2, near_query(0.2f));
+    rows.emplace_back(3, random_vector());
+    for (int64_t id = 4; id < 60; ++id) rows.emplace_back(id, random_vector());
+    for (const auto & [id, vec] : rows) {
+        CHECK(hnsw.add(id, vec.data()));
+        CHECK(store.add(id, vec.data()));
+    }
+    CHECK(bm25.add(1, "battery mode on android"));
+    CHECK(bm25.add(2, "screen brightness settings"));
+    CHECK(bm25.add(3, "android battery saving tips and battery saving care"));
+    // Weak lexical matches, so min-max normalisation has a floor below chunk 1.
+    for (int64_t id = 4; id < 60; ++id) {
+        CHECK(bm25.add(id, "filler text number " + std::to_string(id) + " about phones that run android"));
+    }
+
+    const size_t k = 3;
+    const size_t per_source = k * 4;
+    RankedList from_index;
+    from_index.resize(per_source);
+    from_index.resize(hnsw.search(query.data(), per_source, per_source * 2, from_index.ids.data(),
+                                  from_index.scores.data()));
+    RankedList from_store;
+    from_store.resize(per_source);
+    from_store.resize(store.search(query.data(), per_source, 0, from_store.ids.data(), from_store.scores.data()));
+    const RankedList semantic = merge_ranked(from_index, from_store);
+    RankedList lexical;
+    lexical.resize(per_source);
+    lexical.resize(bm25.search("battery saving android", per_source, lexical.ids.data(), lexical.scores.data()));
+
+    CHECK(!semantic.ids.empty() && semantic.ids[0] == 2);
+    CHECK(!lexical.ids.empty() && lexical.ids[0] == 3);
+    for (const FusionMode mode : {FusionMode::Rrf, FusionMode::Weighted}) {
+        FusionParams fusion;
+        fusion.mode = mode;
+        fusion.semantic_weight = 0.5f;
+        int64_t ids[k];
+        float scores[k];
+        CHECK(fuse_ranked(semantic, lexical, fusion, k, ids, scores) == k);
+        CHECK(ids[0] == 1);
+    }
+}
+
+} // namespace
+
+int main() {
+    test_terms();
+    test_ranking();
+    test_round_trip();
+    test_fuse_ranked();
+    test_fused_retrieval();
+    std::printf("lexical_index: ok\n");
+    return 0;
+}
@@ -0,0 +1,126 @@
+// RequestScheduler: lane order, FIFO tickets within a lane, and yield handoff.
+
+#include "scheduler.h"
+
+#include "check.h"
+
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace peerchat;
+using peerchat::test::wait_until;
+
+namespace {
+
+// Order in which requests got the engine.
+struct Trace {
+    std::mutex mutex;
+    std::vector<std::string> order;
+
+    void add(const std::string & name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        order.push_back(name);
+    }
+};
+
+int waiting(const RequestScheduler & scheduler, RequestPriority priority) {
+    return scheduler.stats().lanes[static_cast<int>(priority)].waiting;
+}
+
+std::thread run_request(RequestScheduler & scheduler, RequestPriority priority, Trace & trace, std::string name) {
+    return std::thread([&scheduler, &trace, priority, name] {
+        scheduler.acquire(priority);
+        trace.add(name);
+        scheduler.release();
+    });
+}
+
+void test_interactive_preempts_queued_background() {
+    RequestScheduler scheduler;
+    Trace trace;
+    scheduler.acquire(RequestPriority::Background);
+
+    // Background queues first, interactive after it.
+    std::thread background = run_request(scheduler, RequestPriority::Background, trace, "background");
+    wait_until([&] { return waiting(scheduler, RequestPriority::Background) == 1; });
+    std::thread interactive = run_request(scheduler, RequestPriority::Interactive, trace, "interactive");
+    wait_until([&] { return waiting(scheduler, RequestPriority::Interactive) == 1; });
+
+    scheduler.release();
+    background.join();
+    interactive.join();
+    CHECK((trace.order == std::vector<std::string>{"interactive", "background"}));
+
+    const SchedulerStats stats = scheduler.stats();
+    CHECK(stats.lanes[0].requests == 1);
+    CHECK(stats.lanes[1].requests == 2);
+    CHECK(stats.lanes[0].waiting == 0 && stats.lanes[1].waiting == 0);
+}
+
+void test_fifo_within_lane() {
+    for (const RequestPriority priority : {RequestPriority::Interactive, RequestPriority::Background}) {
+        RequestScheduler scheduler;
+        Trace trace;
+        scheduler.acquire(RequestPriority::Interactive);
+
+        std::vector<std::thread> threads;
+        std::vector<std::string> expected;
+        for (int i = 0; i < 5; ++i) {
+            expected.push_back(std::to_string(i));
+            threads.push_back(run_request(scheduler, priority, trace, expected.back()));
+            // Tickets are handed out in arrival order; let each one arrive.
+            wait_until([&] { return waiting(scheduler, priority) == i + 1; });
+        }
+        scheduler.release();
+        for (auto & thread : threads) {
+            thread.join();
+        }
+        CHECK(trace.order == expected);
+    }
+}
+
+void test_yield_hands_over_to_interactive() {
+    RequestScheduler scheduler;
+    Trace trace;
+    scheduler.acquire(RequestPriority::Background);
+    CHECK(!scheduler.should_yield(RequestPriority::Background));
+
+    std::thread interactive = run_request(scheduler, RequestPriority::Interactive, trace, "interactive");
+    wait_until([&] { return scheduler.should_yield(RequestPriority::Background); });
+    CHECK(!scheduler.should_yield(RequestPriority::Interactive));
+
+    // Returns only once the interactive request has run and released.
+    scheduler.yield(RequestPriority::Background);
+    trace.add("background");
+    CHECK(!scheduler.should_yield(RequestPriority::Background));
+    scheduler.release();
+    interactive.join();
+    CHECK((trace.order == std::vector<std::string>{"interactive", "background"}));
+
+    const SchedulerStats stats = scheduler.stats();
+    CHECK(stats.lanes[1].yields == 1);
+    // A yield is the same request, not a new one.
+    CHECK(stats.lanes[1].requests == 1);
+    CHECK(stats.lanes[0].requests == 1);
+}
+
+void test_yield_without_waiters_keeps_engine() {
+    RequestScheduler scheduler;
+    scheduler.acquire(RequestPriority::Background);
+    scheduler.yield(RequestPriority::Background);
+    CHECK(scheduler.stats().lanes[1].requests == 1);
+    scheduler.release();
+}
+
+} // namespace
+
+int main() {
+    test_interactive_preempts_queued_background();
+    test_fifo_within_lane();
+    test_yield_hands_over_to_interactive();
+    test_yield_without_waiters_keeps_engine();
+    std::printf("scheduler: ok\n");
+    return 0;
+}
@@ -0,0 +1,98 @@
+// Batch tokenization on the worker pool matches one text at a time, also with
+// several callers at once (vocab-only model from argv[1]).
+
+#include "token_batch.h"
+
+#include "check.h"
+
+#include "llama.h"
+
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace peerchat;
+
+namespace {
+
+std::vector<llama_token> tokenize_one(const llama_vocab * vocab, std::string_view text) {
+    std::vector<llama_token> tokens(text.size() + 8);
+    const int32_t n = llama_tokenize(vocab, text.data(), static_cast<int32_t>(text.size()), tokens.data(),
+                                     static_cast<int32_t>(tokens.size()), true, true);
+    CHECK(n >= 0);
+    tokens.resize(static_cast<size_t>(n));
+    return tokens;
+}
+
+// Enough bytes that every worker gets a run of its own.
+std::vector<std::string> sample_texts(int salt) {
+    std::vector<std::string> texts;
+    for (int i = 0; i < 400; ++i) {
+        std::string text = "Text " + std::to_string(i + salt) + ": ";
+        for (int j = 0; j < 40 + i % 60; ++j) {
+            text += (j % 5 == 0) ? "naïve café, " : "tokens and words ";
+        }
+        texts.push_back(i % 97 == 0 ? std::string() : text);
+    }
+    return texts;
+}
+
+void check_batch(const llama_vocab * vocab, int salt, int n_workers) {
+    const std::vector<std::string> storage = sample_texts(salt);
+    const std::vector<std::string_view> texts(storage.begin(), storage.end());
+    TokenizeOptions options;
+    options.n_workers = n_workers;
+
+    TokenBatch batch;
+    tokenize_batch(vocab, texts, options, batch);
+    CHECK(batch.offsets.size() == texts.size() + 1);
+    std::vector<int32_t> counts;
+    count_tokens_batch(vocab, texts, options, counts);
+    CHECK(counts.size() == texts.size());
+    for (size_t i = 0; i < texts.size(); ++i) {
+        const std::vector<llama_token> expected = tokenize_one(vocab, texts[i]);
+        const std::vector<llama_token> got(batch.tokens.begin() + batch.offsets[i],
+                                           batch.tokens.begin() + batch.offsets[i + 1]);
+        CHECK(got == expected);
+        CHECK(counts[i] == static_cast<int32_t>(expected.size()));
+    }
+}
+
+} // namespace
+
+int main(int argc, char ** argv) {
+    CHECK(argc > 1);
+    llama_log_set([](ggml_log_level, const char *, void *) {}, nullptr);
+    llama_backend_init();
+    llama_model_params params = llama_model_default_params();
+    params.vocab_only = true;
+    llama_model * model = llama_model_load_from_file((std::string(argv[1]) + "/ggml-vocab-llama-spm.gguf").c_str(), params);
+    CHECK(model != nullptr);
+    const llama_vocab * vocab = llama_model_get_vocab(model);
+
+    TokenBatch empty;
+    tokenize_batch(vocab, {}, TokenizeOptions{}, empty);
+    CHECK(empty.tokens.empty() && empty.offsets.size() == 1);
+
+    for (const int n_workers : {1, 2, 4}) {
+        check_batch(vocab, 0, n_workers);
+    }
+    // Callers overlapping on the same pool.
+    std::vector<std::thread> callers;
+    for (int salt = 1; salt <= 3; ++salt) {
+        callers.emplace_back([vocab, salt] {
+            for (int round = 0; round < 3; ++round) {
+                check_batch(vocab, salt * 1000 + round, 1 + salt);
+            }
+        });
+    }
+    for (auto & caller : callers) {
+        caller.join();
+    }
+
+    llama_model_free(model);
+    llama_backend_free();
+    std::printf("token_batch: ok\n");
+    return 0;
+}
@@ -0,0 +1,160 @@
+// HnswIndex: recall, tombstones, replacement by id, and save/open round trips
+// including mutation of a mapped index.
+
+#include "vector_index.h"
+
+#include "check.h"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace peerchat;
+
+namespace {
+
+constexpr uint32_t kDim = 32;
+constexpr size_t kCount = 400;
+constexpr size_t kK = 10;
+
+std::vector<float> random_vector(std::mt19937 & rng) {
+    std::normal_distribution<float> dist;
+    std::vector<float> v(kDim);
+    for (float & x : v) {
+        x = dist(rng);
+    }
+    return v;
+}
+
+struct Results {
+    std::vector<int64_t> ids;
+    std::vector<float> scores;
+};
+
+Results search(const HnswIndex & index, const std::vector<float> & query) {
+    Results r;
+    r.ids.resize(kK);
+    r.scores.resize(kK);
+    const size_t n = index.search(query.data(), kK, 64, r.ids.data(), r.scores.data());
+    r.ids.resize(n);
+    r.scores.resize(n);
+    return r;
+}
+
+bool has(const Results & r, int64_t id) {
+    for (const int64_t x : r.ids) {
+        if (x == id) return true;
+    }
+    return false;
+}
+
+void test_type(VectorType type) {
+    const std::string path = type == VectorType::F16 ? "test_vector_index_f16.bin" : "test_vector_index_f32.bin";
+    std::mt19937 rng(42);
+    HnswIndex::Params params;
+    params.dim = kDim;
+    params.type = type;
+    HnswIndex index(params);
+
+    std::vector<std::vector<float>> vectors;
+    for (size_t i = 0; i < kCount; ++i) {
+        vectors.push_back(random_vector(rng));
+        CHECK(index.add(static_cast<int64_t>(i), vectors.back().data()));
+    }
+    const std::vector<float> zero(kDim, 0.0f);
+    CHECK(!index.add(9999, zero.data()));
+    CHECK(index.size() == kCount);
+
+    // Every row finds itself.
+    size_t found_self = 0;
+    for (size_t i = 0; i < kCount; ++i) {
+        const Results r = search(index, vectors[i]);
+        found_self += !r.ids.empty() && r.ids[0] == static_cast<int64_t>(i);
+    }
+    CHECK(found_self >= kCount * 98 / 100);
+
+    // Removed ids stay out of results even when queried exactly.
+    std::vector<int64_t> removed;
+    for (int64_t id = 0; id < static_cast<int64_t>(kCount); id += 7) {
+        CHECK(index.remove(id));
+        removed.push_back(id);
+    }
+    CHECK(!index.remove(removed.front()));
+    CHECK(!index.contains(removed.front()));
+
+    // Re-adding an id replaces its vector.
+    const int64_t replaced = 3;
+    const std::vector<float> old_vector = vectors[replaced];
+    vectors[replaced] = random_vector(rng);
+    CHECK(index.add(replaced, vectors[replaced].data()));
+    CHECK(index.size() == kCount - removed.size());
+
+    auto check_index = [&](const HnswIndex & idx) {
+        for (const int64_t id : removed) {
+            CHECK(!has(search(idx, vectors[static_cast<size_t>(id)]), id));
+        }
+        const Results now = search(idx, vectors[replaced]);
+        CHECK(!now.ids.empty() && now.ids[0] == replaced && now.scores[0] > 0.99f);
+        const Results before = search(idx, old_vector);
+        CHECK(!(before.ids.size() > 0 && before.ids[0] == replaced && before.scores[0] > 0.99f));
+    };
+    check_index(index);
+
+    // Save and open: same results, bit for bit.
+    CHECK(index.save(path));
+    std::unique_ptr<HnswIndex> reopened = HnswIndex::open(path);
+    CHECK(reopened != nullptr);
+    CHECK(reopened->dim() == kDim && reopened->type() == type);
+    CHECK(reopened->size() == index.size());
+    CHECK(reopened->node_count() == index.node_count());
+    for (size_t i = 0; i < kCount; i += 5) {
+        const Results a = search(index, vectors[i]);
+        const Results b = search(*reopened, vectors[i]);
+        CHECK(a.ids == b.ids);
+        CHECK(a.scores == b.scores);
+    }
+    check_index(*reopened);
+
+    // Mutating the mapped index copies what it touches and leaves the rest intact.
+    std::vector<float> fresh = random_vector(rng);
+    CHECK(reopened->add(100000, fresh.data()));
+    CHECK(reopened->remove(1));
+    const Results fresh_hit = search(*reopened, fresh);
+    CHECK(!fresh_hit.ids.empty() && fresh_hit.ids[0] == 100000);
+    CHECK(!has(search(*reopened, vectors[1]), 1));
+    check_index(*reopened);
+
+    // And that survives another round trip.
+    CHECK(reopened->save(path));
+    reopened.reset();
+    std::unique_ptr<HnswIndex> again = HnswIndex::open(path);
+    CHECK(again != nullptr);
+    CHECK(again->contains(100000) && !again->contains(1));
+    check_index(*again);
+    again.reset();
+
+    // A truncated file is rejected rather than mapped.
+    {
+        std::ifstream in(path, std::ios::binary);
+        const std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        in.close();
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(bytes.data(), static_cast<std::streamsize>(bytes.size() / 2));
+    }
+    CHECK(HnswIndex::open(path) == nullptr);
+    CHECK(HnswIndex::open(path + ".missing") == nullptr);
+    std::remove(path.c_str());
+}
+
+} // namespace
+
+int main() {
+    test_type(VectorType::F16);
+    test_type(VectorType::F32);
+    std::printf("vector_index: ok\n");
+    return 0;
+}
@@ -0,0 +1,161 @@
+// QuantizedStore: approximate scores, swap-remove, replacement by id, and
+// save/open round trips.
+
+#include "vector_store.h"
+
+#include "check.h"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace peerchat;
+
+namespace {
+
+constexpr uint32_t kDim = 96;
+constexpr size_t kCount = 300;
+constexpr size_t kK = 10;
+
+std::vector<float> random_vector(std::mt19937 & rng) {
+    std::normal_distribution<float> dist;
+    std::vector<float> v(kDim);
+    for (float & x : v) {
+        x = dist(rng);
+    }
+    return v;
+}
+
+float cosine(const std::vector<float> & a, const std::vector<float> & b) {
+    double dot = 0, na = 0, nb = 0;
+    for (size_t i = 0; i < a.size(); ++i) {
+        dot += a[i] * b[i];
+        na += a[i] * a[i];
+        nb += b[i] * b[i];
+    }
+    return static_cast<float>(dot / std::sqrt(na * nb));
+}
+
+struct Results {
+    std::vector<int64_t> ids;
+    std::vector<float> scores;
+};
+
+// Every row rescored, so the ranking is the int8 one without the Hamming cut.
+Results search(const QuantizedStore & store, const std::vector<float> & query) {
+    Results r;
+    r.ids.resize(kK);
+    r.scores.resize(kK);
+    const size_t n = store.search(query.data(), kK, kCount * 2, r.ids.data(), r.scores.data());
+    r.ids.resize(n);
+    r.scores.resize(n);
+    return r;
+}
+
+bool has(const Results & r, int64_t id) {
+    for (const int64_t x : r.ids) {
+        if (x == id) return true;
+    }
+    return false;
+}
+
+} // namespace
+
+int main() {
+    const std::string path = "test_vector_store.bin";
+    std::mt19937 rng(7);
+    QuantizedStore store(kDim);
+
+    std::vector<std::vector<float>> vectors;
+    for (size_t i = 0; i < kCount; ++i) {
+        vectors.push_back(random_vector(rng));
+        CHECK(store.add(static_cast<int64_t>(i) * 10, vectors.back().data()));
+    }
+    const std::vector<float> zero(kDim, 0.0f);
+    CHECK(!store.add(1, zero.data()));
+    CHECK(store.size() == kCount);
+
+    // Rows find themselves, and the approximate cosine stays close to the real one.
+    for (size_t i = 0; i < kCount; i += 3) {
+        const Results r = search(store, vectors[i]);
+        CHECK(!r.ids.empty() && r.ids[0] == static_cast<int64_t>(i) * 10);
+        CHECK(r.scores[0] > 0.97f);
+        for (size_t j = 1; j < r.ids.size(); ++j) {
+            CHECK(r.scores[j - 1] >= r.scores[j]);
+            const float exact = cosine(vectors[i], vectors[static_cast<size_t>(r.ids[j] / 10)]);
+            CHECK(std::fabs(r.scores[j] - exact) < 0.05f);
+        }
+    }
+
+    // Removing swaps the last row into the hole; both ids stay consistent.
+    std::vector<int64_t> removed;
+    for (size_t i = 0; i < kCount; i += 9) {
+        CHECK(store.remove(static_cast<int64_t>(i) * 10));
+        removed.push_back(static_cast<int64_t>(i) * 10);
+    }
+    CHECK(!store.remove(removed.front()));
+    CHECK(store.size() == kCount - removed.size());
+
+    // Re-adding an id replaces its row instead of adding a second one.
+    const int64_t replaced = 10;
+    const std::vector<float> old_vector = vectors[1];
+    vectors[1] = random_vector(rng);
+    const size_t size_before = store.size();
+    CHECK(store.add(replaced, vectors[1].data()));
+    CHECK(store.size() == size_before);
+
+    auto check_store = [&](const QuantizedStore & s) {
+        for (const int64_t id : removed) {
+            CHECK(!has(search(s, vectors[static_cast<size_t>(id / 10)]), id));
+        }
+        for (size_t i = 0; i < kCount; i += 4) {
+            const int64_t id = static_cast<int64_t>(i) * 10;
+            if (i % 9 == 0) continue;
+            const Results r = search(s, vectors[i]);
+            CHECK(!r.ids.empty() && r.ids[0] == id);
+        }
+        const Results before = search(s, old_vector);
+        CHECK(!(before.ids.size() > 0 && before.ids[0] == replaced && before.scores[0] > 0.97f));
+    };
+    check_store(store);
+
+    // Save and open: same results, bit for bit.
+    CHECK(store.save(path));
+    std::unique_ptr<QuantizedStore> reopened = QuantizedStore::open(path);
+    CHECK(reopened != nullptr);
+    CHECK(reopened->dim() == kDim && reopened->size() == store.size());
+    CHECK(reopened->resident_bytes() == store.resident_bytes());
+    for (size_t i = 0; i < kCount; i += 5) {
+        const Results a = search(store, vectors[i]);
+        const Results b = search(*reopened, vectors[i]);
+        CHECK(a.ids == b.ids);
+        CHECK(a.scores == b.scores);
+    }
+    check_store(*reopened);
+
+    // The reopened store keeps its id map: removes and replacements still work.
+    CHECK(reopened->remove(20));
+    CHECK(!has(search(*reopened, vectors[2]), 20));
+    CHECK(reopened->add(30, vectors[2].data()));
+    const Results moved = search(*reopened, vectors[2]);
+    CHECK(!moved.ids.empty() && moved.ids[0] == 30);
+
+    // A truncated file is rejected.
+    {
+        std::ifstream in(path, std::ios::binary);
+        const std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        in.close();
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(bytes.data(), static_cast<std::streamsize>(bytes.size() - 1));
+    }
+    CHECK(QuantizedStore::open(path) == nullptr);
+    CHECK(QuantizedStore::open(path + ".missing") == nullptr);
+    std::remove(path.c_str());
+
+    std::printf("vector_store: ok\n");
+    return 0;
+}
@@ -0,0 +1,193 @@
+#include "token_batch.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace peerchat {
+
+namespace {
+
+// Below this much text per thread, starting one costs more than it saves.
+constexpr size_t kMinBytesPerWorker = 16 * 1024;
+
+// Appends the tokens of `text`; returns how many, 0 if it does not tokenize.
+uint32_t append_tokens(const llama_vocab * vocab, std::string_view text, const TokenizeOptions & options,
+                       std::vector<llama_token> & tokens) {
+    const size_t at = tokens.size();
+    // Hardly ever more tokens than bytes; a larger need is reported and retried.
+    tokens.resize(at + text.size() + 8);
+    int32_t n = llama_tokenize(vocab, text.data(), static_cast<int32_t>(text.size()), tokens.data() + at,
+                               static_cast<int32_t>(tokens.size() - at), options.add_special, options.parse_special);
+    if (n < 0) {
+        tokens.resize(at + static_cast<size_t>(-n));
+        n = llama_tokenize(vocab, text.data(), static_cast<int32_t>(text.size()), tokens.data() + at,
+                           static_cast<int32_t>(tokens.size() - at), options.add_special, options.parse_special);
+    }
+    tokens.resize(at + static_cast<size_t>(std::max(n, 0)));
+    return static_cast<uint32_t>(std::max(n, 0));
+}
+
+// First text of each run, then texts.size(): contiguous runs of about the
+// same number of bytes, one per worker.
+std::vector<size_t> partition(const std::vector<std::string_view> & texts, int n_workers) {
+    size_t total = 0;
+    for (const auto & text : texts) {
+        total += text.size();
+    }
+    const size_t runs = std::clamp<size_t>(total / kMinBytesPerWorker, 1,
+                                           std::min<size_t>(static_cast<size_t>(std::max(n_workers, 1)),
+                                                            std::max<size_t>(texts.size(), 1)));
+    std::vector<size_t> bounds{0};
+    size_t seen = 0;
+    for (size_t i = 0; i + 1 < texts.size() && bounds.size() < runs; ++i) {
+        seen += texts[i].size();
+        if (seen * runs >= total * bounds.size()) {
+            bounds.push_back(i + 1);
+        }
+    }
+    bounds.push_back(texts.size());
+    return bounds;
+}
+
+// Threads kept for the life of the process, so a batch of short texts does
+// not pay for starting and joining threads on every call. It grows to the
+// most workers any call asked for. Calls may overlap; a caller waiting on its
+// runs takes queued ones itself, so it never waits on busy workers alone.
+class WorkerPool {
+public:
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        ready_.notify_all();
+        for (auto & thread : threads_) {
+            thread.join();
+        }
+    }
+
+    // Runs fn(run) for every run, the first on the calling thread.
+    template <typename Fn>
+    void for_each_run(size_t runs, Fn && fn) {
+        if (runs == 0) {
+            return;
+        }
+        size_t pending = runs - 1;
+        if (pending > 0) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            while (threads_.size() < pending) {
+                threads_.emplace_back([this] { work(); });
+            }
+            for (size_t run = 1; run < runs; ++run) {
+                tasks_.emplace_back([this, &fn, &pending, run] {
+                    fn(run);
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (--pending == 0) {
+                        done_.notify_all();
+                    }
+                });
+            }
+        }
+        ready_.notify_all();
+        fn(size_t{0});
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (pending > 0) {
+            if (!tasks_.empty()) {
+                run_one(lock);
+            } else {
+                done_.wait(lock);
+            }
+        }
+    }
+
+private:
+    // Called with the lock held; runs the oldest task without it.
+    void run_one(std::unique_lock<std::mutex> & lock) {
+        std::function<void()> task = std::move(tasks_.front());
+        tasks_.pop_front();
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+
+    void work() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            ready_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+            if (tasks_.empty()) {
+                return;
+            }
+            run_one(lock);
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::condition_variable done_;
+    std::deque<std::function<void()>> tasks_;
+    std::vector<std::thread> threads_;
+    bool stop_ = false;
+};
+
+WorkerPool & worker_pool() {
+    static WorkerPool pool;
+    return pool;
+}
+
+} // namespace
+
+void tokenize_batch(const llama_vocab * vocab, const std::vector<std::string_view> & texts,
+                    const TokenizeOptions & options, TokenBatch & out) {
+    out.tokens.clear();
+    out.offsets.assign(1, 0);
+    if (!vocab || texts.empty()) {
+        return;
+    }
+    const std::vector<size_t> bounds = partition(texts, options.n_workers);
+    const size_t runs = bounds.size() - 1;
+    std::vector<TokenBatch> parts(runs);
+    worker_pool().for_each_run(runs, [&](size_t run) {
+        // The first run needs no copy afterwards.
+        TokenBatch & part = run == 0 ? out : parts[run];
+        part.offsets.resize(1, 0);
+        for (size_t i = bounds[run]; i < bounds[run + 1]; ++i) {
+            append_tokens(vocab, texts[i], options, part.tokens);
+            part.offsets.push_back(static_cast<uint32_t>(part.tokens.size()));
+        }
+    });
+    size_t total = out.tokens.size();
+    for (size_t run = 1; run < runs; ++run) {
+        total += parts[run].tokens.size();
+    }
+    out.tokens.reserve(total);
+    out.offsets.reserve(texts.size() + 1);
+    for (size_t run = 1; run < runs; ++run) {
+        const uint32_t base = static_cast<uint32_t>(out.tokens.size());
+        out.tokens.insert(out.tokens.end(), parts[run].tokens.begin(), parts[run].tokens.end());
+        for (size_t i = 1; i < parts[run].offsets.size(); ++i) {
+            out.offsets.push_back(base + parts[run].offsets[i]);
+        }
+    }
+}
+
+void count_tokens_batch(const llama_vocab * vocab, const std::vector<std::string_view> & texts,
+                        const TokenizeOptions & options, std::vector<int32_t> & counts) {
+    counts.assign(texts.size(), 0);
+    if (!vocab || texts.empty()) {
+        return;
+    }
+    const std::vector<size_t> bounds = partition(texts, options.n_workers);
+    worker_pool().for_each_run(bounds.size() - 1, [&](size_t run) {
+        std::vector<llama_token> scratch;
+        for (size_t i = bounds[run]; i < bounds[run + 1]; ++i) {
+            scratch.clear();
+            counts[i] = static_cast<int32_t>(append_tokens(vocab, texts[i], options, scratch));
+        }
+    });
+}
+
+} // namespace peerchat
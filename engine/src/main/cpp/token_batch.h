@@ -0,0 +1,37 @@
+#pragma once
+
+#include "llama.h"
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace peerchat {
+
+// Tokenization of many texts at once. llama_tokenize only reads the
+// vocabulary, so the texts are split into contiguous runs of similar byte
+// size and tokenized on several threads, drawn from a pool that outlives the
+// call; each run fills one growing buffer instead of a vector per text.
+
+struct TokenizeOptions {
+    bool add_special = true;
+    bool parse_special = true;
+    // Upper bound on threads, the caller's included.
+    int n_workers = 1;
+};
+
+// Tokens of every text laid end to end; text i owns
+// tokens[offsets[i], offsets[i + 1]). A text that fails to tokenize owns none.
+struct TokenBatch {
+    std::vector<llama_token> tokens;
+    std::vector<uint32_t> offsets;
+};
+
+void tokenize_batch(const llama_vocab * vocab, const std::vector<std::string_view> & texts,
+                    const TokenizeOptions & options, TokenBatch & out);
+
+// Token count of every text, without keeping the tokens.
+void count_tokens_batch(const llama_vocab * vocab, const std::vector<std::string_view> & texts,
+                        const TokenizeOptions & options, std::vector<int32_t> & counts);
+
+} // namespace peerchat
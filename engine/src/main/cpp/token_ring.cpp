@@ -0,0 +1,229 @@
+#include "token_ring.h"
+
+#include "detokenizer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace peerchat {
+
+struct TokenRing::Header {
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> tail;
+    std::atomic<uint32_t> tokens;
+    std::atomic<uint32_t> state;
+    uint32_t capacity;
+    // Set by a side before it sleeps so the other side only pays for an
+    // eventfd write when somebody is actually parked.
+    std::atomic<uint32_t> consumer_waiting;
+    std::atomic<uint32_t> producer_waiting;
+};
+
+namespace {
+
+// Producer re-checks the abort flag at this interval while the ring is full.
+constexpr int kFullWaitMs = 50;
+
+bool is_continuation(uint8_t c) {
+    return (c & 0xC0) == 0x80;
+}
+
+} // namespace
+
+TokenRing * TokenRing::create(uint32_t capacity) {
+    capacity = std::max<uint32_t>(capacity, 4096);
+    const size_t size = kTokenRingHeaderSize + capacity;
+    void * region = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        return nullptr;
+    }
+    const int data_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    const int space_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (data_fd < 0 || space_fd < 0) {
+        if (data_fd >= 0) ::close(data_fd);
+        if (space_fd >= 0) ::close(space_fd);
+        munmap(region, size);
+        return nullptr;
+    }
+    return new (std::nothrow) TokenRing(region, capacity, data_fd, space_fd);
+}
+
+TokenRing::TokenRing(void * region, uint32_t capacity, int data_fd, int space_fd)
+    : region_(region), capacity_(capacity), data_fd_(data_fd), space_fd_(space_fd) {
+    static_assert(sizeof(Header) <= kTokenRingHeaderSize, "token ring header overflows its slot");
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "token ring needs lock-free 64-bit atomics");
+    new (region_) Header{};
+    header()->capacity = capacity_;
+}
+
+TokenRing::~TokenRing() {
+    ::close(data_fd_);
+    ::close(space_fd_);
+    munmap(region_, region_size());
+}
+
+TokenRing::Header * TokenRing::header() const {
+    return static_cast<Header *>(region_);
+}
+
+uint8_t * TokenRing::data() const {
+    return static_cast<uint8_t *>(region_) + kTokenRingHeaderSize;
+}
+
+void TokenRing::reset() {
+    Header * h = header();
+    h->head.store(0, std::memory_order_relaxed);
+    h->tail.store(0, std::memory_order_relaxed);
+    h->tokens.store(0, std::memory_order_relaxed);
+    h->consumer_waiting.store(0, std::memory_order_relaxed);
+    h->producer_waiting.store(0, std::memory_order_relaxed);
+    h->state.store(static_cast<uint32_t>(TokenRingState::Open), std::memory_order_seq_cst);
+    drain(data_fd_);
+    drain(space_fd_);
+    pending_len_ = 0;
+}
+
+bool TokenRing::push(const char * src, size_t size, const std::atomic<bool> & abort) {
+    Header * h = header();
+    if (pending_len_ > 0) {
+        const size_t need = utf8_sequence_length(static_cast<uint8_t>(pending_[0]));
+        while (pending_len_ < need && size > 0 && is_continuation(static_cast<uint8_t>(*src))) {
+            pending_[pending_len_++] = *src++;
+            --size;
+        }
+        if (pending_len_ < need && size == 0) {
+            h->tokens.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        if (!write_bytes(pending_, pending_len_, abort)) {
+            return false;
+        }
+        pending_len_ = 0;
+    }
+
+    const size_t complete = utf8_complete_prefix(src, size);
+    if (!write_bytes(src, complete, abort)) {
+        return false;
+    }
+    pending_len_ = size - complete;
+    std::memcpy(pending_, src + complete, pending_len_);
+
+    h->tokens.fetch_add(1, std::memory_order_relaxed);
+    publish(h->head.load(std::memory_order_relaxed));
+    return true;
+}
+
+void TokenRing::close() {
+    Header * h = header();
+    if (pending_len_ > 0) {
+        // Invalid trailing bytes; the consumer's decoder replaces them. Never
+        // block here: a consumer that went away must not wedge the decode thread.
+        const std::atomic<bool> give_up{true};
+        write_bytes(pending_, pending_len_, give_up);
+        pending_len_ = 0;
+    }
+    publish(h->head.load(std::memory_order_relaxed));
+    h->state.store(static_cast<uint32_t>(TokenRingState::Closed), std::memory_order_seq_cst);
+    signal(data_fd_);
+}
+
+int64_t TokenRing::await(uint32_t consumed, int timeout_ms) {
+    Header * h = header();
+    if (consumed > 0) {
+        h->tail.fetch_add(consumed, std::memory_order_seq_cst);
+        if (h->producer_waiting.exchange(0, std::memory_order_seq_cst)) {
+            signal(space_fd_);
+        }
+    }
+
+    bool waited = false;
+    for (;;) {
+        const uint64_t tail = h->tail.load(std::memory_order_relaxed);
+        const bool closed = h->state.load(std::memory_order_acquire) == static_cast<uint32_t>(TokenRingState::Closed);
+        const uint64_t head = h->head.load(std::memory_order_acquire);
+        if (head != tail) {
+            return static_cast<int64_t>(head - tail);
+        }
+        if (closed) {
+            return -1;
+        }
+        if (waited || timeout_ms <= 0) {
+            return 0;
+        }
+
+        h->consumer_waiting.store(1, std::memory_order_seq_cst);
+        if (h->head.load(std::memory_order_seq_cst) == tail &&
+            h->state.load(std::memory_order_seq_cst) == static_cast<uint32_t>(TokenRingState::Open)) {
+            pollfd pfd{data_fd_, POLLIN, 0};
+            while (poll(&pfd, 1, timeout_ms) < 0 && errno == EINTR) {
+            }
+            drain(data_fd_);
+        }
+        h->consumer_waiting.store(0, std::memory_order_relaxed);
+        waited = true;
+    }
+}
+
+bool TokenRing::write_bytes(const char * src, size_t size, const std::atomic<bool> & abort) {
+    Header * h = header();
+    uint64_t head = h->head.load(std::memory_order_relaxed);
+    while (size > 0) {
+        const uint64_t tail = h->tail.load(std::memory_order_acquire);
+        const size_t space = capacity_ - static_cast<size_t>(head - tail);
+        if (space == 0) {
+            // Make what we have visible before parking on the consumer.
+            publish(head);
+            if (abort.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            h->producer_waiting.store(1, std::memory_order_seq_cst);
+            if (h->tail.load(std::memory_order_seq_cst) == tail) {
+                pollfd pfd{space_fd_, POLLIN, 0};
+                while (poll(&pfd, 1, kFullWaitMs) < 0 && errno == EINTR) {
+                }
+            }
+            h->producer_waiting.store(0, std::memory_order_relaxed);
+            drain(space_fd_);
+            continue;
+        }
+        const size_t n = std::min(size, space);
+        const size_t offset = static_cast<size_t>(head % capacity_);
+        const size_t first = std::min(n, capacity_ - offset);
+        std::memcpy(data() + offset, src, first);
+        std::memcpy(data(), src + first, n - first);
+        src += n;
+        size -= n;
+        head += n;
+        // Visible right away; the wakeup is deferred to publish().
+        h->head.store(head, std::memory_order_release);
+    }
+    return true;
+}
+
+void TokenRing::publish(uint64_t head) {
+    Header * h = header();
+    h->head.store(head, std::memory_order_seq_cst);
+    if (h->consumer_waiting.exchange(0, std::memory_order_seq_cst)) {
+        signal(data_fd_);
+    }
+}
+
+void TokenRing::signal(int fd) {
+    const uint64_t one = 1;
+    while (::write(fd, &one, sizeof(one)) < 0 && errno == EINTR) {
+    }
+}
+
+void TokenRing::drain(int fd) {
+    uint64_t value = 0;
+    while (::read(fd, &value, sizeof(value)) < 0 && errno == EINTR) {
+    }
+}
+
+} // namespace peerchat
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace peerchat {
+
+// Single-producer/single-consumer byte ring carrying streamed UTF-8 text from
+// the decode loop to Java without a JNI upcall per token.
+//
+// The whole region (header + data) is handed to Java as one direct ByteBuffer.
+// Java only reads the data area; head/tail are published and consumed through
+// await(), so ordering never depends on Java reading the header. The producer
+// holds back an incomplete trailing UTF-8 sequence, so every committed range
+// decodes on its own.
+//
+// Layout (little-endian, offsets in bytes):
+//   0  u64 head      bytes committed by the producer (monotonic)
+//   8  u64 tail      bytes released by the consumer (monotonic)
+//  16  u32 tokens    pieces pushed so far (sequence counter)
+//  20  u32 state     TokenRingState
+//  24  u32 capacity  size of the data area
+//  64  data[capacity]
+constexpr uint32_t kTokenRingHeaderSize = 64;
+constexpr uint32_t kTokenRingDefaultCapacity = 64u << 10;
+
+enum class TokenRingState : uint32_t {
+    Open = 0,
+    Closed = 1,
+};
+
+class TokenRing {
+public:
+    // Returns nullptr when the region or the eventfds cannot be allocated.
+    static TokenRing * create(uint32_t capacity);
+    ~TokenRing();
+
+    TokenRing(const TokenRing &) = delete;
+    TokenRing & operator=(const TokenRing &) = delete;
+
+    void * region() const { return region_; }
+    size_t region_size() const { return kTokenRingHeaderSize + capacity_; }
+
+    // Producer side. reset() starts a new stream; push() blocks while the ring
+    // is full and gives up when abort is raised. close() flushes held-back
+    // bytes, marks the stream finished and always wakes the consumer.
+    void reset();
+    bool push(const char * data, size_t size, const std::atomic<bool> & abort);
+    void close();
+
+    // Consumer side. Releases `consumed` bytes, then waits up to timeout_ms
+    // for data. Returns the readable byte count, 0 on timeout, or -1 once the
+    // stream is closed and fully drained.
+    int64_t await(uint32_t consumed, int timeout_ms);
+
+private:
+    struct Header;
+
+    TokenRing(void * region, uint32_t capacity, int data_fd, int space_fd);
+
+    Header * header() const;
+    uint8_t * data() const;
+    bool write_bytes(const char * src, size_t size, const std::atomic<bool> & abort);
+    void publish(uint64_t head);
+    static void signal(int fd);
+    static void drain(int fd);
+
+    void * region_;
+    uint32_t capacity_;
+    int data_fd_;
+    int space_fd_;
+    // Incomplete UTF-8 tail from the previous push (at most 3 bytes).
+    char pending_[4] = {};
+    size_t pending_len_ = 0;
+};
+
+} // namespace peerchat
@@ -0,0 +1,512 @@
+#include "vector_index.h"
+
+#include "file_io.h"
+#include "vector_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <queue>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+
+namespace peerchat {
+
+namespace {
+
+struct FileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t dim;
+    uint32_t type;
+    uint32_t m;
+    uint32_t ef_construction;
+    uint32_t entry;
+    uint32_t max_level;
+    uint64_t nodes;
+    uint64_t upper_size;
+};
+
+// Sections start on cache-line boundaries so mapped rows stay SIMD-aligned.
+constexpr size_t kSectionAlign = 64;
+constexpr uint32_t kMaxLevel = 15;
+
+size_t align_up(size_t v) {
+    return (v + kSectionAlign - 1) & ~(kSectionAlign - 1);
+}
+
+// Epoch-tagged visited marks; reset is O(1) except on epoch wrap.
+struct VisitedSet {
+    std::vector<uint32_t> marks;
+    uint32_t epoch = 0;
+
+    void reset(size_t n) {
+        if (marks.size() < n) {
+            marks.resize(n, 0);
+        }
+        if (++epoch == 0) {
+            std::fill(marks.begin(), marks.end(), 0);
+            epoch = 1;
+        }
+    }
+    bool insert(uint32_t i) {
+        if (marks[i] == epoch) {
+            return false;
+        }
+        marks[i] = epoch;
+        return true;
+    }
+};
+
+thread_local VisitedSet t_visited;
+// Decoded rows for neighbour selection; two because link_back selects around a base row.
+thread_local std::vector<float> t_candidate_row;
+thread_local std::vector<float> t_base_row;
+
+} // namespace
+
+HnswIndex::HnswIndex(const Params & params)
+    : params_(params),
+      m0_(2 * std::max<uint32_t>(params.m, 2)),
+      level_mult_(1.0 / std::log(static_cast<double>(std::max<uint32_t>(params.m, 2)))),
+      rng_(0x5eed) {
+    params_.m = std::max<uint32_t>(params_.m, 2);
+    params_.ef_construction = std::max(params_.ef_construction, params_.m);
+}
+
+HnswIndex::~HnswIndex() {
+    if (mapping_) {
+        munmap(mapping_, mapping_size_);
+    }
+}
+
+size_t HnswIndex::row_bytes() const {
+    return static_cast<size_t>(params_.dim) * (params_.type == VectorType::F16 ? sizeof(uint16_t) : sizeof(float));
+}
+
+float HnswIndex::similarity(const float * query, uint32_t node) const {
+    const uint8_t * row = rows_.data() + static_cast<size_t>(node) * row_bytes();
+    if (params_.type == VectorType::F16) {
+        return dot_f16(query, reinterpret_cast<const uint16_t *>(row), params_.dim);
+    }
+    return dot_f32(query, reinterpret_cast<const float *>(row), params_.dim);
+}
+
+void HnswIndex::decode_row(uint32_t node, float * out) const {
+    const uint8_t * row = rows_.data() + static_cast<size_t>(node) * row_bytes();
+    if (params_.type == VectorType::F16) {
+        f16_to_f32(reinterpret_cast<const uint16_t *>(row), out, params_.dim);
+    } else {
+        std::memcpy(out, row, row_bytes());
+    }
+}
+
+const uint32_t * HnswIndex::links(uint32_t node, uint32_t level) const {
+    if (level == 0) {
+        return links0_.data() + static_cast<size_t>(node) * (m0_ + 1);
+    }
+    return links_upper_.data() + upper_offsets_[node] + static_cast<size_t>(level - 1) * (params_.m + 1);
+}
+
+uint32_t * HnswIndex::links_mut(uint32_t node, uint32_t level) {
+    if (level == 0) {
+        return links0_.mut().data() + static_cast<size_t>(node) * (m0_ + 1);
+    }
+    return links_upper_.mut().data() + upper_offsets_[node] + static_cast<size_t>(level - 1) * (params_.m + 1);
+}
+
+uint32_t HnswIndex::random_level() {
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    const double u = std::max(uniform(rng_), 1e-12);
+    return std::min(kMaxLevel, static_cast<uint32_t>(-std::log(u) * level_mult_));
+}
+
+uint32_t HnswIndex::greedy_descend(const float * query, uint32_t entry, uint32_t from_level, uint32_t to_level) const {
+    uint32_t cur = entry;
+    float best = similarity(query, cur);
+    for (uint32_t level = from_level; level >= to_level && level > 0; --level) {
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            const uint32_t * l = links(cur, level);
+            for (uint32_t i = 1; i <= l[0]; ++i) {
+                const float s = similarity(query, l[i]);
+                if (s > best) {
+                    best = s;
+                    cur = l[i];
+                    changed = true;
+                }
+            }
+        }
+    }
+    return cur;
+}
+
+std::vector<HnswIndex::Scored> HnswIndex::search_layer(const float * query, uint32_t entry, size_t ef,
+                                                       uint32_t level, bool skip_deleted) const {
+    VisitedSet & visited = t_visited;
+    visited.reset(node_count());
+
+    // candidates: best first; top: worst first, bounded by ef.
+    std::priority_queue<Scored> candidates;
+    std::priority_queue<Scored, std::vector<Scored>, std::greater<Scored>> top;
+
+    const float entry_sim = similarity(query, entry);
+    visited.insert(entry);
+    candidates.emplace(entry_sim, entry);
+    if (!skip_deleted || !deleted_[entry]) {
+        top.emplace(entry_sim, entry);
+    }
+
+    while (!candidates.empty()) {
+        const Scored current = candidates.top();
+        if (top.size() >= ef && current.first < top.top().first) {
+            break;
+        }
+        candidates.pop();
+
+        const uint32_t * l = links(current.second, level);
+        const uint32_t count = l[0];
+        for (uint32_t i = 1; i <= count; ++i) {
+            if (i < count) {
+                __builtin_prefetch(rows_.data() + static_cast<size_t>(l[i + 1]) * row_bytes());
+            }
+            const uint32_t nb = l[i];
+            if (!visited.insert(nb)) {
+                continue;
+            }
+            const float s = similarity(query, nb);
+            if (top.size() < ef || s > top.top().first) {
+                candidates.emplace(s, nb);
+                if (!skip_deleted || !deleted_[nb]) {
+                    top.emplace(s, nb);
+                    if (top.size() > ef) {
+                        top.pop();
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<Scored> out;
+    out.reserve(top.size());
+    while (!top.empty()) {
+        out.push_back(top.top());
+        top.pop();
+    }
+    std::reverse(out.begin(), out.end());
+    return out;
+}
+
+// Keeps a candidate only if it is closer to the base than to every neighbour
+// already kept, which spreads links across directions (HNSW heuristic).
+std::vector<uint32_t> HnswIndex::select_neighbors(std::vector<Scored> candidates, uint32_t max_count) const {
+    std::sort(candidates.begin(), candidates.end(), std::greater<Scored>());
+    std::vector<uint32_t> selected;
+    selected.reserve(max_count);
+    if (candidates.size() <= max_count) {
+        for (const auto & c : candidates) {
+            selected.push_back(c.second);
+        }
+        return selected;
+    }
+
+    std::vector<float> & row = t_candidate_row;
+    row.resize(params_.dim);
+    for (const auto & c : candidates) {
+        if (selected.size() >= max_count) {
+            break;
+        }
+        decode_row(c.second, row.data());
+        bool keep = true;
+        for (uint32_t s : selected) {
+            if (similarity(row.data(), s) > c.first) {
+                keep = false;
+                break;
+            }
+        }
+        if (keep) {
+            selected.push_back(c.second);
+        }
+    }
+    return selected;
+}
+
+void HnswIndex::link_back(uint32_t neighbor, uint32_t node, uint32_t level) {
+    uint32_t * l = links_mut(neighbor, level);
+    const uint32_t cap = capacity_at(level);
+    const uint32_t count = l[0];
+    for (uint32_t i = 1; i <= count; ++i) {
+        if (l[i] == node) {
+            return;
+        }
+    }
+    if (count < cap) {
+        l[count + 1] = node;
+        l[0] = count + 1;
+        return;
+    }
+
+    std::vector<float> & base = t_base_row;
+    base.resize(params_.dim);
+    decode_row(neighbor, base.data());
+    std::vector<Scored> candidates;
+    candidates.reserve(count + 1);
+    for (uint32_t i = 1; i <= count; ++i) {
+        candidates.emplace_back(similarity(base.data(), l[i]), l[i]);
+    }
+    candidates.emplace_back(similarity(base.data(), node), node);
+
+    const std::vector<uint32_t> kept = select_neighbors(std::move(candidates), cap);
+    l[0] = static_cast<uint32_t>(kept.size());
+    std::copy(kept.begin(), kept.end(), l + 1);
+}
+
+bool HnswIndex::add(int64_t id, const float * vec) {
+    if (!vec || params_.dim == 0) {
+        return false;
+    }
+    std::vector<float> query(vec, vec + params_.dim);
+    if (normalize_f32(query.data(), params_.dim) <= 0.0f) {
+        return false;
+    }
+
+    auto existing = id_to_node_.find(id);
+    if (existing != id_to_node_.end()) {
+        deleted_.mut()[existing->second] = 1;
+        id_to_node_.erase(existing);
+    }
+
+    const uint32_t node = static_cast<uint32_t>(node_count());
+    const uint32_t level = random_level();
+
+    ids_.mut().push_back(id);
+    levels_.mut().push_back(static_cast<uint8_t>(level));
+    deleted_.mut().push_back(0);
+    std::vector<uint32_t> & upper = links_upper_.mut();
+    upper_offsets_.mut().push_back(static_cast<uint32_t>(upper.size()));
+    upper.resize(upper.size() + static_cast<size_t>(level) * (params_.m + 1), 0);
+    links0_.mut().resize(static_cast<size_t>(node + 1) * (m0_ + 1), 0);
+
+    std::vector<uint8_t> & rows = rows_.mut();
+    rows.resize(static_cast<size_t>(node + 1) * row_bytes());
+    uint8_t * row = rows.data() + static_cast<size_t>(node) * row_bytes();
+    if (params_.type == VectorType::F16) {
+        f32_to_f16(query.data(), reinterpret_cast<uint16_t *>(row), params_.dim);
+    } else {
+        std::memcpy(row, query.data(), row_bytes());
+    }
+    id_to_node_[id] = node;
+
+    if (node == 0) {
+        entry_ = 0;
+        max_level_ = level;
+        return true;
+    }
+
+    uint32_t cur = entry_;
+    if (level < max_level_) {
+        cur = greedy_descend(query.data(), cur, max_level_, level + 1);
+    }
+    for (int32_t l = static_cast<int32_t>(std::min(level, max_level_)); l >= 0; --l) {
+        const uint32_t lvl = static_cast<uint32_t>(l);
+        std::vector<Scored> candidates = search_layer(query.data(), cur, params_.ef_construction, lvl, false);
+        cur = candidates.front().second;
+        const std::vector<uint32_t> neighbors = select_neighbors(std::move(candidates), params_.m);
+
+        uint32_t * own = links_mut(node, lvl);
+        own[0] = static_cast<uint32_t>(neighbors.size());
+        std::copy(neighbors.begin(), neighbors.end(), own + 1);
+        for (uint32_t nb : neighbors) {
+            link_back(nb, node, lvl);
+        }
+    }
+
+    if (level > max_level_) {
+        entry_ = node;
+        max_level_ = level;
+    }
+    return true;
+}
+
+bool HnswIndex::remove(int64_t id) {
+    auto it = id_to_node_.find(id);
+    if (it == id_to_node_.end()) {
+        return false;
+    }
+    deleted_.mut()[it->second] = 1;
+    id_to_node_.erase(it);
+    return true;
+}
+
+size_t HnswIndex::search(const float * query, size_t k, size_t ef, int64_t * out_ids, float * out_scores) const {
+    if (!query || k == 0 || id_to_node_.empty()) {
+        return 0;
+    }
+    std::vector<float> q(query, query + params_.dim);
+    if (normalize_f32(q.data(), params_.dim) <= 0.0f) {
+        return 0;
+    }
+
+    uint32_t cur = entry_;
+    if (max_level_ > 0) {
+        cur = greedy_descend(q.data(), cur, max_level_, 1);
+    }
+    const std::vector<Scored> found = search_layer(q.data(), cur, std::max(ef, k), 0, true);
+    const size_t n = std::min(k, found.size());
+    for (size_t i = 0; i < n; ++i) {
+        out_ids[i] = ids_[found[i].second];
+        if (out_scores) {
+            out_scores[i] = found[i].first;
+        }
+    }
+    return n;
+}
+
+void HnswIndex::rebuild_id_map() {
+    id_to_node_.clear();
+    id_to_node_.reserve(node_count());
+    for (uint32_t node = 0; node < node_count(); ++node) {
+        if (!deleted_[node]) {
+            id_to_node_[ids_[node]] = node;
+        }
+    }
+}
+
+bool HnswIndex::save(const std::string & path) const {
+    const std::string tmp = path + ".tmp";
+    const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    size_t written = 0;
+    static const uint8_t kPad[kSectionAlign] = {};
+    auto section = [&](const void * data, size_t bytes) {
+        if (!write_all(fd, data, bytes)) {
+            return false;
+        }
+        written += bytes;
+        const size_t pad = align_up(written) - written;
+        written += pad;
+        return write_all(fd, kPad, pad);
+    };
+
+    const FileHeader header{
+        kVectorIndexMagic,
+        kVectorIndexVersion,
+        params_.dim,
+        static_cast<uint32_t>(params_.type),
+        params_.m,
+        params_.ef_construction,
+        entry_,
+        max_level_,
+        static_cast<uint64_t>(node_count()),
+        static_cast<uint64_t>(links_upper_.size()),
+    };
+    const bool ok = section(&header, sizeof(header)) &&
+                    section(ids_.data(), ids_.size() * sizeof(int64_t)) &&
+                    section(levels_.data(), levels_.size()) &&
+                    section(deleted_.data(), deleted_.size()) &&
+                    section(upper_offsets_.data(), upper_offsets_.size() * sizeof(uint32_t)) &&
+                    section(links0_.data(), links0_.size() * sizeof(uint32_t)) &&
+                    section(links_upper_.data(), links_upper_.size() * sizeof(uint32_t)) &&
+                    section(rows_.data(), rows_.size());
+    ::close(fd);
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        ::unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::unique_ptr<HnswIndex> HnswIndex::open(const std::string & path) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < align_up(sizeof(FileHeader))) {
+        ::close(fd);
+        return nullptr;
+    }
+    const size_t size = static_cast<size_t>(st.st_size);
+    void * base = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        return nullptr;
+    }
+
+    FileHeader header{};
+    std::memcpy(&header, base, sizeof(header));
+    if (header.magic != kVectorIndexMagic || header.version != kVectorIndexVersion ||
+        header.dim == 0 || header.type > static_cast<uint32_t>(VectorType::F16) ||
+        header.m < 2 || header.max_level > kMaxLevel ||
+        (header.nodes > 0 && header.entry >= header.nodes) || header.nodes > UINT32_MAX) {
+        munmap(base, size);
+        return nullptr;
+    }
+
+    Params params;
+    params.dim = header.dim;
+    params.m = header.m;
+    params.ef_construction = header.ef_construction;
+    params.type = static_cast<VectorType>(header.type);
+    std::unique_ptr<HnswIndex> index(new HnswIndex(params));
+    index->mapping_ = base;
+    index->mapping_size_ = size;
+    index->entry_ = header.entry;
+    index->max_level_ = header.max_level;
+
+    const uint8_t * bytes = static_cast<const uint8_t *>(base);
+    size_t offset = align_up(sizeof(FileHeader));
+    auto take = [&](auto & column, size_t count) {
+        using T = std::remove_const_t<std::remove_pointer_t<decltype(column.data())>>;
+        const size_t len = count * sizeof(T);
+        if (offset + len > size) {
+            return false;
+        }
+        column.map(reinterpret_cast<const T *>(bytes + offset), count);
+        offset = align_up(offset + len);
+        return true;
+    };
+    const size_t n = static_cast<size_t>(header.nodes);
+    if (!take(index->ids_, n) ||
+        !take(index->levels_, n) ||
+        !take(index->deleted_, n) ||
+        !take(index->upper_offsets_, n) ||
+        !take(index->links0_, n * (index->m0_ + 1)) ||
+        !take(index->links_upper_, static_cast<size_t>(header.upper_size)) ||
+        !take(index->rows_, n * index->row_bytes())) {
+        return nullptr;
+    }
+
+    // Reject link tables that would index outside the mapping.
+    for (size_t node = 0; node < n; ++node) {
+        const uint32_t level = index->levels_[node];
+        if (level > kMaxLevel ||
+            index->upper_offsets_[node] + static_cast<size_t>(level) * (params.m + 1) > index->links_upper_.size()) {
+            return nullptr;
+        }
+        for (uint32_t l = 0; l <= level; ++l) {
+            const uint32_t * links = index->links(static_cast<uint32_t>(node), l);
+            if (links[0] > index->capacity_at(l)) {
+                return nullptr;
+            }
+            for (uint32_t i = 1; i <= links[0]; ++i) {
+                if (links[i] >= n) {
+                    return nullptr;
+                }
+            }
+        }
+    }
+
+    index->rebuild_id_map();
+    return index;
+}
+
+} // namespace peerchat
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace peerchat {
+
+// HNSW graph over unit-length embedding rows, scored by inner product (cosine).
+//
+// Every per-node array is one contiguous column so the whole index can be
+// written with a few sequential writes and mapped back without parsing.
+// A mapped index serves queries straight from the page cache; the first
+// mutation copies only the columns it touches into owned memory.
+//
+// Deletes are tombstones: the node keeps routing searches but never shows up
+// in results. Re-adding an id tombstones the old node and inserts a new one.
+//
+// Not internally synchronised: callers serialise mutations against searches.
+constexpr uint32_t kVectorIndexMagic = 0x49564350; // "PCVI"
+constexpr uint32_t kVectorIndexVersion = 1;
+
+enum class VectorType : uint32_t {
+    F32 = 0,
+    F16 = 1,
+};
+
+class HnswIndex {
+public:
+    struct Params {
+        uint32_t dim = 0;
+        uint32_t m = 16;
+        uint32_t ef_construction = 200;
+        VectorType type = VectorType::F16;
+    };
+
+    explicit HnswIndex(const Params & params);
+    ~HnswIndex();
+
+    HnswIndex(const HnswIndex &) = delete;
+    HnswIndex & operator=(const HnswIndex &) = delete;
+
+    // Maps a file written by save(); nullptr when missing or malformed.
+    static std::unique_ptr<HnswIndex> open(const std::string & path);
+    // Writes to path via a temporary file and rename.
+    bool save(const std::string & path) const;
+
+    // The vector is normalised on insert; zero vectors are rejected.
+    bool add(int64_t id, const float * vec);
+    bool remove(int64_t id);
+    bool contains(int64_t id) const { return id_to_node_.count(id) != 0; }
+
+    // Fills up to k ids/scores, best first; ef is raised to at least k.
+    size_t search(const float * query, size_t k, size_t ef, int64_t * out_ids, float * out_scores) const;
+
+    uint32_t dim() const { return params_.dim; }
+    VectorType type() const { return params_.type; }
+    size_t size() const { return id_to_node_.size(); }
+    size_t node_count() const { return ids_.size(); }
+
+private:
+    // Either a view into the mapped file or an owned, growable copy.
+    template <typename T>
+    class Column {
+    public:
+        const T * data() const { return view_ ? view_ : owned_.data(); }
+        size_t size() const { return view_ ? view_size_ : owned_.size(); }
+        const T & operator[](size_t i) const { return data()[i]; }
+        void map(const T * p, size_t n) {
+            owned_ = std::vector<T>();
+            view_ = p;
+            view_size_ = n;
+        }
+        std::vector<T> & mut() {
+            if (view_) {
+                owned_.assign(view_, view_ + view_size_);
+                view_ = nullptr;
+                view_size_ = 0;
+            }
+            return owned_;
+        }
+
+    private:
+        const T * view_ = nullptr;
+        size_t view_size_ = 0;
+        std::vector<T> owned_;
+    };
+
+    using Scored = std::pair<float, uint32_t>;
+
+    size_t row_bytes() const;
+    float similarity(const float * query, uint32_t node) const;
+    void decode_row(uint32_t node, float * out) const;
+    const uint32_t * links(uint32_t node, uint32_t level) const;
+    uint32_t * links_mut(uint32_t node, uint32_t level);
+    uint32_t capacity_at(uint32_t level) const { return level == 0 ? m0_ : params_.m; }
+    uint32_t random_level();
+
+    uint32_t greedy_descend(const float * query, uint32_t entry, uint32_t from_level, uint32_t to_level) const;
+    std::vector<Scored> search_layer(const float * query, uint32_t entry, size_t ef, uint32_t level,
+                                     bool skip_deleted) const;
+    std::vector<uint32_t> select_neighbors(std::vector<Scored> candidates, uint32_t max_count) const;
+    void link_back(uint32_t node, uint32_t neighbor, uint32_t level);
+    void rebuild_id_map();
+
+    Params params_;
+    uint32_t m0_;
+    double level_mult_;
+    std::mt19937 rng_;
+    uint32_t entry_ = 0;
+    uint32_t max_level_ = 0;
+
+    Column<int64_t> ids_;
+    Column<uint8_t> levels_;
+    Column<uint8_t> deleted_;
+    Column<uint32_t> upper_offsets_;
+    Column<uint32_t> links0_;
+    Column<uint32_t> links_upper_;
+    Column<uint8_t> rows_;
+
+    std::unordered_map<int64_t, uint32_t> id_to_node_;
+
+    void * mapping_ = nullptr;
+    size_t mapping_size_ = 0;
+};
+
+} // namespace peerchat
@@ -0,0 +1,283 @@
+#include "vector_kernels.h"
+
+#include "ggml.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PEERCHAT_KERNELS_NEON 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PEERCHAT_KERNELS_X86 1
+#endif
+
+namespace peerchat {
+
+namespace {
+
+float dot_f32_scalar(const float * a, const float * b, size_t n) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+float dot_f16_scalar(const float * q, const uint16_t * row, size_t n) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        sum += q[i] * ggml_fp16_to_fp32(row[i]);
+    }
+    return sum;
+}
+
+int32_t dot_i8_scalar(const int8_t * a, const int8_t * b, size_t n) {
+    int32_t sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        sum += static_cast<int32_t>(a[i]) * static_cast<int32_t>(b[i]);
+    }
+    return sum;
+}
+
+uint32_t hamming_scalar(const uint64_t * a, const uint64_t * b, size_t words) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < words; ++i) {
+        sum += static_cast<uint32_t>(__builtin_popcountll(a[i] ^ b[i]));
+    }
+    return sum;
+}
+
+#if defined(PEERCHAT_KERNELS_NEON)
+
+float dot_f32_neon(const float * a, const float * b, size_t n) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    float32x4_t acc2 = vdupq_n_f32(0.0f);
+    float32x4_t acc3 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+        acc2 = vfmaq_f32(acc2, vld1q_f32(a + i + 8), vld1q_f32(b + i + 8));
+        acc3 = vfmaq_f32(acc3, vld1q_f32(a + i + 12), vld1q_f32(b + i + 12));
+    }
+    for (; i + 4 <= n; i += 4) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    float sum = vaddvq_f32(vaddq_f32(vaddq_f32(acc0, acc1), vaddq_f32(acc2, acc3)));
+    return sum + dot_f32_scalar(a + i, b + i, n - i);
+}
+
+float dot_f16_neon(const float * q, const uint16_t * row, size_t n) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const uint16x8_t h = vld1q_u16(row + i);
+        const float32x4_t lo = vcvt_f32_f16(vreinterpret_f16_u16(vget_low_u16(h)));
+        const float32x4_t hi = vcvt_f32_f16(vreinterpret_f16_u16(vget_high_u16(h)));
+        acc0 = vfmaq_f32(acc0, vld1q_f32(q + i), lo);
+        acc1 = vfmaq_f32(acc1, vld1q_f32(q + i + 4), hi);
+    }
+    float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+    return sum + dot_f16_scalar(q + i, row + i, n - i);
+}
+
+int32_t dot_i8_neon(const int8_t * a, const int8_t * b, size_t n) {
+    int32x4_t acc0 = vdupq_n_s32(0);
+    int32x4_t acc1 = vdupq_n_s32(0);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const int8x16_t va = vld1q_s8(a + i);
+        const int8x16_t vb = vld1q_s8(b + i);
+        acc0 = vpadalq_s16(acc0, vmull_s8(vget_low_s8(va), vget_low_s8(vb)));
+        acc1 = vpadalq_s16(acc1, vmull_s8(vget_high_s8(va), vget_high_s8(vb)));
+    }
+    return vaddvq_s32(vaddq_s32(acc0, acc1)) + dot_i8_scalar(a + i, b + i, n - i);
+}
+
+uint32_t hamming_neon(const uint64_t * a, const uint64_t * b, size_t words) {
+    uint16x8_t acc = vdupq_n_u16(0);
+    size_t i = 0;
+    // Each step adds at most 16 per u16 lane, so lanes cannot overflow for any
+    // realistic embedding width.
+    for (; i + 2 <= words; i += 2) {
+        const uint8x16_t x = veorq_u8(vreinterpretq_u8_u64(vld1q_u64(a + i)), vreinterpretq_u8_u64(vld1q_u64(b + i)));
+        acc = vpadalq_u8(acc, vcntq_u8(x));
+    }
+    return vaddvq_u16(acc) + hamming_scalar(a + i, b + i, words - i);
+}
+
+#elif defined(PEERCHAT_KERNELS_X86)
+
+__attribute__((target("avx2,fma")))
+float hsum256(__m256 v) {
+    const __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    const __m128 h = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    return _mm_cvtss_f32(_mm_add_ss(h, _mm_movehdup_ps(h)));
+}
+
+__attribute__((target("avx2,fma")))
+float dot_f32_avx2(const float * a, const float * b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    return hsum256(_mm256_add_ps(acc0, acc1)) + dot_f32_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2,fma,f16c")))
+float dot_f16_avx2(const float * q, const uint16_t * row, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m256 v0 = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i)));
+        const __m256 v1 = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i + 8)));
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i), v0, acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i + 8), v1, acc1);
+    }
+    for (; i + 8 <= n; i += 8) {
+        const __m256 v = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i)));
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i), v, acc0);
+    }
+    return hsum256(_mm256_add_ps(acc0, acc1)) + dot_f16_scalar(q + i, row + i, n - i);
+}
+
+// Signed int8 products via maddubs: |a| * sign(b, a) keeps the unsigned operand unsigned.
+__attribute__((target("avx2")))
+int32_t dot_i8_avx2(const int8_t * a, const int8_t * b, size_t n) {
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        const __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+        const __m256i prod = _mm256_maddubs_epi16(_mm256_sign_epi8(va, va), _mm256_sign_epi8(vb, va));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(prod, ones));
+    }
+    const __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    const __m128i h = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    const int32_t sum = _mm_cvtsi128_si32(_mm_add_epi32(h, _mm_shuffle_epi32(h, _MM_SHUFFLE(2, 3, 0, 1))));
+    return sum + dot_i8_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("popcnt")))
+uint32_t hamming_popcnt(const uint64_t * a, const uint64_t * b, size_t words) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < words; ++i) {
+        sum += static_cast<uint64_t>(_mm_popcnt_u64(a[i] ^ b[i]));
+    }
+    return static_cast<uint32_t>(sum);
+}
+
+bool has_popcnt() {
+    static const bool supported = __builtin_cpu_supports("popcnt");
+    return supported;
+}
+
+bool has_avx2() {
+    static const bool supported = __builtin_cpu_supports("avx2") &&
+                                  __builtin_cpu_supports("fma") &&
+                                  __builtin_cpu_supports("f16c");
+    return supported;
+}
+
+#endif
+
+} // namespace
+
+float dot_f32(const float * a, const float * b, size_t n) {
+#if defined(PEERCHAT_KERNELS_NEON)
+    return dot_f32_neon(a, b, n);
+#elif defined(PEERCHAT_KERNELS_X86)
+    return has_avx2() ? dot_f32_avx2(a, b, n) : dot_f32_scalar(a, b, n);
+#else
+    return dot_f32_scalar(a, b, n);
+#endif
+}
+
+float dot_f16(const float * q, const uint16_t * row, size_t n) {
+#if defined(PEERCHAT_KERNELS_NEON)
+    return dot_f16_neon(q, row, n);
+#elif defined(PEERCHAT_KERNELS_X86)
+    return has_avx2() ? dot_f16_avx2(q, row, n) : dot_f16_scalar(q, row, n);
+#else
+    return dot_f16_scalar(q, row, n);
+#endif
+}
+
+int32_t dot_i8(const int8_t * a, const int8_t * b, size_t n) {
+#if defined(PEERCHAT_KERNELS_NEON)
+    return dot_i8_neon(a, b, n);
+#elif defined(PEERCHAT_KERNELS_X86)
+    return has_avx2() ? dot_i8_avx2(a, b, n) : dot_i8_scalar(a, b, n);
+#else
+    return dot_i8_scalar(a, b, n);
+#endif
+}
+
+uint32_t hamming(const uint64_t * a, const uint64_t * b, size_t words) {
+#if defined(PEERCHAT_KERNELS_NEON)
+    return hamming_neon(a, b, words);
+#elif defined(PEERCHAT_KERNELS_X86)
+    return has_popcnt() ? hamming_popcnt(a, b, words) : hamming_scalar(a, b, words);
+#else
+    return hamming_scalar(a, b, words);
+#endif
+}
+
+void f32_to_f16(const float * src, uint16_t * dst, size_t n) {
+    ggml_fp32_to_fp16_row(src, dst, static_cast<int64_t>(n));
+}
+
+void f16_to_f32(const uint16_t * src, float * dst, size_t n) {
+    ggml_fp16_to_fp32_row(src, dst, static_cast<int64_t>(n));
+}
+
+float normalize_f32(float * v, size_t n) {
+    const float norm = std::sqrt(dot_f32(v, v, n));
+    if (norm > 0.0f) {
+        const float inv = 1.0f / norm;
+        for (size_t i = 0; i < n; ++i) {
+            v[i] *= inv;
+        }
+    }
+    return norm;
+}
+
+float quantize_i8(const float * src, int8_t * dst, size_t n) {
+    float max_abs = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        max_abs = std::max(max_abs, std::fabs(src[i]));
+    }
+    if (max_abs == 0.0f) {
+        std::fill(dst, dst + n, static_cast<int8_t>(0));
+        return 0.0f;
+    }
+    const float inv = 127.0f / max_abs;
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] = static_cast<int8_t>(std::lrintf(src[i] * inv));
+    }
+    return max_abs / 127.0f;
+}
+
+void sign_bits(const float * src, uint64_t * dst, size_t n) {
+    const size_t words = (n + 63) / 64;
+    std::fill(dst, dst + words, 0ull);
+    for (size_t i = 0; i < n; ++i) {
+        if (src[i] > 0.0f) {
+            dst[i / 64] |= 1ull << (i % 64);
+        }
+    }
+}
+
+} // namespace peerchat
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace peerchat {
+
+// Dot-product kernels for the RAG vector index and store. NEON on arm64,
+// AVX2/FMA/F16C on x86-64 when the CPU has it (picked once at runtime), scalar
+// otherwise. Half-precision rows are IEEE binary16 stored as uint16_t.
+
+float dot_f32(const float * a, const float * b, size_t n);
+float dot_f16(const float * q, const uint16_t * row, size_t n);
+
+void f32_to_f16(const float * src, uint16_t * dst, size_t n);
+void f16_to_f32(const uint16_t * src, float * dst, size_t n);
+
+// Scales v in place to unit length; returns the original norm (0 leaves v untouched).
+float normalize_f32(float * v, size_t n);
+
+// Quantized kernels for the compressed vector store.
+int32_t dot_i8(const int8_t * a, const int8_t * b, size_t n);
+// Popcount of a XOR b over `words` 64-bit words.
+uint32_t hamming(const uint64_t * a, const uint64_t * b, size_t words);
+
+// Symmetric int8 quantisation; returns the scale that maps codes back to floats.
+float quantize_i8(const float * src, int8_t * dst, size_t n);
+// One bit per dimension (set when positive), packed little-endian into ceil(n / 64) words.
+void sign_bits(const float * src, uint64_t * dst, size_t n);
+
+} // namespace peerchat
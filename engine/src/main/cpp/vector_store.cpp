@@ -0,0 +1,219 @@
+#include "vector_store.h"
+
+#include "file_io.h"
+#include "vector_kernels.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace peerchat {
+
+namespace {
+
+struct FileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t dim;
+    uint32_t reserved;
+    uint64_t rows;
+};
+
+// Hamming distances fit in u16 for any width we accept.
+constexpr uint32_t kMaxDim = 65535;
+
+thread_local std::vector<uint16_t> t_distances;
+thread_local std::vector<uint32_t> t_histogram;
+
+} // namespace
+
+QuantizedStore::QuantizedStore(uint32_t dim) : dim_(dim), words_((static_cast<size_t>(dim) + 63) / 64) {}
+
+size_t QuantizedStore::resident_bytes() const {
+    return ids_.size() * sizeof(int64_t) + scales_.size() * sizeof(float) +
+           bits_.size() * sizeof(uint64_t) + codes_.size();
+}
+
+bool QuantizedStore::add(int64_t id, const float * vec) {
+    if (!vec || dim_ == 0) {
+        return false;
+    }
+    std::vector<float> row(vec, vec + dim_);
+    if (normalize_f32(row.data(), dim_) <= 0.0f) {
+        return false;
+    }
+
+    uint32_t slot;
+    auto existing = id_to_row_.find(id);
+    if (existing != id_to_row_.end()) {
+        slot = existing->second;
+    } else {
+        slot = static_cast<uint32_t>(ids_.size());
+        ids_.push_back(id);
+        scales_.push_back(0.0f);
+        bits_.resize(bits_.size() + words_);
+        codes_.resize(codes_.size() + dim_);
+        id_to_row_[id] = slot;
+    }
+    sign_bits(row.data(), bits_.data() + static_cast<size_t>(slot) * words_, dim_);
+    scales_[slot] = quantize_i8(row.data(), codes_.data() + static_cast<size_t>(slot) * dim_, dim_);
+    return true;
+}
+
+bool QuantizedStore::remove(int64_t id) {
+    auto it = id_to_row_.find(id);
+    if (it == id_to_row_.end()) {
+        return false;
+    }
+    const uint32_t slot = it->second;
+    const uint32_t last = static_cast<uint32_t>(ids_.size() - 1);
+    id_to_row_.erase(it);
+    if (slot != last) {
+        ids_[slot] = ids_[last];
+        scales_[slot] = scales_[last];
+        std::copy_n(bits_.begin() + static_cast<size_t>(last) * words_, words_,
+                    bits_.begin() + static_cast<size_t>(slot) * words_);
+        std::copy_n(codes_.begin() + static_cast<size_t>(last) * dim_, dim_,
+                    codes_.begin() + static_cast<size_t>(slot) * dim_);
+        id_to_row_[ids_[slot]] = slot;
+    }
+    ids_.pop_back();
+    scales_.pop_back();
+    bits_.resize(bits_.size() - words_);
+    codes_.resize(codes_.size() - dim_);
+    return true;
+}
+
+size_t QuantizedStore::search(const float * query, size_t k, size_t candidates, int64_t * out_ids,
+                              float * out_scores) const {
+    const size_t n = ids_.size();
+    if (!query || k == 0 || n == 0) {
+        return 0;
+    }
+    std::vector<float> q(query, query + dim_);
+    if (normalize_f32(q.data(), dim_) <= 0.0f) {
+        return 0;
+    }
+    std::vector<uint64_t> q_bits(words_);
+    std::vector<int8_t> q_codes(dim_);
+    sign_bits(q.data(), q_bits.data(), dim_);
+    const float q_scale = quantize_i8(q.data(), q_codes.data(), dim_);
+
+    // Pass 1: Hamming distance over the whole corpus, then a counting select of
+    // the closest rows (distances are bounded by dim, so no sort is needed).
+    std::vector<uint16_t> & distances = t_distances;
+    std::vector<uint32_t> & histogram = t_histogram;
+    distances.resize(n);
+    histogram.assign(dim_ + 1, 0);
+    for (size_t i = 0; i < n; ++i) {
+        const uint16_t d = static_cast<uint16_t>(hamming(q_bits.data(), bits_.data() + i * words_, words_));
+        distances[i] = d;
+        ++histogram[d];
+    }
+    if (candidates == 0) {
+        candidates = std::max(k * 16, n / 64);
+    }
+    const size_t budget = std::min(n, std::max(candidates, k));
+    uint32_t cutoff = 0;
+    size_t below = 0;
+    while (below + histogram[cutoff] < budget) {
+        below += histogram[cutoff];
+        ++cutoff;
+    }
+    size_t ties = budget - below;
+
+    // Pass 2: int8 rescoring of the shortlist.
+    using Scored = std::pair<float, uint32_t>;
+    std::vector<Scored> shortlist;
+    shortlist.reserve(budget);
+    for (size_t i = 0; i < n && shortlist.size() < budget; ++i) {
+        const uint16_t d = distances[i];
+        if (d > cutoff || (d == cutoff && ties == 0)) {
+            continue;
+        }
+        if (d == cutoff) {
+            --ties;
+        }
+        const int32_t dot = dot_i8(q_codes.data(), codes_.data() + i * dim_, dim_);
+        shortlist.emplace_back(static_cast<float>(dot) * q_scale * scales_[i], static_cast<uint32_t>(i));
+    }
+
+    const size_t out = std::min(k, shortlist.size());
+    std::partial_sort(shortlist.begin(), shortlist.begin() + out, shortlist.end(), std::greater<Scored>());
+    for (size_t i = 0; i < out; ++i) {
+        out_ids[i] = ids_[shortlist[i].second];
+        if (out_scores) {
+            out_scores[i] = shortlist[i].first;
+        }
+    }
+    return out;
+}
+
+bool QuantizedStore::save(const std::string & path) const {
+    const std::string tmp = path + ".tmp";
+    const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    const FileHeader header{kVectorStoreMagic, kVectorStoreVersion, dim_, 0, static_cast<uint64_t>(ids_.size())};
+    const bool ok = write_all(fd, &header, sizeof(header)) &&
+                    write_all(fd, ids_.data(), ids_.size() * sizeof(int64_t)) &&
+                    write_all(fd, scales_.data(), scales_.size() * sizeof(float)) &&
+                    write_all(fd, bits_.data(), bits_.size() * sizeof(uint64_t)) &&
+                    write_all(fd, codes_.data(), codes_.size());
+    ::close(fd);
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        ::unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::unique_ptr<QuantizedStore> QuantizedStore::open(const std::string & path) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st {};
+    FileHeader header{};
+    if (fstat(fd, &st) != 0 || !read_all(fd, &header, sizeof(header)) ||
+        header.magic != kVectorStoreMagic || header.version != kVectorStoreVersion ||
+        header.dim == 0 || header.dim > kMaxDim || header.rows > UINT32_MAX) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    std::unique_ptr<QuantizedStore> store(new QuantizedStore(header.dim));
+    const size_t rows = static_cast<size_t>(header.rows);
+    const size_t expected = sizeof(FileHeader) +
+                            rows * (sizeof(int64_t) + sizeof(float) + store->words_ * sizeof(uint64_t) + header.dim);
+    if (static_cast<size_t>(st.st_size) != expected) {
+        ::close(fd);
+        return nullptr;
+    }
+    store->ids_.resize(rows);
+    store->scales_.resize(rows);
+    store->bits_.resize(rows * store->words_);
+    store->codes_.resize(rows * header.dim);
+    const bool ok = read_all(fd, store->ids_.data(), rows * sizeof(int64_t)) &&
+                    read_all(fd, store->scales_.data(), rows * sizeof(float)) &&
+                    read_all(fd, store->bits_.data(), store->bits_.size() * sizeof(uint64_t)) &&
+                    read_all(fd, store->codes_.data(), store->codes_.size());
+    ::close(fd);
+    if (!ok) {
+        return nullptr;
+    }
+
+    store->id_to_row_.reserve(rows);
+    for (uint32_t row = 0; row < rows; ++row) {
+        if (!store->id_to_row_.emplace(store->ids_[row], row).second) {
+            return nullptr;
+        }
+    }
+    return store;
+}
+
+} // namespace peerchat
@@ -21,6 +21,24 @@ object EngineBridge {
         val length = if (buffer.hasArray()) buffer.remaining() else buffer.limit()
         return EngineNative.stateRestoreFrom(buffer, length)
     }
+
+    fun captureSessionStateDirect(chatId: Long, partialOnly: Boolean = false): ByteBuffer? {
+        EngineRuntime.ensureInitialized()
+        val size = EngineNative.sessionStateSize(chatId, partialOnly)
+        if (size <= 0) return null
+        val buffer = ByteBuffer.allocateDirect(size)
+        val written = EngineNative.sessionStateCaptureInto(chatId, buffer, partialOnly)
+        if (written <= 0) return null
+        buffer.limit(written)
+        buffer.position(0)
+        return buffer
+    }
+
+    fun restoreSessionStateDirect(chatId: Long, buffer: ByteBuffer, partialOnly: Boolean = false): Boolean {
+        if (!buffer.isDirect) return false
+        EngineRuntime.ensureInitialized()
+        return EngineNative.sessionStateRestoreFrom(chatId, buffer, buffer.limit(), partialOnly)
+    }
 }
 
 
@@ -6,8 +6,13 @@ data class EngineMetrics(
     val rawJson: String,
     val nCtx: Int,
     val nThreads: Int,
+    // Threads of single-token decodes; nThreads is the prompt batch count.
+    val nThreadsDecode: Int = 0,
     val nGpuLayers: Int,
     val useVulkan: Boolean,
+    // KV cache type actually in use and its footprint per context token.
+    val kvType: String = "f16",
+    val kvBytesPerToken: Long = 0,
     val promptTokens: Int,
     val generationTokens: Int,
     val ttfsMs: Double,
@@ -17,9 +22,28 @@ data class EngineMetrics(
     val tps: Double,
     val promptTps: Double,
     val contextUsedPct: Double,
+    val reusedTokens: Int,
+    val prefilledTokens: Int,
     val truncated: Boolean,
     val stopReason: String,
     val stopSequence: String,
+    val speculative: Boolean = false,
+    // "model", "lookup" or "none".
+    val draftMode: String = "none",
+    val draftedTokens: Int = 0,
+    val acceptedTokens: Int = 0,
+    val acceptanceRate: Double = 0.0,
+    // Generated tokens per target decode; above 1 only when drafts are accepted.
+    val tokensPerDecode: Double = 0.0,
+    // Times the oldest turns were shifted out of a full context, and the tokens dropped.
+    val contextShifts: Int = 0,
+    val evictedTokens: Int = 0,
+    // Time the generation queued behind background engine work (indexing, snapshots).
+    val queueWaitMs: Double = 0.0,
+    // Auxiliary requests served since load, their tokens, and decodes that batched several sequences.
+    val auxRequests: Long = 0,
+    val auxTokens: Long = 0,
+    val batchedDecodes: Long = 0,
 ) {
     val isError: Boolean get() = stopReason.equals("error", ignoreCase = true)
 
@@ -39,6 +63,8 @@ data class EngineMetrics(
             tps = 0.0,
             promptTps = 0.0,
             contextUsedPct = 0.0,
+            reusedTokens = 0,
+            prefilledTokens = 0,
             truncated = false,
             stopReason = "none",
             stopSequence = "",
@@ -51,8 +77,11 @@ data class EngineMetrics(
                     rawJson = raw,
                     nCtx = obj.optInt("nCtx", obj.optInt("n_ctx", 0)),
                     nThreads = obj.optInt("nThreads", obj.optInt("n_threads", 0)),
+                    nThreadsDecode = obj.optInt("nThreadsDecode", 0),
                     nGpuLayers = obj.optInt("nGpuLayers", obj.optInt("n_gpu_layers", 0)),
                     useVulkan = obj.optBoolean("useVulkan", obj.optBoolean("use_vulkan", false)),
+                    kvType = obj.optString("kvType", "f16"),
+                    kvBytesPerToken = obj.optLong("kvBytesPerToken", 0),
                     promptTokens = obj.optInt("promptTokens", obj.optInt("prompt_tokens", 0)),
                     generationTokens = obj.optInt("generationTokens", obj.optInt("generation_tokens", 0)),
                     ttfsMs = obj.optDouble("ttfsMs", obj.optDouble("ttfs_ms", 0.0)),
@@ -62,9 +91,23 @@ data class EngineMetrics(
                     tps = obj.optDouble("tps", 0.0),
                     promptTps = obj.optDouble("promptTps", obj.optDouble("prompt_tps", 0.0)),
                     contextUsedPct = obj.optDouble("contextUsedPct", obj.optDouble("context_used_pct", 0.0)),
+                    reusedTokens = obj.optInt("reusedTokens", obj.optInt("reused_tokens", 0)),
+                    prefilledTokens = obj.optInt("prefilledTokens", obj.optInt("prefilled_tokens", 0)),
                     truncated = obj.optBoolean("truncated", false),
                     stopReason = obj.optString("stopReason", obj.optString("stop_reason", "none")),
                     stopSequence = obj.optString("stopSequence", obj.optString("stop_sequence", "")),
+                    speculative = obj.optBoolean("speculative", false),
+                    draftMode = obj.optString("draftMode", "none"),
+                    draftedTokens = obj.optInt("draftedTokens", 0),
+                    acceptedTokens = obj.optInt("acceptedTokens", 0),
+                    acceptanceRate = obj.optDouble("acceptanceRate", 0.0),
+                    tokensPerDecode = obj.optDouble("tokensPerDecode", 0.0),
+                    contextShifts = obj.optInt("contextShifts", 0),
+                    evictedTokens = obj.optInt("evictedTokens", 0),
+                    queueWaitMs = obj.optDouble("queueWaitMs", 0.0),
+                    auxRequests = obj.optLong("auxRequests", 0),
+                    auxTokens = obj.optLong("auxTokens", 0),
+                    batchedDecodes = obj.optLong("batchedDecodes", 0),
                 )
             }.getOrElse { empty() }
         }
@@ -7,16 +7,37 @@ object EngineNative {
 
     external fun init()
 
+    /**
+     * [draftModelPath] optionally names a small model with the same vocabulary; when it
+     * loads, generation drafts up to [draftMax] tokens per step and verifies them with
+     * one target decode. A draft that fails to load only disables speculation.
+     * Without a draft model, [lookupMax] > 0 drafts from n-grams of the prompt and the
+     * chat's earlier replies instead (prompt lookup), which needs no extra memory.
+     * [decodeThreads] and [batchThreads] split [nThreads] between single-token decodes
+     * and prompt batches; 0 picks them from the device's core layout.
+     */
     external fun loadModel(
         modelPath: String,
         nThreads: Int,
+        decodeThreads: Int,
+        batchThreads: Int,
         nCtx: Int,
         nGpuLayers: Int,
-        useVulkan: Boolean
+        useVulkan: Boolean,
+        sessionSlots: Int,
+        draftModelPath: String?,
+        draftMax: Int,
+        lookupMax: Int,
+        kvPrecision: String?,
+        memoryBudgetBytes: Long
     ): Boolean
 
     external fun unload()
 
+    /**
+     * [keepPrefix] is the number of leading characters of [prompt] (template header, system
+     * block) that survive context shifts when a long chat outgrows the context window.
+     */
     external fun generate(
         prompt: String,
         systemPrompt: String?,
@@ -25,6 +46,23 @@ object EngineNative {
         topP: Float,
         topK: Int,
         maxTokens: Int,
+        stop: Array<String>,
+        keepPrefix: Int
+    ): String
+
+    /**
+     * Side request (chat title, summary, suggestions) that needs no chat session. It decodes in
+     * a reserved sequence, batched with other auxiliary requests and with a running reply
+     * instead of waiting for it. No prefix reuse, drafting or context shifts; [abort] does not
+     * reach it. Returns "" on failure.
+     */
+    external fun generateAuxiliary(
+        prompt: String,
+        systemPrompt: String?,
+        temperature: Float,
+        topP: Float,
+        topK: Int,
+        maxTokens: Int,
         stop: Array<String>
     ): String
 
@@ -37,17 +75,207 @@ object EngineNative {
         topK: Int,
         maxTokens: Int,
         stop: Array<String>,
+        keepPrefix: Int,
         callback: TokenCallback
     )
 
+    /**
+     * Same as [generateStream] but publishes UTF-8 text into the native ring created by
+     * [tokenRingCreate] instead of calling back per token. Blocks until generation ends;
+     * the ring is always closed on return. Drain it from another thread with [TokenRing].
+     */
+    external fun generateStreamRing(
+        prompt: String,
+        systemPrompt: String?,
+        template: String?,
+        temperature: Float,
+        topP: Float,
+        topK: Int,
+        maxTokens: Int,
+        stop: Array<String>,
+        keepPrefix: Int,
+        ringHandle: Long
+    )
+
+    // Single-producer/single-consumer token ring; capacity <= 0 selects the native default.
+    external fun tokenRingCreate(capacity: Int): Long
+
+    external fun tokenRingBuffer(ringHandle: Long): java.nio.ByteBuffer?
+
+    /**
+     * Releases [consumed] bytes and waits up to [timeoutMs] for more. Returns the readable
+     * byte count, 0 on timeout, or -1 once the stream is closed and drained.
+     */
+    external fun tokenRingAwait(ringHandle: Long, consumed: Int, timeoutMs: Int): Int
+
+    external fun tokenRingDestroy(ringHandle: Long)
+
+    // HNSW vector index (see VectorIndex); vectors are row-major, dim floats per id.
+    external fun vectorIndexCreate(dim: Int, m: Int, efConstruction: Int, halfPrecision: Boolean): Long
+
+    external fun vectorIndexOpen(path: String): Long
+
+    external fun vectorIndexSave(indexHandle: Long, path: String): Boolean
+
+    external fun vectorIndexAdd(indexHandle: Long, ids: LongArray, vectors: FloatArray): Int
+
+    external fun vectorIndexRemove(indexHandle: Long, ids: LongArray): Int
+
+    /** Fills [outIds]/[outScores] best first and returns how many were written. */
+    external fun vectorIndexSearch(
+        indexHandle: Long,
+        query: FloatArray,
+        topK: Int,
+        ef: Int,
+        outIds: LongArray,
+        outScores: FloatArray?
+    ): Int
+
+    external fun vectorIndexSize(indexHandle: Long): Int
+
+    external fun vectorIndexDim(indexHandle: Long): Int
+
+    external fun vectorIndexDestroy(indexHandle: Long)
+
+    // Quantized vector store (see VectorStore).
+    external fun vectorStoreCreate(dim: Int): Long
+
+    external fun vectorStoreOpen(path: String): Long
+
+    external fun vectorStoreSave(storeHandle: Long, path: String): Boolean
+
+    external fun vectorStoreAdd(storeHandle: Long, ids: LongArray, vectors: FloatArray): Int
+
+    external fun vectorStoreRemove(storeHandle: Long, ids: LongArray): Int
+
+    external fun vectorStoreSearch(
+        storeHandle: Long,
+        query: FloatArray,
+        topK: Int,
+        candidates: Int,
+        outIds: LongArray,
+        outScores: FloatArray?
+    ): Int
+
+    external fun vectorStoreSize(storeHandle: Long): Int
+
+    external fun vectorStoreDim(storeHandle: Long): Int
+
+    external fun vectorStoreDestroy(storeHandle: Long)
+
+    /** Writes cosine(query, row) for each float32 little-endian blob into [outScores]. */
+    external fun vectorRerank(query: FloatArray, rows: Array<ByteArray>, outScores: FloatArray)
+
+    // BM25 lexical index (see LexicalIndex).
+    external fun lexicalIndexCreate(): Long
+
+    external fun lexicalIndexOpen(path: String): Long
+
+    external fun lexicalIndexSave(indexHandle: Long, path: String): Boolean
+
+    external fun lexicalIndexAdd(indexHandle: Long, ids: LongArray, texts: Array<String>): Int
+
+    external fun lexicalIndexRemove(indexHandle: Long, ids: LongArray): Int
+
+    external fun lexicalIndexSize(indexHandle: Long): Int
+
+    external fun lexicalIndexDestroy(indexHandle: Long)
+
+    /**
+     * Semantic + lexical retrieval fused natively (see HybridSearch). Handles may be 0 to
+     * skip a source. [mode] is 0 for reciprocal-rank fusion, 1 for weighted scores.
+     */
+    external fun retrieveFused(
+        indexHandle: Long,
+        storeHandle: Long,
+        lexicalHandle: Long,
+        queryVector: FloatArray?,
+        queryText: String?,
+        topK: Int,
+        depth: Int,
+        mode: Int,
+        semanticWeight: Float,
+        outIds: LongArray,
+        outScores: FloatArray?
+    ): Int
+
+    /**
+     * Loads a small embedding model (BGE, MiniLM, nomic-embed) next to the chat model.
+     * While it is loaded [embed] runs on it under its own lock, so retrieval no longer
+     * waits for generation. [contextLength] 0 uses the model's training context, capped
+     * at 2048; [pooling] is "mean", "cls", "last" or null for the model's own.
+     */
+    external fun loadEmbedder(
+        modelPath: String,
+        nThreads: Int,
+        contextLength: Int,
+        gpuLayers: Int,
+        pooling: String?
+    ): Boolean
+
+    external fun unloadEmbedder()
+
     external fun embed(texts: Array<String>): Array<FloatArray>
 
     external fun countTokens(text: String): Int
 
+    /**
+     * Splits [text] into chunks of at most [maxTokens] tokens, repeating about [overlapTokens]
+     * between neighbours and ending on paragraph, sentence or word breaks where the budget
+     * allows. The document is tokenized once. Returns `[start, end, tokens]` per chunk as
+     * string indices, or null without a model.
+     */
+    external fun chunkText(text: String, maxTokens: Int, overlapTokens: Int): IntArray?
+
+    /**
+     * Tokenizes the UTF-8 texts packed in the direct buffer [input], text i at bytes
+     * `[offsets[i], offsets[i + 1])`, on the engine's threads without waiting for
+     * generation. Fills [tokenOffsets] (one more entry than texts) and writes the tokens as
+     * native-order ints into [tokens] when they all fit. Returns the total token count, or
+     * -1 without a model or on bad offsets. See [TokenBatch].
+     */
+    external fun tokenizeBatch(
+        input: java.nio.ByteBuffer,
+        offsets: IntArray,
+        addSpecial: Boolean,
+        tokens: java.nio.ByteBuffer?,
+        tokenOffsets: IntArray
+    ): Int
+
+    /** [countTokens] for every text packed as in [tokenizeBatch]; false without a model. */
+    external fun countTokensBatch(input: java.nio.ByteBuffer, offsets: IntArray, counts: IntArray): Boolean
+
     external fun metrics(): String
 
     external fun detectModel(modelPath: String): String
 
+    /**
+     * Times the loaded model at each candidate thread count and switches the engine to
+     * the fastest for decode and for prompt batches. Runs in the background between
+     * other requests, a few seconds on a phone. JSON as in [ThreadCalibration], "{}"
+     * without a model or when the model changed meanwhile.
+     */
+    external fun calibrateThreads(): String
+
+    /**
+     * Dry-run memory plan for loading [modelPath] with one context of these
+     * parameters; JSON with per-backend weight, KV, recurrent, compute and
+     * output bytes, or "{}" when the file cannot be read. With a non-zero
+     * [gpuBudgetBytes] the GPU layer count is lowered until the GPU share fits.
+     */
+    external fun planMemory(
+        modelPath: String,
+        contextLength: Int,
+        batch: Int,
+        ubatch: Int,
+        kvTypeK: String?,
+        kvTypeV: String?,
+        flashAttn: Boolean,
+        gpuLayers: Int,
+        sequences: Int,
+        gpuBudgetBytes: Long
+    ): String
+
     external fun stateCapture(): ByteArray
 
     external fun stateRestore(state: ByteArray): Boolean
@@ -61,12 +289,60 @@ object EngineNative {
 
     external fun stateRestoreFrom(buffer: java.nio.ByteBuffer, length: Int): Boolean
 
+    // Streamed, chunk-compressed snapshots written/read natively; return the stored size or 0.
+    external fun stateSaveCompressed(path: String): Long
+
+    external fun stateLoadCompressed(path: String): Boolean
+
+    /**
+     * Bind [chatId] to a KV sequence of the loaded context and make it the target of
+     * subsequent generate calls. Returns true when the chat's cache is still resident
+     * (or was reloaded from the spill directory) so no restore is needed.
+     */
+    external fun sessionSelect(chatId: Long): Boolean
+
+    external fun sessionRelease(chatId: Long)
+
+    /**
+     * Directory where cold sessions are spilled when evicted from the context.
+     * Existing spill files are discarded since they belong to a previous load.
+     */
+    external fun sessionSpillDir(path: String)
+
+    // Per-sequence snapshots: only the cells owned by the chat's sequence plus its tokens.
+    // partialOnly limits the payload to the SWA / recurrent part of the cache.
+    external fun sessionStateSize(chatId: Long, partialOnly: Boolean): Int
+
+    external fun sessionStateCapture(chatId: Long, partialOnly: Boolean): ByteArray
+
+    external fun sessionStateCaptureInto(chatId: Long, buffer: java.nio.ByteBuffer, partialOnly: Boolean): Int
+
+    external fun sessionStateRestore(chatId: Long, state: ByteArray, partialOnly: Boolean): Boolean
+
+    external fun sessionStateRestoreFrom(
+        chatId: Long,
+        buffer: java.nio.ByteBuffer,
+        length: Int,
+        partialOnly: Boolean
+    ): Boolean
+
+    external fun sessionStateSaveCompressed(chatId: Long, path: String): Long
+
+    external fun sessionStateLoadCompressed(chatId: Long, path: String): Boolean
+
     /**
      * Request abort of current generation operation.
      * Thread-safe and can be called from any thread.
      */
     external fun abort()
 
+    /**
+     * Progress of the prompt prefill inside a running generate call: fills [out] with
+     * tokens decoded, tokens total and estimated milliseconds remaining. Returns false
+     * when no prefill is running. Lock-free; safe to poll from any thread.
+     */
+    external fun prefillProgress(out: LongArray): Boolean
+
     /**
      * Attempt to recover engine state after crashes or errors.
      * Clears memory, resets abort flags, and attempts to restore normal operation.
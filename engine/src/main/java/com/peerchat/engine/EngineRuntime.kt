@@ -22,6 +22,10 @@ object EngineRuntime {
     private val _modelMeta = MutableStateFlow<String?>(null)
     val modelMeta: StateFlow<String?> = _modelMeta
 
+    // Path of the dedicated embedding model, null while embeddings use the chat model.
+    private val _embedderPath = MutableStateFlow<String?>(null)
+    val embedderPath: StateFlow<String?> = _embedderPath
+
     fun ensureInitialized() {
         if (initOnce.compareAndSet(false, true)) {
             EngineNative.init()
@@ -37,9 +41,17 @@ object EngineRuntime {
             EngineNative.loadModel(
                 config.modelPath,
                 config.threads,
+                config.decodeThreads,
+                config.batchThreads,
                 config.contextLength,
                 config.gpuLayers,
-                config.useVulkan
+                config.useVulkan,
+                config.sessionSlots,
+                config.draftModelPath,
+                config.draftMax,
+                config.lookupMax,
+                config.kvPrecision,
+                config.memoryBudgetBytes
             )
         }
         
@@ -67,6 +79,52 @@ object EngineRuntime {
         _modelMeta.value = null
     }
 
+    /**
+     * Loads a dedicated embedding model; embeddings then no longer depend on the chat
+     * model being loaded. A failed load also drops any previous embedder, so embeddings
+     * fall back to the chat model.
+     */
+    suspend fun loadEmbedder(
+        path: String,
+        threads: Int = 2,
+        contextLength: Int = 0,
+        gpuLayers: Int = 0,
+        pooling: String? = null,
+    ): Boolean {
+        ensureInitialized()
+        val success = withContext(Dispatchers.IO) {
+            EngineNative.loadEmbedder(path, threads, contextLength, gpuLayers, pooling)
+        }
+        _embedderPath.value = if (success) path else null
+        return success
+    }
+
+    suspend fun unloadEmbedder() {
+        if (_embedderPath.value == null) return
+        withContext(Dispatchers.IO) { EngineNative.unloadEmbedder() }
+        _embedderPath.value = null
+    }
+
+    /**
+     * Runs a side request (title, summary, suggestions) next to any reply being generated,
+     * batched into the same decodes rather than queued behind it. Null on failure.
+     */
+    suspend fun generateAuxiliary(
+        prompt: String,
+        systemPrompt: String? = null,
+        maxTokens: Int = 64,
+        temperature: Float = 0.2f,
+        topP: Float = 0.9f,
+        topK: Int = 40,
+        stop: Array<String> = emptyArray(),
+    ): String? {
+        ensureInitialized()
+        val text = withContext(Dispatchers.IO) {
+            EngineNative.generateAuxiliary(prompt, systemPrompt, temperature, topP, topK, maxTokens, stop)
+        }
+        return text.ifEmpty { null }
+    }
+
     fun updateMetrics(metrics: EngineMetrics) {
         _metrics.value = metrics
     }
@@ -79,6 +137,47 @@ object EngineRuntime {
 
     fun currentModelMeta(): String? = _modelMeta.value
 
+    /**
+     * Metadata of any GGUF file, read from its header without loading the model:
+     * architecture, template, and per-layer weight bytes and quant types.
+     * Null when the file cannot be read.
+     */
+    fun inspectModel(path: String): String? =
+        runCatching { EngineNative.detectModel(path) }.getOrNull()?.takeIf { it != "{}" }
+
+    /**
+     * Finds the fastest decode and prompt-batch thread counts for the loaded model and
+     * applies them. Store the result per model and pass it back through
+     * [EngineConfig.decodeThreads] and [EngineConfig.batchThreads]. Null on failure.
+     */
+    suspend fun calibrateThreads(): ThreadCalibration? {
+        ensureInitialized()
+        val json = withContext(Dispatchers.IO) { EngineNative.calibrateThreads() }
+        val calibration = ThreadCalibration.fromJson(json) ?: return null
+        updateMetricsFromNative()
+        return calibration
+    }
+
+    /**
+     * Predicted memory for loading [path] with one context, without loading it.
+     * When [gpuBudgetBytes] is set the plan carries the most GPU layers that fit.
+     */
+    fun planMemory(
+        path: String,
+        contextLength: Int,
+        gpuLayers: Int,
+        kvPrecision: String = "f16",
+        batch: Int = 512,
+        ubatch: Int = 512,
+        sequences: Int = 1,
+        gpuBudgetBytes: Long = 0,
+    ): MemoryPlan? = runCatching {
+        EngineNative.planMemory(
+            path, contextLength, batch, ubatch, kvPrecision, kvPrecision,
+            false, gpuLayers, sequences, gpuBudgetBytes
+        )
+    }.getOrNull()?.let { MemoryPlan.fromJson(it) }
+
     suspend fun captureState(): ByteArray? = mutex.withLock {
         ensureInitialized()
         val snapshot = withContext(Dispatchers.IO) { EngineNative.stateCapture() }
@@ -95,18 +194,75 @@ object EngineRuntime {
         restored
     }
 
+    suspend fun captureSessionState(chatId: Long, partialOnly: Boolean = false): ByteArray? = mutex.withLock {
+        ensureInitialized()
+        val snapshot = withContext(Dispatchers.IO) { EngineNative.sessionStateCapture(chatId, partialOnly) }
+        if (snapshot.isEmpty()) null else snapshot
+    }
+
+    suspend fun restoreSessionState(
+        chatId: Long,
+        snapshot: ByteArray,
+        partialOnly: Boolean = false
+    ): Boolean = mutex.withLock {
+        if (snapshot.isEmpty()) return@withLock false
+        ensureInitialized()
+        withContext(Dispatchers.IO) { EngineNative.sessionStateRestore(chatId, snapshot, partialOnly) }
+    }
+
+    suspend fun saveSessionState(chatId: Long, path: String): Long = mutex.withLock {
+        ensureInitialized()
+        withContext(Dispatchers.IO) { EngineNative.sessionStateSaveCompressed(chatId, path) }
+    }
+
+    suspend fun loadSessionState(chatId: Long, path: String): Boolean = mutex.withLock {
+        ensureInitialized()
+        withContext(Dispatchers.IO) { EngineNative.sessionStateLoadCompressed(chatId, path) }
+    }
+
     suspend fun clearState(clearData: Boolean = false) = mutex.withLock {
         ensureInitialized()
         withContext(Dispatchers.IO) { EngineNative.stateClear(clearData) }
         updateMetrics(EngineMetrics.empty())
     }
 
+    suspend fun selectSession(chatId: Long): Boolean = mutex.withLock {
+        ensureInitialized()
+        withContext(Dispatchers.IO) { EngineNative.sessionSelect(chatId) }
+    }
+
+    suspend fun releaseSession(chatId: Long) = mutex.withLock {
+        ensureInitialized()
+        withContext(Dispatchers.IO) { EngineNative.sessionRelease(chatId) }
+    }
+
+    suspend fun setSessionSpillDir(path: String) = mutex.withLock {
+        ensureInitialized()
+        withContext(Dispatchers.IO) { EngineNative.sessionSpillDir(path) }
+    }
+
     data class EngineConfig(
         val modelPath: String,
         val threads: Int,
         val contextLength: Int,
         val gpuLayers: Int,
         val useVulkan: Boolean = true,
+        val sessionSlots: Int = 4,
+        val draftModelPath: String? = null,
+        val draftMax: Int = 8,
+        // Prompt-lookup drafting when no draft model is set; pays off on answers that
+        // quote retrieved passages. 0 disables it.
+        val lookupMax: Int = 8,
+        // KV cache type: "f16", "q8_0" or "q4_0". Quantized caches force flash attention
+        // and roughly halve (q8_0) or quarter (q4_0) the memory per context token.
+        val kvPrecision: String = "f16",
+        // Bytes the weights and KV caches may use; when > 0 the engine lowers the context
+        // length to the largest that fits. 0 keeps [contextLength] as requested.
+        val memoryBudgetBytes: Long = 0,
+        // Threads of single-token decodes (pinned to the fast cores) and of prompt
+        // batches, each at most [threads]; 0 lets the engine pick from the core layout.
+        val decodeThreads: Int = 0,
+        val batchThreads: Int = 0,
     )
 
     sealed interface EngineStatus {
@@ -0,0 +1,67 @@
+package com.peerchat.engine
+
+/**
+ * Hybrid retrieval in a single native call: semantic candidates from the HNSW index
+ * and/or quantized store, lexical candidates from BM25, fused into one ranking.
+ */
+object HybridSearch {
+    enum class Fusion(internal val code: Int) {
+        /** Sum of 1 / (60 + rank) across sources; robust to uncalibrated scores. */
+        ReciprocalRank(0),
+        /** Weighted sum of min-max normalised scores. */
+        Weighted(1)
+    }
+
+    data class Hit(val id: Long, val score: Float)
+
+    /**
+     * Any source may be null, as may [queryVector] or [queryText]. [depth] is how many
+     * candidates each source contributes (0 = 4 x [topK]). [semanticWeight] only
+     * applies to [Fusion.Weighted].
+     */
+    fun search(
+        index: VectorIndex?,
+        store: VectorStore?,
+        lexical: LexicalIndex?,
+        queryVector: FloatArray?,
+        queryText: String?,
+        topK: Int,
+        depth: Int = 0,
+        fusion: Fusion = Fusion.ReciprocalRank,
+        semanticWeight: Float = 0.7f
+    ): List<Hit> {
+        if (topK <= 0) return emptyList()
+        val ids = LongArray(topK)
+        val scores = FloatArray(topK)
+        // Hold each source open for the duration of the native call.
+        val found = index.withHandleOrZero { indexHandle ->
+            store.withHandleOrZero { storeHandle ->
+                lexical.withHandleOrZero { lexicalHandle ->
+                    EngineNative.retrieveFused(
+                        indexHandle,
+                        storeHandle,
+                        lexicalHandle,
+                        queryVector,
+                        queryText,
+                        topK,
+                        depth,
+                        fusion.code,
+                        semanticWeight,
+                        ids,
+                        scores
+                    )
+                }
+            }
+        }
+        return List(found) { Hit(ids[it], scores[it]) }
+    }
+
+    private fun <T> VectorIndex?.withHandleOrZero(block: (Long) -> T): T =
+        if (this == null) block(0L) else withHandle(block)
+
+    private fun <T> VectorStore?.withHandleOrZero(block: (Long) -> T): T =
+        if (this == null) block(0L) else withHandle(block)
+
+    private fun <T> LexicalIndex?.withHandleOrZero(block: (Long) -> T): T =
+        if (this == null) block(0L) else withHandle(block)
+}
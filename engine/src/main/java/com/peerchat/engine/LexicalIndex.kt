@@ -0,0 +1,56 @@
+package com.peerchat.engine
+
+import java.io.Closeable
+import java.util.concurrent.locks.ReentrantReadWriteLock
+import kotlin.concurrent.read
+import kotlin.concurrent.write
+
+/**
+ * Native BM25 index over chunk text, keyed by the same ids as [VectorIndex].
+ * Terms come from a Unicode word splitter (lowercased letters/digits, one term per
+ * Han character). Queries go through [HybridSearch]. Thread-safety matches [VectorIndex].
+ */
+class LexicalIndex private constructor(private var handle: Long) : Closeable {
+    private val lifecycle = ReentrantReadWriteLock()
+
+    val size: Int get() = lifecycle.read { if (handle == 0L) 0 else EngineNative.lexicalIndexSize(handle) }
+
+    /** Indexes [texts] under [ids]; re-adding an id replaces its text. */
+    fun add(ids: LongArray, texts: Array<String>): Int {
+        require(ids.size == texts.size) { "${ids.size} ids but ${texts.size} texts" }
+        if (ids.isEmpty()) return 0
+        return lifecycle.read { if (handle == 0L) 0 else EngineNative.lexicalIndexAdd(handle, ids, texts) }
+    }
+
+    fun remove(ids: LongArray): Int {
+        if (ids.isEmpty()) return 0
+        return lifecycle.read { if (handle == 0L) 0 else EngineNative.lexicalIndexRemove(handle, ids) }
+    }
+
+    fun save(path: String): Boolean =
+        lifecycle.read { handle != 0L && EngineNative.lexicalIndexSave(handle, path) }
+
+    internal fun <T> withHandle(block: (Long) -> T): T = lifecycle.read { block(handle) }
+
+    override fun close() {
+        lifecycle.write {
+            if (handle == 0L) return
+            EngineNative.lexicalIndexDestroy(handle)
+            handle = 0L
+        }
+    }
+
+    companion object {
+        fun create(): LexicalIndex {
+            val handle = EngineNative.lexicalIndexCreate()
+            check(handle != 0L) { "lexical index allocation failed" }
+            return LexicalIndex(handle)
+        }
+
+        /** Loads an index written by [save]; null when the file is missing or malformed. */
+        fun open(path: String): LexicalIndex? {
+            val handle = EngineNative.lexicalIndexOpen(path)
+            return if (handle == 0L) null else LexicalIndex(handle)
+        }
+    }
+}
@@ -0,0 +1,58 @@
+package com.peerchat.engine
+
+import org.json.JSONObject
+
+/**
+ * Predicted allocation of one model plus one context, from EngineNative.planMemory.
+ * A dry run over the GGUF header: nothing is loaded or allocated.
+ */
+data class MemoryPlan(
+    val rawJson: String,
+    val nLayer: Int,
+    // Layers placed on the GPU; n_layer + 1 means the output head too.
+    val nGpuLayers: Int,
+    val kvBytesPerToken: Long,
+    // Compute buffers come from hand-tuned formulas, not a measurement.
+    val computeEstimated: Boolean,
+    val cpu: BackendBytes,
+    val gpu: BackendBytes,
+) {
+    val totalBytes: Long get() = cpu.total + gpu.total
+
+    data class BackendBytes(
+        val weights: Long = 0,
+        val kv: Long = 0,
+        val recurrent: Long = 0,
+        val compute: Long = 0,
+        val output: Long = 0,
+    ) {
+        val total: Long get() = weights + kv + recurrent + compute + output
+
+        companion object {
+            fun fromJson(obj: JSONObject?): BackendBytes = if (obj == null) BackendBytes() else BackendBytes(
+                weights = obj.optLong("weights", 0),
+                kv = obj.optLong("kv", 0),
+                recurrent = obj.optLong("recurrent", 0),
+                compute = obj.optLong("compute", 0),
+                output = obj.optLong("output", 0),
+            )
+        }
+    }
+
+    companion object {
+        /** Null when the planner could not read the model. */
+        fun fromJson(raw: String): MemoryPlan? = runCatching {
+            val obj = JSONObject(raw)
+            if (!obj.has("nLayer")) return null
+            MemoryPlan(
+                rawJson = raw,
+                nLayer = obj.optInt("nLayer", 0),
+                nGpuLayers = obj.optInt("nGpuLayers", 0),
+                kvBytesPerToken = obj.optLong("kvBytesPerToken", 0),
+                computeEstimated = obj.optBoolean("computeEstimated", true),
+                cpu = BackendBytes.fromJson(obj.optJSONObject("cpu")),
+                gpu = BackendBytes.fromJson(obj.optJSONObject("gpu")),
+            )
+        }.getOrNull()
+    }
+}
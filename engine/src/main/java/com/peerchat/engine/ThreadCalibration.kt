@@ -0,0 +1,47 @@
+package com.peerchat.engine
+
+import org.json.JSONObject
+
+/**
+ * Thread counts measured by EngineNative.calibrateThreads on the loaded model: the
+ * fastest count for single-token decodes and for prompt batches, and every trial.
+ */
+data class ThreadCalibration(
+    val rawJson: String,
+    val decodeThreads: Int,
+    val batchThreads: Int,
+    val decodeTps: Double,
+    val prefillTps: Double,
+    val trials: List<Trial>,
+) {
+    data class Trial(
+        val threads: Int,
+        val decodeTps: Double,
+        val prefillTps: Double,
+    )
+
+    companion object {
+        /** Null when calibration did not run. */
+        fun fromJson(raw: String): ThreadCalibration? = runCatching {
+            val obj = JSONObject(raw)
+            if (obj.optInt("decodeThreads", 0) <= 0) return null
+            val trials = obj.optJSONArray("trials")
+            ThreadCalibration(
+                rawJson = raw,
+                decodeThreads = obj.optInt("decodeThreads", 0),
+                batchThreads = obj.optInt("batchThreads", 0),
+                decodeTps = obj.optDouble("decodeTps", 0.0),
+                prefillTps = obj.optDouble("prefillTps", 0.0),
+                trials = (0 until (trials?.length() ?: 0)).mapNotNull { i ->
+                    trials?.optJSONObject(i)?.let { trial ->
+                        Trial(
+                            threads = trial.optInt("threads", 0),
+                            decodeTps = trial.optDouble("decodeTps", 0.0),
+                            prefillTps = trial.optDouble("prefillTps", 0.0),
+                        )
+                    }
+                },
+            )
+        }.getOrNull()
+    }
+}
@@ -0,0 +1,63 @@
+package com.peerchat.engine
+
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+import java.nio.IntBuffer
+
+/**
+ * Tokenizes many strings in one native call. The texts travel as one UTF-8 direct buffer
+ * with offsets, and the engine splits them across its threads; only the vocabulary is read,
+ * so a running generation neither blocks nor is blocked by it.
+ */
+object TokenBatch {
+    /** Tokens of every text laid end to end; text i owns `[offsets[i], offsets[i + 1])`. */
+    class Result(val tokens: IntBuffer, val offsets: IntArray) {
+        val size: Int get() = offsets.size - 1
+
+        fun count(index: Int): Int = offsets[index + 1] - offsets[index]
+
+        fun tokensOf(index: Int): IntArray {
+            val out = IntArray(count(index))
+            tokens.duplicate().apply { position(offsets[index]) }.get(out)
+            return out
+        }
+    }
+
+    /** Null without a model. */
+    fun tokenize(texts: List<String>, addSpecial: Boolean = true): Result? {
+        if (texts.isEmpty()) return Result(IntBuffer.allocate(0), IntArray(1))
+        val (input, offsets) = pack(texts)
+        val tokenOffsets = IntArray(texts.size + 1)
+        // Hardly ever more tokens than bytes; a larger result is fetched again at its size.
+        var tokens = allocateTokens(offsets.last() + 8 * texts.size)
+        var total = EngineNative.tokenizeBatch(input, offsets, addSpecial, tokens, tokenOffsets)
+        if (total > tokens.capacity() / Int.SIZE_BYTES) {
+            tokens = allocateTokens(total)
+            total = EngineNative.tokenizeBatch(input, offsets, addSpecial, tokens, tokenOffsets)
+        }
+        if (total < 0) return null
+        val view = tokens.asIntBuffer()
+        view.limit(total)
+        return Result(view, tokenOffsets)
+    }
+
+    /** Token count of every text, or null without a model. */
+    fun countTokens(texts: List<String>): IntArray? {
+        if (texts.isEmpty()) return IntArray(0)
+        val (input, offsets) = pack(texts)
+        val counts = IntArray(texts.size)
+        return if (EngineNative.countTokensBatch(input, offsets, counts)) counts else null
+    }
+
+    private fun pack(texts: List<String>): Pair<ByteBuffer, IntArray> {
+        val encoded = texts.map { it.encodeToByteArray() }
+        val offsets = IntArray(texts.size + 1)
+        encoded.forEachIndexed { i, bytes -> offsets[i + 1] = offsets[i] + bytes.size }
+        val input = ByteBuffer.allocateDirect(maxOf(offsets.last(), 1))
+        encoded.forEach { input.put(it) }
+        return input to offsets
+    }
+
+    private fun allocateTokens(count: Int): ByteBuffer =
+        ByteBuffer.allocateDirect(maxOf(count, 1) * Int.SIZE_BYTES).order(ByteOrder.nativeOrder())
+}
@@ -0,0 +1,71 @@
+package com.peerchat.engine
+
+import java.io.Closeable
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+
+/**
+ * Consumer side of the native token ring used by [EngineNative.generateStreamRing].
+ *
+ * The decode loop only copies UTF-8 bytes into native memory; this class drains
+ * whatever accumulated since the last call in one JNI transition. The producer never
+ * splits a code point across commits, so each drained batch decodes on its own.
+ * Not thread-safe: use from a single consumer thread.
+ */
+class TokenRing(capacity: Int = 0) : Closeable {
+    val handle: Long = EngineNative.tokenRingCreate(capacity)
+    private val region: ByteBuffer
+    private val capacity: Int
+    private var tail = 0L
+    private var pendingRelease = 0
+    private var scratch = ByteArray(256)
+    private var closed = false
+
+    init {
+        check(handle != 0L) { "token ring allocation failed" }
+        region = requireNotNull(EngineNative.tokenRingBuffer(handle)) { "token ring buffer unavailable" }
+            .order(ByteOrder.LITTLE_ENDIAN)
+        this.capacity = region.getInt(CAPACITY_OFFSET)
+    }
+
+    /** Pieces the producer has pushed so far. */
+    val tokens: Int get() = region.getInt(TOKENS_OFFSET)
+
+    /**
+     * Waits up to [timeoutMs] and returns everything readable: an empty string on
+     * timeout, or null once the stream is closed and fully drained.
+     */
+    fun poll(timeoutMs: Int): String? {
+        val available = EngineNative.tokenRingAwait(handle, pendingRelease, timeoutMs)
+        pendingRelease = 0
+        if (available < 0) return null
+        if (available == 0) return ""
+        if (scratch.size < available) {
+            scratch = ByteArray(maxOf(available, scratch.size * 2))
+        }
+        val offset = (tail % capacity).toInt()
+        val first = minOf(available, capacity - offset)
+        region.position(HEADER_SIZE + offset)
+        region.get(scratch, 0, first)
+        if (first < available) {
+            region.position(HEADER_SIZE)
+            region.get(scratch, first, available - first)
+        }
+        tail += available
+        pendingRelease = available
+        return String(scratch, 0, available, Charsets.UTF_8)
+    }
+
+    override fun close() {
+        if (closed) return
+        closed = true
+        EngineNative.tokenRingDestroy(handle)
+    }
+
+    private companion object {
+        // Mirrors the header layout in token_ring.h.
+        const val TOKENS_OFFSET = 16
+        const val CAPACITY_OFFSET = 24
+        const val HEADER_SIZE = 64
+    }
+}
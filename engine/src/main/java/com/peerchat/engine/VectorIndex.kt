@@ -0,0 +1,85 @@
+package com.peerchat.engine
+
+import java.io.Closeable
+import java.util.concurrent.locks.ReentrantReadWriteLock
+import kotlin.concurrent.read
+import kotlin.concurrent.write
+
+/**
+ * Native HNSW index over unit-length embeddings, scored by cosine similarity.
+ *
+ * Rows are stored as float16 by default, which keeps recall within noise of float32
+ * at half the memory. An index opened from disk is memory-mapped and serves queries
+ * straight from the page cache; the first insert or delete copies what it touches.
+ * Safe to share between threads: the native side serialises writers against readers,
+ * and [close] waits for in-flight calls before freeing the handle.
+ */
+class VectorIndex private constructor(private var handle: Long) : Closeable {
+    private val lifecycle = ReentrantReadWriteLock()
+
+    data class Hit(val id: Long, val score: Float)
+
+    val dim: Int = EngineNative.vectorIndexDim(handle)
+
+    /** Live (non-deleted) vectors. */
+    val size: Int get() = lifecycle.read { if (handle == 0L) 0 else EngineNative.vectorIndexSize(handle) }
+
+    /** Adds [ids] with their rows packed back to back in [vectors]; re-adding an id replaces it. */
+    fun add(ids: LongArray, vectors: FloatArray): Int {
+        require(vectors.size == ids.size * dim) { "expected ${ids.size * dim} floats, got ${vectors.size}" }
+        if (ids.isEmpty()) return 0
+        return lifecycle.read { if (handle == 0L) 0 else EngineNative.vectorIndexAdd(handle, ids, vectors) }
+    }
+
+    fun remove(ids: LongArray): Int {
+        if (ids.isEmpty()) return 0
+        return lifecycle.read { if (handle == 0L) 0 else EngineNative.vectorIndexRemove(handle, ids) }
+    }
+
+    /** Best-first neighbours of [query]; [ef] widens the candidate list for better recall. */
+    fun search(query: FloatArray, topK: Int, ef: Int = maxOf(topK * 2, DEFAULT_EF)): List<Hit> {
+        if (topK <= 0 || query.size != dim) return emptyList()
+        val ids = LongArray(topK)
+        val scores = FloatArray(topK)
+        val found = lifecycle.read {
+            if (handle == 0L) 0 else EngineNative.vectorIndexSearch(handle, query, topK, ef, ids, scores)
+        }
+        return List(found) { Hit(ids[it], scores[it]) }
+    }
+
+    /** Writes a file [open] can map back; replaces [path] atomically. */
+    fun save(path: String): Boolean =
+        lifecycle.read { handle != 0L && EngineNative.vectorIndexSave(handle, path) }
+
+    /** Runs [block] with the live native handle (0 once closed), holding off [close] meanwhile. */
+    internal fun <T> withHandle(block: (Long) -> T): T = lifecycle.read { block(handle) }
+
+    override fun close() {
+        lifecycle.write {
+            if (handle == 0L) return
+            EngineNative.vectorIndexDestroy(handle)
+            handle = 0L
+        }
+    }
+
+    companion object {
+        const val DEFAULT_EF = 64
+
+        fun create(
+            dim: Int,
+            m: Int = 16,
+            efConstruction: Int = 200,
+            halfPrecision: Boolean = true
+        ): VectorIndex {
+            val handle = EngineNative.vectorIndexCreate(dim, m, efConstruction, halfPrecision)
+            check(handle != 0L) { "vector index allocation failed (dim=$dim)" }
+            return VectorIndex(handle)
+        }
+
+        /** Maps an index written by [save]; null when the file is missing or malformed. */
+        fun open(path: String): VectorIndex? {
+            val handle = EngineNative.vectorIndexOpen(path)
+            return if (handle == 0L) null else VectorIndex(handle)
+        }
+    }
+}
@@ -0,0 +1,84 @@
+package com.peerchat.engine
+
+import java.io.Closeable
+import java.util.concurrent.locks.ReentrantReadWriteLock
+import kotlin.concurrent.read
+import kotlin.concurrent.write
+
+/**
+ * Compressed native copy of every embedding (sign bits plus int8 codes) for
+ * exhaustive scans: a Hamming pass over the whole corpus, int8 rescoring of the
+ * closest rows, then [rerank] against the stored float rows for the final order.
+ * Roughly a quarter of the float32 footprint stays resident.
+ * Thread-safety matches [VectorIndex].
+ */
+class VectorStore private constructor(private var handle: Long) : Closeable {
+    private val lifecycle = ReentrantReadWriteLock()
+
+    val dim: Int = EngineNative.vectorStoreDim(handle)
+
+    val size: Int get() = lifecycle.read { if (handle == 0L) 0 else EngineNative.vectorStoreSize(handle) }
+
+    /** Adds [ids] with their rows packed back to back in [vectors]; re-adding an id replaces it. */
+    fun add(ids: LongArray, vectors: FloatArray): Int {
+        require(vectors.size == ids.size * dim) { "expected ${ids.size * dim} floats, got ${vectors.size}" }
+        if (ids.isEmpty()) return 0
+        return lifecycle.read { if (handle == 0L) 0 else EngineNative.vectorStoreAdd(handle, ids, vectors) }
+    }
+
+    fun remove(ids: LongArray): Int {
+        if (ids.isEmpty()) return 0
+        return lifecycle.read { if (handle == 0L) 0 else EngineNative.vectorStoreRemove(handle, ids) }
+    }
+
+    /**
+     * Ids of the [topK] rows closest to [query] by approximate cosine. [candidates]
+     * bounds the int8 rescoring pass; 0 lets the native side size it from the corpus.
+     */
+    fun search(query: FloatArray, topK: Int, candidates: Int = 0): LongArray {
+        if (topK <= 0 || query.size != dim) return LongArray(0)
+        val ids = LongArray(topK)
+        val found = lifecycle.read {
+            if (handle == 0L) 0 else EngineNative.vectorStoreSearch(handle, query, topK, candidates, ids, null)
+        }
+        return if (found == topK) ids else ids.copyOf(found)
+    }
+
+    fun save(path: String): Boolean =
+        lifecycle.read { handle != 0L && EngineNative.vectorStoreSave(handle, path) }
+
+    /** Runs [block] with the live native handle (0 once closed), holding off [close] meanwhile. */
+    internal fun <T> withHandle(block: (Long) -> T): T = lifecycle.read { block(handle) }
+
+    override fun close() {
+        lifecycle.write {
+            if (handle == 0L) return
+            EngineNative.vectorStoreDestroy(handle)
+            handle = 0L
+        }
+    }
+
+    companion object {
+        fun create(dim: Int): VectorStore {
+            val handle = EngineNative.vectorStoreCreate(dim)
+            check(handle != 0L) { "vector store allocation failed (dim=$dim)" }
+            return VectorStore(handle)
+        }
+
+        /** Loads a store written by [save]; null when the file is missing or malformed. */
+        fun open(path: String): VectorStore? {
+            val handle = EngineNative.vectorStoreOpen(path)
+            return if (handle == 0L) null else VectorStore(handle)
+        }
+
+        /**
+         * Cosine of [query] against float32 little-endian [rows] (the embedding table's
+         * blob format). Rows of the wrong length score 0.
+         */
+        fun rerank(query: FloatArray, rows: Array<ByteArray>): FloatArray {
+            val scores = FloatArray(rows.size)
+            if (rows.isNotEmpty()) EngineNative.vectorRerank(query, rows, scores)
+            return scores
+        }
+    }
+}
@@ -6,6 +6,12 @@ import com.peerchat.data.db.Document
 import com.peerchat.data.db.PeerDatabase
 import com.peerchat.engine.EngineNative
 import com.peerchat.engine.EngineRuntime
+import com.peerchat.engine.HybridSearch
+import com.peerchat.engine.LexicalIndex
+import com.peerchat.engine.TokenBatch
+import com.peerchat.engine.VectorIndex
+import com.peerchat.engine.VectorStore
+import java.io.File
 import java.security.MessageDigest
 import java.util.LinkedHashMap
 import java.util.concurrent.atomic.AtomicReference
@@ -27,6 +33,7 @@ private var embeddingCacheBytes: Long = 0
 private val docScoreCache = object : LinkedHashMap<Long, CandidateScore>(512, 0.75f, true) {}
 
 private const val MAX_TOKEN_CACHE_ENTRIES = 5000
+private const val BREAK_CANDIDATES_PER_BATCH = 8
 private const val MAX_EMBEDDING_CACHE_ENTRIES = 1500
 private const val MAX_EMBEDDING_CACHE_BYTES: Long = 32L * 1024L * 1024L // ~32 MB
 private const val DEFAULT_DOC_SCORE_ENTRIES = 2000
@@ -35,16 +42,99 @@ private var docScoreMaxEntries = DEFAULT_DOC_SCORE_ENTRIES
 
 private data class CandidateScore(var score: Float, var updatedAtMs: Long)
 
-data class RagAnnSnapshot(
-    val numPlanes: Int,
-    val bucketSize: Int,
-    val fallbackSize: Int,
-    val records: List<SerializedVector>
-)
+/**
+ * Native retrieval indexes kept in step with the embedding table: an HNSW graph for
+ * fast approximate lookups, a quantized store for exhaustive candidate scans and a
+ * BM25 index over chunk text, all keyed by embedding id. [save] writes files that
+ * [open] maps or reads back without touching the database.
+ */
+class RagAnnSnapshot internal constructor(
+    internal val index: VectorIndex,
+    internal val store: VectorStore,
+    internal val lexical: LexicalIndex
+) : java.io.Closeable {
+    val size: Int get() = index.size
+    val dim: Int get() = index.dim
+
+    /**
+     * Writes all three files or none: each goes to a temporary path first and is renamed
+     * into place only once every write succeeded, so a failed save keeps the previous set.
+     */
+    fun save(indexPath: String, storePath: String, lexicalPath: String): Boolean {
+        val targets = listOf(File(indexPath), File(storePath), File(lexicalPath))
+        val temps = targets.map { File(it.path + ".tmp") }
+        val written = index.save(temps[0].path) && store.save(temps[1].path) && lexical.save(temps[2].path)
+        if (written && temps.zip(targets).all { (temp, target) -> temp.renameTo(target) }) {
+            return true
+        }
+        temps.forEach { runCatching { it.delete() } }
+        return false
+    }
+
+    internal fun add(ids: LongArray, vectors: FloatArray, texts: Array<String>) {
+        index.add(ids, vectors)
+        store.add(ids, vectors)
+        lexical.add(ids, texts)
+    }
+
+    internal fun remove(ids: LongArray) {
+        index.remove(ids)
+        store.remove(ids)
+        lexical.remove(ids)
+    }
 
-data class SerializedVector(val id: Long, val vector: FloatArray, val norm: Float)
+    internal fun retrieve(
+        queryVector: FloatArray?,
+        queryText: String,
+        topK: Int,
+        fusion: HybridSearch.Fusion,
+        semanticWeight: Float
+    ): List<HybridSearch.Hit> = HybridSearch.search(
+        index = index,
+        store = store,
+        lexical = lexical,
+        queryVector = queryVector?.takeIf { it.size == dim },
+        queryText = queryText,
+        topK = topK,
+        fusion = fusion,
+        semanticWeight = semanticWeight
+    )
+
+    override fun close() {
+        index.close()
+        store.close()
+        lexical.close()
+    }
+
+    companion object {
+        internal fun create(dim: Int, m: Int = 16, efConstruction: Int = 200): RagAnnSnapshot {
+            val index = VectorIndex.create(dim, m, efConstruction)
+            val store = runCatching { VectorStore.create(dim) }.getOrElse {
+                index.close()
+                throw it
+            }
+            val lexical = runCatching { LexicalIndex.create() }.getOrElse {
+                index.close()
+                store.close()
+                throw it
+            }
+            return RagAnnSnapshot(index, store, lexical)
+        }
 
-private data class VectorRecord(val id: Long, val vector: FloatArray, val norm: Float)
+        fun open(indexPath: String, storePath: String, lexicalPath: String): RagAnnSnapshot? {
+            val index = VectorIndex.open(indexPath) ?: return null
+            val store = VectorStore.open(storePath)
+            val lexical = LexicalIndex.open(lexicalPath)
+            if (store == null || lexical == null || store.dim != index.dim) {
+                index.close()
+                store?.close()
+                lexical?.close()
+                return null
+            }
+            return RagAnnSnapshot(index, store, lexical)
+        }
+    }
+}
 
 fun interface RagEmbeddingIndex {
     fun query(query: FloatArray, topK: Int): List<Long>
@@ -52,13 +142,32 @@ fun interface RagEmbeddingIndex {
 
 private object EmbeddingIndexRegistry {
     private val delegate = AtomicReference<RagEmbeddingIndex?>(null)
+    // Native indexes behind the delegate when we own them; kept in step with the embedding table.
+    private val live = AtomicReference<RagAnnSnapshot?>(null)
 
     fun register(index: RagEmbeddingIndex) {
         delegate.set(index)
+        live.getAndSet(null)?.close()
+    }
+
+    fun install(snapshot: RagAnnSnapshot) {
+        delegate.set(RagEmbeddingIndex { query, topK -> snapshot.index.search(query, topK).map { it.id } })
+        live.getAndSet(snapshot)?.takeIf { it !== snapshot }?.close()
+    }
+
+    fun live(): RagAnnSnapshot? = live.get()
+
+    // Starts fresh indexes only when the caller knows they cover every stored embedding.
+    @Synchronized
+    fun liveFor(dim: Int, createIfMissing: Boolean): RagAnnSnapshot? {
+        live.get()?.let { return if (it.dim == dim) it else null }
+        if (!createIfMissing || delegate.get() != null) return null
+        return RagAnnSnapshot.create(dim).also { install(it) }
     }
 
     fun clear() {
         delegate.set(null)
+        live.getAndSet(null)?.close()
     }
 
     fun query(query: FloatArray, topK: Int): List<Long> {
@@ -88,6 +197,30 @@ private fun countTokensCached(text: String): Int {
     return count
 }
 
+// Cached token counts for many texts; the misses are counted in one native batch.
+private fun countTokensCached(texts: List<String>): IntArray {
+    val counts = IntArray(texts.size)
+    val keys = texts.map { sha256(it).take(16) }
+    val missing = ArrayList<Int>()
+    cacheLock.read {
+        keys.forEachIndexed { i, key ->
+            val cached = tokenCountCache[key]
+            if (cached != null) counts[i] = cached else missing.add(i)
+        }
+    }
+    if (missing.isEmpty()) return counts
+
+    val counted = runCatching { TokenBatch.countTokens(missing.map { texts[it] }) }.getOrNull()
+    cacheLock.write {
+        missing.forEachIndexed { j, i ->
+            counts[i] = counted?.get(j) ?: (texts[i].length / 4).coerceAtLeast(1)
+            tokenCountCache[keys[i]] = counts[i]
+        }
+        trimTokenCacheLocked()
+    }
+    return counts
+}
+
 // Cached embedding computation to reduce redundant calculations with Android native fallback
 private suspend fun embedCached(texts: Array<String>): Array<FloatArray> {
     val results = Array(texts.size) { FloatArray(0) }
@@ -134,8 +267,8 @@ private suspend fun embedCached(texts: Array<String>): Array<FloatArray> {
 private suspend fun computeEmbeddingsWithFallback(texts: Array<String>): Array<FloatArray> {
     val engineStatus = EngineRuntime.status.value
 
-    // Try llama.cpp embeddings first if model is loaded
-    if (engineStatus is EngineRuntime.EngineStatus.Loaded) {
+    // Try llama.cpp embeddings first: the dedicated embedder if loaded, else the chat model
+    if (EngineRuntime.embedderPath.value != null || engineStatus is EngineRuntime.EngineStatus.Loaded) {
         val nativeEmbeddings = runCatching {
             EngineNative.embed(texts)
         }.getOrDefault(Array(texts.size) { FloatArray(0) })
@@ -276,45 +409,51 @@ object RagService {
         EmbeddingIndexRegistry.clear()
     }
 
+    /**
+     * Rebuilds the native indexes from the embedding table and makes them live.
+     * Returns null when there is nothing to index. Rows whose dimension differs from the
+     * first embedding found (e.g. written by a previous embedding model) are skipped.
+     */
     suspend fun rebuildAnnIndex(
         db: PeerDatabase,
-        maxEmbeddings: Int = 10_000,
-        numPlanes: Int = 12,
-        bucketSize: Int = 256,
-        fallbackSize: Int = 512
-    ): RagAnnSnapshot {
+        maxEmbeddings: Int = 100_000,
+        m: Int = 16,
+        efConstruction: Int = 200
+    ): RagAnnSnapshot? {
         val pageSize = 512
-        val records = ArrayList<VectorRecord>(min(maxEmbeddings, 2048))
+        var snapshot: RagAnnSnapshot? = null
+        var indexed = 0
         var offset = 0
-        while (records.size < maxEmbeddings) {
-            val batch = db.embeddingDao().listPaginated(pageSize, offset)
-            if (batch.isEmpty()) break
-            batch.forEach { embedding ->
-                if (records.size >= maxEmbeddings) return@forEach
-                val vector = bytesToFloatArray(embedding.vector)
-                if (vector.isNotEmpty()) {
-                    val norm = vectorNorm(vector)
-                    if (norm > 0f) {
-                        records.add(VectorRecord(embedding.id, vector, norm))
-                    }
-                }
+        try {
+            while (indexed < maxEmbeddings) {
+                val batch = db.embeddingDao().listPaginated(pageSize, offset)
+                if (batch.isEmpty()) break
+                offset += batch.size
+                val dim = snapshot?.dim ?: batch.firstOrNull { it.dim > 0 }?.dim ?: continue
+                val rows = batch.filter { it.dim == dim && it.vector.size == dim * 4 }
+                    .take(maxEmbeddings - indexed)
+                if (rows.isEmpty()) continue
+                val target = snapshot ?: RagAnnSnapshot.create(dim, m, efConstruction).also { snapshot = it }
+                val vectors = FloatArray(rows.size * dim)
+                rows.forEachIndexed { row, embedding -> readFloats(embedding.vector, vectors, row * dim) }
+                val texts = db.ragDao().getByEmbeddingIds(rows.map { it.id })
+                    .associate { (it.embeddingId ?: -1L) to it.text }
+                target.add(LongArray(rows.size) { rows[it].id }, vectors, Array(rows.size) { texts[rows[it].id].orEmpty() })
+                indexed += rows.size
             }
-            offset += batch.size
+        } catch (t: Throwable) {
+            snapshot?.close()
+            throw t
         }
 
-        if (records.isEmpty()) {
+        val built = snapshot
+        if (built == null || built.size == 0) {
+            built?.close()
             clearAnnIndex()
-            return RagAnnSnapshot(numPlanes, bucketSize, fallbackSize, emptyList())
+            return null
         }
-
-        registerRecords(records, numPlanes, bucketSize, fallbackSize)
-
-        return RagAnnSnapshot(
-            numPlanes = numPlanes,
-            bucketSize = bucketSize,
-            fallbackSize = fallbackSize,
-            records = records.map { SerializedVector(it.id, it.vector, it.norm) }
-        )
+        EmbeddingIndexRegistry.install(built)
+        return built
     }
 
     fun configureDocScoreCache(maxEntries: Int) {
@@ -333,44 +472,7 @@ object RagService {
     }
 
     fun loadAnnSnapshot(snapshot: RagAnnSnapshot) {
-        val records = snapshot.records.map { VectorRecord(it.id, it.vector, it.norm) }
-        registerRecords(records, snapshot.numPlanes, snapshot.bucketSize, snapshot.fallbackSize)
-    }
-
-    private fun registerRecords(
-        records: List<VectorRecord>,
-        numPlanes: Int,
-        bucketSize: Int,
-        fallbackSize: Int
-    ) {
-        if (records.isEmpty()) {
-            clearAnnIndex()
-            return
-        }
-        val annIndex = RagEmbeddingIndex { query, topK ->
-            if (query.isEmpty()) return@RagEmbeddingIndex emptyList()
-            val qNorm = vectorNorm(query)
-            if (qNorm <= 0f) return@RagEmbeddingIndex emptyList()
-
-            val breadthScale = max(2, numPlanes.coerceAtLeast(1) / 4)
-            val searchBreadth = max(
-                topK.coerceAtLeast(1) * breadthScale,
-                max(bucketSize.coerceAtLeast(topK), fallbackSize)
-            )
-
-            records.asSequence()
-                .filter { it.vector.size == query.size }
-                .map { record ->
-                    val score = cosine(query, record.vector, record.norm)
-                    record.id to score
-                }
-                .sortedByDescending { it.second }
-                .take(searchBreadth)
-                .take(topK.coerceAtLeast(1))
-                .map { it.first }
-                .toList()
-        }
-        registerAnnIndex(annIndex)
+        EmbeddingIndexRegistry.install(snapshot)
     }
 
     suspend fun indexDocument(db: PeerDatabase, doc: Document, text: String, maxChunkTokens: Int = 512, overlapTokens: Int = 64) {
@@ -384,6 +486,7 @@ object RagService {
         val chunkTexts = chunks.map { it.text }.toTypedArray()
         val embeddings = embedCached(chunkTexts)
 
+        val indexed = ArrayList<Triple<Long, FloatArray, String>>(chunks.size)
         for (i in chunks.indices) {
             val chunk = chunks[i]
             val vec = embeddings[i]
@@ -409,7 +512,18 @@ object RagService {
                     embeddingId = embId
                 )
             )
+            if (norm > 0f) indexed.add(Triple(embId, vec, chunk.text))
         }
+        if (indexed.isEmpty()) return
+
+        // Keep the live indexes in step so new chunks are searchable before the next rebuild.
+        val dim = indexed.first().second.size
+        val rows = indexed.filter { it.second.size == dim }
+        val coversTable = db.embeddingDao().count() <= rows.size
+        val live = EmbeddingIndexRegistry.liveFor(dim, createIfMissing = coversTable) ?: return
+        val vectors = FloatArray(rows.size * dim)
+        rows.forEachIndexed { row, (_, vec, _) -> vec.copyInto(vectors, row * dim) }
+        live.add(LongArray(rows.size) { rows[it].first }, vectors, Array(rows.size) { rows[it].third })
     }
 
     suspend fun retrieve(db: PeerDatabase, query: String, topK: Int = 6): List<RagChunk> {
@@ -418,17 +532,35 @@ object RagService {
         return retrieveHybrid(db, query, topK)
     }
 
+    /**
+     * Hybrid semantic + lexical retrieval. With live native indexes this is one native
+     * call (HNSW + quantized scan + BM25, fused by [fusion]); the alphas set the semantic
+     * weight for [HybridSearch.Fusion.Weighted]. Without them, FTS candidates are fused
+     * with re-ranked ANN candidates here.
+     */
     suspend fun retrieveHybrid(
         db: PeerDatabase,
         query: String,
         topK: Int = 6,
         alphaSemantic: Float = 0.7f,
         alphaLexical: Float = 0.3f,
+        fusion: HybridSearch.Fusion = HybridSearch.Fusion.ReciprocalRank,
     ): List<RagChunk> {
         val engineStatus = EngineRuntime.status.value
         if (engineStatus !is EngineRuntime.EngineStatus.Loaded) return emptyList()
 
         val qv = embedCached(arrayOf(query)).firstOrNull() ?: return emptyList()
+
+        val live = EmbeddingIndexRegistry.live()
+        if (live != null) {
+            val weightSum = alphaSemantic + alphaLexical
+            val semanticWeight = if (weightSum > 0f) alphaSemantic / weightSum else 0.5f
+            val hits = live.retrieve(qv.takeIf { it.isNotEmpty() }, query, topK, fusion, semanticWeight)
+            if (hits.isNotEmpty()) {
+                return chunksInRankOrder(db, hits.map { it.id to it.score })
+            }
+        }
+
         if (qv.isEmpty()) {
             // No semantic vector available; fall back to lexical-only retrieval
             val lexicalOnly = db.ragDao().searchChunks(query, limit = topK)
@@ -450,91 +582,41 @@ object RagService {
             byDoc.forEach { candidateEmbeddings[it.id] = it }
         }
 
-        val desiredCandidates = max(topK * 12, candidateEmbeddings.size)
-        if (candidateEmbeddings.size < desiredCandidates) {
-            val batchSize = 200
-            var offset = 0
-            while (candidateEmbeddings.size < desiredCandidates) {
-                val batch = db.embeddingDao().listPaginated(batchSize, offset)
-                if (batch.isEmpty()) break
-                batch.forEach { candidateEmbeddings.putIfAbsent(it.id, it) }
-                offset += batch.size
-            }
-        }
-
-        val semanticScores = HashMap<Long, Float>(candidateEmbeddings.size.coerceAtLeast(topK * 2))
-        candidateEmbeddings.values.forEach { emb ->
-            if (emb.dim <= 0 || emb.vector.isEmpty()) return@forEach
-            if (emb.dim != qv.size) return@forEach
-            val v = bytesToFloatArray(emb.vector)
-            val similarity = cosine(qv, v, emb.norm)
-            semanticScores[emb.id] = similarity
-        }
+        // Exact cosine over the stored float rows, computed natively without decoding them here.
+        val scored = candidateEmbeddings.values.filter { it.dim == qv.size && it.vector.isNotEmpty() }
+        val exact = VectorStore.rerank(qv, Array(scored.size) { scored[it].vector })
+        val semanticScores = HashMap<Long, Float>(scored.size.coerceAtLeast(topK * 2))
+        scored.forEachIndexed { i, emb -> semanticScores[emb.id] = exact[i] }
 
-        // Get lexical matches (FTS search) with improved scoring
+        // FTS already ranks by match; score by rank alone.
         val lexicalScores = HashMap<Long, Float>()
-
-        // Calculate TF-IDF inspired lexical scores
-        val queryTerms = query.lowercase()
-            .split("\\s+".toRegex())
-            .filter { it.length > 2 } // Ignore very short terms
-            .distinct()
-
         for ((rank, chunk) in lexicalMatches.withIndex()) {
-            // Base rank score (lower is better rank)
-            val rankScore = 1f - (rank.toFloat() / lexicalMatches.size.toFloat())
-
-            // Term frequency bonus
-            val chunkText = chunk.text.lowercase()
-            val termMatches = queryTerms.count { term ->
-                chunkText.contains(term)
-            }
-            val termFrequency = termMatches.toFloat() / queryTerms.size.toFloat()
-
-            // Exact phrase bonus
-            val exactMatch = if (chunkText.contains(query.lowercase())) 0.3f else 0f
-
-            // Position bonus (earlier chunks in document get slight preference)
-            val positionBonus = if (chunk.start < 1000) 0.1f else 0f
-
-            val score = rankScore * 0.5f + termFrequency * 0.3f + exactMatch + positionBonus
-
             val embeddingId = chunk.embeddingId ?: continue
-            if (score > 0.05f) { // Only keep meaningful scores
-                lexicalScores[embeddingId] = score
-                recordDocScore(chunk.docId, score)
-            }
+            lexicalScores.putIfAbsent(embeddingId, 1f - rank.toFloat() / lexicalMatches.size.toFloat())
         }
 
-        // Fuse semantic and lexical scores
-        val fused = ArrayList<Pair<Long, Float>>()
-        val allIds = HashSet<Long>()
-        allIds.addAll(semanticScores.keys)
-        allIds.addAll(lexicalScores.keys)
-
-        for (id in allIds) {
-            val semanticScore = semanticScores[id] ?: 0f
-            val lexicalScore = lexicalScores[id] ?: 0f
-            val docBonus = candidateEmbeddings[id]?.docId?.let { docScore(it) } ?: 0f
-            val combinedScore = semanticScore * alphaSemantic +
-                lexicalScore * alphaLexical +
-                docBonus * 0.1f
-            fused.add(id to combinedScore)
+        val fused = HashMap<Long, Float>(semanticScores.size + lexicalScores.size)
+        semanticScores.forEach { (id, score) -> fused[id] = score * alphaSemantic }
+        lexicalScores.forEach { (id, score) -> fused.merge(id, score * alphaLexical, Float::plus) }
+        fused.replaceAll { id, score ->
+            score + (candidateEmbeddings[id]?.docId?.let { docScore(it) } ?: 0f) * 0.1f
         }
 
-        // Sort by score and take top K
-        fused.sortByDescending { it.second }
-        val topEmbeddingIds = fused.take(topK).map { it.first }
-
-        // Batch fetch chunks for the top results
-        if (topEmbeddingIds.isEmpty()) return emptyList()
+        val top = fused.entries.sortedByDescending { it.value }.take(topK).map { it.key to it.value }
+        return chunksInRankOrder(db, top)
+    }
 
-        val chunks = db.ragDao().getByEmbeddingIds(topEmbeddingIds.filter { it > 0 })
-        return chunks.sortedBy { chunk ->
-            // Sort by the combined score
-            val embId = chunk.embeddingId ?: -1L
-            fused.find { it.first == embId }?.second ?: 0f
-        }.reversed() // descending order
+    private suspend fun chunksInRankOrder(db: PeerDatabase, ranked: List<Pair<Long, Float>>): List<RagChunk> {
+        if (ranked.isEmpty()) return emptyList()
+        val rank = HashMap<Long, Int>(ranked.size * 2)
+        ranked.forEachIndexed { i, (id, _) -> rank.putIfAbsent(id, i) }
+        val chunks = db.ragDao().getByEmbeddingIds(ranked.map { it.first }.filter { it > 0 })
+            .sortedBy { rank[it.embeddingId ?: -1L] ?: Int.MAX_VALUE }
+        chunks.forEach { chunk ->
+            val position = rank[chunk.embeddingId ?: -1L] ?: return@forEach
+            recordDocScore(chunk.docId, ranked[position].second)
+        }
+        return chunks
     }
 
     fun buildContext(chunks: List<RagChunk>, maxChars: Int = 4000): String {
@@ -569,6 +651,7 @@ object RagService {
         if (embeddingIds.isNotEmpty()) {
             db.ragDao().deleteChunksByEmbeddingIds(embeddingIds)
             db.embeddingDao().deleteByIds(embeddingIds)
+            EmbeddingIndexRegistry.live()?.remove(embeddingIds.toLongArray())
         }
 
         // Re-index with new parameters
@@ -606,11 +689,29 @@ data class RagStats(
 private data class ChunkInfo(val text: String, val start: Int, val end: Int, val tokenCount: Int)
 
 /**
- * Tokenizer-aware chunking using binary search to find optimal chunk boundaries.
- * This ensures chunks respect the token limit precisely while finding natural break points.
+ * Tokenizer-aware chunking. The native chunker tokenizes the document once; without it,
+ * binary search over token counts finds each boundary.
  */
 private fun optimizedTokenizerChunks(text: String, maxTokens: Int, overlapTokens: Int): List<ChunkInfo> {
     if (text.isEmpty()) return emptyList()
+    nativeChunks(text, maxTokens, overlapTokens)?.let { return it }
+    return searchedTokenizerChunks(text, maxTokens, overlapTokens)
+}
+
+private fun nativeChunks(text: String, maxTokens: Int, overlapTokens: Int): List<ChunkInfo>? {
+    val flat = runCatching { EngineNative.chunkText(text, maxTokens, overlapTokens) }.getOrNull() ?: return null
+    return (0 until flat.size / 3).mapNotNull { i ->
+        val start = flat[i * 3]
+        val end = flat[i * 3 + 1]
+        if (end <= start) null else ChunkInfo(text.substring(start, end), start, end, flat[i * 3 + 2])
+    }
+}
+
+/**
+ * Binary search to find optimal chunk boundaries, one token count per probe.
+ * This ensures chunks respect the token limit precisely while finding natural break points.
+ */
+private fun searchedTokenizerChunks(text: String, maxTokens: Int, overlapTokens: Int): List<ChunkInfo> {
 
     val out = ArrayList<ChunkInfo>()
     var pos = 0
@@ -725,6 +826,7 @@ private fun findNaturalBreakPoint(
     var bestScore = 0
     var bestTokens = countTokensCached(text.substring(start, targetPos))
 
+    val candidates = ArrayList<Pair<Int, Int>>()
     for (i in searchEnd downTo searchStart) {
         if (i <= start) continue
 
@@ -760,10 +862,15 @@ private fun findNaturalBreakPoint(
             else -> 0
         }
 
-        if (score > 0) {
-            // Verify this break creates a reasonable chunk
-            val chunkText = text.substring(start, i)
-            val tokens = countTokensCached(chunkText)
+        if (score > 0) candidates.add(i to score)
+    }
+
+    // Verify the breaks create reasonable chunks, counting a few candidates per native call.
+    for (group in candidates.chunked(BREAK_CANDIDATES_PER_BATCH)) {
+        val counts = countTokensCached(group.map { (i, _) -> text.substring(start, i) })
+        for ((k, candidate) in group.withIndex()) {
+            val (i, score) = candidate
+            val tokens = counts[k]
 
             // Prefer breaks that get us closer to maxTokens
             val tokenRatio = tokens.toFloat() / maxTokens
@@ -783,7 +890,7 @@ private fun findNaturalBreakPoint(
 
                 // Early exit for very good breaks
                 if (score >= 4 && tokenRatio in 0.7f..1.2f) {
-                    break
+                    return bestBreak
                 }
             }
         }
@@ -857,27 +964,16 @@ private fun vectorNorm(v: FloatArray): Float {
     return sqrt(sum).toFloat()
 }
 
-private fun cosine(q: FloatArray, v: FloatArray, vNorm: Float): Float {
-    val n = min(q.size, v.size)
-    var dot = 0.0
-    for (i in 0 until n) dot += (q[i] * v[i])
-    val qn = vectorNorm(q)
-    val denom = (qn * (if (vNorm > 0) vNorm else vectorNorm(v)))
-    return if (denom > 0f) (dot / denom).toFloat() else 0f
-}
-
 private fun floatArrayToBytes(v: FloatArray): ByteArray {
     val bb = java.nio.ByteBuffer.allocate(v.size * 4).order(java.nio.ByteOrder.LITTLE_ENDIAN)
     for (x in v) bb.putFloat(x)
     return bb.array()
 }
 
-private fun bytesToFloatArray(b: ByteArray): FloatArray {
-    val bb = java.nio.ByteBuffer.wrap(b).order(java.nio.ByteOrder.LITTLE_ENDIAN)
-    val out = FloatArray(b.size / 4)
-    for (i in out.indices) out[i] = bb.getFloat()
-    return out
+private fun readFloats(b: ByteArray, dst: FloatArray, offset: Int) {
+    java.nio.ByteBuffer.wrap(b).order(java.nio.ByteOrder.LITTLE_ENDIAN).asFloatBuffer().get(dst, offset, b.size / 4)
 }
+
 private fun trimTokenCacheLocked() {
     if (tokenCountCache.size <= MAX_TOKEN_CACHE_ENTRIES) return
     val iterator = tokenCountCache.entries.iterator()
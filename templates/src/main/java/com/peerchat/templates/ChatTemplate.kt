@@ -19,11 +19,14 @@ data class ChatMessage(
 
 /**
  * Result of applying a template. Carries both the textual prompt and any stop sequences
- * required by the underlying model to terminate cleanly.
+ * required by the underlying model to terminate cleanly. [keepLength] is the length of the
+ * leading text (template header and system block) the engine keeps when it shifts older
+ * turns out of a full context.
  */
 data class ChatPrompt(
     val text: String,
     val stopSequences: List<String>,
+    val keepLength: Int = 0,
 )
 
 /**
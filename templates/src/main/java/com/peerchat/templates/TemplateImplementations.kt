@@ -73,6 +73,7 @@ private class Llama3Template : ChatTemplate {
         }
 
         systemPrompt?.takeIf { it.isNotBlank() }?.let { appendBlock("system", it) }
+        val keepLength = sb.length
 
         normaliseHistory(history).forEach { message ->
             val role = when (message.role) {
@@ -85,7 +86,7 @@ private class Llama3Template : ChatTemplate {
 
         appendBlock("user", nextUser.content)
         sb.append("<|start_header_id|>assistant<|end_header_id|>\n")
-        return ChatPrompt(sb.toString(), stopSequences)
+        return ChatPrompt(sb.toString(), stopSequences, keepLength)
     }
 }
 
@@ -116,6 +117,7 @@ private class ChatMlTemplate(
         }
 
         systemPrompt?.takeIf { it.isNotBlank() }?.let { append("system", it) }
+        val keepLength = sb.length
         normaliseHistory(history).forEach { message ->
             when (message.role) {
                 ChatRole.USER -> append("user", message.content)
@@ -125,7 +127,7 @@ private class ChatMlTemplate(
         }
         append("user", nextUser.content)
         sb.append("<|im_start|>assistant\n")
-        return ChatPrompt(sb.toString(), stopSequences)
+        return ChatPrompt(sb.toString(), stopSequences, keepLength)
     }
 }
 
@@ -156,6 +158,7 @@ private class GemmaTemplate : ChatTemplate {
         }
 
         systemPrompt?.takeIf { it.isNotBlank() }?.let { append("system", it) }
+        val keepLength = sb.length
         normaliseHistory(history).forEach { message ->
             when (message.role) {
                 ChatRole.USER -> append("user", message.content)
@@ -165,7 +168,7 @@ private class GemmaTemplate : ChatTemplate {
         }
         append("user", nextUser.content)
         sb.append("<start_of_turn>model\n")
-        return ChatPrompt(sb.toString(), stopSequences)
+        return ChatPrompt(sb.toString(), stopSequences, keepLength)
     }
 }
 
@@ -209,12 +212,15 @@ private class MistralTemplate : ChatTemplate {
 
         val sb = StringBuilder()
         val sys = systemPrompt?.trimmed()
+        // The system block sits inside the first [INST]; keep up to its end.
+        var keepLength = 0
         turns.forEachIndexed { index, (user, assistant) ->
             sb.append("<s>[INST]")
             if (index == 0 && !sys.isNullOrEmpty()) {
                 sb.append(" <<SYS>>\n")
                 sb.append(sys)
                 sb.append("\n<</SYS>>\n\n")
+                keepLength = sb.length
             } else {
                 sb.append(" ")
             }
@@ -228,7 +234,7 @@ private class MistralTemplate : ChatTemplate {
                 sb.append("\n")
             }
         }
-        return ChatPrompt(sb.toString(), stopSequences)
+        return ChatPrompt(sb.toString(), stopSequences, keepLength)
     }
 }
 